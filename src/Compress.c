@@ -0,0 +1,632 @@
+/* Nic Pucci
+ * COMPRESS IMPLEMENTATION
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include "List.h"
+#include "Stats.h"
+#include "Compress.h"
+
+const int COMPRESS_MIN_MATCH = 4;
+const int COMPRESS_LAST_LITERALS = 5; // a block always ends in at least this many literals ...
+const int COMPRESS_MATCH_SEARCH_MARGIN = 12; // ... and no match starts this close to its end
+const unsigned int COMPRESS_MAX_OFFSET = 65535;
+const int COMPRESS_SKIP_STRENGTH = 6; // after 2^6 failed searches the step grows by one byte
+const unsigned int COMPRESS_HASH_MULTIPLIER = 2654435761U;
+const int COMPRESS_MIN_PAYLOAD_SIZE = 64; // shorter payloads rarely shrink enough to be worth it
+const int COMPRESS_MIN_SAVING_SHIFT = 3; // a payload is sent compressed only if that saves at least 1/8 of it
+
+static inline unsigned int Read32 ( const unsigned char *p )
+{
+	unsigned int value;
+	memcpy ( &value , p , sizeof ( value ) );
+	return value;
+}
+
+static inline unsigned long long Read64 ( const unsigned char *p )
+{
+	unsigned long long value;
+	memcpy ( &value , p , sizeof ( value ) );
+	return value;
+}
+
+static inline unsigned int Hash32 ( unsigned int sequence )
+{
+	return sequence * COMPRESS_HASH_MULTIPLIER;
+}
+
+/* The number of leading bytes of the two 8-byte words that agree, given they differ. */
+static inline int NumEqualBytes ( unsigned long long difference )
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	return __builtin_ctzll ( difference ) >> 3;
+#else
+	return __builtin_clzll ( difference ) >> 3;
+#endif
+}
+
+/* How many bytes from current on equal those from reference on, current going
+ * no further than limit. */
+static inline int CountMatching ( const unsigned char *current , const unsigned char *reference , const unsigned char *limit )
+{
+	const unsigned char *start = current;
+
+	while ( current + 8 <= limit )
+	{
+		unsigned long long difference = Read64 ( current ) ^ Read64 ( reference );
+		if ( difference )
+		{
+			return current - start + NumEqualBytes ( difference );
+		}
+
+		current += 8;
+		reference += 8;
+	}
+
+	while ( current < limit && *current == *reference )
+	{
+		current += 1;
+		reference += 1;
+	}
+
+	return current - start;
+}
+
+/* The 255-byte continuation of a literal or match length past its token's 15. */
+static inline unsigned char *WriteLength ( unsigned char *op , unsigned int length )
+{
+	while ( length >= 255 )
+	{
+		*op++ = 255;
+		length -= 255;
+	}
+
+	*op++ = ( unsigned char ) length;
+	return op;
+}
+
+static inline int ReadLength ( const unsigned char **ip , const unsigned char *inEnd , size_t *length )
+{
+	unsigned char byte;
+	do
+	{
+		if ( *ip >= inEnd )
+		{
+			return FAILURE_OP_CODE;
+		}
+
+		byte = *( *ip )++;
+		*length += byte;
+	} while ( byte == 255 );
+
+	return SUCCESS_OP_CODE;
+}
+
+/* Copies a dictionary from memory, keeping its last COMPRESS_MAX_DICTIONARY_SIZE
+ * bytes, and indexes it. */
+int CompressDictionaryInit ( COMPRESS_DICTIONARY *dictionary , const char *data , int size )
+{
+	memset ( dictionary , 0 , sizeof ( COMPRESS_DICTIONARY ) );
+	if ( size > COMPRESS_MAX_DICTIONARY_SIZE )
+	{
+		data += size - COMPRESS_MAX_DICTIONARY_SIZE;
+		size = COMPRESS_MAX_DICTIONARY_SIZE;
+	}
+
+	dictionary -> data = malloc ( size > 0 ? size : 1 );
+	if ( !dictionary -> data )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	memcpy ( dictionary -> data , data , size );
+	dictionary -> size = size;
+
+	// FNV-1a, so the two ends can tell whether they loaded the same bytes
+	unsigned int id = 2166136261U;
+	for ( int i = 0 ; i < size ; i++ )
+	{
+		id = ( id ^ ( unsigned char ) data [ i ] ) * 16777619U;
+	}
+	dictionary -> id = id ? id : 1;
+
+	// later positions overwrite earlier ones: the nearest match is the cheapest to reach
+	const unsigned char *bytes = ( const unsigned char *) dictionary -> data;
+	for ( int i = 0 ; i + COMPRESS_MIN_MATCH <= size ; i++ )
+	{
+		dictionary -> table [ Hash32 ( Read32 ( bytes + i ) ) >> ( 32 - COMPRESS_DICTIONARY_HASH_BITS ) ] = i + 1;
+	}
+
+	return SUCCESS_OP_CODE;
+}
+
+/* Reads the dictionary file at path; reports why it could not on stderr. */
+int CompressDictionaryLoad ( COMPRESS_DICTIONARY *dictionary , const char *path )
+{
+	int fd = open ( path , O_RDONLY );
+	struct stat status;
+	if ( fd < 0 || fstat ( fd , &status ) < 0 )
+	{
+		perror ( path );
+		if ( fd >= 0 )
+		{
+			close ( fd );
+		}
+		return FAILURE_OP_CODE;
+	}
+
+	off_t size = status.st_size < COMPRESS_MAX_DICTIONARY_SIZE ? status.st_size : COMPRESS_MAX_DICTIONARY_SIZE;
+	char *data = malloc ( size > 0 ? size : 1 );
+	ssize_t numRead = data ? pread ( fd , data , size , status.st_size - size ) : -1;
+	close ( fd );
+
+	if ( numRead != size )
+	{
+		fprintf ( stderr , "%s: could not read the dictionary\n" , path );
+		free ( data );
+		return FAILURE_OP_CODE;
+	}
+
+	int result = CompressDictionaryInit ( dictionary , data , size );
+	free ( data );
+	return result;
+}
+
+void CompressDictionaryFree ( COMPRESS_DICTIONARY *dictionary )
+{
+	free ( dictionary -> data );
+	dictionary -> data = NULL;
+	dictionary -> size = 0;
+}
+
+void CompressorInit ( COMPRESSOR *compressor )
+{
+	memset ( compressor -> table , 0 , sizeof ( compressor -> table ) );
+	compressor -> base = 1;
+}
+
+/* Compresses length bytes of input into output, matching against the
+ * dictionary too if there is one. Returns the compressed length, or 0 if it
+ * would not fit in capacity bytes: the caller then sends the input as it is.
+ *
+ * The hash table is never cleared between inputs. Each input's positions are
+ * numbered on from the last one's, so an entry below base is known to be
+ * stale; with no dictionary match either, the search just moves on. */
+static inline __attribute__ (( always_inline )) int CompressWith ( COMPRESSOR *compressor , const COMPRESS_DICTIONARY *dictionary , const char *input , int length , char *output , int capacity )
+{
+	if ( compressor -> base > ~0U - ( unsigned int ) length - 1 )
+	{
+		CompressorInit ( compressor );
+	}
+
+	unsigned int *table = compressor -> table;
+	unsigned int base = compressor -> base;
+	compressor -> base += length;
+
+	const unsigned char *dictionaryStart = dictionary ? ( const unsigned char *) dictionary -> data : NULL;
+	const unsigned char *dictionaryEnd = dictionary ? dictionaryStart + dictionary -> size : NULL;
+
+	const unsigned char *in = ( const unsigned char *) input;
+	const unsigned char *inEnd = in + length;
+	const unsigned char *matchLimit = inEnd - COMPRESS_LAST_LITERALS;
+	const unsigned char *searchLimit = inEnd - COMPRESS_MATCH_SEARCH_MARGIN;
+	const unsigned char *ip = in;
+	const unsigned char *anchor = in;
+
+	unsigned char *op = ( unsigned char *) output;
+	unsigned char *outEnd = op + capacity;
+
+	unsigned int numSearches = 1 << COMPRESS_SKIP_STRENGTH;
+
+	while ( length >= COMPRESS_MATCH_SEARCH_MARGIN && ip <= searchLimit )
+	{
+		unsigned int sequence = Read32 ( ip );
+		unsigned int hash = Hash32 ( sequence );
+		unsigned int position = ip - in;
+		unsigned int *slot = &table [ hash >> ( 32 - COMPRESS_HASH_BITS ) ];
+		unsigned int candidate = *slot;
+		*slot = base + position;
+
+		const unsigned char *reference = NULL;
+		const unsigned char *referenceStart = in;
+		unsigned int offset = 0;
+
+		if ( candidate >= base && position - ( candidate - base ) <= COMPRESS_MAX_OFFSET && Read32 ( in + candidate - base ) == sequence )
+		{
+			reference = in + candidate - base;
+			offset = position - ( candidate - base );
+		}
+		else if ( dictionary )
+		{
+			unsigned int entry = dictionary -> table [ hash >> ( 32 - COMPRESS_DICTIONARY_HASH_BITS ) ];
+			unsigned int distance = dictionary -> size - ( entry - 1 ) + position;
+			if ( entry && distance <= COMPRESS_MAX_OFFSET && Read32 ( dictionaryStart + entry - 1 ) == sequence )
+			{
+				reference = dictionaryStart + entry - 1;
+				referenceStart = dictionaryStart;
+				offset = distance;
+			}
+		}
+
+		if ( !reference )
+		{
+			// the longer nothing matches, the faster it skips ahead: incompressible input costs little
+			ip += numSearches++ >> COMPRESS_SKIP_STRENGTH;
+			continue;
+		}
+
+		while ( ip > anchor && reference > referenceStart && ip [ -1 ] == reference [ -1 ] )
+		{
+			ip -= 1;
+			reference -= 1;
+		}
+
+		int matchLength;
+		if ( referenceStart == dictionaryStart )
+		{
+			// a match running off the end of the dictionary carries on from the start of the input
+			size_t dictionaryLeft = dictionaryEnd - reference;
+			const unsigned char *limit = ( size_t ) ( matchLimit - ip ) > dictionaryLeft ? ip + dictionaryLeft : matchLimit;
+			matchLength = CountMatching ( ip , reference , limit );
+			if ( ip + matchLength == limit && limit < matchLimit )
+			{
+				matchLength += CountMatching ( ip + matchLength , in , matchLimit );
+			}
+		}
+		else
+		{
+			matchLength = CountMatching ( ip , reference , matchLimit );
+		}
+
+		unsigned int literalLength = ip - anchor;
+		unsigned int extraMatchLength = matchLength - COMPRESS_MIN_MATCH;
+		if ( op + 1 + literalLength + literalLength / 255 + 1 + 2 + extraMatchLength / 255 + 1 > outEnd )
+		{
+			return 0;
+		}
+
+		unsigned char *token = op++;
+		*token = ( literalLength < 15 ? literalLength : 15 ) << 4 | ( extraMatchLength < 15 ? extraMatchLength : 15 );
+		if ( literalLength >= 15 )
+		{
+			op = WriteLength ( op , literalLength - 15 );
+		}
+
+		// a word at a time, running past the literals when the output has room (the input always does: ip is short of its end)
+		if ( op + literalLength + 8 <= outEnd )
+		{
+			for ( unsigned int i = 0 ; i < literalLength ; i += 8 )
+			{
+				memcpy ( op + i , anchor + i , 8 );
+			}
+		}
+		else
+		{
+			memcpy ( op , anchor , literalLength );
+		}
+		op += literalLength;
+
+		*op++ = ( unsigned char ) offset;
+		*op++ = ( unsigned char ) ( offset >> 8 );
+		if ( extraMatchLength >= 15 )
+		{
+			op = WriteLength ( op , extraMatchLength - 15 );
+		}
+
+		ip += matchLength;
+		anchor = ip;
+		numSearches = 1 << COMPRESS_SKIP_STRENGTH;
+
+		// indexes a position inside the match, so text repeated back to back is found again at once
+		if ( ip <= searchLimit )
+		{
+			table [ Hash32 ( Read32 ( ip - 2 ) ) >> ( 32 - COMPRESS_HASH_BITS ) ] = base + ( ip - 2 - in );
+		}
+	}
+
+	unsigned int literalLength = inEnd - anchor;
+	if ( op + 1 + literalLength + literalLength / 255 + 1 > outEnd )
+	{
+		return 0;
+	}
+
+	*op++ = ( literalLength < 15 ? literalLength : 15 ) << 4;
+	if ( literalLength >= 15 )
+	{
+		op = WriteLength ( op , literalLength - 15 );
+	}
+
+	memcpy ( op , anchor , literalLength );
+	op += literalLength;
+
+	return op - ( unsigned char *) output;
+}
+
+/* The search is compiled twice, so a block without a dictionary tests for one nowhere. */
+int CompressBlock ( COMPRESSOR *compressor , const COMPRESS_DICTIONARY *dictionary , const char *input , int length , char *output , int capacity )
+{
+	if ( dictionary )
+	{
+		return CompressWith ( compressor , dictionary , input , length , output , capacity );
+	}
+
+	return CompressWith ( compressor , NULL , input , length , output , capacity );
+}
+
+/* Writes length bytes at op from offset bytes back, which may overlap op
+ * itself: a short offset repeats a pattern. Whole words are copied, writing up
+ * to 15 bytes past the match, when outEnd leaves room. */
+static inline void CopyMatch ( unsigned char *op , size_t offset , size_t length , const unsigned char *outEnd )
+{
+	const unsigned char *reference = op - offset;
+	unsigned char *matchEnd = op + length;
+
+	if ( matchEnd + 8 > outEnd )
+	{
+		while ( op < matchEnd )
+		{
+			*op++ = *reference++;
+		}
+		return;
+	}
+
+	if ( offset < 8 )
+	{
+		// once a whole number of periods (8 bytes or more) is out, words can be copied from that far back
+		size_t period = offset;
+		while ( period < 8 )
+		{
+			period += offset;
+		}
+
+		unsigned char *periodEnd = op + period < matchEnd ? op + period : matchEnd;
+		while ( op < periodEnd )
+		{
+			*op++ = *reference++;
+		}
+		reference = op - period;
+	}
+
+	if ( op - reference >= 16 && matchEnd + 16 <= outEnd )
+	{
+		while ( op < matchEnd )
+		{
+			memcpy ( op , reference , 16 );
+			op += 16;
+			reference += 16;
+		}
+		return;
+	}
+
+	while ( op < matchEnd )
+	{
+		memcpy ( op , reference , 8 );
+		op += 8;
+		reference += 8;
+	}
+}
+
+/* Decompresses length bytes of input into output, which takes at most capacity
+ * bytes. Returns the decompressed length, or -1 if the input is malformed,
+ * would decompress past capacity or reaches into a dictionary it was not given. */
+int DecompressBlock ( const COMPRESS_DICTIONARY *dictionary , const char *input , int length , char *output , int capacity )
+{
+	const unsigned char *ip = ( const unsigned char *) input;
+	const unsigned char *inEnd = ip + length;
+	unsigned char *op = ( unsigned char *) output;
+	unsigned char *outStart = op;
+	unsigned char *outEnd = op + capacity;
+
+	while ( ip < inEnd )
+	{
+		unsigned int token = *ip++;
+
+		// the common sequence, short literals then a short match from 8 or more bytes back, in fixed-size copies
+		if ( token < 0xf0 && ( token & 15 ) != 15 && inEnd - ip >= 16 + 2 && outEnd - op >= 16 + 24 )
+		{
+			size_t literalLength = token >> 4;
+			memcpy ( op , ip , 16 );
+			op += literalLength;
+			ip += literalLength;
+
+			size_t offset = ip [ 0 ] | ip [ 1 ] << 8;
+			size_t numDecoded = op - outStart;
+			const unsigned char *reference = NULL;
+			if ( offset >= 8 && offset <= numDecoded )
+			{
+				reference = op - offset;
+			}
+			else if ( dictionary && offset >= numDecoded + 24 && offset - numDecoded <= ( size_t ) dictionary -> size )
+			{
+				reference = ( const unsigned char *) dictionary -> data + dictionary -> size - ( offset - numDecoded );
+			}
+
+			if ( reference )
+			{
+				memcpy ( op , reference , 8 );
+				memcpy ( op + 8 , reference + 8 , 8 );
+				memcpy ( op + 16 , reference + 16 , 8 );
+				op += ( token & 15 ) + COMPRESS_MIN_MATCH;
+				ip += 2;
+				continue;
+			}
+
+			// the match needs the careful path: back up to just after the literals
+			ip -= literalLength;
+			op -= literalLength;
+		}
+
+		size_t literalLength = token >> 4;
+		if ( literalLength == 15 && ReadLength ( &ip , inEnd , &literalLength ) == FAILURE_OP_CODE )
+		{
+			return -1;
+		}
+
+		if ( literalLength > ( size_t ) ( inEnd - ip ) || literalLength > ( size_t ) ( outEnd - op ) )
+		{
+			return -1;
+		}
+
+		// 16 bytes at a time while both sides have room to spare; the overshoot is overwritten next
+		if ( ip + literalLength + 16 <= inEnd && op + literalLength + 16 <= outEnd )
+		{
+			for ( size_t i = 0 ; i < literalLength ; i += 16 )
+			{
+				memcpy ( op + i , ip + i , 16 );
+			}
+		}
+		else
+		{
+			memcpy ( op , ip , literalLength );
+		}
+		ip += literalLength;
+		op += literalLength;
+
+		if ( ip == inEnd )
+		{
+			break;
+		}
+
+		if ( inEnd - ip < 2 )
+		{
+			return -1;
+		}
+
+		size_t offset = ip [ 0 ] | ip [ 1 ] << 8;
+		ip += 2;
+
+		size_t matchLength = token & 15;
+		if ( matchLength == 15 && ReadLength ( &ip , inEnd , &matchLength ) == FAILURE_OP_CODE )
+		{
+			return -1;
+		}
+		matchLength += COMPRESS_MIN_MATCH;
+
+		if ( offset == 0 || matchLength > ( size_t ) ( outEnd - op ) )
+		{
+			return -1;
+		}
+
+		size_t numDecoded = op - outStart;
+		if ( offset > numDecoded )
+		{
+			// starts in the dictionary, and may run on into the output
+			size_t fromDictionary = offset - numDecoded;
+			if ( !dictionary || fromDictionary > ( size_t ) dictionary -> size )
+			{
+				return -1;
+			}
+
+			size_t numCopied = fromDictionary < matchLength ? fromDictionary : matchLength;
+			memcpy ( op , dictionary -> data + dictionary -> size - fromDictionary , numCopied );
+			op += numCopied;
+			matchLength -= numCopied;
+		}
+
+		CopyMatch ( op , offset , matchLength , outEnd );
+		op += matchLength;
+	}
+
+	return op - outStart;
+}
+
+/* Compresses the frame's payload in place when that pays: payloads shorter than
+ * COMPRESS_MIN_PAYLOAD_SIZE, and ones it would not shrink by an eighth, are left
+ * as they are. Returns the frame's length. */
+int CompressFrame ( COMPRESSOR *compressor , const COMPRESS_DICTIONARY *dictionary , char *frame )
+{
+	FRAME_HEADER header;
+	int frameLength = FrameLength ( frame );
+	if ( FrameDecodeHeader ( frame , frameLength , &header ) == FAILURE_OP_CODE )
+	{
+		return frameLength;
+	}
+
+	int payloadLength = header.payloadLength;
+	if ( payloadLength < COMPRESS_MIN_PAYLOAD_SIZE || payloadLength > COMPRESS_MAX_PAYLOAD_SIZE || ( header.flags & FRAME_FLAG_COMPRESSED ) )
+	{
+		return frameLength;
+	}
+
+	char compressed [ COMPRESS_MAX_PAYLOAD_SIZE ];
+	int capacity = payloadLength - ( payloadLength >> COMPRESS_MIN_SAVING_SHIFT );
+	int compressedLength = CompressBlock ( compressor , dictionary , frame + FRAME_HEADER_SIZE , payloadLength , compressed , capacity );
+	if ( compressedLength == 0 )
+	{
+		return frameLength;
+	}
+
+	memcpy ( frame + FRAME_HEADER_SIZE , compressed , compressedLength );
+	header.flags |= FRAME_FLAG_COMPRESSED | ( dictionary ? FRAME_FLAG_DICTIONARY : 0 );
+	header.payloadLength = compressedLength;
+	FrameEncodeHeader ( frame , &header );
+
+	StatsAdd ( STATS_FRAMES_COMPRESSED , 1 );
+	StatsAdd ( STATS_COMPRESSION_BYTES_SAVED , payloadLength - compressedLength );
+	return FRAME_HEADER_SIZE + compressedLength;
+}
+
+/* Restores a compressed frame: plain (COMPRESS_MAX_PAYLOAD_SIZE bytes) gets the
+ * payload it was sent with and plainHeader its header. Fails if the payload is
+ * malformed or was compressed against a dictionary that is not loaded. */
+int DecompressFrame ( const COMPRESS_DICTIONARY *dictionary , const FRAME_HEADER *header , const char *payload , FRAME_HEADER *plainHeader , char *plain )
+{
+	int withDictionary = ( header -> flags & FRAME_FLAG_DICTIONARY ) != 0;
+	if ( withDictionary && ( !dictionary || !dictionary -> data ) )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	int plainLength = DecompressBlock ( withDictionary ? dictionary : NULL , payload , header -> payloadLength , plain , COMPRESS_MAX_PAYLOAD_SIZE );
+	if ( plainLength < 0 )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	*plainHeader = *header;
+	plainHeader -> flags &= ~( FRAME_FLAG_COMPRESSED | FRAME_FLAG_DICTIONARY );
+	plainHeader -> payloadLength = plainLength;
+	return SUCCESS_OP_CODE;
+}
+
+/* Writes a hello frame naming the dictionary this end has loaded, if any;
+ * returns its length. */
+int CompressEncodeHello ( char *frame , const COMPRESS_DICTIONARY *dictionary , int replyWanted )
+{
+	FRAME_HEADER header = {
+		.version = FRAME_PROTOCOL_VERSION ,
+		.type = FRAME_TYPE_HELLO ,
+		.flags = 0 ,
+		.sequence = 0 , // stamped on sending
+		.payloadLength = FRAME_HELLO_PAYLOAD_SIZE
+	};
+	FrameEncodeHeader ( frame , &header );
+
+	unsigned int networkId = htonl ( dictionary && dictionary -> data ? dictionary -> id : 0 );
+	frame [ FRAME_HEADER_SIZE ] = replyWanted ? 1 : 0;
+	memcpy ( frame + FRAME_HEADER_SIZE + 1 , &networkId , sizeof ( networkId ) );
+
+	return COMPRESS_HELLO_FRAME_SIZE;
+}
+
+/* A newer peer may say more after the fields known here; that is ignored. */
+int CompressDecodeHello ( const FRAME_HEADER *header , const char *payload , unsigned int *dictionaryId , int *replyWanted )
+{
+	if ( header -> payloadLength < FRAME_HELLO_PAYLOAD_SIZE )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	unsigned int networkId;
+	memcpy ( &networkId , payload + 1 , sizeof ( networkId ) );
+	*dictionaryId = ntohl ( networkId );
+	*replyWanted = payload [ 0 ] != 0;
+	return SUCCESS_OP_CODE;
+}
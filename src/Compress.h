@@ -0,0 +1,66 @@
+/* Nic Pucci
+ * COMPRESS HEADER
+ *
+ * LZ77 payload compression for chat frames, in the LZ4 block layout: each
+ * sequence is a token (literal count, match length), the literals, then a
+ * 2-byte little-endian offset back into what was already decoded. A block ends
+ * with a sequence of literals alone. Matches are found through one hash table
+ * of the last position every 4-byte prefix was seen at, so compressing is a
+ * single pass with no entropy stage and decoding is mostly memcpy.
+ *
+ * A priming dictionary (sample traffic, e.g. earlier logs) may sit in front of
+ * every payload: matches can reach back into it, so even a short line made of
+ * familiar text shrinks. Both ends must load the same one; the hello frame each
+ * sends at session start carries its dictionary's id, and a frame compressed
+ * against it is flagged FRAME_FLAG_DICTIONARY.
+ *
+ * A compressor belongs to one thread; a loaded dictionary is read-only and may
+ * be shared.
+*/
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "Protocol.h"
+
+#define COMPRESS_HASH_BITS 12
+#define COMPRESS_DICTIONARY_HASH_BITS 14
+#define COMPRESS_MAX_DICTIONARY_SIZE ( 32 * 1024 ) // the last this many bytes of a dictionary file are kept
+#define COMPRESS_MAX_PAYLOAD_SIZE 2048 // longer payloads are sent as they are
+#define COMPRESS_HELLO_FRAME_SIZE ( FRAME_HEADER_SIZE + FRAME_HELLO_PAYLOAD_SIZE )
+
+typedef struct compressDictionary
+{
+	char *data;
+	int size;
+	unsigned int id; // a hash of data, never 0
+	unsigned int table [ 1 << COMPRESS_DICTIONARY_HASH_BITS ]; // hash of 4 bytes -> their position + 1, 0 = none
+} COMPRESS_DICTIONARY;
+
+typedef struct compressor
+{
+	unsigned int base; // table value of the next input's first byte; anything lower is from an earlier input
+	unsigned int table [ 1 << COMPRESS_HASH_BITS ];
+} COMPRESSOR;
+
+int CompressDictionaryInit ( COMPRESS_DICTIONARY *dictionary , const char *data , int size );
+
+int CompressDictionaryLoad ( COMPRESS_DICTIONARY *dictionary , const char *path );
+
+void CompressDictionaryFree ( COMPRESS_DICTIONARY *dictionary );
+
+void CompressorInit ( COMPRESSOR *compressor );
+
+int CompressBlock ( COMPRESSOR *compressor , const COMPRESS_DICTIONARY *dictionary , const char *input , int length , char *output , int capacity );
+
+int DecompressBlock ( const COMPRESS_DICTIONARY *dictionary , const char *input , int length , char *output , int capacity );
+
+int CompressFrame ( COMPRESSOR *compressor , const COMPRESS_DICTIONARY *dictionary , char *frame );
+
+int DecompressFrame ( const COMPRESS_DICTIONARY *dictionary , const FRAME_HEADER *header , const char *payload , FRAME_HEADER *plainHeader , char *plain );
+
+int CompressEncodeHello ( char *frame , const COMPRESS_DICTIONARY *dictionary , int replyWanted );
+
+int CompressDecodeHello ( const FRAME_HEADER *header , const char *payload , unsigned int *dictionaryId , int *replyWanted );
+
+#endif
@@ -0,0 +1,346 @@
+/* Nic Pucci
+ * COMPRESS BENCH IMPLEMENTATION
+ *
+ * Microbenchmarks for the payload compressor. Each corpus is cut into payloads
+ * of chat frame sizes that are compressed one by one, as the input thread does,
+ * with and without a priming dictionary made from a different sample of the
+ * same kind of text. Reports the compressed share of the bytes, MB/s and ns
+ * per payload both ways. Every payload is checked to come back as it went in.
+ *
+ * Before anything is timed the compressor and decompressor are checked against
+ * fixed streams, with and without a dictionary; a mismatch exits nonzero, so
+ * make bench fails on it.
+ *
+ * usage: compressbench [corpus name ...]   (no names = every corpus)
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "List.h"
+#include "Compress.h"
+
+const int COMPRESS_BENCH_SIZES [] = { 128 , 512 , 1400 };
+const int COMPRESS_BENCH_NUM_SIZES = sizeof ( COMPRESS_BENCH_SIZES ) / sizeof ( COMPRESS_BENCH_SIZES [ 0 ] );
+const int COMPRESS_BENCH_NUM_PAYLOADS = 1024;
+const int COMPRESS_BENCH_DICTIONARY_SIZE = COMPRESS_MAX_DICTIONARY_SIZE;
+const unsigned long long COMPRESS_BENCH_MIN_NS = 200000000ULL; // each direction runs rounds for at least this long
+#define COMPRESS_BENCH_LINE_SIZE 256
+
+/* Fixed streams, each checked against an independent LZ4 block decoder when it
+ * was recorded. The first has a literal run and a match both past 15 and a
+ * match overlapping itself (a run of one byte); the second reaches back into
+ * its dictionary. Both ends of a session must read them the same way. */
+const char KNOWN_ANSWER_TEXT [] =
+	"2026-10-18 INFO [worker-3] request id=0000beef took 12 ms status=200\n"
+	"2026-10-18 INFO [worker-5] request id=0000f00d took 7 ms status=200\n"
+	"==============================================\n";
+const char KNOWN_ANSWER_STREAM [] =
+	"ff36323032362d31302d313820494e464f205b776f726b65722d335d2072657175"
+	"6573742069643d303030306265656620746f6f6b203132206d7320737461747573"
+	"3d3230300a4500051d354500426630306445001b3744001f3d010016503d3d3d3d"
+	"0a";
+const char KNOWN_ANSWER_DICTIONARY [] = "2026-10-17 WARN [worker-1] request id=00001234 took 950 ms status=503\n";
+const unsigned int KNOWN_ANSWER_DICTIONARY_ID = 0x2e8f5621; // FNV-1a of the dictionary, as hellos carry it
+const char KNOWN_ANSWER_DICTIONARY_TEXT [] = "2026-10-18 WARN [worker-1] request id=00001234 took 950 ms status=503\n";
+const char KNOWN_ANSWER_DICTIONARY_STREAM [] = "0546001f38460024503d3530330a";
+
+typedef struct compressBenchCorpus
+{
+	const char *name;
+	int ( *line ) ( char *line ); // writes one line of the corpus, returns its length
+} COMPRESS_BENCH_CORPUS;
+
+unsigned long long benchSeed = 1;
+
+unsigned int NextRandom ()
+{
+	benchSeed ^= benchSeed << 13;
+	benchSeed ^= benchSeed >> 7;
+	benchSeed ^= benchSeed << 17;
+	return ( unsigned int ) benchSeed;
+}
+
+unsigned long long NowNs ()
+{
+	struct timespec now;
+	clock_gettime ( CLOCK_MONOTONIC , &now );
+	return ( unsigned long long ) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* service logs: fixed words around timestamps, ids and timings */
+int LogLine ( char *line )
+{
+	const char *levels [] = { "INFO" , "INFO" , "DEBUG" , "WARN" , "ERROR" };
+	const char *paths [] = { "/api/v1/items" , "/api/v1/users" , "/api/v1/orders" , "/healthz" };
+
+	return snprintf (
+		line , COMPRESS_BENCH_LINE_SIZE ,
+		"2026-10-18T12:%02u:%02u.%03uZ %-5s [worker-%u] request id=%08x user=%u %s took %u ms status=%u\n" ,
+		NextRandom () % 60 , NextRandom () % 60 , NextRandom () % 1000 ,
+		levels [ NextRandom () % 5 ] , NextRandom () % 8 , NextRandom () , NextRandom () % 10000 ,
+		paths [ NextRandom () % 4 ] , NextRandom () % 500 , NextRandom () % 3 ? 200 : 500
+	);
+}
+
+/* stack traces: a few exception headers and a pool of frames they share */
+int TraceLine ( char *line )
+{
+	const char *classes [] = { "OrderService" , "UserRepository" , "HttpHandler" , "ConnectionPool" , "JsonCodec" , "RetryPolicy" };
+	const char *methods [] = { "process" , "lookup" , "handle" , "acquire" , "decode" , "run" };
+
+	if ( NextRandom () % 12 == 0 )
+	{
+		return snprintf ( line , COMPRESS_BENCH_LINE_SIZE , "java.lang.IllegalStateException: %s failed after %u attempts\n" , classes [ NextRandom () % 6 ] , NextRandom () % 5 + 1 );
+	}
+
+	int frame = NextRandom () % 6;
+	return snprintf (
+		line , COMPRESS_BENCH_LINE_SIZE ,
+		"\tat com.example.%s.%s(%s.java:%u)\n" ,
+		classes [ frame ] , methods [ frame ] , classes [ frame ] , 40 + frame * 17 + NextRandom () % 3
+	);
+}
+
+/* incompressible: what an already compressed or encrypted paste looks like */
+int RandomLine ( char *line )
+{
+	for ( int i = 0 ; i < 64 ; i++ )
+	{
+		line [ i ] = ( char ) NextRandom ();
+	}
+	return 64;
+}
+
+const COMPRESS_BENCH_CORPUS COMPRESS_BENCH_CORPORA [] = {
+	{ "logs" , LogLine } ,
+	{ "traces" , TraceLine } ,
+	{ "random" , RandomLine }
+};
+const int COMPRESS_BENCH_NUM_CORPORA = sizeof ( COMPRESS_BENCH_CORPORA ) / sizeof ( COMPRESS_BENCH_CORPORA [ 0 ] );
+
+void FillCorpus ( const COMPRESS_BENCH_CORPUS *corpus , char *text , long size , unsigned long long seed )
+{
+	benchSeed = seed;
+
+	char line [ COMPRESS_BENCH_LINE_SIZE ];
+	long length = 0;
+	while ( length < size )
+	{
+		int lineLength = corpus -> line ( line );
+		int numCopied = lineLength < size - length ? lineLength : size - length;
+		memcpy ( text + length , line , numCopied );
+		length += numCopied;
+	}
+}
+
+/* Decodes hex into bytes; returns the number of bytes. */
+int FromHex ( char *bytes , const char *hex )
+{
+	int length = strlen ( hex ) / 2;
+	for ( int i = 0 ; i < length ; i++ )
+	{
+		unsigned int byte;
+		sscanf ( hex + 2 * i , "%2x" , &byte );
+		bytes [ i ] = ( char ) byte;
+	}
+
+	return length;
+}
+
+/* text has to compress to exactly stream, and stream decompress to text. */
+int MatchesStream ( const COMPRESS_DICTIONARY *dictionary , const char *text , const char *hexStream )
+{
+	char stream [ 256 ];
+	char output [ 256 ];
+	int textLength = strlen ( text );
+	int streamLength = FromHex ( stream , hexStream );
+
+	COMPRESSOR compressor;
+	CompressorInit ( &compressor );
+	int compressedLength = CompressBlock ( &compressor , dictionary , text , textLength , output , sizeof ( output ) );
+	if ( compressedLength != streamLength || memcmp ( output , stream , streamLength ) != 0 )
+	{
+		return 0;
+	}
+
+	int restoredLength = DecompressBlock ( dictionary , stream , streamLength , output , sizeof ( output ) );
+	return restoredLength == textLength && memcmp ( output , text , textLength ) == 0;
+}
+
+int CheckKnownAnswers ()
+{
+	if ( !MatchesStream ( NULL , KNOWN_ANSWER_TEXT , KNOWN_ANSWER_STREAM ) )
+	{
+		fprintf ( stderr , "compressbench: does not match the fixed stream\n" );
+		return FAILURE_OP_CODE;
+	}
+
+	COMPRESS_DICTIONARY dictionary;
+	if ( CompressDictionaryInit ( &dictionary , KNOWN_ANSWER_DICTIONARY , sizeof ( KNOWN_ANSWER_DICTIONARY ) - 1 ) == FAILURE_OP_CODE )
+	{
+		fprintf ( stderr , "compressbench: out of memory\n" );
+		return FAILURE_OP_CODE;
+	}
+
+	int matches = dictionary.id == KNOWN_ANSWER_DICTIONARY_ID
+		&& MatchesStream ( &dictionary , KNOWN_ANSWER_DICTIONARY_TEXT , KNOWN_ANSWER_DICTIONARY_STREAM );
+	CompressDictionaryFree ( &dictionary );
+	if ( !matches )
+	{
+		fprintf ( stderr , "compressbench: does not match the fixed stream with a dictionary\n" );
+		return FAILURE_OP_CODE;
+	}
+
+	printf ( "known answers (fixed streams, with and without a dictionary): match\n" );
+	return SUCCESS_OP_CODE;
+}
+
+void RunBenchCase ( const COMPRESS_BENCH_CORPUS *corpus , const COMPRESS_DICTIONARY *dictionary , int size )
+{
+	int capacity = size + size / 255 + 16;
+	char *payloads = malloc ( ( long ) COMPRESS_BENCH_NUM_PAYLOADS * size );
+	char *compressed = malloc ( ( long ) COMPRESS_BENCH_NUM_PAYLOADS * capacity );
+	int *compressedLengths = malloc ( COMPRESS_BENCH_NUM_PAYLOADS * sizeof ( int ) );
+	char *restored = malloc ( size );
+	if ( !payloads || !compressed || !compressedLengths || !restored )
+	{
+		fprintf ( stderr , "compressbench: out of memory\n" );
+		exit ( -1 );
+	}
+
+	FillCorpus ( corpus , payloads , ( long ) COMPRESS_BENCH_NUM_PAYLOADS * size , 1 );
+
+	COMPRESSOR compressor;
+	CompressorInit ( &compressor );
+
+	long numCompressed = 0;
+	unsigned long long numCompressedBytes = 0;
+	unsigned long long compressNs = 0;
+	while ( compressNs < COMPRESS_BENCH_MIN_NS )
+	{
+		numCompressedBytes = 0;
+		unsigned long long startNs = NowNs ();
+		for ( int i = 0 ; i < COMPRESS_BENCH_NUM_PAYLOADS ; i++ )
+		{
+			compressedLengths [ i ] = CompressBlock ( &compressor , dictionary , payloads + ( long ) i * size , size , compressed + ( long ) i * capacity , capacity );
+			numCompressedBytes += compressedLengths [ i ];
+		}
+		compressNs += NowNs () - startNs;
+		numCompressed += COMPRESS_BENCH_NUM_PAYLOADS;
+	}
+
+	long numDecompressed = 0;
+	unsigned long long decompressNs = 0;
+	while ( decompressNs < COMPRESS_BENCH_MIN_NS )
+	{
+		unsigned long long startNs = NowNs ();
+		for ( int i = 0 ; i < COMPRESS_BENCH_NUM_PAYLOADS ; i++ )
+		{
+			int restoredLength = DecompressBlock ( dictionary , compressed + ( long ) i * capacity , compressedLengths [ i ] , restored , size );
+			if ( restoredLength != size )
+			{
+				fprintf ( stderr , "compressbench: %s payload %d did not decompress\n" , corpus -> name , i );
+				exit ( -1 );
+			}
+		}
+		decompressNs += NowNs () - startNs;
+		numDecompressed += COMPRESS_BENCH_NUM_PAYLOADS;
+	}
+
+	// the timed rounds only count lengths; every payload is compared once, untimed
+	for ( int i = 0 ; i < COMPRESS_BENCH_NUM_PAYLOADS ; i++ )
+	{
+		DecompressBlock ( dictionary , compressed + ( long ) i * capacity , compressedLengths [ i ] , restored , size );
+		if ( memcmp ( restored , payloads + ( long ) i * size , size ) != 0 )
+		{
+			fprintf ( stderr , "compressbench: %s payload %d came back different\n" , corpus -> name , i );
+			exit ( -1 );
+		}
+	}
+
+	printf (
+		"%-8s %6d %5s %7.3f %12.0f %12.0f %10.1f %10.1f\n" ,
+		corpus -> name ,
+		size ,
+		dictionary ? "yes" : "no" ,
+		( double ) numCompressedBytes / ( ( double ) COMPRESS_BENCH_NUM_PAYLOADS * size ) ,
+		( double ) numCompressed * size * 1000.0 / compressNs ,
+		( double ) numDecompressed * size * 1000.0 / decompressNs ,
+		( double ) compressNs / numCompressed ,
+		( double ) decompressNs / numDecompressed
+	);
+	fflush ( stdout );
+
+	free ( payloads );
+	free ( compressed );
+	free ( compressedLengths );
+	free ( restored );
+}
+
+int CorpusSelected ( const char *name , int argc , char *argv [] )
+{
+	if ( argc < 2 )
+	{
+		return 1;
+	}
+
+	for ( int i = 1 ; i < argc ; i++ )
+	{
+		if ( strcmp ( argv [ i ] , name ) == 0 )
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int main ( int argc , char *argv [] )
+{
+	if ( CheckKnownAnswers () == FAILURE_OP_CODE )
+	{
+		return -1;
+	}
+
+	char *sample = malloc ( COMPRESS_BENCH_DICTIONARY_SIZE );
+	if ( !sample )
+	{
+		fprintf ( stderr , "compressbench: out of memory\n" );
+		return -1;
+	}
+
+	printf ( "%-8s %6s %5s %7s %12s %12s %10s %10s\n" , "corpus" , "size" , "dict" , "ratio" , "comp MB/s" , "decomp MB/s" , "comp ns" , "decomp ns" );
+
+	for ( int c = 0 ; c < COMPRESS_BENCH_NUM_CORPORA ; c++ )
+	{
+		const COMPRESS_BENCH_CORPUS *corpus = &COMPRESS_BENCH_CORPORA [ c ];
+		if ( !CorpusSelected ( corpus -> name , argc , argv ) )
+		{
+			continue;
+		}
+
+		// the dictionary is another stretch of the same kind of text, not the payloads themselves
+		COMPRESS_DICTIONARY dictionary;
+		FillCorpus ( corpus , sample , COMPRESS_BENCH_DICTIONARY_SIZE , 2 );
+		if ( CompressDictionaryInit ( &dictionary , sample , COMPRESS_BENCH_DICTIONARY_SIZE ) == FAILURE_OP_CODE )
+		{
+			fprintf ( stderr , "compressbench: out of memory\n" );
+			return -1;
+		}
+
+		for ( int s = 0 ; s < COMPRESS_BENCH_NUM_SIZES ; s++ )
+		{
+			RunBenchCase ( corpus , NULL , COMPRESS_BENCH_SIZES [ s ] );
+			RunBenchCase ( corpus , &dictionary , COMPRESS_BENCH_SIZES [ s ] );
+		}
+
+		CompressDictionaryFree ( &dictionary );
+	}
+
+	free ( sample );
+	return 0;
+}
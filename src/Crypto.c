@@ -0,0 +1,1489 @@
+/* Nic Pucci
+ * CRYPTO IMPLEMENTATION
+*/
+
+#include <string.h>
+#include "List.h"
+#include "Crypto.h"
+
+#if defined ( __x86_64__ )
+#include <immintrin.h>
+#define CRYPTO_X86_KERNELS 1
+#endif
+
+#define CHACHA_BLOCK_SIZE 64
+#define AEAD_AHEAD_SIZE ( 7 * CHACHA_BLOCK_SIZE ) // what an eight-block pass has left after Poly1305's key
+
+typedef unsigned __int128 UINT128;
+typedef unsigned long long FIELD_ELEMENT [ 5 ]; // mod 2^255 - 19, in 51-bit limbs
+
+typedef struct poly1305State
+{
+	unsigned long long r [ 3 ]; // the key's clamped half, in 44/44/42-bit limbs
+	unsigned long long h [ 3 ]; // the running sum, in the same limbs
+	unsigned long long pad [ 2 ];
+	unsigned char buffer [ 16 ];
+	size_t bufferLength;
+} POLY1305_STATE;
+
+/* XORs length bytes of input with the keystream from state's counter on. With
+ * firstBlock, the first block of keystream is written there as it is and the
+ * text takes the keystream from the next block. */
+typedef void ( *CHACHA_KERNEL ) ( const unsigned int *state , unsigned char *firstBlock , const unsigned char *input , unsigned char *output , size_t length );
+
+const unsigned int CHACHA_CONSTANTS [ 4 ] = { 0x61707865 , 0x3320646e , 0x79622d32 , 0x6b206574 }; // "expand 32-byte k"
+const int CHACHA_DOUBLE_ROUNDS = 10;
+const unsigned long long POLY1305_MASK_44 = 0xfffffffffffULL;
+const unsigned long long POLY1305_MASK_42 = 0x3ffffffffffULL;
+const unsigned long long POLY1305_MASK_26 = 0x3ffffffULL;
+const size_t POLY1305_AVX2_MIN_SIZE = 384; // below this the powers of r cost more than the vector kernel saves
+const unsigned long long FIELD_MASK_51 = 0x7ffffffffffffULL;
+const unsigned long long X25519_A24 = 121665; // ( 486662 - 2 ) / 4
+
+const unsigned int BLAKE2S_IV [ 8 ] = {
+	0x6a09e667 , 0xbb67ae85 , 0x3c6ef372 , 0xa54ff53a , 0x510e527f , 0x9b05688c , 0x1f83d9ab , 0x5be0cd19
+};
+
+const unsigned char BLAKE2S_SIGMA [ 10 ][ 16 ] = {
+	{ 0 , 1 , 2 , 3 , 4 , 5 , 6 , 7 , 8 , 9 , 10 , 11 , 12 , 13 , 14 , 15 } ,
+	{ 14 , 10 , 4 , 8 , 9 , 15 , 13 , 6 , 1 , 12 , 0 , 2 , 11 , 7 , 5 , 3 } ,
+	{ 11 , 8 , 12 , 0 , 5 , 2 , 15 , 13 , 10 , 14 , 3 , 6 , 7 , 1 , 9 , 4 } ,
+	{ 7 , 9 , 3 , 1 , 13 , 12 , 11 , 14 , 2 , 6 , 5 , 10 , 4 , 0 , 15 , 8 } ,
+	{ 9 , 0 , 5 , 7 , 2 , 4 , 10 , 15 , 14 , 1 , 11 , 12 , 6 , 8 , 3 , 13 } ,
+	{ 2 , 12 , 6 , 10 , 0 , 11 , 8 , 3 , 4 , 13 , 7 , 5 , 15 , 14 , 1 , 9 } ,
+	{ 12 , 5 , 1 , 15 , 14 , 13 , 4 , 10 , 0 , 7 , 6 , 3 , 9 , 2 , 8 , 11 } ,
+	{ 13 , 11 , 7 , 14 , 12 , 1 , 3 , 9 , 5 , 0 , 15 , 4 , 8 , 6 , 2 , 10 } ,
+	{ 6 , 15 , 14 , 9 , 11 , 3 , 0 , 8 , 12 , 2 , 13 , 7 , 1 , 4 , 10 , 5 } ,
+	{ 10 , 2 , 8 , 4 , 7 , 6 , 1 , 5 , 15 , 11 , 9 , 14 , 3 , 12 , 13 , 0 }
+};
+
+const char *CRYPTO_KERNEL_NAMES [ CRYPTO_NUM_KERNELS ] = { "portable" , "sse2" , "avx2" };
+
+/* a memset the compiler cannot drop for writing to memory that is never read again */
+static void *( *const volatile wipeMemset ) ( void * , int , size_t ) = memset;
+
+static inline unsigned int Load32 ( const unsigned char *p )
+{
+	return ( unsigned int ) p [ 0 ] | ( unsigned int ) p [ 1 ] << 8 | ( unsigned int ) p [ 2 ] << 16 | ( unsigned int ) p [ 3 ] << 24;
+}
+
+static inline void Store32 ( unsigned char *p , unsigned int value )
+{
+	p [ 0 ] = value;
+	p [ 1 ] = value >> 8;
+	p [ 2 ] = value >> 16;
+	p [ 3 ] = value >> 24;
+}
+
+static inline unsigned long long Load64 ( const unsigned char *p )
+{
+	return ( unsigned long long ) Load32 ( p ) | ( unsigned long long ) Load32 ( p + 4 ) << 32;
+}
+
+static inline void Store64 ( unsigned char *p , unsigned long long value )
+{
+	Store32 ( p , ( unsigned int ) value );
+	Store32 ( p + 4 , ( unsigned int ) ( value >> 32 ) );
+}
+
+static inline unsigned int Rotl32 ( unsigned int value , int n )
+{
+	return value << n | value >> ( 32 - n );
+}
+
+/* output = input ^ keystream, a word at a time where it can */
+static inline void XorBytes ( unsigned char *output , const unsigned char *input , const unsigned char *keystream , size_t length )
+{
+	size_t i = 0;
+	for ( ; i + 8 <= length ; i += 8 )
+	{
+		unsigned long long a , b;
+		memcpy ( &a , input + i , 8 );
+		memcpy ( &b , keystream + i , 8 );
+		a ^= b;
+		memcpy ( output + i , &a , 8 );
+	}
+
+	for ( ; i < length ; i++ )
+	{
+		output [ i ] = input [ i ] ^ keystream [ i ];
+	}
+}
+
+void CryptoWipe ( void *data , size_t length )
+{
+	wipeMemset ( data , 0 , length );
+}
+
+/* Compares without an early exit, so the time taken says nothing of where a
+ * forged tag first differs. */
+int CryptoEqual ( const unsigned char *a , const unsigned char *b , size_t length )
+{
+	unsigned char difference = 0;
+	for ( size_t i = 0 ; i < length ; i++ )
+	{
+		difference |= a [ i ] ^ b [ i ];
+	}
+
+	return difference == 0;
+}
+
+/*
+ * CHACHA20
+ */
+
+static void ChaChaSetup ( unsigned int *state , const unsigned char *key , const unsigned char *nonce , unsigned int counter )
+{
+	for ( int i = 0 ; i < 4 ; i++ )
+	{
+		state [ i ] = CHACHA_CONSTANTS [ i ];
+	}
+
+	for ( int i = 0 ; i < 8 ; i++ )
+	{
+		state [ 4 + i ] = Load32 ( key + 4 * i );
+	}
+
+	state [ 12 ] = counter;
+	for ( int i = 0 ; i < 3 ; i++ )
+	{
+		state [ 13 + i ] = Load32 ( nonce + 4 * i );
+	}
+}
+
+static inline void QuarterRound ( unsigned int *x , int a , int b , int c , int d )
+{
+	x [ a ] += x [ b ];
+	x [ d ] = Rotl32 ( x [ d ] ^ x [ a ] , 16 );
+	x [ c ] += x [ d ];
+	x [ b ] = Rotl32 ( x [ b ] ^ x [ c ] , 12 );
+	x [ a ] += x [ b ];
+	x [ d ] = Rotl32 ( x [ d ] ^ x [ a ] , 8 );
+	x [ c ] += x [ d ];
+	x [ b ] = Rotl32 ( x [ b ] ^ x [ c ] , 7 );
+}
+
+static void ChaChaBlock ( const unsigned int *state , unsigned char *keystream )
+{
+	unsigned int x [ 16 ];
+	memcpy ( x , state , sizeof ( x ) );
+
+	for ( int i = 0 ; i < CHACHA_DOUBLE_ROUNDS ; i++ )
+	{
+		QuarterRound ( x , 0 , 4 , 8 , 12 );
+		QuarterRound ( x , 1 , 5 , 9 , 13 );
+		QuarterRound ( x , 2 , 6 , 10 , 14 );
+		QuarterRound ( x , 3 , 7 , 11 , 15 );
+		QuarterRound ( x , 0 , 5 , 10 , 15 );
+		QuarterRound ( x , 1 , 6 , 11 , 12 );
+		QuarterRound ( x , 2 , 7 , 8 , 13 );
+		QuarterRound ( x , 3 , 4 , 9 , 14 );
+	}
+
+	for ( int i = 0 ; i < 16 ; i++ )
+	{
+		Store32 ( keystream + 4 * i , x [ i ] + state [ i ] );
+	}
+}
+
+static void ChaChaPortable ( const unsigned int *state , unsigned char *firstBlock , const unsigned char *input , unsigned char *output , size_t length )
+{
+	unsigned int blockState [ 16 ];
+	unsigned char keystream [ CHACHA_BLOCK_SIZE ];
+	memcpy ( blockState , state , sizeof ( blockState ) );
+
+	if ( firstBlock )
+	{
+		ChaChaBlock ( blockState , firstBlock );
+		blockState [ 12 ] += 1;
+	}
+
+	while ( length > 0 )
+	{
+		size_t blockLength = length < CHACHA_BLOCK_SIZE ? length : CHACHA_BLOCK_SIZE;
+		ChaChaBlock ( blockState , keystream );
+		XorBytes ( output , input , keystream , blockLength );
+
+		blockState [ 12 ] += 1;
+		input += blockLength;
+		output += blockLength;
+		length -= blockLength;
+	}
+
+	CryptoWipe ( blockState , sizeof ( blockState ) );
+	CryptoWipe ( keystream , sizeof ( keystream ) );
+}
+
+#ifdef CRYPTO_X86_KERNELS
+
+/* The vector kernels run several blocks side by side, one per 32-bit lane:
+ * x [ i ] holds word i of every block, so a round is the scalar round on
+ * vectors, and the blocks are transposed back into byte order at the end. */
+
+static inline __attribute__ (( always_inline )) __m128i RotlSse2 ( __m128i value , const int n )
+{
+	if ( n == 16 )
+	{
+		return _mm_shufflehi_epi16 ( _mm_shufflelo_epi16 ( value , 0xb1 ) , 0xb1 );
+	}
+
+	return _mm_or_si128 ( _mm_slli_epi32 ( value , n ) , _mm_srli_epi32 ( value , 32 - n ) );
+}
+
+static inline __attribute__ (( always_inline )) void QuarterRoundSse2 ( __m128i *x , int a , int b , int c , int d )
+{
+	x [ a ] = _mm_add_epi32 ( x [ a ] , x [ b ] );
+	x [ d ] = RotlSse2 ( _mm_xor_si128 ( x [ d ] , x [ a ] ) , 16 );
+	x [ c ] = _mm_add_epi32 ( x [ c ] , x [ d ] );
+	x [ b ] = RotlSse2 ( _mm_xor_si128 ( x [ b ] , x [ c ] ) , 12 );
+	x [ a ] = _mm_add_epi32 ( x [ a ] , x [ b ] );
+	x [ d ] = RotlSse2 ( _mm_xor_si128 ( x [ d ] , x [ a ] ) , 8 );
+	x [ c ] = _mm_add_epi32 ( x [ c ] , x [ d ] );
+	x [ b ] = RotlSse2 ( _mm_xor_si128 ( x [ b ] , x [ c ] ) , 7 );
+}
+
+/* Four blocks, 256 bytes of keystream, per pass. A last block or less goes
+ * through the portable kernel, which costs less than a four-block pass. */
+static void ChaChaSse2 ( const unsigned int *state , unsigned char *firstBlock , const unsigned char *input , unsigned char *output , size_t length )
+{
+	unsigned int counter = state [ 12 ];
+	int numSkipped = firstBlock ? CHACHA_BLOCK_SIZE / 16 : 0; // keystream vectors the first pass keeps from the text
+	__m128i keystream [ 16 ];
+
+	while ( length + 16 * numSkipped > CHACHA_BLOCK_SIZE )
+	{
+		__m128i x [ 16 ];
+		for ( int i = 0 ; i < 16 ; i++ )
+		{
+			x [ i ] = _mm_set1_epi32 ( state [ i ] );
+		}
+		__m128i counters = _mm_add_epi32 ( _mm_set1_epi32 ( counter ) , _mm_set_epi32 ( 3 , 2 , 1 , 0 ) );
+		x [ 12 ] = counters;
+
+		for ( int i = 0 ; i < CHACHA_DOUBLE_ROUNDS ; i++ )
+		{
+			QuarterRoundSse2 ( x , 0 , 4 , 8 , 12 );
+			QuarterRoundSse2 ( x , 1 , 5 , 9 , 13 );
+			QuarterRoundSse2 ( x , 2 , 6 , 10 , 14 );
+			QuarterRoundSse2 ( x , 3 , 7 , 11 , 15 );
+			QuarterRoundSse2 ( x , 0 , 5 , 10 , 15 );
+			QuarterRoundSse2 ( x , 1 , 6 , 11 , 12 );
+			QuarterRoundSse2 ( x , 2 , 7 , 8 , 13 );
+			QuarterRoundSse2 ( x , 3 , 4 , 9 , 14 );
+		}
+
+		for ( int i = 0 ; i < 16 ; i++ )
+		{
+			x [ i ] = _mm_add_epi32 ( x [ i ] , i == 12 ? counters : _mm_set1_epi32 ( state [ i ] ) );
+		}
+
+		// keystream [ 4 * block + g ] = words 4g .. 4g + 3 of that block
+		for ( int g = 0 ; g < 4 ; g++ )
+		{
+			__m128i t0 = _mm_unpacklo_epi32 ( x [ 4 * g ] , x [ 4 * g + 1 ] );
+			__m128i t1 = _mm_unpacklo_epi32 ( x [ 4 * g + 2 ] , x [ 4 * g + 3 ] );
+			__m128i t2 = _mm_unpackhi_epi32 ( x [ 4 * g ] , x [ 4 * g + 1 ] );
+			__m128i t3 = _mm_unpackhi_epi32 ( x [ 4 * g + 2 ] , x [ 4 * g + 3 ] );
+			keystream [ g ] = _mm_unpacklo_epi64 ( t0 , t1 );
+			keystream [ 4 + g ] = _mm_unpackhi_epi64 ( t0 , t1 );
+			keystream [ 8 + g ] = _mm_unpacklo_epi64 ( t2 , t3 );
+			keystream [ 12 + g ] = _mm_unpackhi_epi64 ( t2 , t3 );
+		}
+
+		if ( numSkipped > 0 )
+		{
+			memcpy ( firstBlock , keystream , CHACHA_BLOCK_SIZE );
+		}
+
+		size_t passLength = 4 * CHACHA_BLOCK_SIZE - 16 * numSkipped;
+		if ( length < passLength )
+		{
+			XorBytes ( output , input , ( const unsigned char *) ( keystream + numSkipped ) , length );
+			length = 0;
+			numSkipped = 0;
+			break;
+		}
+
+		for ( int i = numSkipped ; i < 16 ; i++ )
+		{
+			__m128i text = _mm_loadu_si128 ( ( const __m128i *) ( input + 16 * ( i - numSkipped ) ) );
+			_mm_storeu_si128 ( ( __m128i *) ( output + 16 * ( i - numSkipped ) ) , _mm_xor_si128 ( text , keystream [ i ] ) );
+		}
+
+		counter += 4;
+		input += passLength;
+		output += passLength;
+		length -= passLength;
+		numSkipped = 0;
+	}
+
+	CryptoWipe ( keystream , sizeof ( keystream ) );
+
+	// numSkipped is only left when there was no text at all
+	if ( length > 0 || numSkipped > 0 )
+	{
+		unsigned int tailState [ 16 ];
+		memcpy ( tailState , state , sizeof ( tailState ) );
+		tailState [ 12 ] = counter;
+		ChaChaPortable ( tailState , numSkipped > 0 ? firstBlock : NULL , input , output , length );
+	}
+}
+
+static inline __attribute__ (( target ( "avx2" ) , always_inline )) __m256i RotlAvx2 ( __m256i value , const int n )
+{
+	if ( n == 16 )
+	{
+		const __m256i rotate16 = _mm256_set_epi8 (
+			13 , 12 , 15 , 14 , 9 , 8 , 11 , 10 , 5 , 4 , 7 , 6 , 1 , 0 , 3 , 2 ,
+			13 , 12 , 15 , 14 , 9 , 8 , 11 , 10 , 5 , 4 , 7 , 6 , 1 , 0 , 3 , 2
+		);
+		return _mm256_shuffle_epi8 ( value , rotate16 );
+	}
+
+	if ( n == 8 )
+	{
+		const __m256i rotate8 = _mm256_set_epi8 (
+			14 , 13 , 12 , 15 , 10 , 9 , 8 , 11 , 6 , 5 , 4 , 7 , 2 , 1 , 0 , 3 ,
+			14 , 13 , 12 , 15 , 10 , 9 , 8 , 11 , 6 , 5 , 4 , 7 , 2 , 1 , 0 , 3
+		);
+		return _mm256_shuffle_epi8 ( value , rotate8 );
+	}
+
+	return _mm256_or_si256 ( _mm256_slli_epi32 ( value , n ) , _mm256_srli_epi32 ( value , 32 - n ) );
+}
+
+static inline __attribute__ (( target ( "avx2" ) , always_inline )) void QuarterRoundAvx2 ( __m256i *x , int a , int b , int c , int d )
+{
+	x [ a ] = _mm256_add_epi32 ( x [ a ] , x [ b ] );
+	x [ d ] = RotlAvx2 ( _mm256_xor_si256 ( x [ d ] , x [ a ] ) , 16 );
+	x [ c ] = _mm256_add_epi32 ( x [ c ] , x [ d ] );
+	x [ b ] = RotlAvx2 ( _mm256_xor_si256 ( x [ b ] , x [ c ] ) , 12 );
+	x [ a ] = _mm256_add_epi32 ( x [ a ] , x [ b ] );
+	x [ d ] = RotlAvx2 ( _mm256_xor_si256 ( x [ d ] , x [ a ] ) , 8 );
+	x [ c ] = _mm256_add_epi32 ( x [ c ] , x [ d ] );
+	x [ b ] = RotlAvx2 ( _mm256_xor_si256 ( x [ b ] , x [ c ] ) , 7 );
+}
+
+/* Eight blocks side by side, 512 bytes of keystream:
+ * keystream [ 2 * block ] and [ 2 * block + 1 ] = that block's two halves. */
+static inline __attribute__ (( target ( "avx2" ) , always_inline )) void ChaChaEightBlocksAvx2 ( const unsigned int *state , unsigned int counter , __m256i *keystream )
+{
+	__m256i x [ 16 ];
+	for ( int i = 0 ; i < 16 ; i++ )
+	{
+		x [ i ] = _mm256_set1_epi32 ( state [ i ] );
+	}
+	__m256i counters = _mm256_add_epi32 ( _mm256_set1_epi32 ( counter ) , _mm256_set_epi32 ( 7 , 6 , 5 , 4 , 3 , 2 , 1 , 0 ) );
+	x [ 12 ] = counters;
+
+	for ( int i = 0 ; i < CHACHA_DOUBLE_ROUNDS ; i++ )
+	{
+		QuarterRoundAvx2 ( x , 0 , 4 , 8 , 12 );
+		QuarterRoundAvx2 ( x , 1 , 5 , 9 , 13 );
+		QuarterRoundAvx2 ( x , 2 , 6 , 10 , 14 );
+		QuarterRoundAvx2 ( x , 3 , 7 , 11 , 15 );
+		QuarterRoundAvx2 ( x , 0 , 5 , 10 , 15 );
+		QuarterRoundAvx2 ( x , 1 , 6 , 11 , 12 );
+		QuarterRoundAvx2 ( x , 2 , 7 , 8 , 13 );
+		QuarterRoundAvx2 ( x , 3 , 4 , 9 , 14 );
+	}
+
+	for ( int i = 0 ; i < 16 ; i++ )
+	{
+		x [ i ] = _mm256_add_epi32 ( x [ i ] , i == 12 ? counters : _mm256_set1_epi32 ( state [ i ] ) );
+	}
+
+	// within each 128-bit half as for SSE2: rows [ 4 * g + b ] hold words
+	// 4g .. 4g + 3 of block b below and of block b + 4 above
+	__m256i rows [ 16 ];
+	for ( int g = 0 ; g < 4 ; g++ )
+	{
+		__m256i t0 = _mm256_unpacklo_epi32 ( x [ 4 * g ] , x [ 4 * g + 1 ] );
+		__m256i t1 = _mm256_unpacklo_epi32 ( x [ 4 * g + 2 ] , x [ 4 * g + 3 ] );
+		__m256i t2 = _mm256_unpackhi_epi32 ( x [ 4 * g ] , x [ 4 * g + 1 ] );
+		__m256i t3 = _mm256_unpackhi_epi32 ( x [ 4 * g + 2 ] , x [ 4 * g + 3 ] );
+		rows [ 4 * g ] = _mm256_unpacklo_epi64 ( t0 , t1 );
+		rows [ 4 * g + 1 ] = _mm256_unpackhi_epi64 ( t0 , t1 );
+		rows [ 4 * g + 2 ] = _mm256_unpacklo_epi64 ( t2 , t3 );
+		rows [ 4 * g + 3 ] = _mm256_unpackhi_epi64 ( t2 , t3 );
+	}
+
+	for ( int b = 0 ; b < 4 ; b++ )
+	{
+		keystream [ 2 * b ] = _mm256_permute2x128_si256 ( rows [ b ] , rows [ 4 + b ] , 0x20 );
+		keystream [ 2 * b + 1 ] = _mm256_permute2x128_si256 ( rows [ 8 + b ] , rows [ 12 + b ] , 0x20 );
+		keystream [ 8 + 2 * b ] = _mm256_permute2x128_si256 ( rows [ b ] , rows [ 4 + b ] , 0x31 );
+		keystream [ 8 + 2 * b + 1 ] = _mm256_permute2x128_si256 ( rows [ 8 + b ] , rows [ 12 + b ] , 0x31 );
+	}
+}
+
+/* One round on the row layout: a, b, c and d each hold a row of the state
+ * for two blocks, a block to a 128-bit half, so the lanes are the columns. */
+static inline __attribute__ (( target ( "avx2" ) , always_inline )) void RowQuarterRoundAvx2 ( __m256i *a , __m256i *b , __m256i *c , __m256i *d )
+{
+	*a = _mm256_add_epi32 ( *a , *b );
+	*d = RotlAvx2 ( _mm256_xor_si256 ( *d , *a ) , 16 );
+	*c = _mm256_add_epi32 ( *c , *d );
+	*b = RotlAvx2 ( _mm256_xor_si256 ( *b , *c ) , 12 );
+	*a = _mm256_add_epi32 ( *a , *b );
+	*d = RotlAvx2 ( _mm256_xor_si256 ( *d , *a ) , 8 );
+	*c = _mm256_add_epi32 ( *c , *d );
+	*b = RotlAvx2 ( _mm256_xor_si256 ( *b , *c ) , 7 );
+}
+
+/* The column round, then the diagonal one: the rows are turned so the
+ * diagonals line up as columns, and turned back after. */
+static inline __attribute__ (( target ( "avx2" ) , always_inline )) void RowDoubleRoundAvx2 ( __m256i *a , __m256i *b , __m256i *c , __m256i *d )
+{
+	RowQuarterRoundAvx2 ( a , b , c , d );
+	*b = _mm256_shuffle_epi32 ( *b , 0x39 );
+	*c = _mm256_shuffle_epi32 ( *c , 0x4e );
+	*d = _mm256_shuffle_epi32 ( *d , 0x93 );
+	RowQuarterRoundAvx2 ( a , b , c , d );
+	*b = _mm256_shuffle_epi32 ( *b , 0x93 );
+	*c = _mm256_shuffle_epi32 ( *c , 0x4e );
+	*d = _mm256_shuffle_epi32 ( *d , 0x39 );
+}
+
+/* Four blocks, 256 bytes of keystream, as two pairs on the row layout. Each
+ * pair is one chain of dependent instructions rather than eight independent
+ * ones, but it has a quarter of the work, so for the last few blocks of a
+ * datagram it takes about half the time of an eight-block pass. With
+ * numBlocks 2 only the first pair is worked: a short datagram's seal needs no
+ * more, and skipping the other takes about a third off it. */
+static inline __attribute__ (( target ( "avx2" ) , always_inline )) void ChaChaFourBlocksAvx2 ( const unsigned int *state , unsigned int counter , __m256i *keystream , int numBlocks )
+{
+	__m256i a0 = _mm256_broadcastsi128_si256 ( _mm_loadu_si128 ( ( const __m128i *) state ) );
+	__m256i b0 = _mm256_broadcastsi128_si256 ( _mm_loadu_si128 ( ( const __m128i *) ( state + 4 ) ) );
+	__m256i c0 = _mm256_broadcastsi128_si256 ( _mm_loadu_si128 ( ( const __m128i *) ( state + 8 ) ) );
+	__m256i d0 = _mm256_set_epi32 ( state [ 15 ] , state [ 14 ] , state [ 13 ] , counter + 1 , state [ 15 ] , state [ 14 ] , state [ 13 ] , counter );
+	__m256i d1 = _mm256_add_epi32 ( d0 , _mm256_set_epi32 ( 0 , 0 , 0 , 2 , 0 , 0 , 0 , 2 ) );
+	__m256i a1 = a0 , b1 = b0 , c1 = c0;
+	__m256i firstD = d0;
+
+	if ( numBlocks > 2 )
+	{
+		for ( int i = 0 ; i < CHACHA_DOUBLE_ROUNDS ; i++ )
+		{
+			RowDoubleRoundAvx2 ( &a0 , &b0 , &c0 , &d0 );
+			RowDoubleRoundAvx2 ( &a1 , &b1 , &c1 , &d1 );
+		}
+	}
+	else
+	{
+		for ( int i = 0 ; i < CHACHA_DOUBLE_ROUNDS ; i++ )
+		{
+			RowDoubleRoundAvx2 ( &a0 , &b0 , &c0 , &d0 );
+		}
+	}
+
+	__m256i firstA = _mm256_broadcastsi128_si256 ( _mm_loadu_si128 ( ( const __m128i *) state ) );
+	__m256i firstB = _mm256_broadcastsi128_si256 ( _mm_loadu_si128 ( ( const __m128i *) ( state + 4 ) ) );
+	__m256i firstC = _mm256_broadcastsi128_si256 ( _mm_loadu_si128 ( ( const __m128i *) ( state + 8 ) ) );
+	a0 = _mm256_add_epi32 ( a0 , firstA );
+	b0 = _mm256_add_epi32 ( b0 , firstB );
+	c0 = _mm256_add_epi32 ( c0 , firstC );
+	d0 = _mm256_add_epi32 ( d0 , firstD );
+	a1 = _mm256_add_epi32 ( a1 , firstA );
+	b1 = _mm256_add_epi32 ( b1 , firstB );
+	c1 = _mm256_add_epi32 ( c1 , firstC );
+	d1 = _mm256_add_epi32 ( d1 , _mm256_add_epi32 ( firstD , _mm256_set_epi32 ( 0 , 0 , 0 , 2 , 0 , 0 , 0 , 2 ) ) );
+
+	// a block's four rows are its 64 bytes in order: the low halves make one
+	// block and the high halves the next
+	keystream [ 0 ] = _mm256_permute2x128_si256 ( a0 , b0 , 0x20 );
+	keystream [ 1 ] = _mm256_permute2x128_si256 ( c0 , d0 , 0x20 );
+	keystream [ 2 ] = _mm256_permute2x128_si256 ( a0 , b0 , 0x31 );
+	keystream [ 3 ] = _mm256_permute2x128_si256 ( c0 , d0 , 0x31 );
+	keystream [ 4 ] = _mm256_permute2x128_si256 ( a1 , b1 , 0x20 );
+	keystream [ 5 ] = _mm256_permute2x128_si256 ( c1 , d1 , 0x20 );
+	keystream [ 6 ] = _mm256_permute2x128_si256 ( a1 , b1 , 0x31 );
+	keystream [ 7 ] = _mm256_permute2x128_si256 ( c1 , d1 , 0x31 );
+}
+
+/* Eight blocks per pass while more than four are left, then one four- or
+ * two-block pass for the rest; at chat sizes that last pass is usually the
+ * only one. */
+static __attribute__ (( target ( "avx2" ) )) void ChaChaAvx2 ( const unsigned int *state , unsigned char *firstBlock , const unsigned char *input , unsigned char *output , size_t length )
+{
+	unsigned int counter = state [ 12 ];
+	int numSkipped = firstBlock ? CHACHA_BLOCK_SIZE / 32 : 0; // keystream vectors the first pass keeps from the text
+	__m256i keystream [ 16 ];
+
+	while ( length + 32 * numSkipped > 0 )
+	{
+		size_t passBytes = length + 32 * numSkipped;
+		int numBlocks = passBytes > 4 * CHACHA_BLOCK_SIZE ? 8 : passBytes > 2 * CHACHA_BLOCK_SIZE ? 4 : 2;
+		if ( numBlocks == 8 )
+		{
+			ChaChaEightBlocksAvx2 ( state , counter , keystream );
+		}
+		else
+		{
+			ChaChaFourBlocksAvx2 ( state , counter , keystream , numBlocks );
+		}
+
+		if ( numSkipped > 0 )
+		{
+			memcpy ( firstBlock , keystream , CHACHA_BLOCK_SIZE );
+		}
+
+		size_t passLength = numBlocks * CHACHA_BLOCK_SIZE - 32 * numSkipped;
+		if ( length < passLength )
+		{
+			XorBytes ( output , input , ( const unsigned char *) ( keystream + numSkipped ) , length );
+			break;
+		}
+
+		for ( int i = numSkipped ; i < 2 * numBlocks ; i++ )
+		{
+			__m256i text = _mm256_loadu_si256 ( ( const __m256i *) ( input + 32 * ( i - numSkipped ) ) );
+			_mm256_storeu_si256 ( ( __m256i *) ( output + 32 * ( i - numSkipped ) ) , _mm256_xor_si256 ( text , keystream [ i ] ) );
+		}
+
+		counter += numBlocks;
+		input += passLength;
+		output += passLength;
+		length -= passLength;
+		numSkipped = 0;
+	}
+
+	CryptoWipe ( keystream , sizeof ( keystream ) );
+}
+
+#endif
+
+const CHACHA_KERNEL CHACHA_KERNELS [ CRYPTO_NUM_KERNELS ] = {
+	[ CRYPTO_KERNEL_PORTABLE ] = ChaChaPortable ,
+#ifdef CRYPTO_X86_KERNELS
+	[ CRYPTO_KERNEL_SSE2 ] = ChaChaSse2 ,
+	[ CRYPTO_KERNEL_AVX2 ] = ChaChaAvx2
+#endif
+};
+
+int cryptoKernel = CRYPTO_KERNEL_PORTABLE; // set before any thread starts
+
+int CryptoKernelSupported ( int kernel )
+{
+	if ( kernel < 0 || kernel >= CRYPTO_NUM_KERNELS || !CHACHA_KERNELS [ kernel ] )
+	{
+		return 0;
+	}
+
+#ifdef CRYPTO_X86_KERNELS
+	if ( kernel == CRYPTO_KERNEL_AVX2 )
+	{
+		__builtin_cpu_init ();
+		return __builtin_cpu_supports ( "avx2" );
+	}
+#endif
+
+	return 1; // SSE2 is part of x86-64
+}
+
+int CryptoUseKernel ( int kernel )
+{
+	if ( !CryptoKernelSupported ( kernel ) )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	cryptoKernel = kernel;
+	return SUCCESS_OP_CODE;
+}
+
+void CryptoInit ()
+{
+	for ( int kernel = CRYPTO_NUM_KERNELS - 1 ; kernel > CRYPTO_KERNEL_PORTABLE ; kernel-- )
+	{
+		if ( CryptoUseKernel ( kernel ) == SUCCESS_OP_CODE )
+		{
+			return;
+		}
+	}
+}
+
+int CryptoKernel ()
+{
+	return cryptoKernel;
+}
+
+const char *CryptoKernelName ( int kernel )
+{
+	return kernel >= 0 && kernel < CRYPTO_NUM_KERNELS ? CRYPTO_KERNEL_NAMES [ kernel ] : "unknown";
+}
+
+void ChaCha20Xor ( const unsigned char *key , const unsigned char *nonce , unsigned int counter , const unsigned char *input , unsigned char *output , size_t length )
+{
+	unsigned int state [ 16 ];
+	ChaChaSetup ( state , key , nonce , counter );
+	CHACHA_KERNELS [ cryptoKernel ] ( state , NULL , input , output , length );
+	CryptoWipe ( state , sizeof ( state ) );
+}
+
+/*
+ * POLY1305
+ */
+
+static void Poly1305Init ( POLY1305_STATE *poly , const unsigned char *key )
+{
+	unsigned long long t0 = Load64 ( key );
+	unsigned long long t1 = Load64 ( key + 8 );
+
+	// r is clamped as the RFC asks, then split into limbs
+	poly -> r [ 0 ] = t0 & 0xffc0fffffffULL;
+	poly -> r [ 1 ] = ( ( t0 >> 44 ) | ( t1 << 20 ) ) & 0xfffffc0ffffULL;
+	poly -> r [ 2 ] = ( t1 >> 24 ) & 0x00ffffffc0fULL;
+
+	poly -> h [ 0 ] = 0;
+	poly -> h [ 1 ] = 0;
+	poly -> h [ 2 ] = 0;
+
+	poly -> pad [ 0 ] = Load64 ( key + 16 );
+	poly -> pad [ 1 ] = Load64 ( key + 24 );
+	poly -> bufferLength = 0;
+}
+
+#ifdef CRYPTO_X86_KERNELS
+
+/* The AVX2 kernel runs four blocks side by side in 26-bit limbs, one block to
+ * a 64-bit lane, so that _mm256_mul_epu32 multiplies all four lanes' limbs at
+ * once. Every lane steps by r^4; at the end lane j is multiplied by r^(4 - j)
+ * and the lanes are added, which gives the same sum as one block at a time. */
+
+/* h = h * r mod 2^130 - 5, in 44-bit limbs, for the powers of r */
+static void Poly1305Multiply ( unsigned long long *h , const unsigned long long *r )
+{
+	unsigned long long s1 = r [ 1 ] * ( 5 << 2 );
+	unsigned long long s2 = r [ 2 ] * ( 5 << 2 );
+
+	UINT128 d0 = ( UINT128 ) h [ 0 ] * r [ 0 ] + ( UINT128 ) h [ 1 ] * s2 + ( UINT128 ) h [ 2 ] * s1;
+	UINT128 d1 = ( UINT128 ) h [ 0 ] * r [ 1 ] + ( UINT128 ) h [ 1 ] * r [ 0 ] + ( UINT128 ) h [ 2 ] * s2;
+	UINT128 d2 = ( UINT128 ) h [ 0 ] * r [ 2 ] + ( UINT128 ) h [ 1 ] * r [ 1 ] + ( UINT128 ) h [ 2 ] * r [ 0 ];
+
+	unsigned long long carry = ( unsigned long long ) ( d0 >> 44 );
+	h [ 0 ] = ( unsigned long long ) d0 & POLY1305_MASK_44;
+	d1 += carry;
+	carry = ( unsigned long long ) ( d1 >> 44 );
+	h [ 1 ] = ( unsigned long long ) d1 & POLY1305_MASK_44;
+	d2 += carry;
+	carry = ( unsigned long long ) ( d2 >> 42 );
+	h [ 2 ] = ( unsigned long long ) d2 & POLY1305_MASK_42;
+	h [ 0 ] += carry * 5;
+	carry = h [ 0 ] >> 44;
+	h [ 0 ] &= POLY1305_MASK_44;
+	h [ 1 ] += carry;
+}
+
+/* 44/44/42-bit limbs to five 26-bit ones */
+static void Poly1305SplitLimbs ( unsigned int *limbs , const unsigned long long *h )
+{
+	unsigned long long h0 = h [ 0 ] , h1 = h [ 1 ] , h2 = h [ 2 ];
+	unsigned long long carry = h0 >> 44;
+	h0 &= POLY1305_MASK_44;
+	h1 += carry;
+	carry = h1 >> 44;
+	h1 &= POLY1305_MASK_44;
+	h2 += carry;
+
+	limbs [ 0 ] = h0 & POLY1305_MASK_26;
+	limbs [ 1 ] = ( ( h0 >> 26 ) | ( h1 << 18 ) ) & POLY1305_MASK_26;
+	limbs [ 2 ] = ( h1 >> 8 ) & POLY1305_MASK_26;
+	limbs [ 3 ] = ( ( h1 >> 34 ) | ( h2 << 10 ) ) & POLY1305_MASK_26;
+	limbs [ 4 ] = h2 >> 16;
+}
+
+/* five 26-bit limbs, a little over after adding the lanes, back to 44/44/42 */
+static void Poly1305JoinLimbs ( unsigned long long *h , const unsigned long long *limbs )
+{
+	unsigned long long h0 = limbs [ 0 ] + ( limbs [ 1 ] << 26 );
+	unsigned long long carry = h0 >> 44;
+	h0 &= POLY1305_MASK_44;
+	unsigned long long h1 = carry + ( limbs [ 2 ] << 8 ) + ( limbs [ 3 ] << 34 );
+	carry = h1 >> 44;
+	h1 &= POLY1305_MASK_44;
+	unsigned long long h2 = carry + ( limbs [ 4 ] << 16 );
+	carry = h2 >> 42;
+	h2 &= POLY1305_MASK_42;
+	h0 += carry * 5;
+	carry = h0 >> 44;
+	h0 &= POLY1305_MASK_44;
+	h1 += carry;
+
+	h [ 0 ] = h0;
+	h [ 1 ] = h1;
+	h [ 2 ] = h2;
+}
+
+/* four 16-byte blocks, each with its 2^128, to 26-bit limbs: m [ i ] holds
+ * limb i of block j in lane j */
+static inline __attribute__ (( target ( "avx2" ) , always_inline )) void Poly1305LoadAvx2 ( __m256i *m , const unsigned char *message )
+{
+	const __m256i mask = _mm256_set1_epi64x ( POLY1305_MASK_26 );
+	__m256i a = _mm256_loadu_si256 ( ( const __m256i *) message );
+	__m256i b = _mm256_loadu_si256 ( ( const __m256i *) ( message + 32 ) );
+	__m256i low = _mm256_permute4x64_epi64 ( _mm256_unpacklo_epi64 ( a , b ) , 0xd8 );
+	__m256i high = _mm256_permute4x64_epi64 ( _mm256_unpackhi_epi64 ( a , b ) , 0xd8 );
+
+	m [ 0 ] = _mm256_and_si256 ( low , mask );
+	m [ 1 ] = _mm256_and_si256 ( _mm256_srli_epi64 ( low , 26 ) , mask );
+	m [ 2 ] = _mm256_and_si256 ( _mm256_or_si256 ( _mm256_srli_epi64 ( low , 52 ) , _mm256_slli_epi64 ( high , 12 ) ) , mask );
+	m [ 3 ] = _mm256_and_si256 ( _mm256_srli_epi64 ( high , 14 ) , mask );
+	m [ 4 ] = _mm256_or_si256 ( _mm256_srli_epi64 ( high , 40 ) , _mm256_set1_epi64x ( 1 << 24 ) );
+}
+
+static inline __attribute__ (( target ( "avx2" ) , always_inline )) __m256i MultiplyAddAvx2 ( __m256i sum , __m256i a , __m256i b )
+{
+	return _mm256_add_epi64 ( sum , _mm256_mul_epu32 ( a , b ) );
+}
+
+/* h = h * r, lane by lane, with s [ i ] = 5 * r [ i ]: limb i times limb j
+ * lands on limb i + j, wrapping past limb 4 times 5. The limbs come back
+ * carried to 26 bits, limbs 1 and 4 a little over. */
+static inline __attribute__ (( target ( "avx2" ) , always_inline )) void Poly1305MultiplyAvx2 ( __m256i *h , const __m256i *r , const __m256i *s )
+{
+	__m256i d0 = _mm256_mul_epu32 ( h [ 0 ] , r [ 0 ] );
+	d0 = MultiplyAddAvx2 ( d0 , h [ 1 ] , s [ 4 ] );
+	d0 = MultiplyAddAvx2 ( d0 , h [ 2 ] , s [ 3 ] );
+	d0 = MultiplyAddAvx2 ( d0 , h [ 3 ] , s [ 2 ] );
+	d0 = MultiplyAddAvx2 ( d0 , h [ 4 ] , s [ 1 ] );
+
+	__m256i d1 = _mm256_mul_epu32 ( h [ 0 ] , r [ 1 ] );
+	d1 = MultiplyAddAvx2 ( d1 , h [ 1 ] , r [ 0 ] );
+	d1 = MultiplyAddAvx2 ( d1 , h [ 2 ] , s [ 4 ] );
+	d1 = MultiplyAddAvx2 ( d1 , h [ 3 ] , s [ 3 ] );
+	d1 = MultiplyAddAvx2 ( d1 , h [ 4 ] , s [ 2 ] );
+
+	__m256i d2 = _mm256_mul_epu32 ( h [ 0 ] , r [ 2 ] );
+	d2 = MultiplyAddAvx2 ( d2 , h [ 1 ] , r [ 1 ] );
+	d2 = MultiplyAddAvx2 ( d2 , h [ 2 ] , r [ 0 ] );
+	d2 = MultiplyAddAvx2 ( d2 , h [ 3 ] , s [ 4 ] );
+	d2 = MultiplyAddAvx2 ( d2 , h [ 4 ] , s [ 3 ] );
+
+	__m256i d3 = _mm256_mul_epu32 ( h [ 0 ] , r [ 3 ] );
+	d3 = MultiplyAddAvx2 ( d3 , h [ 1 ] , r [ 2 ] );
+	d3 = MultiplyAddAvx2 ( d3 , h [ 2 ] , r [ 1 ] );
+	d3 = MultiplyAddAvx2 ( d3 , h [ 3 ] , r [ 0 ] );
+	d3 = MultiplyAddAvx2 ( d3 , h [ 4 ] , s [ 4 ] );
+
+	__m256i d4 = _mm256_mul_epu32 ( h [ 0 ] , r [ 4 ] );
+	d4 = MultiplyAddAvx2 ( d4 , h [ 1 ] , r [ 3 ] );
+	d4 = MultiplyAddAvx2 ( d4 , h [ 2 ] , r [ 2 ] );
+	d4 = MultiplyAddAvx2 ( d4 , h [ 3 ] , r [ 1 ] );
+	d4 = MultiplyAddAvx2 ( d4 , h [ 4 ] , r [ 0 ] );
+
+	// two carry chains at once, 0 to 1 to 2 to 3 and 3 to 4 to 0 to 1, so the
+	// next block waits on half as many steps
+	const __m256i mask = _mm256_set1_epi64x ( POLY1305_MASK_26 );
+	__m256i lowCarry = _mm256_srli_epi64 ( d0 , 26 );
+	__m256i highCarry = _mm256_srli_epi64 ( d3 , 26 );
+	d0 = _mm256_and_si256 ( d0 , mask );
+	d3 = _mm256_and_si256 ( d3 , mask );
+	d1 = _mm256_add_epi64 ( d1 , lowCarry );
+	d4 = _mm256_add_epi64 ( d4 , highCarry );
+
+	lowCarry = _mm256_srli_epi64 ( d1 , 26 );
+	highCarry = _mm256_srli_epi64 ( d4 , 26 );
+	d1 = _mm256_and_si256 ( d1 , mask );
+	d4 = _mm256_and_si256 ( d4 , mask );
+	d2 = _mm256_add_epi64 ( d2 , lowCarry );
+	d0 = _mm256_add_epi64 ( d0 , _mm256_add_epi64 ( highCarry , _mm256_slli_epi64 ( highCarry , 2 ) ) );
+
+	lowCarry = _mm256_srli_epi64 ( d2 , 26 );
+	highCarry = _mm256_srli_epi64 ( d0 , 26 );
+	d2 = _mm256_and_si256 ( d2 , mask );
+	d0 = _mm256_and_si256 ( d0 , mask );
+	d3 = _mm256_add_epi64 ( d3 , lowCarry );
+	d1 = _mm256_add_epi64 ( d1 , highCarry );
+
+	lowCarry = _mm256_srli_epi64 ( d3 , 26 );
+	d3 = _mm256_and_si256 ( d3 , mask );
+	d4 = _mm256_add_epi64 ( d4 , lowCarry );
+
+	h [ 0 ] = d0;
+	h [ 1 ] = d1;
+	h [ 2 ] = d2;
+	h [ 3 ] = d3;
+	h [ 4 ] = d4;
+}
+
+static __attribute__ (( target ( "avx2" ) )) void Poly1305BlocksAvx2 ( POLY1305_STATE *poly , const unsigned char *message , size_t numGroups )
+{
+	// powers [ i ] = r^(i + 1)
+	unsigned long long powers [ 4 ][ 3 ];
+	unsigned int powerLimbs [ 4 ][ 5 ];
+	memcpy ( powers [ 0 ] , poly -> r , sizeof ( powers [ 0 ] ) );
+	for ( int i = 1 ; i < 4 ; i++ )
+	{
+		memcpy ( powers [ i ] , powers [ i - 1 ] , sizeof ( powers [ i ] ) );
+		Poly1305Multiply ( powers [ i ] , poly -> r );
+	}
+	for ( int i = 0 ; i < 4 ; i++ )
+	{
+		Poly1305SplitLimbs ( powerLimbs [ i ] , powers [ i ] );
+	}
+
+	// the running sum so far joins the first block, in lane 0. All the scalar
+	// work comes before the first vector: calling out to code without AVX
+	// while the vector registers' upper halves are in use stalls some CPUs
+	unsigned int startLimbs [ 5 ];
+	Poly1305SplitLimbs ( startLimbs , poly -> h );
+
+	__m256i stepR [ 5 ] , stepS [ 5 ] , lastR [ 5 ] , lastS [ 5 ];
+	for ( int i = 0 ; i < 5 ; i++ )
+	{
+		stepR [ i ] = _mm256_set1_epi64x ( powerLimbs [ 3 ][ i ] );
+		stepS [ i ] = _mm256_set1_epi64x ( powerLimbs [ 3 ][ i ] * 5ULL );
+		lastR [ i ] = _mm256_set_epi64x ( powerLimbs [ 0 ][ i ] , powerLimbs [ 1 ][ i ] , powerLimbs [ 2 ][ i ] , powerLimbs [ 3 ][ i ] );
+		lastS [ i ] = _mm256_set_epi64x ( powerLimbs [ 0 ][ i ] * 5ULL , powerLimbs [ 1 ][ i ] * 5ULL , powerLimbs [ 2 ][ i ] * 5ULL , powerLimbs [ 3 ][ i ] * 5ULL );
+	}
+
+	__m256i h [ 5 ];
+	Poly1305LoadAvx2 ( h , message );
+	h [ 0 ] = _mm256_add_epi64 ( h [ 0 ] , _mm256_set_epi64x ( 0 , 0 , 0 , startLimbs [ 0 ] ) );
+	h [ 1 ] = _mm256_add_epi64 ( h [ 1 ] , _mm256_set_epi64x ( 0 , 0 , 0 , startLimbs [ 1 ] ) );
+	h [ 2 ] = _mm256_add_epi64 ( h [ 2 ] , _mm256_set_epi64x ( 0 , 0 , 0 , startLimbs [ 2 ] ) );
+	h [ 3 ] = _mm256_add_epi64 ( h [ 3 ] , _mm256_set_epi64x ( 0 , 0 , 0 , startLimbs [ 3 ] ) );
+	h [ 4 ] = _mm256_add_epi64 ( h [ 4 ] , _mm256_set_epi64x ( 0 , 0 , 0 , startLimbs [ 4 ] ) );
+
+	for ( size_t g = 1 ; g < numGroups ; g++ )
+	{
+		__m256i m [ 5 ];
+		Poly1305MultiplyAvx2 ( h , stepR , stepS );
+		Poly1305LoadAvx2 ( m , message + 64 * g );
+		h [ 0 ] = _mm256_add_epi64 ( h [ 0 ] , m [ 0 ] );
+		h [ 1 ] = _mm256_add_epi64 ( h [ 1 ] , m [ 1 ] );
+		h [ 2 ] = _mm256_add_epi64 ( h [ 2 ] , m [ 2 ] );
+		h [ 3 ] = _mm256_add_epi64 ( h [ 3 ] , m [ 3 ] );
+		h [ 4 ] = _mm256_add_epi64 ( h [ 4 ] , m [ 4 ] );
+	}
+
+	Poly1305MultiplyAvx2 ( h , lastR , lastS );
+
+	unsigned long long sums [ 5 ];
+	for ( int i = 0 ; i < 5 ; i++ )
+	{
+		__m128i pair = _mm_add_epi64 ( _mm256_castsi256_si128 ( h [ i ] ) , _mm256_extracti128_si256 ( h [ i ] , 1 ) );
+		sums [ i ] = ( unsigned long long ) _mm_cvtsi128_si64 ( pair ) + ( unsigned long long ) _mm_extract_epi64 ( pair , 1 );
+	}
+	Poly1305JoinLimbs ( poly -> h , sums );
+
+	CryptoWipe ( powers , sizeof ( powers ) );
+	CryptoWipe ( powerLimbs , sizeof ( powerLimbs ) );
+}
+
+#endif
+
+/* h = ( h + block ) * r mod 2^130 - 5 for each whole 16-byte block; highBit is
+ * the 2^128 every full block carries. */
+static void Poly1305Blocks ( POLY1305_STATE *poly , const unsigned char *message , size_t length , unsigned long long highBit )
+{
+#ifdef CRYPTO_X86_KERNELS
+	if ( cryptoKernel == CRYPTO_KERNEL_AVX2 && highBit && length >= POLY1305_AVX2_MIN_SIZE )
+	{
+		size_t vectorLength = length & ~( size_t ) 63;
+		Poly1305BlocksAvx2 ( poly , message , vectorLength / 64 );
+		message += vectorLength;
+		length -= vectorLength;
+	}
+#endif
+
+	unsigned long long r0 = poly -> r [ 0 ] , r1 = poly -> r [ 1 ] , r2 = poly -> r [ 2 ];
+	unsigned long long s1 = r1 * ( 5 << 2 );
+	unsigned long long s2 = r2 * ( 5 << 2 );
+	unsigned long long h0 = poly -> h [ 0 ] , h1 = poly -> h [ 1 ] , h2 = poly -> h [ 2 ];
+
+	while ( length >= 16 )
+	{
+		unsigned long long t0 = Load64 ( message );
+		unsigned long long t1 = Load64 ( message + 8 );
+
+		h0 += t0 & POLY1305_MASK_44;
+		h1 += ( ( t0 >> 44 ) | ( t1 << 20 ) ) & POLY1305_MASK_44;
+		h2 += ( ( t1 >> 24 ) & POLY1305_MASK_42 ) | highBit;
+
+		UINT128 d0 = ( UINT128 ) h0 * r0 + ( UINT128 ) h1 * s2 + ( UINT128 ) h2 * s1;
+		UINT128 d1 = ( UINT128 ) h0 * r1 + ( UINT128 ) h1 * r0 + ( UINT128 ) h2 * s2;
+		UINT128 d2 = ( UINT128 ) h0 * r2 + ( UINT128 ) h1 * r1 + ( UINT128 ) h2 * r0;
+
+		unsigned long long carry = ( unsigned long long ) ( d0 >> 44 );
+		h0 = ( unsigned long long ) d0 & POLY1305_MASK_44;
+		d1 += carry;
+		carry = ( unsigned long long ) ( d1 >> 44 );
+		h1 = ( unsigned long long ) d1 & POLY1305_MASK_44;
+		d2 += carry;
+		carry = ( unsigned long long ) ( d2 >> 42 );
+		h2 = ( unsigned long long ) d2 & POLY1305_MASK_42;
+		h0 += carry * 5;
+		carry = h0 >> 44;
+		h0 &= POLY1305_MASK_44;
+		h1 += carry;
+
+		message += 16;
+		length -= 16;
+	}
+
+	poly -> h [ 0 ] = h0;
+	poly -> h [ 1 ] = h1;
+	poly -> h [ 2 ] = h2;
+}
+
+static void Poly1305Update ( POLY1305_STATE *poly , const unsigned char *message , size_t length )
+{
+	if ( poly -> bufferLength > 0 )
+	{
+		size_t numTaken = 16 - poly -> bufferLength < length ? 16 - poly -> bufferLength : length;
+		memcpy ( poly -> buffer + poly -> bufferLength , message , numTaken );
+		poly -> bufferLength += numTaken;
+		message += numTaken;
+		length -= numTaken;
+
+		if ( poly -> bufferLength < 16 )
+		{
+			return;
+		}
+
+		Poly1305Blocks ( poly , poly -> buffer , 16 , 1ULL << 40 );
+		poly -> bufferLength = 0;
+	}
+
+	size_t wholeLength = length & ~( size_t ) 15;
+	Poly1305Blocks ( poly , message , wholeLength , 1ULL << 40 );
+
+	memcpy ( poly -> buffer , message + wholeLength , length - wholeLength );
+	poly -> bufferLength = length - wholeLength;
+}
+
+static void Poly1305Final ( POLY1305_STATE *poly , unsigned char *tag )
+{
+	// a last partial block gets its 1 right after it instead of at 2^128
+	if ( poly -> bufferLength > 0 )
+	{
+		poly -> buffer [ poly -> bufferLength ] = 1;
+		memset ( poly -> buffer + poly -> bufferLength + 1 , 0 , 15 - poly -> bufferLength );
+		Poly1305Blocks ( poly , poly -> buffer , 16 , 0 );
+	}
+
+	unsigned long long h0 = poly -> h [ 0 ] , h1 = poly -> h [ 1 ] , h2 = poly -> h [ 2 ];
+
+	unsigned long long carry = h1 >> 44;
+	h1 &= POLY1305_MASK_44;
+	h2 += carry;
+	carry = h2 >> 42;
+	h2 &= POLY1305_MASK_42;
+	h0 += carry * 5;
+	carry = h0 >> 44;
+	h0 &= POLY1305_MASK_44;
+	h1 += carry;
+	carry = h1 >> 44;
+	h1 &= POLY1305_MASK_44;
+	h2 += carry;
+	carry = h2 >> 42;
+	h2 &= POLY1305_MASK_42;
+	h0 += carry * 5;
+	carry = h0 >> 44;
+	h0 &= POLY1305_MASK_44;
+	h1 += carry;
+
+	// h - p, kept instead of h when it does not go negative
+	unsigned long long g0 = h0 + 5;
+	carry = g0 >> 44;
+	g0 &= POLY1305_MASK_44;
+	unsigned long long g1 = h1 + carry;
+	carry = g1 >> 44;
+	g1 &= POLY1305_MASK_44;
+	unsigned long long g2 = h2 + carry - ( 1ULL << 42 );
+
+	unsigned long long keepG = ( g2 >> 63 ) - 1;
+	h0 = ( h0 & ~keepG ) | ( g0 & keepG );
+	h1 = ( h1 & ~keepG ) | ( g1 & keepG );
+	h2 = ( h2 & ~keepG ) | ( g2 & keepG );
+
+	// tag = ( h + s ) mod 2^128
+	unsigned long long t0 = poly -> pad [ 0 ];
+	unsigned long long t1 = poly -> pad [ 1 ];
+
+	h0 += t0 & POLY1305_MASK_44;
+	carry = h0 >> 44;
+	h0 &= POLY1305_MASK_44;
+	h1 += ( ( ( t0 >> 44 ) | ( t1 << 20 ) ) & POLY1305_MASK_44 ) + carry;
+	carry = h1 >> 44;
+	h1 &= POLY1305_MASK_44;
+	h2 += ( ( t1 >> 24 ) & POLY1305_MASK_42 ) + carry;
+	h2 &= POLY1305_MASK_42;
+
+	Store64 ( tag , h0 | ( h1 << 44 ) );
+	Store64 ( tag + 8 , ( h1 >> 20 ) | ( h2 << 24 ) );
+
+	CryptoWipe ( poly , sizeof ( POLY1305_STATE ) );
+}
+
+void Poly1305 ( unsigned char *tag , const unsigned char *key , const unsigned char *message , size_t length )
+{
+	POLY1305_STATE poly;
+	Poly1305Init ( &poly , key );
+	Poly1305Update ( &poly , message , length );
+	Poly1305Final ( &poly , tag );
+}
+
+/*
+ * CHACHA20-POLY1305
+ */
+
+/* MACs data zero-padded to whole blocks, straight from where it lies but for
+ * the last partial block. */
+static void Poly1305Padded ( POLY1305_STATE *poly , const unsigned char *data , size_t length )
+{
+	size_t wholeLength = length & ~( size_t ) 15;
+	Poly1305Blocks ( poly , data , wholeLength , 1ULL << 40 );
+
+	if ( length > wholeLength )
+	{
+		unsigned char block [ 16 ] = { 0 };
+		memcpy ( block , data + wholeLength , length - wholeLength );
+		Poly1305Blocks ( poly , block , 16 , 1ULL << 40 );
+	}
+}
+
+/* The AEAD's MAC: the additional data and the ciphertext, each padded to 16
+ * bytes, then both lengths. */
+static void AeadTag ( unsigned char *tag , const unsigned char *polyKey , const unsigned char *aad , size_t aadLength , const unsigned char *text , size_t length )
+{
+	unsigned char lengths [ 16 ];
+	Store64 ( lengths , aadLength );
+	Store64 ( lengths + 8 , length );
+
+	POLY1305_STATE poly;
+	Poly1305Init ( &poly , polyKey );
+	Poly1305Padded ( &poly , aad , aadLength );
+	Poly1305Padded ( &poly , text , length );
+	Poly1305Padded ( &poly , lengths , sizeof ( lengths ) );
+	Poly1305Final ( &poly , tag );
+}
+
+/* Encrypts text in place and writes its tag. Poly1305's key is block 0 of the
+ * keystream and the text starts at block 1, so one kernel call makes both. */
+void CryptoAeadSeal ( const unsigned char *key , const unsigned char *nonce , const unsigned char *aad , size_t aadLength , unsigned char *text , size_t length , unsigned char *tag )
+{
+	unsigned int state [ 16 ];
+	unsigned char polyKey [ CHACHA_BLOCK_SIZE ];
+	ChaChaSetup ( state , key , nonce , 0 );
+	CHACHA_KERNELS [ cryptoKernel ] ( state , polyKey , text , text , length );
+	AeadTag ( tag , polyKey , aad , aadLength , text , length );
+
+	CryptoWipe ( state , sizeof ( state ) );
+	CryptoWipe ( polyKey , sizeof ( polyKey ) );
+}
+
+/* Checks the tag, then decrypts text in place; text is left as it was if the
+ * tag is wrong. The pass that makes Poly1305's key also makes the keystream
+ * for the first AEAD_AHEAD_SIZE bytes of text, held back until the tag is
+ * checked. */
+int CryptoAeadOpen ( const unsigned char *key , const unsigned char *nonce , const unsigned char *aad , size_t aadLength , unsigned char *text , size_t length , const unsigned char *tag )
+{
+	static const unsigned char zeros [ AEAD_AHEAD_SIZE ] = { 0 };
+	unsigned int state [ 16 ];
+	unsigned char polyKey [ CHACHA_BLOCK_SIZE ];
+	unsigned char keystream [ AEAD_AHEAD_SIZE ];
+	unsigned char expectedTag [ CRYPTO_TAG_SIZE ];
+	size_t numAhead = length < AEAD_AHEAD_SIZE ? length : AEAD_AHEAD_SIZE;
+	ChaChaSetup ( state , key , nonce , 0 );
+	CHACHA_KERNELS [ cryptoKernel ] ( state , polyKey , zeros , keystream , numAhead );
+	AeadTag ( expectedTag , polyKey , aad , aadLength , text , length );
+
+	int authentic = CryptoEqual ( expectedTag , tag , CRYPTO_TAG_SIZE );
+	if ( authentic )
+	{
+		XorBytes ( text , text , keystream , numAhead );
+		if ( length > numAhead )
+		{
+			state [ 12 ] = 1 + AEAD_AHEAD_SIZE / CHACHA_BLOCK_SIZE;
+			CHACHA_KERNELS [ cryptoKernel ] ( state , NULL , text + numAhead , text + numAhead , length - numAhead );
+		}
+	}
+
+	CryptoWipe ( state , sizeof ( state ) );
+	CryptoWipe ( polyKey , sizeof ( polyKey ) );
+	CryptoWipe ( keystream , numAhead );
+	return authentic ? SUCCESS_OP_CODE : FAILURE_OP_CODE;
+}
+
+/*
+ * X25519
+ */
+
+static void FeFromBytes ( FIELD_ELEMENT h , const unsigned char *s )
+{
+	unsigned long long w0 = Load64 ( s );
+	unsigned long long w1 = Load64 ( s + 8 );
+	unsigned long long w2 = Load64 ( s + 16 );
+	unsigned long long w3 = Load64 ( s + 24 );
+
+	// the top bit is ignored, as RFC 7748 asks of u-coordinates
+	h [ 0 ] = w0 & FIELD_MASK_51;
+	h [ 1 ] = ( ( w0 >> 51 ) | ( w1 << 13 ) ) & FIELD_MASK_51;
+	h [ 2 ] = ( ( w1 >> 38 ) | ( w2 << 26 ) ) & FIELD_MASK_51;
+	h [ 3 ] = ( ( w2 >> 25 ) | ( w3 << 39 ) ) & FIELD_MASK_51;
+	h [ 4 ] = ( w3 >> 12 ) & FIELD_MASK_51;
+}
+
+static void FeCarry ( FIELD_ELEMENT h )
+{
+	unsigned long long carry;
+	carry = h [ 0 ] >> 51; h [ 0 ] &= FIELD_MASK_51; h [ 1 ] += carry;
+	carry = h [ 1 ] >> 51; h [ 1 ] &= FIELD_MASK_51; h [ 2 ] += carry;
+	carry = h [ 2 ] >> 51; h [ 2 ] &= FIELD_MASK_51; h [ 3 ] += carry;
+	carry = h [ 3 ] >> 51; h [ 3 ] &= FIELD_MASK_51; h [ 4 ] += carry;
+	carry = h [ 4 ] >> 51; h [ 4 ] &= FIELD_MASK_51; h [ 0 ] += carry * 19;
+}
+
+/* The one representation of h below p, as 32 little-endian bytes. */
+static void FeToBytes ( unsigned char *s , const FIELD_ELEMENT f )
+{
+	FIELD_ELEMENT h;
+	memcpy ( h , f , sizeof ( FIELD_ELEMENT ) );
+	FeCarry ( h );
+	FeCarry ( h );
+
+	// h < 2^255 + a little now; q is 1 if h >= p
+	unsigned long long q = ( h [ 0 ] + 19 ) >> 51;
+	q = ( h [ 1 ] + q ) >> 51;
+	q = ( h [ 2 ] + q ) >> 51;
+	q = ( h [ 3 ] + q ) >> 51;
+	q = ( h [ 4 ] + q ) >> 51;
+
+	h [ 0 ] += 19 * q;
+	unsigned long long carry;
+	carry = h [ 0 ] >> 51; h [ 0 ] &= FIELD_MASK_51; h [ 1 ] += carry;
+	carry = h [ 1 ] >> 51; h [ 1 ] &= FIELD_MASK_51; h [ 2 ] += carry;
+	carry = h [ 2 ] >> 51; h [ 2 ] &= FIELD_MASK_51; h [ 3 ] += carry;
+	carry = h [ 3 ] >> 51; h [ 3 ] &= FIELD_MASK_51; h [ 4 ] += carry;
+	h [ 4 ] &= FIELD_MASK_51;
+
+	Store64 ( s , h [ 0 ] | ( h [ 1 ] << 51 ) );
+	Store64 ( s + 8 , ( h [ 1 ] >> 13 ) | ( h [ 2 ] << 38 ) );
+	Store64 ( s + 16 , ( h [ 2 ] >> 26 ) | ( h [ 3 ] << 25 ) );
+	Store64 ( s + 24 , ( h [ 3 ] >> 39 ) | ( h [ 4 ] << 12 ) );
+}
+
+static inline void FeAdd ( FIELD_ELEMENT h , const FIELD_ELEMENT f , const FIELD_ELEMENT g )
+{
+	for ( int i = 0 ; i < 5 ; i++ )
+	{
+		h [ i ] = f [ i ] + g [ i ];
+	}
+}
+
+/* f - g, with 2p added so no limb goes negative */
+static inline void FeSub ( FIELD_ELEMENT h , const FIELD_ELEMENT f , const FIELD_ELEMENT g )
+{
+	h [ 0 ] = f [ 0 ] + 0xfffffffffffdaULL - g [ 0 ];
+	for ( int i = 1 ; i < 5 ; i++ )
+	{
+		h [ i ] = f [ i ] + 0xffffffffffffeULL - g [ i ];
+	}
+	FeCarry ( h );
+}
+
+static void FeMul ( FIELD_ELEMENT h , const FIELD_ELEMENT f , const FIELD_ELEMENT g )
+{
+	unsigned long long f0 = f [ 0 ] , f1 = f [ 1 ] , f2 = f [ 2 ] , f3 = f [ 3 ] , f4 = f [ 4 ];
+	unsigned long long g0 = g [ 0 ] , g1 = g [ 1 ] , g2 = g [ 2 ] , g3 = g [ 3 ] , g4 = g [ 4 ];
+	unsigned long long g1x19 = g1 * 19 , g2x19 = g2 * 19 , g3x19 = g3 * 19 , g4x19 = g4 * 19;
+
+	// 2^255 = 19 mod p, so the parts past the fifth limb fold back in times 19
+	UINT128 r0 = ( UINT128 ) f0 * g0 + ( UINT128 ) f1 * g4x19 + ( UINT128 ) f2 * g3x19 + ( UINT128 ) f3 * g2x19 + ( UINT128 ) f4 * g1x19;
+	UINT128 r1 = ( UINT128 ) f0 * g1 + ( UINT128 ) f1 * g0 + ( UINT128 ) f2 * g4x19 + ( UINT128 ) f3 * g3x19 + ( UINT128 ) f4 * g2x19;
+	UINT128 r2 = ( UINT128 ) f0 * g2 + ( UINT128 ) f1 * g1 + ( UINT128 ) f2 * g0 + ( UINT128 ) f3 * g4x19 + ( UINT128 ) f4 * g3x19;
+	UINT128 r3 = ( UINT128 ) f0 * g3 + ( UINT128 ) f1 * g2 + ( UINT128 ) f2 * g1 + ( UINT128 ) f3 * g0 + ( UINT128 ) f4 * g4x19;
+	UINT128 r4 = ( UINT128 ) f0 * g4 + ( UINT128 ) f1 * g3 + ( UINT128 ) f2 * g2 + ( UINT128 ) f3 * g1 + ( UINT128 ) f4 * g0;
+
+	r1 += ( unsigned long long ) ( r0 >> 51 );
+	r2 += ( unsigned long long ) ( r1 >> 51 );
+	r3 += ( unsigned long long ) ( r2 >> 51 );
+	r4 += ( unsigned long long ) ( r3 >> 51 );
+
+	h [ 0 ] = ( ( unsigned long long ) r0 & FIELD_MASK_51 ) + ( unsigned long long ) ( r4 >> 51 ) * 19;
+	h [ 1 ] = ( unsigned long long ) r1 & FIELD_MASK_51;
+	h [ 2 ] = ( unsigned long long ) r2 & FIELD_MASK_51;
+	h [ 3 ] = ( unsigned long long ) r3 & FIELD_MASK_51;
+	h [ 4 ] = ( unsigned long long ) r4 & FIELD_MASK_51;
+
+	h [ 1 ] += h [ 0 ] >> 51;
+	h [ 0 ] &= FIELD_MASK_51;
+}
+
+static void FeSquare ( FIELD_ELEMENT h , const FIELD_ELEMENT f )
+{
+	FeMul ( h , f , f );
+}
+
+static void FeMulSmall ( FIELD_ELEMENT h , const FIELD_ELEMENT f , unsigned long long n )
+{
+	UINT128 r [ 5 ];
+	for ( int i = 0 ; i < 5 ; i++ )
+	{
+		r [ i ] = ( UINT128 ) f [ i ] * n;
+	}
+
+	for ( int i = 0 ; i < 4 ; i++ )
+	{
+		r [ i + 1 ] += ( unsigned long long ) ( r [ i ] >> 51 );
+		h [ i ] = ( unsigned long long ) r [ i ] & FIELD_MASK_51;
+	}
+	h [ 4 ] = ( unsigned long long ) r [ 4 ] & FIELD_MASK_51;
+	h [ 0 ] += ( unsigned long long ) ( r [ 4 ] >> 51 ) * 19;
+	h [ 1 ] += h [ 0 ] >> 51;
+	h [ 0 ] &= FIELD_MASK_51;
+}
+
+static void FeSquareTimes ( FIELD_ELEMENT h , const FIELD_ELEMENT f , int n )
+{
+	FeSquare ( h , f );
+	for ( int i = 1 ; i < n ; i++ )
+	{
+		FeSquare ( h , h );
+	}
+}
+
+/* z ^ ( p - 2 ) = 1 / z, through the usual chain of 254 squarings and 11 multiplications */
+static void FeInvert ( FIELD_ELEMENT out , const FIELD_ELEMENT z )
+{
+	FIELD_ELEMENT z2 , z9 , z11 , z2_5_0 , z2_10_0 , z2_20_0 , z2_50_0 , z2_100_0 , t;
+
+	FeSquare ( z2 , z );
+	FeSquareTimes ( t , z2 , 2 );
+	FeMul ( z9 , t , z );
+	FeMul ( z11 , z9 , z2 );
+	FeSquare ( t , z11 );
+	FeMul ( z2_5_0 , t , z9 );
+	FeSquareTimes ( t , z2_5_0 , 5 );
+	FeMul ( z2_10_0 , t , z2_5_0 );
+	FeSquareTimes ( t , z2_10_0 , 10 );
+	FeMul ( z2_20_0 , t , z2_10_0 );
+	FeSquareTimes ( t , z2_20_0 , 20 );
+	FeMul ( t , t , z2_20_0 );
+	FeSquareTimes ( t , t , 10 );
+	FeMul ( z2_50_0 , t , z2_10_0 );
+	FeSquareTimes ( t , z2_50_0 , 50 );
+	FeMul ( z2_100_0 , t , z2_50_0 );
+	FeSquareTimes ( t , z2_100_0 , 100 );
+	FeMul ( t , t , z2_100_0 );
+	FeSquareTimes ( t , t , 50 );
+	FeMul ( t , t , z2_50_0 );
+	FeSquareTimes ( t , t , 5 );
+	FeMul ( out , t , z11 );
+}
+
+/* Swaps f and g if swap is 1, touching both either way. */
+static inline void FeConditionalSwap ( FIELD_ELEMENT f , FIELD_ELEMENT g , unsigned long long swap )
+{
+	unsigned long long mask = 0 - swap;
+	for ( int i = 0 ; i < 5 ; i++ )
+	{
+		unsigned long long x = ( f [ i ] ^ g [ i ] ) & mask;
+		f [ i ] ^= x;
+		g [ i ] ^= x;
+	}
+}
+
+/* The Montgomery ladder of RFC 7748, section 5. */
+void X25519 ( unsigned char *sharedKey , const unsigned char *secretKey , const unsigned char *publicKey )
+{
+	unsigned char scalar [ 32 ];
+	memcpy ( scalar , secretKey , 32 );
+	scalar [ 0 ] &= 248;
+	scalar [ 31 ] &= 127;
+	scalar [ 31 ] |= 64;
+
+	FIELD_ELEMENT x1 , x2 , z2 , x3 , z3;
+	FeFromBytes ( x1 , publicKey );
+	memset ( x2 , 0 , sizeof ( x2 ) );
+	x2 [ 0 ] = 1;
+	memset ( z2 , 0 , sizeof ( z2 ) );
+	memcpy ( x3 , x1 , sizeof ( x3 ) );
+	memset ( z3 , 0 , sizeof ( z3 ) );
+	z3 [ 0 ] = 1;
+
+	unsigned long long swap = 0;
+	for ( int t = 254 ; t >= 0 ; t-- )
+	{
+		unsigned long long bit = ( scalar [ t >> 3 ] >> ( t & 7 ) ) & 1;
+		swap ^= bit;
+		FeConditionalSwap ( x2 , x3 , swap );
+		FeConditionalSwap ( z2 , z3 , swap );
+		swap = bit;
+
+		FIELD_ELEMENT a , aa , b , bb , e , c , d , da , cb , t0;
+		FeAdd ( a , x2 , z2 );
+		FeSquare ( aa , a );
+		FeSub ( b , x2 , z2 );
+		FeSquare ( bb , b );
+		FeSub ( e , aa , bb );
+		FeAdd ( c , x3 , z3 );
+		FeSub ( d , x3 , z3 );
+		FeMul ( da , d , a );
+		FeMul ( cb , c , b );
+
+		FeAdd ( t0 , da , cb );
+		FeSquare ( x3 , t0 );
+		FeSub ( t0 , da , cb );
+		FeSquare ( t0 , t0 );
+		FeMul ( z3 , x1 , t0 );
+
+		FeMul ( x2 , aa , bb );
+		FeMulSmall ( t0 , e , X25519_A24 );
+		FeAdd ( t0 , aa , t0 );
+		FeMul ( z2 , e , t0 );
+	}
+
+	FeConditionalSwap ( x2 , x3 , swap );
+	FeConditionalSwap ( z2 , z3 , swap );
+
+	FeInvert ( z2 , z2 );
+	FeMul ( x2 , x2 , z2 );
+	FeToBytes ( sharedKey , x2 );
+
+	CryptoWipe ( scalar , sizeof ( scalar ) );
+	CryptoWipe ( x2 , sizeof ( x2 ) );
+	CryptoWipe ( z2 , sizeof ( z2 ) );
+	CryptoWipe ( x3 , sizeof ( x3 ) );
+	CryptoWipe ( z3 , sizeof ( z3 ) );
+}
+
+void X25519PublicKey ( unsigned char *publicKey , const unsigned char *secretKey )
+{
+	static const unsigned char basePoint [ 32 ] = { 9 };
+	X25519 ( publicKey , secretKey , basePoint );
+}
+
+/*
+ * BLAKE2S
+ */
+
+static inline unsigned int Rotr32 ( unsigned int value , int n )
+{
+	return value >> n | value << ( 32 - n );
+}
+
+static inline void Blake2sMix ( unsigned int *v , int a , int b , int c , int d , unsigned int x , unsigned int y )
+{
+	v [ a ] += v [ b ] + x;
+	v [ d ] = Rotr32 ( v [ d ] ^ v [ a ] , 16 );
+	v [ c ] += v [ d ];
+	v [ b ] = Rotr32 ( v [ b ] ^ v [ c ] , 12 );
+	v [ a ] += v [ b ] + y;
+	v [ d ] = Rotr32 ( v [ d ] ^ v [ a ] , 8 );
+	v [ c ] += v [ d ];
+	v [ b ] = Rotr32 ( v [ b ] ^ v [ c ] , 7 );
+}
+
+static void Blake2sCompress ( BLAKE2S_STATE *state , const unsigned char *block , int last )
+{
+	unsigned int m [ 16 ];
+	unsigned int v [ 16 ];
+	for ( int i = 0 ; i < 16 ; i++ )
+	{
+		m [ i ] = Load32 ( block + 4 * i );
+	}
+
+	for ( int i = 0 ; i < 8 ; i++ )
+	{
+		v [ i ] = state -> h [ i ];
+		v [ 8 + i ] = BLAKE2S_IV [ i ];
+	}
+	v [ 12 ] ^= ( unsigned int ) state -> counter;
+	v [ 13 ] ^= ( unsigned int ) ( state -> counter >> 32 );
+	if ( last )
+	{
+		v [ 14 ] = ~v [ 14 ];
+	}
+
+	for ( int round = 0 ; round < 10 ; round++ )
+	{
+		const unsigned char *s = BLAKE2S_SIGMA [ round ];
+		Blake2sMix ( v , 0 , 4 , 8 , 12 , m [ s [ 0 ] ] , m [ s [ 1 ] ] );
+		Blake2sMix ( v , 1 , 5 , 9 , 13 , m [ s [ 2 ] ] , m [ s [ 3 ] ] );
+		Blake2sMix ( v , 2 , 6 , 10 , 14 , m [ s [ 4 ] ] , m [ s [ 5 ] ] );
+		Blake2sMix ( v , 3 , 7 , 11 , 15 , m [ s [ 6 ] ] , m [ s [ 7 ] ] );
+		Blake2sMix ( v , 0 , 5 , 10 , 15 , m [ s [ 8 ] ] , m [ s [ 9 ] ] );
+		Blake2sMix ( v , 1 , 6 , 11 , 12 , m [ s [ 10 ] ] , m [ s [ 11 ] ] );
+		Blake2sMix ( v , 2 , 7 , 8 , 13 , m [ s [ 12 ] ] , m [ s [ 13 ] ] );
+		Blake2sMix ( v , 3 , 4 , 9 , 14 , m [ s [ 14 ] ] , m [ s [ 15 ] ] );
+	}
+
+	for ( int i = 0 ; i < 8 ; i++ )
+	{
+		state -> h [ i ] ^= v [ i ] ^ v [ 8 + i ];
+	}
+}
+
+/* A key, if any, is hashed as a first block of its own, zero padded. */
+void Blake2sInit ( BLAKE2S_STATE *state , size_t outputLength , const unsigned char *key , size_t keyLength )
+{
+	memcpy ( state -> h , BLAKE2S_IV , sizeof ( state -> h ) );
+	state -> h [ 0 ] ^= 0x01010000 ^ ( unsigned int ) ( keyLength << 8 ) ^ ( unsigned int ) outputLength;
+	state -> counter = 0;
+	state -> outputLength = outputLength;
+	state -> bufferLength = 0;
+
+	if ( keyLength > 0 )
+	{
+		memset ( state -> buffer , 0 , CRYPTO_BLAKE2S_BLOCK_SIZE );
+		memcpy ( state -> buffer , key , keyLength );
+		state -> bufferLength = CRYPTO_BLAKE2S_BLOCK_SIZE;
+	}
+}
+
+/* The last block is flagged as such, so a full buffer is only compressed once
+ * more input shows it is not the last. */
+void Blake2sUpdate ( BLAKE2S_STATE *state , const void *input , size_t length )
+{
+	const unsigned char *bytes = ( const unsigned char *) input;
+
+	while ( length > 0 )
+	{
+		if ( state -> bufferLength == CRYPTO_BLAKE2S_BLOCK_SIZE )
+		{
+			state -> counter += CRYPTO_BLAKE2S_BLOCK_SIZE;
+			Blake2sCompress ( state , state -> buffer , 0 );
+			state -> bufferLength = 0;
+		}
+
+		size_t numTaken = CRYPTO_BLAKE2S_BLOCK_SIZE - state -> bufferLength;
+		if ( numTaken > length )
+		{
+			numTaken = length;
+		}
+
+		memcpy ( state -> buffer + state -> bufferLength , bytes , numTaken );
+		state -> bufferLength += numTaken;
+		bytes += numTaken;
+		length -= numTaken;
+	}
+}
+
+void Blake2sFinal ( BLAKE2S_STATE *state , unsigned char *output )
+{
+	state -> counter += state -> bufferLength;
+	memset ( state -> buffer + state -> bufferLength , 0 , CRYPTO_BLAKE2S_BLOCK_SIZE - state -> bufferLength );
+	Blake2sCompress ( state , state -> buffer , 1 );
+
+	unsigned char digest [ CRYPTO_HASH_SIZE ];
+	for ( int i = 0 ; i < 8 ; i++ )
+	{
+		Store32 ( digest + 4 * i , state -> h [ i ] );
+	}
+	memcpy ( output , digest , state -> outputLength );
+
+	CryptoWipe ( digest , sizeof ( digest ) );
+	CryptoWipe ( state , sizeof ( BLAKE2S_STATE ) );
+}
+
+void Blake2s ( unsigned char *output , size_t outputLength , const unsigned char *key , size_t keyLength , const void *input , size_t length )
+{
+	BLAKE2S_STATE state;
+	Blake2sInit ( &state , outputLength , key , keyLength );
+	Blake2sUpdate ( &state , input , length );
+	Blake2sFinal ( &state , output );
+}
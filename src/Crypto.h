@@ -0,0 +1,78 @@
+/* Nic Pucci
+ * CRYPTO HEADER
+ *
+ * The primitives behind --encrypt, written out here rather than linked in:
+ * ChaCha20-Poly1305 (RFC 8439) seals each datagram, X25519 (RFC 7748) agrees
+ * the session's keys and BLAKE2s (RFC 7693) derives them and hashes the
+ * pre-shared key. All of it runs in time independent of secret data.
+ *
+ * ChaCha20 has three kernels: one block at a time in plain C, four blocks side
+ * by side in SSE2 and eight in AVX2, which does the last four or fewer of a
+ * datagram two to a vector instead. Poly1305 runs on 64-bit limbs, or with
+ * AVX2 on four blocks at once once the text is long enough to pay for it.
+ * CryptoInit picks the widest kernel the CPU runs; until then the plain one is
+ * used. A seal makes Poly1305's key in the same pass as the keystream.
+*/
+
+#ifndef CRYPTO_H
+#define CRYPTO_H
+
+#include <stddef.h>
+
+#define CRYPTO_KEY_SIZE 32
+#define CRYPTO_NONCE_SIZE 12
+#define CRYPTO_TAG_SIZE 16
+#define CRYPTO_HASH_SIZE 32 // BLAKE2s output, at most
+#define CRYPTO_BLAKE2S_BLOCK_SIZE 64
+
+enum CRYPTO_KERNEL {
+	CRYPTO_KERNEL_PORTABLE = 0,
+	CRYPTO_KERNEL_SSE2,
+	CRYPTO_KERNEL_AVX2,
+	CRYPTO_NUM_KERNELS
+};
+
+typedef struct blake2sState
+{
+	unsigned int h [ 8 ];
+	unsigned long long counter; // bytes compressed so far
+	unsigned char buffer [ CRYPTO_BLAKE2S_BLOCK_SIZE ];
+	size_t bufferLength;
+	size_t outputLength;
+} BLAKE2S_STATE;
+
+void CryptoInit ();
+
+int CryptoKernelSupported ( int kernel );
+
+int CryptoUseKernel ( int kernel );
+
+int CryptoKernel ();
+
+const char *CryptoKernelName ( int kernel );
+
+void ChaCha20Xor ( const unsigned char *key , const unsigned char *nonce , unsigned int counter , const unsigned char *input , unsigned char *output , size_t length );
+
+void Poly1305 ( unsigned char *tag , const unsigned char *key , const unsigned char *message , size_t length );
+
+void CryptoAeadSeal ( const unsigned char *key , const unsigned char *nonce , const unsigned char *aad , size_t aadLength , unsigned char *text , size_t length , unsigned char *tag );
+
+int CryptoAeadOpen ( const unsigned char *key , const unsigned char *nonce , const unsigned char *aad , size_t aadLength , unsigned char *text , size_t length , const unsigned char *tag );
+
+void X25519 ( unsigned char *sharedKey , const unsigned char *secretKey , const unsigned char *publicKey );
+
+void X25519PublicKey ( unsigned char *publicKey , const unsigned char *secretKey );
+
+void Blake2sInit ( BLAKE2S_STATE *state , size_t outputLength , const unsigned char *key , size_t keyLength );
+
+void Blake2sUpdate ( BLAKE2S_STATE *state , const void *input , size_t length );
+
+void Blake2sFinal ( BLAKE2S_STATE *state , unsigned char *output );
+
+void Blake2s ( unsigned char *output , size_t outputLength , const unsigned char *key , size_t keyLength , const void *input , size_t length );
+
+int CryptoEqual ( const unsigned char *a , const unsigned char *b , size_t length );
+
+void CryptoWipe ( void *data , size_t length );
+
+#endif
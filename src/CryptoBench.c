@@ -0,0 +1,665 @@
+/* Nic Pucci
+ * CRYPTO BENCH IMPLEMENTATION
+ *
+ * Microbenchmarks for --encrypt. Two sessions are keyed against each other as
+ * the chat bench does, then datagrams of chat sizes are sealed by one and
+ * opened by the other, once with each ChaCha20 kernel the CPU runs. Against
+ * that it times what every datagram costs anyway: a send and a receive of the
+ * sealed size over loopback UDP. Reports ns per datagram each way, seal MB/s,
+ * and the share of seal, send, receive and open that is crypto. Every
+ * datagram is checked to open to what was sealed.
+ *
+ * Before anything is timed every kernel the CPU runs is checked against the
+ * known-answer vectors of RFC 8439, RFC 7748 and RFC 7693; a mismatch exits
+ * nonzero, so make bench fails on it. So does a session that, after its peer
+ * restarted and the keys changed over, takes the peer's old handshake or an
+ * old datagram replayed.
+ *
+ * usage: cryptobench [kernel name ...]   (no names = every kernel the CPU runs)
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "List.h"
+#include "Crypto.h"
+#include "Protocol.h"
+#include "Secure.h"
+
+const int CRYPTO_BENCH_SIZES [] = { 64 , 128 , 512 , 1400 };
+const int CRYPTO_BENCH_NUM_SIZES = sizeof ( CRYPTO_BENCH_SIZES ) / sizeof ( CRYPTO_BENCH_SIZES [ 0 ] );
+const int CRYPTO_BENCH_NUM_DATAGRAMS = 1024; // under SECURE_REPLAY_WINDOW_SIZE, so none is turned away as too old
+const unsigned long long CRYPTO_BENCH_MIN_NS = 200000000ULL; // each direction runs rounds for at least this long
+#define CRYPTO_BENCH_DATAGRAM_SIZE_ALLOC 2048
+
+/* RFC 8439 2.3.2 and 2.4.2: ChaCha20 with key 00 .. 1f */
+const char CHACHA20_BLOCK_NONCE [] = "000000090000004a00000000";
+const char CHACHA20_BLOCK_KEYSTREAM [] =
+	"10f1e7e4d13b5915500fdd1fa32071c4c7d1f4c733c068030422aa9ac3d46c4e"
+	"d2826446079faa0914c2d705d98b02a2b5129cd1de164eb9cbd083e8a2503c4e";
+const char CHACHA20_ENCRYPT_NONCE [] = "000000000000004a00000000";
+const char SUNSCREEN_TEXT [] = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+const char CHACHA20_ENCRYPT_CIPHERTEXT [] =
+	"6e2e359a2568f98041ba0728dd0d6981e97e7aec1d4360c20a27afccfd9fae0b"
+	"f91b65c5524733ab8f593dabcd62b3571639d624e65152ab8f530c359f0861d8"
+	"07ca0dbf500d6a6156a38e088a22b65e52bc514d16ccf806818ce91ab7793736"
+	"5af90bbf74a35be6b40b8eedf2785e42874d";
+
+/* RFC 8439 2.5.2 */
+const char POLY1305_KEY [] = "85d6be7857556d337f4452fe42d506a80103808afb0db2fd4abff6af4149f51b";
+const char POLY1305_TEXT [] = "Cryptographic Forum Research Group";
+const char POLY1305_TAG [] = "a8061dc1305136c6c22b8baf0c0127a9";
+
+/* RFC 8439 2.8.2: the sunscreen text again */
+const char AEAD_KEY [] = "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f";
+const char AEAD_NONCE [] = "070000004041424344454647";
+const char AEAD_AAD [] = "50515253c0c1c2c3c4c5c6c7";
+const char AEAD_CIPHERTEXT [] =
+	"d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d6"
+	"3dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b36"
+	"92ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc"
+	"3ff4def08e4b7a9de576d26586cec64b6116";
+const char AEAD_TAG [] = "1ae10b594f09e26a7e902ecbd0600691";
+
+/* RFC 7748 5.2, first vector, and 6.1 */
+const char X25519_SCALAR [] = "a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4";
+const char X25519_U [] = "e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c";
+const char X25519_OUTPUT [] = "c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552";
+const char X25519_ALICE_SECRET [] = "77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a";
+const char X25519_ALICE_PUBLIC [] = "8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a";
+const char X25519_BOB_SECRET [] = "5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb";
+const char X25519_BOB_PUBLIC [] = "de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f";
+const char X25519_SHARED [] = "4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742";
+
+/* RFC 7693 appendix B, then keyed (key 00 .. 1f) over nothing and over 00 .. fe,
+ * as in the reference implementation's known-answer file */
+const char BLAKE2S_ABC [] = "508c5e8c327c14e2e1a72ba34eeb452f37458b209ed63a294d999b4c86675982";
+const char BLAKE2S_KEYED_EMPTY [] = "48a8997da407876b3d79c0d92325ad3b89cbb754d86ab71aee047ad345fd2c49";
+const char BLAKE2S_KEYED_255 [] = "3fb735061abc519dfe979e54c1ee5bfad0a9d858b3315bad34bde999efd724dd";
+
+const int KNOWN_ANSWER_LONG_SIZE = 1400; // past the AVX2 Poly1305 threshold, which no RFC vector reaches
+
+unsigned long long NowNs ()
+{
+	struct timespec now;
+	clock_gettime ( CLOCK_MONOTONIC , &now );
+	return ( unsigned long long ) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* Decodes hex into bytes; returns the number of bytes. */
+int FromHex ( unsigned char *bytes , const char *hex )
+{
+	int length = strlen ( hex ) / 2;
+	for ( int i = 0 ; i < length ; i++ )
+	{
+		unsigned int byte;
+		sscanf ( hex + 2 * i , "%2x" , &byte );
+		bytes [ i ] = ( unsigned char ) byte;
+	}
+
+	return length;
+}
+
+int MatchesHex ( const unsigned char *bytes , const char *hex )
+{
+	unsigned char expected [ 256 ];
+	int length = FromHex ( expected , hex );
+	return memcmp ( bytes , expected , length ) == 0;
+}
+
+/* ChaCha20, Poly1305 and the AEAD with the kernel in use. Every prefix of the
+ * RFC's ciphertext is a known answer too, so the short passes are checked
+ * along with the long ones. Returns the name of the first vector missed, or
+ * NULL. */
+const char *CheckKernelAnswers ()
+{
+	unsigned char key [ CRYPTO_KEY_SIZE ];
+	unsigned char nonce [ CRYPTO_NONCE_SIZE ];
+	unsigned char text [ 256 ];
+	unsigned char tag [ CRYPTO_TAG_SIZE ];
+	int textLength = sizeof ( SUNSCREEN_TEXT ) - 1;
+
+	for ( int i = 0 ; i < CRYPTO_KEY_SIZE ; i++ )
+	{
+		key [ i ] = i;
+	}
+
+	FromHex ( nonce , CHACHA20_BLOCK_NONCE );
+	memset ( text , 0 , 64 );
+	ChaCha20Xor ( key , nonce , 1 , text , text , 64 );
+	if ( !MatchesHex ( text , CHACHA20_BLOCK_KEYSTREAM ) )
+	{
+		return "RFC 8439 2.3.2 (ChaCha20 block)";
+	}
+
+	unsigned char expected [ 256 ];
+	FromHex ( expected , CHACHA20_ENCRYPT_CIPHERTEXT );
+	FromHex ( nonce , CHACHA20_ENCRYPT_NONCE );
+	for ( int length = 1 ; length <= textLength ; length++ )
+	{
+		ChaCha20Xor ( key , nonce , 1 , ( const unsigned char *) SUNSCREEN_TEXT , text , length );
+		if ( memcmp ( text , expected , length ) != 0 )
+		{
+			return "RFC 8439 2.4.2 (ChaCha20 encryption)";
+		}
+	}
+
+	FromHex ( key , POLY1305_KEY );
+	Poly1305 ( tag , key , ( const unsigned char *) POLY1305_TEXT , sizeof ( POLY1305_TEXT ) - 1 );
+	if ( !MatchesHex ( tag , POLY1305_TAG ) )
+	{
+		return "RFC 8439 2.5.2 (Poly1305)";
+	}
+
+	unsigned char aad [ 16 ];
+	int aadLength = FromHex ( aad , AEAD_AAD );
+	FromHex ( key , AEAD_KEY );
+	FromHex ( nonce , AEAD_NONCE );
+	memcpy ( text , SUNSCREEN_TEXT , textLength );
+	CryptoAeadSeal ( key , nonce , aad , aadLength , text , textLength , tag );
+	if ( !MatchesHex ( text , AEAD_CIPHERTEXT ) || !MatchesHex ( tag , AEAD_TAG ) )
+	{
+		return "RFC 8439 2.8.2 (AEAD seal)";
+	}
+
+	if ( CryptoAeadOpen ( key , nonce , aad , aadLength , text , textLength , tag ) == FAILURE_OP_CODE
+		|| memcmp ( text , SUNSCREEN_TEXT , textLength ) != 0 )
+	{
+		return "RFC 8439 2.8.2 (AEAD open)";
+	}
+
+	CryptoAeadSeal ( key , nonce , aad , aadLength , text , textLength , tag );
+	tag [ 0 ] ^= 1;
+	if ( CryptoAeadOpen ( key , nonce , aad , aadLength , text , textLength , tag ) == SUCCESS_OP_CODE )
+	{
+		return "RFC 8439 2.8.2 (AEAD open of a forged tag)";
+	}
+
+	return NULL;
+}
+
+/* Long texts take paths no RFC vector reaches (eight-block passes, the AVX2
+ * Poly1305), so there each kernel has to agree with the portable one, which
+ * the vectors pin down. */
+const char *CheckKernelAgrees ( int kernel )
+{
+	unsigned char key [ CRYPTO_KEY_SIZE ];
+	unsigned char nonce [ CRYPTO_NONCE_SIZE ];
+	unsigned char texts [ 2 ][ KNOWN_ANSWER_LONG_SIZE ];
+	unsigned char tags [ 2 ][ CRYPTO_TAG_SIZE ];
+	int kernels [ 2 ] = { CRYPTO_KERNEL_PORTABLE , kernel };
+
+	FromHex ( key , AEAD_KEY );
+	FromHex ( nonce , AEAD_NONCE );
+	for ( int k = 0 ; k < 2 ; k++ )
+	{
+		CryptoUseKernel ( kernels [ k ] );
+		for ( int i = 0 ; i < KNOWN_ANSWER_LONG_SIZE ; i++ )
+		{
+			texts [ k ][ i ] = SUNSCREEN_TEXT [ i % ( sizeof ( SUNSCREEN_TEXT ) - 1 ) ];
+		}
+		CryptoAeadSeal ( key , nonce , NULL , 0 , texts [ k ] , KNOWN_ANSWER_LONG_SIZE , tags [ k ] );
+	}
+
+	if ( memcmp ( texts [ 0 ] , texts [ 1 ] , KNOWN_ANSWER_LONG_SIZE ) != 0 || memcmp ( tags [ 0 ] , tags [ 1 ] , CRYPTO_TAG_SIZE ) != 0 )
+	{
+		return "the portable kernel on a 1400-byte AEAD seal";
+	}
+
+	return NULL;
+}
+
+/* X25519 and BLAKE2s, which have one implementation whatever the kernel. */
+const char *CheckSharedAnswers ()
+{
+	unsigned char secret [ CRYPTO_KEY_SIZE ];
+	unsigned char point [ CRYPTO_KEY_SIZE ];
+	unsigned char result [ CRYPTO_KEY_SIZE ];
+
+	FromHex ( secret , X25519_SCALAR );
+	FromHex ( point , X25519_U );
+	X25519 ( result , secret , point );
+	if ( !MatchesHex ( result , X25519_OUTPUT ) )
+	{
+		return "RFC 7748 5.2 (X25519)";
+	}
+
+	const char *secrets [ 2 ] = { X25519_ALICE_SECRET , X25519_BOB_SECRET };
+	const char *publics [ 2 ] = { X25519_ALICE_PUBLIC , X25519_BOB_PUBLIC };
+	for ( int i = 0 ; i < 2 ; i++ )
+	{
+		FromHex ( secret , secrets [ i ] );
+		X25519PublicKey ( result , secret );
+		if ( !MatchesHex ( result , publics [ i ] ) )
+		{
+			return "RFC 7748 6.1 (X25519 public key)";
+		}
+
+		FromHex ( point , publics [ 1 - i ] );
+		X25519 ( result , secret , point );
+		if ( !MatchesHex ( result , X25519_SHARED ) )
+		{
+			return "RFC 7748 6.1 (X25519 shared secret)";
+		}
+	}
+
+	Blake2s ( result , CRYPTO_HASH_SIZE , NULL , 0 , "abc" , 3 );
+	if ( !MatchesHex ( result , BLAKE2S_ABC ) )
+	{
+		return "RFC 7693 appendix B (BLAKE2s)";
+	}
+
+	unsigned char key [ CRYPTO_KEY_SIZE ];
+	unsigned char input [ 255 ];
+	for ( int i = 0 ; i < CRYPTO_KEY_SIZE ; i++ )
+	{
+		key [ i ] = i;
+	}
+	for ( int i = 0 ; i < 255 ; i++ )
+	{
+		input [ i ] = i;
+	}
+
+	Blake2s ( result , CRYPTO_HASH_SIZE , key , CRYPTO_KEY_SIZE , input , 0 );
+	if ( !MatchesHex ( result , BLAKE2S_KEYED_EMPTY ) )
+	{
+		return "keyed BLAKE2s of nothing";
+	}
+
+	// fed in uneven pieces, so the buffering between blocks is checked too
+	BLAKE2S_STATE state;
+	Blake2sInit ( &state , CRYPTO_HASH_SIZE , key , CRYPTO_KEY_SIZE );
+	for ( int offset = 0 , piece = 1 ; offset < 255 ; offset += piece , piece = piece * 2 + 1 )
+	{
+		Blake2sUpdate ( &state , input + offset , offset + piece <= 255 ? piece : 255 - offset );
+	}
+	Blake2sFinal ( &state , result );
+	if ( !MatchesHex ( result , BLAKE2S_KEYED_255 ) )
+	{
+		return "keyed BLAKE2s of 00 .. fe";
+	}
+
+	return NULL;
+}
+
+/* Every kernel the CPU runs, whatever was asked for on the command line; the
+ * widest is left in use. */
+int CheckKnownAnswers ()
+{
+	const char *missed = CheckSharedAnswers ();
+	if ( missed )
+	{
+		fprintf ( stderr , "cryptobench: does not match %s\n" , missed );
+		return FAILURE_OP_CODE;
+	}
+
+	int widest = CryptoKernel ();
+	for ( int kernel = 0 ; kernel < CRYPTO_NUM_KERNELS ; kernel++ )
+	{
+		if ( !CryptoKernelSupported ( kernel ) )
+		{
+			continue;
+		}
+
+		CryptoUseKernel ( kernel );
+		missed = CheckKernelAnswers ();
+		if ( !missed )
+		{
+			missed = CheckKernelAgrees ( kernel );
+		}
+
+		if ( missed )
+		{
+			fprintf ( stderr , "cryptobench: the %s kernel does not match %s\n" , CryptoKernelName ( kernel ) , missed );
+			return FAILURE_OP_CODE;
+		}
+	}
+
+	CryptoUseKernel ( widest );
+	printf ( "known answers (RFC 8439, RFC 7748, RFC 7693): every kernel matches\n" );
+	return SUCCESS_OP_CODE;
+}
+
+/* Keys sender and receiver to each other, as if their handshakes had crossed
+ * the network. */
+int PairSessions ( SECURE_SESSION *sender , SECURE_SESSION *receiver )
+{
+	SECURE_SESSION *ends [ 2 ] = { sender , receiver };
+	for ( int i = 0 ; i < 2 ; i++ )
+	{
+		if ( SecureInit ( ends [ i ] , NULL ) == FAILURE_OP_CODE )
+		{
+			return FAILURE_OP_CODE;
+		}
+	}
+
+	for ( int i = 0 ; i < 2 ; i++ )
+	{
+		char frame [ SECURE_MAX_HANDSHAKE_SIZE ];
+		int length = SecureEncodeHandshake ( ends [ i ] , frame , 0 );
+
+		FRAME_HEADER header;
+		int replyWanted;
+		int keysChanged;
+		if ( FrameDecodeHeader ( frame , length , &header ) == FAILURE_OP_CODE
+			|| SecureAcceptHandshake ( ends [ 1 - i ] , &header , frame + FRAME_HEADER_SIZE , &replyWanted , &keysChanged ) == FAILURE_OP_CODE )
+		{
+			return FAILURE_OP_CODE;
+		}
+	}
+
+	return SUCCESS_OP_CODE;
+}
+
+/* Seals plainLength bytes of filler from sender into datagram; returns the
+ * sealed length. */
+int SealFiller ( SECURE_SESSION *sender , char *datagram , int plainLength )
+{
+	memset ( datagram + SECURE_PLAIN_OFFSET , 'x' , plainLength );
+	return SecureSeal ( sender , datagram , plainLength );
+}
+
+/* Gives receiver the handshake frame of length bytes, as if off the wire;
+ * returns what SecureAcceptHandshake did with it. */
+int TakeHandshakeFrame ( SECURE_SESSION *receiver , const char *frame , int length )
+{
+	FRAME_HEADER header;
+	int replyWanted;
+	int keysChanged;
+	if ( FrameDecodeHeader ( frame , length , &header ) == FAILURE_OP_CODE )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	return SecureAcceptHandshake ( receiver , &header , frame + FRAME_HEADER_SIZE , &replyWanted , &keysChanged );
+}
+
+/* The peer restarts with a new key pair and the receiver's keys change over
+ * to it; then the peer's old handshake and a datagram it sealed before the
+ * restart are replayed. Both must be refused, and the new keys must stay in
+ * use. Returns what went wrong, or NULL. */
+const char *CheckHandshakeReplay ()
+{
+	SECURE_SESSION peer;
+	SECURE_SESSION receiver;
+	if ( PairSessions ( &peer , &receiver ) == FAILURE_OP_CODE )
+	{
+		return "keys could not be agreed";
+	}
+
+	char oldHandshake [ SECURE_MAX_HANDSHAKE_SIZE ];
+	int oldHandshakeLength = SecureEncodeHandshake ( &peer , oldHandshake , 0 );
+
+	char oldDatagram [ CRYPTO_BENCH_DATAGRAM_SIZE_ALLOC ];
+	char datagram [ CRYPTO_BENCH_DATAGRAM_SIZE_ALLOC ];
+	int oldLength = SealFiller ( &peer , oldDatagram , 64 );
+	memcpy ( datagram , oldDatagram , oldLength );
+
+	const char *missed = NULL;
+	int keysChanged;
+	if ( SecureOpen ( &receiver , datagram , oldLength , &keysChanged ) != 64 )
+	{
+		missed = "a datagram sealed before the restart did not open";
+	}
+
+	// the restart: a new key pair, and handshakes both ways, the peer's sent twice
+	char handshake [ SECURE_MAX_HANDSHAKE_SIZE ];
+	SecureFree ( &peer );
+	if ( !missed && SecureInit ( &peer , NULL ) == FAILURE_OP_CODE )
+	{
+		missed = "the restarted peer could not make a key pair";
+	}
+
+	if ( !missed )
+	{
+		int length = SecureEncodeHandshake ( &receiver , handshake , 0 );
+		int taken = TakeHandshakeFrame ( &peer , handshake , length );
+
+		length = SecureEncodeHandshake ( &peer , handshake , 1 );
+		for ( int i = 0 ; i < 2 && taken == SUCCESS_OP_CODE ; i++ )
+		{
+			taken = TakeHandshakeFrame ( &receiver , handshake , length );
+		}
+
+		if ( taken == FAILURE_OP_CODE )
+		{
+			missed = "the restarted peer's handshake was refused";
+		}
+	}
+
+	if ( !missed )
+	{
+		int length = SealFiller ( &peer , datagram , 64 );
+		if ( SecureOpen ( &receiver , datagram , length , &keysChanged ) != 64 || !keysChanged )
+		{
+			missed = "the keys did not change over to the restarted peer's";
+		}
+	}
+
+	if ( !missed && TakeHandshakeFrame ( &receiver , oldHandshake , oldHandshakeLength ) == SUCCESS_OP_CODE )
+	{
+		missed = "the old handshake, replayed after the keys changed, was taken";
+	}
+
+	if ( !missed )
+	{
+		memcpy ( datagram , oldDatagram , oldLength );
+		if ( SecureOpen ( &receiver , datagram , oldLength , &keysChanged ) >= 0 )
+		{
+			missed = "an old datagram, replayed after the keys changed, was opened";
+		}
+	}
+
+	if ( !missed && strcmp ( SecureFingerprint ( &receiver ) , SecureFingerprint ( &peer ) ) != 0 )
+	{
+		missed = "the old keys came back into use";
+	}
+
+	if ( !missed )
+	{
+		int length = SealFiller ( &receiver , datagram , 64 );
+		if ( SecureOpen ( &peer , datagram , length , &keysChanged ) != 64 )
+		{
+			missed = "the new keys stopped working";
+		}
+	}
+
+	SecureFree ( &peer );
+	SecureFree ( &receiver );
+	return missed;
+}
+
+/* ns for one send and one receive of a datagram of length bytes over
+ * loopback, the floor under every datagram the chat puts on the wire */
+double TimeLoopback ( int length )
+{
+	int sendFD = socket ( AF_INET , SOCK_DGRAM , 0 );
+	int receiveFD = socket ( AF_INET , SOCK_DGRAM , 0 );
+	struct sockaddr_in addr = { .sin_family = AF_INET , .sin_port = 0 , .sin_addr.s_addr = htonl ( INADDR_LOOPBACK ) };
+	socklen_t addrLength = sizeof ( addr );
+	if ( sendFD < 0 || receiveFD < 0
+		|| bind ( receiveFD , ( struct sockaddr *) &addr , sizeof ( addr ) ) < 0
+		|| getsockname ( receiveFD , ( struct sockaddr *) &addr , &addrLength ) < 0
+		|| connect ( sendFD , ( struct sockaddr *) &addr , sizeof ( addr ) ) < 0 )
+	{
+		perror ( "cryptobench: loopback socket" );
+		exit ( -1 );
+	}
+
+	char datagram [ CRYPTO_BENCH_DATAGRAM_SIZE_ALLOC ];
+	memset ( datagram , 'x' , length );
+
+	long numRounds = 0;
+	unsigned long long roundNs = 0;
+	while ( roundNs < CRYPTO_BENCH_MIN_NS )
+	{
+		unsigned long long startNs = NowNs ();
+		for ( int i = 0 ; i < CRYPTO_BENCH_NUM_DATAGRAMS ; i++ )
+		{
+			if ( send ( sendFD , datagram , length , 0 ) != length
+				|| recv ( receiveFD , datagram , sizeof ( datagram ) , 0 ) != length )
+			{
+				perror ( "cryptobench: loopback round" );
+				exit ( -1 );
+			}
+		}
+		roundNs += NowNs () - startNs;
+		numRounds += CRYPTO_BENCH_NUM_DATAGRAMS;
+	}
+
+	close ( sendFD );
+	close ( receiveFD );
+	return ( double ) roundNs / numRounds;
+}
+
+void RunBenchCase ( SECURE_SESSION *sender , SECURE_SESSION *receiver , int kernel , int size , double loopbackNs )
+{
+	char *plain = malloc ( size );
+	char *datagrams = malloc ( ( long ) CRYPTO_BENCH_NUM_DATAGRAMS * CRYPTO_BENCH_DATAGRAM_SIZE_ALLOC );
+	int *sealedLengths = malloc ( CRYPTO_BENCH_NUM_DATAGRAMS * sizeof ( int ) );
+	if ( !plain || !datagrams || !sealedLengths )
+	{
+		fprintf ( stderr , "cryptobench: out of memory\n" );
+		exit ( -1 );
+	}
+
+	for ( int i = 0 ; i < size ; i++ )
+	{
+		plain [ i ] = ( char ) ( 'a' + i % 26 );
+	}
+
+	CryptoUseKernel ( kernel );
+
+	// each round seals a batch, then opens it; putting the plaintext back between rounds is untimed
+	long numSealed = 0;
+	unsigned long long sealNs = 0;
+	unsigned long long openNs = 0;
+	while ( sealNs < CRYPTO_BENCH_MIN_NS || openNs < CRYPTO_BENCH_MIN_NS )
+	{
+		for ( int i = 0 ; i < CRYPTO_BENCH_NUM_DATAGRAMS ; i++ )
+		{
+			memcpy ( datagrams + ( long ) i * CRYPTO_BENCH_DATAGRAM_SIZE_ALLOC + SECURE_PLAIN_OFFSET , plain , size );
+		}
+
+		unsigned long long startNs = NowNs ();
+		for ( int i = 0 ; i < CRYPTO_BENCH_NUM_DATAGRAMS ; i++ )
+		{
+			sealedLengths [ i ] = SecureSeal ( sender , datagrams + ( long ) i * CRYPTO_BENCH_DATAGRAM_SIZE_ALLOC , size );
+		}
+		sealNs += NowNs () - startNs;
+
+		startNs = NowNs ();
+		for ( int i = 0 ; i < CRYPTO_BENCH_NUM_DATAGRAMS ; i++ )
+		{
+			int keysChanged;
+			if ( SecureOpen ( receiver , datagrams + ( long ) i * CRYPTO_BENCH_DATAGRAM_SIZE_ALLOC , sealedLengths [ i ] , &keysChanged ) != size )
+			{
+				fprintf ( stderr , "cryptobench: %s datagram %d did not open\n" , CryptoKernelName ( kernel ) , i );
+				exit ( -1 );
+			}
+		}
+		openNs += NowNs () - startNs;
+		numSealed += CRYPTO_BENCH_NUM_DATAGRAMS;
+	}
+
+	// the timed rounds only count lengths; the last batch is compared, untimed
+	for ( int i = 0 ; i < CRYPTO_BENCH_NUM_DATAGRAMS ; i++ )
+	{
+		if ( memcmp ( datagrams + ( long ) i * CRYPTO_BENCH_DATAGRAM_SIZE_ALLOC , plain , size ) != 0 )
+		{
+			fprintf ( stderr , "cryptobench: %s datagram %d came back different\n" , CryptoKernelName ( kernel ) , i );
+			exit ( -1 );
+		}
+	}
+
+	double sealPerNs = ( double ) sealNs / numSealed;
+	double openPerNs = ( double ) openNs / numSealed;
+	printf (
+		"%6d %-8s %10.1f %10.1f %10.0f %12.1f %8.1f%%\n" ,
+		size ,
+		CryptoKernelName ( kernel ) ,
+		sealPerNs ,
+		openPerNs ,
+		( double ) size * 1000.0 / sealPerNs ,
+		loopbackNs ,
+		( sealPerNs + openPerNs ) * 100.0 / ( sealPerNs + openPerNs + loopbackNs )
+	);
+	fflush ( stdout );
+
+	free ( plain );
+	free ( datagrams );
+	free ( sealedLengths );
+}
+
+int KernelSelected ( int kernel , int argc , char *argv [] )
+{
+	if ( !CryptoKernelSupported ( kernel ) )
+	{
+		return 0;
+	}
+
+	if ( argc < 2 )
+	{
+		return 1;
+	}
+
+	for ( int i = 1 ; i < argc ; i++ )
+	{
+		if ( strcmp ( argv [ i ] , CryptoKernelName ( kernel ) ) == 0 )
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int main ( int argc , char *argv [] )
+{
+	CryptoInit ();
+	if ( CheckKnownAnswers () == FAILURE_OP_CODE )
+	{
+		return -1;
+	}
+
+	const char *missed = CheckHandshakeReplay ();
+	if ( missed )
+	{
+		fprintf ( stderr , "cryptobench: %s\n" , missed );
+		return -1;
+	}
+	printf ( "handshake replayed after a key change: refused\n" );
+
+	SECURE_SESSION sender;
+	SECURE_SESSION receiver;
+	if ( PairSessions ( &sender , &receiver ) == FAILURE_OP_CODE )
+	{
+		fprintf ( stderr , "cryptobench: keys could not be agreed\n" );
+		return -1;
+	}
+
+	printf ( "%6s %-8s %10s %10s %10s %12s %9s\n" , "size" , "kernel" , "seal ns" , "open ns" , "seal MB/s" , "loopback ns" , "crypto" );
+
+	for ( int s = 0 ; s < CRYPTO_BENCH_NUM_SIZES ; s++ )
+	{
+		double loopbackNs = TimeLoopback ( CRYPTO_BENCH_SIZES [ s ] + FRAME_SEALED_OVERHEAD );
+		for ( int kernel = 0 ; kernel < CRYPTO_NUM_KERNELS ; kernel++ )
+		{
+			if ( KernelSelected ( kernel , argc , argv ) )
+			{
+				RunBenchCase ( &sender , &receiver , kernel , CRYPTO_BENCH_SIZES [ s ] , loopbackNs );
+			}
+		}
+	}
+
+	SecureFree ( &sender );
+	SecureFree ( &receiver );
+	return 0;
+}
@@ -0,0 +1,375 @@
+/* Nic Pucci
+ * FILE TRANSFER IMPLEMENTATION
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include "List.h"
+#include "Stats.h"
+#include "FileTransfer.h"
+
+const int FILE_MAX_RENAMES = 99; // name.1 to name.99 are tried when the offered name is taken
+const double FILE_BYTES_PER_MB = 1000000.0;
+
+static void ResetFileTransfer ( FILE_TRANSFER *transfer , unsigned int id , unsigned long long size )
+{
+	transfer -> id = id;
+	transfer -> fd = -1;
+	transfer -> map = NULL;
+	transfer -> size = size;
+	transfer -> numBytesDone = 0;
+	transfer -> startNs = StatsNow ();
+	transfer -> lastProgressNs = transfer -> startNs;
+}
+
+/* Maps the regular file at path for sending, offered under the last part of
+ * its path. Sets errno on failure. */
+int FileTransferOpenSource ( FILE_TRANSFER *transfer , const char *path , unsigned int id )
+{
+	ResetFileTransfer ( transfer , id , 0 );
+
+	const char *name = strrchr ( path , '/' );
+	name = name ? name + 1 : path;
+	snprintf ( transfer -> name , sizeof ( transfer -> name ) , "%s" , name );
+	if ( transfer -> name [ 0 ] == 0 )
+	{
+		errno = EISDIR;
+		return FAILURE_OP_CODE;
+	}
+
+	transfer -> fd = open ( path , O_RDONLY );
+	if ( transfer -> fd < 0 )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	struct stat status;
+	if ( fstat ( transfer -> fd , &status ) < 0 )
+	{
+		FileTransferClose ( transfer );
+		return FAILURE_OP_CODE;
+	}
+
+	if ( !S_ISREG ( status.st_mode ) )
+	{
+		FileTransferClose ( transfer );
+		errno = S_ISDIR ( status.st_mode ) ? EISDIR : EINVAL; // only a regular file has a size to offer
+		return FAILURE_OP_CODE;
+	}
+
+	transfer -> size = status.st_size;
+	if ( transfer -> size == 0 )
+	{
+		return SUCCESS_OP_CODE;
+	}
+
+	char *map = mmap ( NULL , transfer -> size , PROT_READ , MAP_PRIVATE , transfer -> fd , 0 );
+	if ( map == MAP_FAILED )
+	{
+		FileTransferClose ( transfer );
+		return FAILURE_OP_CODE;
+	}
+
+	// read once, front to back: the kernel can read well ahead and drop pages behind
+	madvise ( map , transfer -> size , MADV_SEQUENTIAL );
+	transfer -> map = map;
+	return SUCCESS_OP_CODE;
+}
+
+/* A name from the network may only name a visible file in the current
+ * directory, and must show as it is: no dotfile such as .bashrc (which also
+ * rules out . and ..), no path and no control characters. */
+int FileTransferNameAllowed ( const char *name )
+{
+	if ( name [ 0 ] == 0 || name [ 0 ] == '.' )
+	{
+		return 0;
+	}
+
+	for ( const unsigned char *c = ( const unsigned char *) name ; *c ; c++ )
+	{
+		if ( *c == '/' || *c < 0x20 || *c == 0x7f )
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Creates the file under name, or name.1, name.2 ... if it is taken, never
+ * replacing an existing file. Returns the descriptor, or -1. */
+static int CreateUnusedFile ( FILE_TRANSFER *transfer , const char *name )
+{
+	for ( int attempt = 0 ; attempt <= FILE_MAX_RENAMES ; attempt++ )
+	{
+		if ( attempt == 0 )
+		{
+			snprintf ( transfer -> name , sizeof ( transfer -> name ) , "%s" , name );
+		}
+		else
+		{
+			snprintf ( transfer -> name , sizeof ( transfer -> name ) , "%s.%d" , name , attempt );
+		}
+
+		int fd = open ( transfer -> name , O_RDWR | O_CREAT | O_EXCL , 0644 );
+		if ( fd >= 0 || errno != EEXIST )
+		{
+			return fd;
+		}
+	}
+
+	return -1;
+}
+
+/* Creates the file an offer names, at its full size, and maps it for writing. */
+int FileTransferCreateDestination ( FILE_TRANSFER *transfer , unsigned int id , const char *name , unsigned long long size )
+{
+	ResetFileTransfer ( transfer , id , size );
+	if ( !FileTransferNameAllowed ( name ) )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	transfer -> fd = CreateUnusedFile ( transfer , name );
+	if ( transfer -> fd < 0 )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	if ( size == 0 )
+	{
+		return SUCCESS_OP_CODE;
+	}
+
+	// allocated up front, so a full disk refuses the offer instead of faulting a write into the map
+	int error = posix_fallocate ( transfer -> fd , 0 , size );
+	if ( error == ENOSPC || error == EFBIG || ( error != 0 && ftruncate ( transfer -> fd , size ) < 0 ) )
+	{
+		FileTransferAbandon ( transfer );
+		return FAILURE_OP_CODE;
+	}
+
+	char *map = mmap ( NULL , size , PROT_READ | PROT_WRITE , MAP_SHARED , transfer -> fd , 0 );
+	if ( map == MAP_FAILED )
+	{
+		FileTransferAbandon ( transfer );
+		return FAILURE_OP_CODE;
+	}
+
+	transfer -> map = map;
+	return SUCCESS_OP_CODE;
+}
+
+/* Unmaps and closes the file; a destination keeps whatever was written to it. */
+void FileTransferClose ( FILE_TRANSFER *transfer )
+{
+	if ( transfer -> map )
+	{
+		munmap ( transfer -> map , transfer -> size );
+		transfer -> map = NULL;
+	}
+
+	if ( transfer -> fd >= 0 )
+	{
+		close ( transfer -> fd );
+		transfer -> fd = -1;
+	}
+}
+
+/* Closes a destination that will not be finished and removes it. */
+void FileTransferAbandon ( FILE_TRANSFER *transfer )
+{
+	if ( transfer -> fd >= 0 )
+	{
+		unlink ( transfer -> name );
+	}
+
+	FileTransferClose ( transfer );
+}
+
+/* Writes the offer frame (at most FILE_MAX_OFFER_SIZE bytes); returns its length. */
+int FileTransferEncodeOffer ( const FILE_TRANSFER *transfer , char *frame )
+{
+	int nameLength = strlen ( transfer -> name );
+
+	FRAME_HEADER header = {
+		.version = FRAME_PROTOCOL_VERSION ,
+		.type = FRAME_TYPE_FILE_OFFER ,
+		.flags = 0 ,
+		.sequence = 0 , // stamped on sending
+		.payloadLength = FRAME_FILE_OFFER_HEADER_SIZE + nameLength
+	};
+	FrameEncodeHeader ( frame , &header );
+
+	char *payload = frame + FRAME_HEADER_SIZE;
+	unsigned int networkId = htonl ( transfer -> id );
+	unsigned long long networkSize = htobe64 ( transfer -> size );
+	memcpy ( payload , &networkId , sizeof ( networkId ) );
+	memcpy ( payload + FRAME_FILE_ID_SIZE , &networkSize , sizeof ( networkSize ) );
+	memcpy ( payload + FRAME_FILE_OFFER_HEADER_SIZE , transfer -> name , nameLength );
+
+	return FRAME_HEADER_SIZE + header.payloadLength;
+}
+
+/* Reads an offer; name must hold FILE_MAX_NAME_SIZE + 1 bytes. */
+int FileTransferDecodeOffer ( const FRAME_HEADER *header , const char *payload , unsigned int *id , unsigned long long *size , char *name )
+{
+	int nameLength = header -> payloadLength - FRAME_FILE_OFFER_HEADER_SIZE;
+	if ( nameLength <= 0 || nameLength > FILE_MAX_NAME_SIZE )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	unsigned int networkId;
+	unsigned long long networkSize;
+	memcpy ( &networkId , payload , sizeof ( networkId ) );
+	memcpy ( &networkSize , payload + FRAME_FILE_ID_SIZE , sizeof ( networkSize ) );
+	*id = ntohl ( networkId );
+	*size = be64toh ( networkSize );
+
+	memcpy ( name , payload + FRAME_FILE_OFFER_HEADER_SIZE , nameLength );
+	name [ nameLength ] = 0;
+	return strlen ( name ) == ( size_t ) nameLength ? SUCCESS_OP_CODE : FAILURE_OP_CODE;
+}
+
+/* Copies the next chunk from the map into frame (FRAGMENT_MAX_DATAGRAM_SIZE
+ * bytes) behind its headers; returns the frame's length, 0 once the whole file
+ * has been handed out. */
+int FileTransferEncodeChunk ( FILE_TRANSFER *transfer , char *frame )
+{
+	unsigned long long offset = transfer -> numBytesDone;
+	if ( offset >= transfer -> size )
+	{
+		return 0;
+	}
+
+	int dataLength = transfer -> size - offset < FILE_CHUNK_DATA_SIZE ? ( int ) ( transfer -> size - offset ) : FILE_CHUNK_DATA_SIZE;
+
+	FRAME_HEADER header = {
+		.version = FRAME_PROTOCOL_VERSION ,
+		.type = FRAME_TYPE_FILE_CHUNK ,
+		.flags = FRAME_FLAG_UNORDERED ,
+		.sequence = 0 , // stamped on sending
+		.payloadLength = FRAME_FILE_CHUNK_HEADER_SIZE + dataLength
+	};
+	FrameEncodeHeader ( frame , &header );
+
+	unsigned int networkId = htonl ( transfer -> id );
+	unsigned long long networkOffset = htobe64 ( offset );
+	memcpy ( frame + FRAME_HEADER_SIZE , &networkId , sizeof ( networkId ) );
+	memcpy ( frame + FRAME_HEADER_SIZE + FRAME_FILE_ID_SIZE , &networkOffset , sizeof ( networkOffset ) );
+	memcpy ( frame + FILE_CHUNK_DATA_OFFSET , transfer -> map + offset , dataLength );
+
+	transfer -> numBytesDone += dataLength;
+	return FILE_CHUNK_DATA_OFFSET + dataLength;
+}
+
+/* Copies a chunk of this transfer into place. The reliable session delivers
+ * each chunk once, so counting the bytes written tells when the file is whole. */
+int FileTransferWriteChunk ( FILE_TRANSFER *transfer , const FRAME_HEADER *header , const char *payload )
+{
+	int dataLength = header -> payloadLength - FRAME_FILE_CHUNK_HEADER_SIZE;
+	if ( dataLength <= 0 || dataLength > FILE_CHUNK_DATA_SIZE || transfer -> fd < 0 )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	unsigned int networkId;
+	unsigned long long networkOffset;
+	memcpy ( &networkId , payload , sizeof ( networkId ) );
+	memcpy ( &networkOffset , payload + FRAME_FILE_ID_SIZE , sizeof ( networkOffset ) );
+	unsigned long long offset = be64toh ( networkOffset );
+
+	if ( ntohl ( networkId ) != transfer -> id || offset > transfer -> size || dataLength > transfer -> size - offset )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	memcpy ( transfer -> map + offset , payload + FRAME_FILE_CHUNK_HEADER_SIZE , dataLength );
+	transfer -> numBytesDone += dataLength;
+	return SUCCESS_OP_CODE;
+}
+
+/* Writes an answer (accepted or not) or a completion (accepted is ignored and
+ * sent as 1) for transfer id; returns its length, FILE_CONTROL_FRAME_SIZE. */
+int FileTransferEncodeControl ( char *frame , int type , unsigned int id , int accepted )
+{
+	FRAME_HEADER header = {
+		.version = FRAME_PROTOCOL_VERSION ,
+		.type = type ,
+		.flags = 0 ,
+		.sequence = 0 , // stamped on sending
+		.payloadLength = FRAME_FILE_ID_SIZE + 1
+	};
+	FrameEncodeHeader ( frame , &header );
+
+	unsigned int networkId = htonl ( id );
+	memcpy ( frame + FRAME_HEADER_SIZE , &networkId , sizeof ( networkId ) );
+	frame [ FRAME_HEADER_SIZE + FRAME_FILE_ID_SIZE ] = type == FRAME_TYPE_FILE_COMPLETE || accepted;
+
+	return FILE_CONTROL_FRAME_SIZE;
+}
+
+int FileTransferDecodeControl ( const FRAME_HEADER *header , const char *payload , unsigned int *id , int *accepted )
+{
+	if ( header -> payloadLength < FRAME_FILE_ID_SIZE + 1 )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	unsigned int networkId;
+	memcpy ( &networkId , payload , sizeof ( networkId ) );
+	*id = ntohl ( networkId );
+	*accepted = payload [ FRAME_FILE_ID_SIZE ] != 0;
+	return SUCCESS_OP_CODE;
+}
+
+static double FileTransferSeconds ( const FILE_TRANSFER *transfer )
+{
+	return ( StatsNow () - transfer -> startNs ) / 1e9;
+}
+
+static double FileTransferMBPerSecond ( const FILE_TRANSFER *transfer , double seconds )
+{
+	return seconds > 0 ? transfer -> numBytesDone / FILE_BYTES_PER_MB / seconds : 0;
+}
+
+/* "<verb> <name>: <percent>% of <size> MB, <rate> MB/s", no newline; returns its length. */
+int FileTransferFormatProgress ( const FILE_TRANSFER *transfer , const char *verb , char *buffer , int size )
+{
+	int percent = transfer -> size > 0 ? ( int ) ( transfer -> numBytesDone * 100 / transfer -> size ) : 100;
+	double seconds = FileTransferSeconds ( transfer );
+
+	int length = snprintf ( buffer , size , "%s %s: %d%% of %.1f MB, %.1f MB/s" ,
+		verb ,
+		transfer -> name ,
+		percent ,
+		transfer -> size / FILE_BYTES_PER_MB ,
+		FileTransferMBPerSecond ( transfer , seconds ) );
+	return length < size ? length : size - 1;
+}
+
+/* "<verb> <name>: <size> MB in <seconds> s, <rate> MB/s", no newline; returns its length. */
+int FileTransferFormatDone ( const FILE_TRANSFER *transfer , const char *verb , char *buffer , int size )
+{
+	double seconds = FileTransferSeconds ( transfer );
+
+	int length = snprintf ( buffer , size , "%s %s: %.1f MB in %.2f s, %.1f MB/s" ,
+		verb ,
+		transfer -> name ,
+		transfer -> size / FILE_BYTES_PER_MB ,
+		seconds ,
+		FileTransferMBPerSecond ( transfer , seconds ) );
+	return length < size ? length : size - 1;
+}
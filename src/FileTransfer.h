@@ -0,0 +1,71 @@
+/* Nic Pucci
+ * FILE TRANSFER HEADER
+ *
+ * Files are sent over the chat's own socket pair, in reliable mode. The sender
+ * offers the file (its size and name) and waits for the receiver to answer.
+ * Once accepted the file is streamed as chunk frames, each carrying its offset,
+ * and the reliable session's window paces them. Chunks are marked unordered, so
+ * the receiver writes every chunk into place the moment it arrives instead of
+ * holding the ones behind a lost chunk, and acknowledges the whole transfer
+ * once every byte is in.
+ *
+ * Neither end copies the file through read or write. The sender maps the
+ * source and copies each chunk straight from the page cache into its frame; the
+ * receiver creates the destination at its full size up front and maps it, so a
+ * chunk is one copy into place and running out of disk space is found before
+ * the transfer starts, not halfway through it.
+ *
+ * A transfer belongs to one thread at a time.
+*/
+
+#ifndef FILE_TRANSFER_H
+#define FILE_TRANSFER_H
+
+#include "Protocol.h"
+#include "Fragment.h"
+
+#define FILE_MAX_NAME_SIZE 255
+#define FILE_CHUNK_DATA_OFFSET ( FRAME_HEADER_SIZE + FRAME_FILE_CHUNK_HEADER_SIZE )
+#define FILE_CHUNK_DATA_SIZE ( FRAGMENT_MAX_DATAGRAM_SIZE - FILE_CHUNK_DATA_OFFSET ) // bytes in every chunk but the last
+#define FILE_MAX_OFFER_SIZE ( FRAME_HEADER_SIZE + FRAME_FILE_OFFER_HEADER_SIZE + FILE_MAX_NAME_SIZE )
+#define FILE_CONTROL_FRAME_SIZE ( FRAME_HEADER_SIZE + FRAME_FILE_ID_SIZE + 1 ) // an answer or a completion
+
+typedef struct fileTransfer
+{
+	unsigned int id;
+	char name [ FILE_MAX_NAME_SIZE + 1 ]; // as offered: the last part of the source's path
+	int fd; // -1 once closed
+	char *map; // NULL for an empty file
+	unsigned long long size;
+	unsigned long long numBytesDone; // queued by the sender, written by the receiver
+	unsigned long long startNs;
+	unsigned long long lastProgressNs;
+} FILE_TRANSFER;
+
+int FileTransferOpenSource ( FILE_TRANSFER *transfer , const char *path , unsigned int id );
+
+int FileTransferNameAllowed ( const char *name );
+
+int FileTransferCreateDestination ( FILE_TRANSFER *transfer , unsigned int id , const char *name , unsigned long long size );
+
+void FileTransferClose ( FILE_TRANSFER *transfer );
+
+void FileTransferAbandon ( FILE_TRANSFER *transfer );
+
+int FileTransferEncodeOffer ( const FILE_TRANSFER *transfer , char *frame );
+
+int FileTransferDecodeOffer ( const FRAME_HEADER *header , const char *payload , unsigned int *id , unsigned long long *size , char *name );
+
+int FileTransferEncodeChunk ( FILE_TRANSFER *transfer , char *frame );
+
+int FileTransferWriteChunk ( FILE_TRANSFER *transfer , const FRAME_HEADER *header , const char *payload );
+
+int FileTransferEncodeControl ( char *frame , int type , unsigned int id , int accepted );
+
+int FileTransferDecodeControl ( const FRAME_HEADER *header , const char *payload , unsigned int *id , int *accepted );
+
+int FileTransferFormatProgress ( const FILE_TRANSFER *transfer , const char *verb , char *buffer , int size );
+
+int FileTransferFormatDone ( const FILE_TRANSFER *transfer , const char *verb , char *buffer , int size );
+
+#endif
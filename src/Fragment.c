@@ -0,0 +1,254 @@
+/* Nic Pucci
+ * FRAGMENT IMPLEMENTATION
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "List.h"
+#include "Stats.h"
+#include "Fragment.h"
+
+const int REASSEMBLY_INITIAL_CAPACITY = 16 * FRAGMENT_DATA_SIZE; // doubled as later fragments come in
+
+/* Writes the frame and fragment headers in front of the textLength bytes
+ * already at frame + FRAGMENT_TEXT_OFFSET; returns the frame's length. */
+int FragmentEncode ( char *frame , unsigned int messageId , unsigned int index , int textLength , int last )
+{
+	FRAME_HEADER header = {
+		.version = FRAME_PROTOCOL_VERSION ,
+		.type = FRAME_TYPE_FRAGMENT ,
+		.flags = last ? FRAME_FLAG_LAST_FRAGMENT : 0 ,
+		.sequence = 0 , // stamped on sending
+		.payloadLength = FRAME_FRAGMENT_HEADER_SIZE + textLength
+	};
+	FrameEncodeHeader ( frame , &header );
+
+	unsigned int networkMessageId = htonl ( messageId );
+	unsigned int networkIndex = htonl ( index );
+	memcpy ( frame + FRAME_HEADER_SIZE , &networkMessageId , sizeof ( networkMessageId ) );
+	memcpy ( frame + FRAME_HEADER_SIZE + sizeof ( networkMessageId ) , &networkIndex , sizeof ( networkIndex ) );
+
+	return FRAGMENT_TEXT_OFFSET + textLength;
+}
+
+void ReassemblerInit ( REASSEMBLER *reassembler , int timeoutMs )
+{
+	memset ( reassembler , 0 , sizeof ( REASSEMBLER ) );
+	reassembler -> timeoutNs = ( unsigned long long ) timeoutMs * 1000000ULL;
+}
+
+static void DropReassembly ( REASSEMBLER *reassembler , REASSEMBLY *message )
+{
+	free ( message -> text );
+	reassembler -> numBufferedBytes -= message -> capacity;
+
+	message -> text = NULL;
+	message -> capacity = 0;
+	message -> inUse = 0;
+}
+
+void ReassemblerFree ( REASSEMBLER *reassembler )
+{
+	for ( int i = 0 ; i < REASSEMBLY_MAX_MESSAGES ; i++ )
+	{
+		DropReassembly ( reassembler , &reassembler -> messages [ i ] );
+	}
+}
+
+/* Gives up on the message, counting it as lost. */
+static void AbandonReassembly ( REASSEMBLER *reassembler , REASSEMBLY *message )
+{
+	DropReassembly ( reassembler , message );
+	StatsAdd ( STATS_REASSEMBLY_DROPS , 1 );
+}
+
+static void ExpireReassemblies ( REASSEMBLER *reassembler , unsigned long long nowNs )
+{
+	for ( int i = 0 ; i < REASSEMBLY_MAX_MESSAGES ; i++ )
+	{
+		REASSEMBLY *message = &reassembler -> messages [ i ];
+		if ( message -> inUse && nowNs - message -> lastArrivalNs > reassembler -> timeoutNs )
+		{
+			AbandonReassembly ( reassembler , message );
+		}
+	}
+}
+
+/* The message, other than keep, that has gone longest without a fragment;
+ * NULL if there is none. */
+static REASSEMBLY *OldestReassembly ( REASSEMBLER *reassembler , REASSEMBLY *keep )
+{
+	REASSEMBLY *oldest = NULL;
+	for ( int i = 0 ; i < REASSEMBLY_MAX_MESSAGES ; i++ )
+	{
+		REASSEMBLY *message = &reassembler -> messages [ i ];
+		if ( message -> inUse && message != keep && ( !oldest || message -> lastArrivalNs < oldest -> lastArrivalNs ) )
+		{
+			oldest = message;
+		}
+	}
+
+	return oldest;
+}
+
+/* The message a fragment belongs to, started if it is the first fragment in;
+ * with every slot taken the oldest message makes way. */
+static REASSEMBLY *FindReassembly ( REASSEMBLER *reassembler , unsigned long long sender , unsigned int messageId , unsigned long long nowNs )
+{
+	REASSEMBLY *unused = NULL;
+	for ( int i = 0 ; i < REASSEMBLY_MAX_MESSAGES ; i++ )
+	{
+		REASSEMBLY *message = &reassembler -> messages [ i ];
+		if ( !message -> inUse )
+		{
+			unused = unused ? unused : message;
+			continue;
+		}
+
+		if ( message -> sender == sender && message -> messageId == messageId )
+		{
+			return message;
+		}
+	}
+
+	if ( !unused )
+	{
+		unused = OldestReassembly ( reassembler , NULL );
+		AbandonReassembly ( reassembler , unused );
+	}
+
+	unused -> inUse = 1;
+	unused -> sender = sender;
+	unused -> messageId = messageId;
+	unused -> length = 0;
+	unused -> numFragments = 0;
+	unused -> numReceived = 0;
+	unused -> lastArrivalNs = nowNs;
+	memset ( unused -> received , 0 , sizeof ( unused -> received ) );
+	return unused;
+}
+
+/* Makes the message's buffer hold at least length bytes, doubling it. Other
+ * messages, longest waiting first, are given up if the growth would go over
+ * REASSEMBLY_MAX_BYTES. */
+static int GrowReassembly ( REASSEMBLER *reassembler , REASSEMBLY *message , int length )
+{
+	if ( message -> text && length <= message -> capacity )
+	{
+		return SUCCESS_OP_CODE;
+	}
+
+	int capacity = message -> capacity > 0 ? message -> capacity : REASSEMBLY_INITIAL_CAPACITY;
+	while ( capacity < length )
+	{
+		capacity *= 2;
+	}
+
+	if ( capacity > FRAGMENT_MAX_MESSAGE_SIZE )
+	{
+		capacity = FRAGMENT_MAX_MESSAGE_SIZE;
+	}
+
+	while ( reassembler -> numBufferedBytes + capacity - message -> capacity > REASSEMBLY_MAX_BYTES )
+	{
+		REASSEMBLY *oldest = OldestReassembly ( reassembler , message );
+		if ( !oldest )
+		{
+			return FAILURE_OP_CODE;
+		}
+
+		AbandonReassembly ( reassembler , oldest );
+	}
+
+	char *text = realloc ( message -> text , capacity );
+	if ( !text )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	reassembler -> numBufferedBytes += capacity - message -> capacity;
+	message -> text = text;
+	message -> capacity = capacity;
+	return SUCCESS_OP_CODE;
+}
+
+/* Takes one fragment frame from sender (any number that tells senders apart).
+ * Returns the whole message once its last missing fragment is in, setting
+ * *messageLength; the caller frees it. Returns NULL otherwise. */
+char *ReassemblerAdd ( REASSEMBLER *reassembler , unsigned long long sender , const FRAME_HEADER *header , const char *payload , int *messageLength )
+{
+	if ( header -> payloadLength < FRAME_FRAGMENT_HEADER_SIZE )
+	{
+		return NULL;
+	}
+
+	unsigned int messageId;
+	unsigned int index;
+	memcpy ( &messageId , payload , sizeof ( messageId ) );
+	memcpy ( &index , payload + sizeof ( messageId ) , sizeof ( index ) );
+	messageId = ntohl ( messageId );
+	index = ntohl ( index );
+
+	const char *text = payload + FRAME_FRAGMENT_HEADER_SIZE;
+	int textLength = header -> payloadLength - FRAME_FRAGMENT_HEADER_SIZE;
+	int last = ( header -> flags & FRAME_FLAG_LAST_FRAGMENT ) != 0;
+
+	// every fragment but the last is full, which is what puts index * FRAGMENT_DATA_SIZE where its text goes
+	if ( index >= FRAGMENT_MAX_FRAGMENTS || textLength > FRAGMENT_DATA_SIZE || ( !last && textLength != FRAGMENT_DATA_SIZE ) )
+	{
+		return NULL;
+	}
+
+	unsigned long long nowNs = StatsNow ();
+	ExpireReassemblies ( reassembler , nowNs );
+
+	REASSEMBLY *message = FindReassembly ( reassembler , sender , messageId , nowNs );
+	if ( message -> received [ index >> 3 ] & ( 1 << ( index & 7 ) ) )
+	{
+		return NULL; // a duplicate
+	}
+
+	int offset = index * FRAGMENT_DATA_SIZE;
+	int end = offset + textLength;
+
+	// nothing may lie past the last fragment, and there is only one last fragment
+	int pastLast = message -> numFragments > 0 && ( int ) index >= message -> numFragments;
+	int lastTooEarly = last && ( message -> numFragments > 0 || message -> length > end );
+	if ( pastLast || lastTooEarly || GrowReassembly ( reassembler , message , end ) == FAILURE_OP_CODE )
+	{
+		AbandonReassembly ( reassembler , message );
+		return NULL;
+	}
+
+	memcpy ( message -> text + offset , text , textLength );
+	message -> received [ index >> 3 ] |= 1 << ( index & 7 );
+	message -> numReceived += 1;
+	message -> lastArrivalNs = nowNs;
+
+	if ( end > message -> length )
+	{
+		message -> length = end;
+	}
+
+	if ( last )
+	{
+		message -> numFragments = index + 1;
+	}
+
+	if ( message -> numFragments == 0 || message -> numReceived < message -> numFragments )
+	{
+		return NULL;
+	}
+
+	// handed over whole: the buffer leaves the reassembler with the message
+	char *whole = message -> text;
+	*messageLength = message -> length;
+	reassembler -> numBufferedBytes -= message -> capacity;
+	message -> text = NULL;
+	message -> capacity = 0;
+	message -> inUse = 0;
+
+	StatsAdd ( STATS_MESSAGES_REASSEMBLED , 1 );
+	return whole;
+}
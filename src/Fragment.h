@@ -0,0 +1,65 @@
+/* Nic Pucci
+ * FRAGMENT HEADER
+ *
+ * Messages too long for one frame travel as fragment frames. Every fragment but
+ * the last carries exactly FRAGMENT_DATA_SIZE bytes of text, so with the
+ * headers it fills one Ethernet-sized datagram and never needs IP
+ * fragmentation, and its index alone says where its text goes. The sender
+ * queues each fragment as soon as it is full, so a long message streams
+ * through the send path (and, in reliable mode, its window) instead of being
+ * buffered whole first.
+ *
+ * The receiver copies each fragment's text into place in a buffer of its
+ * message and hands the whole buffer on once every fragment up to the last one
+ * is in, whatever order they came in. Reassembly is bounded: a message may be
+ * at most FRAGMENT_MAX_FRAGMENTS fragments long, at most REASSEMBLY_MAX_MESSAGES
+ * are put together at once within REASSEMBLY_MAX_BYTES of buffers, and a
+ * message that has not grown for the timeout is given up. When a limit is reached the
+ * message that has waited longest is dropped.
+ *
+ * A reassembler belongs to one thread.
+*/
+
+#ifndef FRAGMENT_H
+#define FRAGMENT_H
+
+#include "Protocol.h"
+
+#define FRAGMENT_MAX_DATAGRAM_SIZE ( 1472 - FRAME_SEALED_OVERHEAD ) // a 1500 byte MTU less the IPv4 and UDP headers, with room to be sealed
+#define FRAGMENT_TEXT_OFFSET ( FRAME_HEADER_SIZE + FRAME_FRAGMENT_HEADER_SIZE )
+#define FRAGMENT_DATA_SIZE ( FRAGMENT_MAX_DATAGRAM_SIZE - FRAGMENT_TEXT_OFFSET ) // text in every fragment but the last
+#define FRAGMENT_MAX_MESSAGE_SIZE ( 16 << 20 )
+#define FRAGMENT_MAX_FRAGMENTS ( FRAGMENT_MAX_MESSAGE_SIZE / FRAGMENT_DATA_SIZE ) // per message; a longer one is cut after this many
+#define REASSEMBLY_MAX_MESSAGES 16
+#define REASSEMBLY_MAX_BYTES ( 64 << 20 )
+
+typedef struct reassembly
+{
+	int inUse;
+	unsigned long long sender;
+	unsigned int messageId;
+	char *text;
+	int capacity;
+	int length; // text up to the furthest fragment in; the message's length once the last is in
+	int numFragments; // 0 until the last fragment is in
+	int numReceived;
+	unsigned long long lastArrivalNs;
+	unsigned char received [ ( FRAGMENT_MAX_FRAGMENTS + 7 ) / 8 ];
+} REASSEMBLY;
+
+typedef struct reassembler
+{
+	REASSEMBLY messages [ REASSEMBLY_MAX_MESSAGES ];
+	long long numBufferedBytes;
+	unsigned long long timeoutNs;
+} REASSEMBLER;
+
+int FragmentEncode ( char *frame , unsigned int messageId , unsigned int index , int textLength , int last );
+
+void ReassemblerInit ( REASSEMBLER *reassembler , int timeoutMs );
+
+void ReassemblerFree ( REASSEMBLER *reassembler );
+
+char *ReassemblerAdd ( REASSEMBLER *reassembler , unsigned long long sender , const FRAME_HEADER *header , const char *payload , int *messageLength );
+
+#endif
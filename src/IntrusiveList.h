@@ -0,0 +1,227 @@
+/* Nic Pucci
+ * INTRUSIVE LIST HEADER
+ *
+ * Header-only, type-specialised doubly linked list. The links live inside the
+ * element (an INTRUSIVE_LINK field), so an element costs no NODE, no payload
+ * pointer and no allocation of its own, and a walk touches one cache line per
+ * element instead of two. INTRUSIVE_LIST_DEFINE generates a list type and
+ * static inline operations for one element type; the equality test and the
+ * destructor are named at definition time and called directly, so they inline
+ * instead of going through function pointers.
+ *
+ * Unlike LIST there is no cursor: positions are element pointers. An element
+ * can be in at most one list per link field at a time.
+ *
+ *   typedef struct peer {
+ *       INTRUSIVE_LINK ( struct peer ) link;
+ *       ...
+ *   } PEER;
+ *
+ *   static inline int PeerEqual ( PEER *peer , void *arg ) { ... }
+ *   static inline void PeerFree ( PEER *peer ) { ... }
+ *
+ *   INTRUSIVE_LIST_DEFINE ( PeerList , PEER_LIST , PEER , link , PeerEqual , PeerFree )
+ *
+ * gives PEER_LIST and PeerListInit, PeerListCount, PeerListFirst, PeerListLast,
+ * PeerListNext, PeerListPrev, PeerListAppend, PeerListPrepend,
+ * PeerListInsertBefore, PeerListInsertAfter, PeerListRemove, PeerListTrim,
+ * PeerListTrimHead, PeerListConcat, PeerListSearch and PeerListFree.
+*/
+
+#ifndef INTRUSIVE_LIST_H
+#define INTRUSIVE_LIST_H
+
+#include <stddef.h>
+
+#define INTRUSIVE_LINK( ITEM_TYPE ) \
+	struct { \
+		ITEM_TYPE *prev; \
+		ITEM_TYPE *next; \
+	}
+
+/* for ( item = first ; item ; item = next ) over a generated list */
+#define INTRUSIVE_LIST_FOR_EACH( item , list , linkField ) \
+	for ( ( item ) = ( list ) -> head ; ( item ) ; ( item ) = ( item ) -> linkField.next )
+
+#define INTRUSIVE_LIST_DEFINE( Prefix , LIST_TYPE , ITEM_TYPE , linkField , ItemEqual , ItemFree ) \
+ \
+typedef struct \
+{ \
+	ITEM_TYPE *head; \
+	ITEM_TYPE *tail; \
+	int count; \
+} LIST_TYPE; \
+ \
+static inline void Prefix##Init ( LIST_TYPE *list ) \
+{ \
+	list -> head = NULL; \
+	list -> tail = NULL; \
+	list -> count = 0; \
+} \
+ \
+static inline int Prefix##Count ( LIST_TYPE *list ) \
+{ \
+	return list -> count; \
+} \
+ \
+static inline ITEM_TYPE *Prefix##First ( LIST_TYPE *list ) \
+{ \
+	return list -> head; \
+} \
+ \
+static inline ITEM_TYPE *Prefix##Last ( LIST_TYPE *list ) \
+{ \
+	return list -> tail; \
+} \
+ \
+static inline ITEM_TYPE *Prefix##Next ( ITEM_TYPE *item ) \
+{ \
+	return item -> linkField.next; \
+} \
+ \
+static inline ITEM_TYPE *Prefix##Prev ( ITEM_TYPE *item ) \
+{ \
+	return item -> linkField.prev; \
+} \
+ \
+/* Links item between prevItem and nextItem (either may be NULL). */ \
+static inline void Prefix##Link ( LIST_TYPE *list , ITEM_TYPE *prevItem , ITEM_TYPE *item , ITEM_TYPE *nextItem ) \
+{ \
+	item -> linkField.prev = prevItem; \
+	item -> linkField.next = nextItem; \
+ \
+	if ( prevItem ) \
+	{ \
+		prevItem -> linkField.next = item; \
+	} \
+	else \
+	{ \
+		list -> head = item; \
+	} \
+ \
+	if ( nextItem ) \
+	{ \
+		nextItem -> linkField.prev = item; \
+	} \
+	else \
+	{ \
+		list -> tail = item; \
+	} \
+ \
+	list -> count += 1; \
+} \
+ \
+static inline void Prefix##Append ( LIST_TYPE *list , ITEM_TYPE *item ) \
+{ \
+	Prefix##Link ( list , list -> tail , item , NULL ); \
+} \
+ \
+static inline void Prefix##Prepend ( LIST_TYPE *list , ITEM_TYPE *item ) \
+{ \
+	Prefix##Link ( list , NULL , item , list -> head ); \
+} \
+ \
+static inline void Prefix##InsertBefore ( LIST_TYPE *list , ITEM_TYPE *at , ITEM_TYPE *item ) \
+{ \
+	Prefix##Link ( list , at -> linkField.prev , item , at ); \
+} \
+ \
+static inline void Prefix##InsertAfter ( LIST_TYPE *list , ITEM_TYPE *at , ITEM_TYPE *item ) \
+{ \
+	Prefix##Link ( list , at , item , at -> linkField.next ); \
+} \
+ \
+/* Unlinks item, which must be in list; returns it. */ \
+static inline ITEM_TYPE *Prefix##Remove ( LIST_TYPE *list , ITEM_TYPE *item ) \
+{ \
+	ITEM_TYPE *prevItem = item -> linkField.prev; \
+	ITEM_TYPE *nextItem = item -> linkField.next; \
+ \
+	if ( prevItem ) \
+	{ \
+		prevItem -> linkField.next = nextItem; \
+	} \
+	else \
+	{ \
+		list -> head = nextItem; \
+	} \
+ \
+	if ( nextItem ) \
+	{ \
+		nextItem -> linkField.prev = prevItem; \
+	} \
+	else \
+	{ \
+		list -> tail = prevItem; \
+	} \
+ \
+	item -> linkField.prev = NULL; \
+	item -> linkField.next = NULL; \
+	list -> count -= 1; \
+	return item; \
+} \
+ \
+/* Removes and returns the last element, or NULL if the list is empty. */ \
+static inline ITEM_TYPE *Prefix##Trim ( LIST_TYPE *list ) \
+{ \
+	return list -> tail ? Prefix##Remove ( list , list -> tail ) : NULL; \
+} \
+ \
+/* Removes and returns the first element, or NULL if the list is empty. */ \
+static inline ITEM_TYPE *Prefix##TrimHead ( LIST_TYPE *list ) \
+{ \
+	return list -> head ? Prefix##Remove ( list , list -> head ) : NULL; \
+} \
+ \
+/* Moves every element of list2 onto the end of list1 in O(1); list2 ends empty. */ \
+static inline void Prefix##Concat ( LIST_TYPE *list1 , LIST_TYPE *list2 ) \
+{ \
+	if ( !list2 -> head ) \
+	{ \
+		return; \
+	} \
+ \
+	list2 -> head -> linkField.prev = list1 -> tail; \
+	if ( list1 -> tail ) \
+	{ \
+		list1 -> tail -> linkField.next = list2 -> head; \
+	} \
+	else \
+	{ \
+		list1 -> head = list2 -> head; \
+	} \
+ \
+	list1 -> tail = list2 -> tail; \
+	list1 -> count += list2 -> count; \
+	Prefix##Init ( list2 ); \
+} \
+ \
+/* First element from the head for which ItemEqual ( element , comparisonArg ), or NULL. */ \
+static inline ITEM_TYPE *Prefix##Search ( LIST_TYPE *list , void *comparisonArg ) \
+{ \
+	for ( ITEM_TYPE *item = list -> head ; item ; item = item -> linkField.next ) \
+	{ \
+		if ( ItemEqual ( item , comparisonArg ) ) \
+		{ \
+			return item; \
+		} \
+	} \
+ \
+	return NULL; \
+} \
+ \
+/* Hands every element to ItemFree, tail first like ListFree, and empties the list. */ \
+static inline void Prefix##Free ( LIST_TYPE *list ) \
+{ \
+	ITEM_TYPE *item = list -> tail; \
+	while ( item ) \
+	{ \
+		ITEM_TYPE *prevItem = item -> linkField.prev; \
+		ItemFree ( item ); \
+		item = prevItem; \
+	} \
+ \
+	Prefix##Init ( list ); \
+}
+
+#endif
@@ -3,44 +3,35 @@
 */
 
 #include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "List.h"
+#include "Pool.h"
+#include "ListKeyIndex.h"
+#include "ListEpoch.h"
 
 const int SUCCESS_OP_CODE = 0;
 const int FAILURE_OP_CODE = -1;
 
-/* NUM OF ALLOCATIONS (Only for defining size of static arrays at compile-time) */
-#define MAX_NUM_NODES_ALLOC 500
-#define MAX_NUM_LISTS_ALLOC 500
-
-/* NUM OF ALLOCATIONS AS INTS (For functions and usage) */
-const int MAX_NUM_NODES = MAX_NUM_NODES_ALLOC;
-const int MAX_NUM_LISTS = MAX_NUM_LISTS_ALLOC;
+/* POOL CHUNK SIZES (the pools grow by doubling chunks as needed) */
+const unsigned int INITIAL_NODE_CHUNK_SIZE = 512;
+const unsigned int INITIAL_LIST_CHUNK_SIZE = 64;
 
 /* INITIALIZE MEMORY STATE FLAGS */
 const int INITIALIZED_FREE_MEM_ALLOC = 1;
-int initializedFreeMemAllocFlag = 0;
 
 /* ALLOCATED MEMORY */
-NODE allocNodesArr [ MAX_NUM_NODES_ALLOC ];
-int *freeNodeIndexesPtrArr [ MAX_NUM_NODES_ALLOC ];
-
-int topFreeNodeIndex = -1; 
+pthread_once_t initFreeAllocMemoryOnce = PTHREAD_ONCE_INIT;
+int initializedFreeMemAllocFlag = 0;
 
-LIST allocListsArr [ MAX_NUM_LISTS_ALLOC ];
-int *freeListIndexesPtrArr [ MAX_NUM_LISTS_ALLOC ];
-int topFreeListIndex = -1;
+POOL nodePool;
+POOL listPool;
 
 void DEBUG_PRINT_FREE_ALLOC_INFO () {
 	printf ( "\n-------------- DEBUG_PRINT_FREE_ALLOC_INFO\n" );
 
-	int totalFreeNodes = topFreeNodeIndex + 1;
-	int totalFreeListHeads = topFreeListIndex + 1;
-
-	printf ( "Total Free Nodes: %d\n", totalFreeNodes );
-	printf ( "Total Free List Heads: %d\n\n", totalFreeListHeads );
-
-	printf ( "topFreeNodeIndex: %d\n", topFreeNodeIndex );
-	printf ( "topFreeListIndex: %d\n\n", topFreeListIndex );
+	printf ( "Total Allocated Nodes: %lu\n", PoolNumObjects ( &nodePool ) );
+	printf ( "Total Allocated List Heads: %lu\n\n", PoolNumObjects ( &listPool ) );
 }
 
 void ClearNode ( NODE *node ) 
@@ -80,33 +71,13 @@ int SetList ( LIST *list , NODE *initHeadNodePtr )
 
 NODE *PopNextFreeNode () 
 {
-	int stackEmpty = topFreeNodeIndex < 0;
-	if ( stackEmpty ) 
-	{
-		return NULL;
-	}
-
-	int freeIndex = *freeNodeIndexesPtrArr [ topFreeNodeIndex ];
-	NODE* freeNode = &allocNodesArr [ freeIndex ];
-
-	topFreeNodeIndex -= 1;
-
+	NODE *freeNode = ( NODE *) PoolAlloc ( &nodePool );
 	return freeNode;
 }
 
 LIST *PopNextFreeList () 
 {
-	int stackEmpty = topFreeListIndex < 0;
-	if ( stackEmpty ) 
-	{
-		return NULL;
-	}
-
-	int freeIndex = *freeListIndexesPtrArr [ topFreeListIndex ];
-	LIST *freeList = &allocListsArr [ freeIndex ];
-
-	topFreeListIndex -= 1;
-
+	LIST *freeList = ( LIST *) PoolAlloc ( &listPool );
 	return freeList;
 }
 
@@ -117,23 +88,8 @@ void PushFreedNode ( NODE *node )
 		return;
 	}
 
-	int* nodeIndex = &node -> allocID;
-	if ( *nodeIndex >= MAX_NUM_NODES ) 
-	{
-		return;
-	}
-
-	int stackFull = topFreeNodeIndex >= MAX_NUM_NODES - 1;
-	if ( stackFull ) 
-	{
-		return;
-	}
-
 	ClearNode ( node );
-
-	topFreeNodeIndex += 1;
-	freeNodeIndexesPtrArr [ topFreeNodeIndex ] = nodeIndex;
-
+	PoolFree ( &nodePool , node );
 }
 
 void PushFreedList ( LIST *list ) 
@@ -143,23 +99,8 @@ void PushFreedList ( LIST *list )
 		return;
 	}
 
-	int* listIndex = &list -> allocID;
-	if ( *listIndex >= MAX_NUM_LISTS ) 
-	{
-		return;
-	}
-
-	int stackFull = topFreeListIndex >= MAX_NUM_LISTS - 1;
-	if ( stackFull ) 
-	{
-		return;
-	}
-
 	SetList ( list , NULL );
-
-	topFreeListIndex += 1;
-	freeListIndexesPtrArr [ topFreeListIndex ] = listIndex;
-
+	PoolFree ( &listPool , list );
 }
 
 void FreeAllocNode ( NODE *node ) 
@@ -176,6 +117,16 @@ void FreeAllocNode ( NODE *node )
 	PushFreedNode ( node );
 }
 
+void ReclaimNode ( void *object ) 
+{
+	FreeAllocNode ( ( NODE *) object );
+}
+
+void ReclaimList ( void *object ) 
+{
+	PushFreedList ( ( LIST *) object );
+}
+
 void FreeAllocList ( LIST *list ) 
 {
 	if ( !list ) 
@@ -184,58 +135,148 @@ void FreeAllocList ( LIST *list )
 	}
 
 	SetList ( list , NULL );
+	KeyIndexFree ( list -> keyIndex );
+	list -> keyIndex = NULL;
+
+	// a reader may still be about to load its head
+	if ( list -> concurrentReads ) 
+	{
+		list -> concurrentReads = 0;
+		ListEpochRetire ( &ReclaimList , list );
+		return;
+	}
 
 	PushFreedList ( list );
 }
 
-NODE *GetNewNode ( void *item ) {
+/* Orders a node's own fields before the store that links it in, so a concurrent
+ * reader that reaches it sees it whole. Compiles to nothing on x86. */
+static inline void PublishLinks () 
+{
+	atomic_thread_fence ( memory_order_release );
+}
+
+static inline NODE *LoadLink ( NODE **link ) 
+{
+	return __atomic_load_n ( link , __ATOMIC_ACQUIRE );
+}
+
+/* KEY INDEX HOOKS: every node joining or leaving an indexed list goes through
+ * GetNewNode/ReleaseNode, or is re-indexed by the bulk moves below. */
+void IndexNode ( LIST *list , NODE *node ) 
+{
+	if ( list -> keyIndex ) 
+	{
+		KeyIndexInsert ( list -> keyIndex , list -> keyIndex -> keyOf ( node -> valuePtr ) , ( unsigned long ) node );
+	}
+}
+
+void UnindexNode ( LIST *list , NODE *node ) 
+{
+	if ( list -> keyIndex ) 
+	{
+		KeyIndexErase ( list -> keyIndex , list -> keyIndex -> keyOf ( node -> valuePtr ) , ( unsigned long ) node );
+	}
+}
+
+/* The index is grown before a node is taken, so a node is never linked without
+ * its index entry. */
+NODE *GetNewNode ( LIST *list , void *item ) {
+	if ( list -> keyIndex && KeyIndexReserve ( list -> keyIndex , 1 ) == FAILURE_OP_CODE ) 
+	{
+		return NULL;
+	}
+
 	NODE *node = PopNextFreeNode ();
 	if ( node ) 
 	{
 		node -> valuePtr = item;
+		IndexNode ( list , node );
+		PublishLinks ();
 	}
 
 	return node;
 }
 
+/* node must already be unlinked. With concurrent reads it keeps its links until
+ * no reader can be standing on it. */
+void RecycleNode ( LIST *list , NODE *node ) 
+{
+	if ( list -> concurrentReads ) 
+	{
+		ListEpochRetire ( &ReclaimNode , node );
+		return;
+	}
+
+	FreeAllocNode ( node );
+}
+
+void ReleaseNode ( LIST *list , NODE *node ) 
+{
+	UnindexNode ( list , node );
+	RecycleNode ( list , node );
+}
+
+/* Indexes the nodes from firstNode on that just moved into list. If the index
+ * cannot grow it is dropped rather than left incomplete. */
+void IndexMovedNodes ( LIST *list , NODE *firstNode , int numMoved ) 
+{
+	if ( !list -> keyIndex ) 
+	{
+		return;
+	}
+
+	if ( KeyIndexReserve ( list -> keyIndex , numMoved ) == FAILURE_OP_CODE ) 
+	{
+		ListDetachIndex ( list );
+		return;
+	}
+
+	NODE *node = firstNode;
+	for ( int i = 0 ; i < numMoved ; i++ ) 
+	{
+		IndexNode ( list , node );
+		node = node -> nextNodePtr;
+	}
+}
+
 LIST *GetNewList () {
 	LIST *list = PopNextFreeList ();
 	return list;
 }
 
-void InitAllFreeNodes () 
+void InitFreeNode ( void *object , unsigned long objectID ) 
 {
-	for ( int i = 0 ; i < MAX_NUM_NODES ; i++ ) 
-	{
-		NODE *node = &allocNodesArr [ i ];
-		node -> allocID = i;
-		PushFreedNode ( node );
-	}
+	NODE *node = ( NODE *) object;
+	ClearNode ( node );
+	node -> allocID = ( int ) objectID;
 }
 
-void InitAllFreeLists () 
+void InitFreeList ( void *object , unsigned long objectID ) 
 {
-	for ( int i = 0 ; i < MAX_NUM_LISTS ; i++ ) 
-	{
-		LIST *list = &allocListsArr [ i ];
-		list -> currentNodeState = BEFORE_HEAD;
-		list -> currentCapacity = 0;
-		list -> allocID = i;
-		PushFreedList ( list );
-	}
+	LIST *list = ( LIST *) object;
+	SetList ( list , NULL );
+	list -> keyIndex = NULL;
+	list -> concurrentReads = 0;
+	list -> allocID = ( int ) objectID;
 }
 
 void InitFreeAllocMemory () 
 {
-	InitAllFreeNodes (); 
-	InitAllFreeLists ();
+	int nodesReady = PoolInit ( &nodePool , sizeof ( NODE ) , INITIAL_NODE_CHUNK_SIZE , &InitFreeNode );
+	int listsReady = PoolInit ( &listPool , sizeof ( LIST ) , INITIAL_LIST_CHUNK_SIZE , &InitFreeList );
+
+	if ( nodesReady == SUCCESS_OP_CODE && listsReady == SUCCESS_OP_CODE ) 
+	{
+		initializedFreeMemAllocFlag = INITIALIZED_FREE_MEM_ALLOC;
+	}
 }
 
 LIST *ListCreate () {
+	pthread_once ( &initFreeAllocMemoryOnce , &InitFreeAllocMemory );
 	if ( initializedFreeMemAllocFlag != INITIALIZED_FREE_MEM_ALLOC ) 
 	{
-		InitFreeAllocMemory ();
-		initializedFreeMemAllocFlag = INITIALIZED_FREE_MEM_ALLOC;
+		return NULL;
 	}
 
 	LIST* list = GetNewList ();
@@ -367,24 +408,18 @@ int InsertNode ( NODE* firstNode , NODE* lastNode , NODE* insertNode ) {
 		return FAILURE_OP_CODE;
 	}
 
+	insertNode -> prevNodePtr = firstNode;
+	insertNode -> nextNodePtr = lastNode;
+	PublishLinks ();
+
 	if ( firstNode ) 
 	{
 		firstNode -> nextNodePtr = insertNode;
-		insertNode -> prevNodePtr = firstNode;
-	}
-	else 
-	{
-		insertNode -> prevNodePtr = NULL;
 	}
 
 	if ( lastNode ) 
 	{
 		lastNode -> prevNodePtr = insertNode;
-		insertNode -> nextNodePtr = lastNode;
-	}
-	else 
-	{
-		insertNode -> nextNodePtr = NULL;
 	}
 
 	return SUCCESS_OP_CODE;
@@ -397,7 +432,7 @@ int ListAppend ( LIST *list , void *item )
 		return FAILURE_OP_CODE;
 	}
 
-	NODE* newItemNode = GetNewNode ( item );
+	NODE* newItemNode = GetNewNode ( list , item );
 	int noFreeNodesLeft = !newItemNode;
 	if ( noFreeNodesLeft ) 
 	{
@@ -410,6 +445,7 @@ int ListAppend ( LIST *list , void *item )
 	}
 
 	newItemNode -> prevNodePtr = list -> tailNodePtr;
+	PublishLinks ();
 	list -> tailNodePtr -> nextNodePtr = newItemNode;
 
 	list -> tailNodePtr = newItemNode;
@@ -432,7 +468,7 @@ int ListPrepend ( LIST *list , void *item )
 		return FAILURE_OP_CODE;
 	}
 
-	NODE* newItemNode = GetNewNode ( item );
+	NODE* newItemNode = GetNewNode ( list , item );
 	int noFreeNodesLeft = !newItemNode;
 	if ( noFreeNodesLeft ) 
 	{
@@ -445,6 +481,7 @@ int ListPrepend ( LIST *list , void *item )
 	}
 
 	newItemNode -> nextNodePtr = list -> headNodePtr;
+	PublishLinks ();
 	list -> headNodePtr -> prevNodePtr = newItemNode;
 
 	list -> headNodePtr = newItemNode;
@@ -477,7 +514,7 @@ int ListInsert ( LIST *list , void *item )
 		return ListAppend ( list , item );
 	}
 
-	NODE* newItemNode = GetNewNode ( item );
+	NODE* newItemNode = GetNewNode ( list , item );
 	int noFreeNodesLeft = !newItemNode;
 	if ( noFreeNodesLeft ) 
 	{
@@ -486,15 +523,16 @@ int ListInsert ( LIST *list , void *item )
 
 	if ( list -> currentCapacity <= 0 ) 
 	{
-		return SetList ( list , item );
+		return SetList ( list , newItemNode );
 	}
 
 	NODE* prevNode = list -> currentNodePtr -> prevNodePtr;
 	newItemNode -> prevNodePtr = prevNode;
-	prevNode -> nextNodePtr = newItemNode;
+	newItemNode -> nextNodePtr = list -> currentNodePtr;
+	PublishLinks ();
 
+	prevNode -> nextNodePtr = newItemNode;
 	list -> currentNodePtr -> prevNodePtr = newItemNode;
-	newItemNode -> nextNodePtr = list -> currentNodePtr;
 
 	list -> currentNodePtr = newItemNode;
 	list -> currentCapacity += 1;
@@ -518,7 +556,7 @@ int ListAdd ( LIST *list , void *item )
 		return ListAppend ( list , item );
 	}
 
-	NODE* newItemNode = GetNewNode ( item );
+	NODE* newItemNode = GetNewNode ( list , item );
 	int noFreeNodesLeft = !newItemNode;
 	if ( noFreeNodesLeft ) 
 	{
@@ -584,7 +622,7 @@ void *ListRemove ( LIST *list )
 	list -> currentCapacity -= 1;
 
 	void *value = oldCurrentNode -> valuePtr;
-	FreeAllocNode ( oldCurrentNode );
+	ReleaseNode ( list , oldCurrentNode );
 	
 	return value;
 }
@@ -627,7 +665,7 @@ void *ListTrim ( LIST *list )
 	}
 
 	void *value = trimmedNode -> valuePtr;
-	FreeAllocNode ( trimmedNode );
+	ReleaseNode ( list , trimmedNode );
 
 	return value;
 }
@@ -644,6 +682,8 @@ void ListFree ( LIST *list , void ( *itemFree ) ( void* ) )
 		return;
 	}
 
+	ListDetachIndex ( list ); // dropped whole rather than emptied entry by entry
+
 	int numNodes = list -> currentCapacity;
 
 	for ( int i = 0 ; i < numNodes ; i++ ) 
@@ -665,6 +705,11 @@ void ListConcat ( LIST *list1 , LIST **list2 )
 		return;
 	}
 
+	IndexMovedNodes ( list1 , (* list2 ) -> headNodePtr , (* list2 ) -> currentCapacity );
+
+	(* list2 ) -> headNodePtr -> prevNodePtr = list1 -> tailNodePtr; // NULL when list1 is empty
+	PublishLinks ();
+
 	if ( list1 -> currentCapacity <= 0 ) 
 	{
 		list1 -> headNodePtr = (* list2 ) -> headNodePtr;
@@ -712,4 +757,467 @@ void *ListSearch ( LIST *list , int ( *comparator ) ( void* , void* ) , void *co
 	ListLast ( list );
 	ListNext ( list );
 	return NULL;
-}
\ No newline at end of file
+}
+
+/* Appends items in order, linking the new nodes among themselves before the
+ * list is touched once. Stops early if the pool runs out; returns how many items
+ * were appended. The cursor ends on the last appended item. */
+int ListAppendBatch ( LIST *list , void **items , int numItems ) 
+{
+	if ( !list || !items || numItems <= 0 ) 
+	{
+		return 0;
+	}
+
+	NODE *firstNode = NULL;
+	NODE *lastNode = NULL;
+	int numAppended = 0;
+
+	while ( numAppended < numItems ) 
+	{
+		NODE *node = GetNewNode ( list , items [ numAppended ] );
+		if ( !node ) 
+		{
+			break;
+		}
+
+		node -> prevNodePtr = lastNode;
+		if ( lastNode ) 
+		{
+			lastNode -> nextNodePtr = node;
+		}
+		else 
+		{
+			firstNode = node;
+		}
+
+		lastNode = node;
+		numAppended += 1;
+	}
+
+	if ( numAppended == 0 ) 
+	{
+		return 0;
+	}
+
+	firstNode -> prevNodePtr = list -> tailNodePtr; // NULL when the list is empty
+	PublishLinks ();
+
+	if ( list -> currentCapacity <= 0 ) 
+	{
+		list -> headNodePtr = firstNode;
+	}
+	else 
+	{
+		list -> tailNodePtr -> nextNodePtr = firstNode;
+	}
+
+	list -> tailNodePtr = lastNode;
+	list -> currentNodePtr = lastNode;
+	list -> currentNodeState = WITHIN_LIST;
+	list -> currentCapacity += numAppended;
+
+	return numAppended;
+}
+
+/* Removes up to maxItems from the tail into items, tail first (the order that
+ * repeated ListTrim calls would give). Returns how many were removed. */
+int ListTrimBatch ( LIST *list , void **items , int maxItems ) 
+{
+	if ( !list || !items || maxItems <= 0 ) 
+	{
+		return 0;
+	}
+
+	int numTrimmed = 0;
+	NODE *node = list -> tailNodePtr;
+	NODE *trimmedHead = NULL;
+
+	while ( node && numTrimmed < maxItems ) 
+	{
+		items [ numTrimmed ] = node -> valuePtr;
+		numTrimmed += 1;
+		UnindexNode ( list , node );
+
+		trimmedHead = node;
+		node = node -> prevNodePtr;
+	}
+
+	if ( !node ) 
+	{
+		SetList ( list , NULL );
+	}
+	else 
+	{
+		node -> nextNodePtr = NULL;
+		list -> tailNodePtr = node;
+		list -> currentNodePtr = node;
+		list -> currentCapacity -= numTrimmed;
+	}
+
+	// recycled only once cut off from the list
+	while ( trimmedHead ) 
+	{
+		NODE *nextNode = trimmedHead -> nextNodePtr;
+		RecycleNode ( list , trimmedHead );
+		trimmedHead = nextNode;
+	}
+
+	return numTrimmed;
+}
+
+/* Detaches the current item and everything after it into a new list, which is
+ * returned (NULL if there is no current item or no list head is free). The links
+ * are cut in O(1); the moved items are counted by walking out from the cursor in
+ * both directions at once, so that costs the shorter of the two sides. The
+ * original list's cursor is left on its new tail. */
+LIST *ListSplit ( LIST *list ) 
+{
+	if ( !list || list -> currentNodeState != WITHIN_LIST || !list -> currentNodePtr ) 
+	{
+		return NULL;
+	}
+
+	LIST *splitList = ListCreate ();
+	if ( !splitList ) 
+	{
+		return NULL;
+	}
+
+	NODE *splitNode = list -> currentNodePtr;
+
+	int numBefore = 0;
+	int numAfter = 1;
+	NODE *backward = splitNode -> prevNodePtr;
+	NODE *forward = splitNode -> nextNodePtr;
+	while ( backward && forward ) 
+	{
+		numBefore += 1;
+		numAfter += 1;
+		backward = backward -> prevNodePtr;
+		forward = forward -> nextNodePtr;
+	}
+
+	if ( !backward ) 
+	{
+		numAfter = list -> currentCapacity - numBefore;
+	}
+
+	// the moved nodes leave this list's index; the new list starts without one
+	if ( list -> keyIndex ) 
+	{
+		NODE *node = splitNode;
+		for ( int i = 0 ; i < numAfter ; i++ ) 
+		{
+			UnindexNode ( list , node );
+			node = node -> nextNodePtr;
+		}
+	}
+
+	splitList -> headNodePtr = splitNode;
+	splitList -> tailNodePtr = list -> tailNodePtr;
+	splitList -> currentNodePtr = splitNode;
+	splitList -> currentNodeState = WITHIN_LIST;
+	splitList -> currentCapacity = numAfter;
+
+	NODE *newTail = splitNode -> prevNodePtr;
+	splitNode -> prevNodePtr = NULL;
+
+	if ( !newTail ) 
+	{
+		SetList ( list , NULL );
+		return splitList;
+	}
+
+	newTail -> nextNodePtr = NULL;
+	list -> tailNodePtr = newTail;
+	list -> currentNodePtr = newTail;
+	list -> currentCapacity -= numAfter;
+
+	return splitList;
+}
+
+/* Moves every item of *list2 into list right after the current item (before the
+ * head if the cursor is before it, after the tail if beyond it) in O(1), then
+ * frees *list2 and sets it to NULL like ListConcat. The cursor ends on the last
+ * spliced item. */
+void ListSplice ( LIST *list , LIST **list2 ) 
+{
+	if ( !list || !list2 || !( *list2 ) ) 
+	{
+		return;
+	}
+
+	LIST *source = *list2;
+	if ( source -> currentCapacity <= 0 ) 
+	{
+		FreeAllocList ( source );
+		*list2 = NULL;
+		return;
+	}
+
+	IndexMovedNodes ( list , source -> headNodePtr , source -> currentCapacity );
+
+	NODE *prevNode;
+	NODE *nextNode;
+	if ( list -> currentCapacity <= 0 || list -> currentNodeState == BEFORE_HEAD ) 
+	{
+		prevNode = NULL;
+		nextNode = list -> headNodePtr;
+	}
+	else if ( list -> currentNodeState == AFTER_TAIL || !list -> currentNodePtr ) 
+	{
+		prevNode = list -> tailNodePtr;
+		nextNode = NULL;
+	}
+	else 
+	{
+		prevNode = list -> currentNodePtr;
+		nextNode = list -> currentNodePtr -> nextNodePtr;
+	}
+
+	source -> headNodePtr -> prevNodePtr = prevNode;
+	source -> tailNodePtr -> nextNodePtr = nextNode;
+	PublishLinks ();
+
+	if ( prevNode ) 
+	{
+		prevNode -> nextNodePtr = source -> headNodePtr;
+	}
+	else 
+	{
+		list -> headNodePtr = source -> headNodePtr;
+	}
+
+	if ( nextNode ) 
+	{
+		nextNode -> prevNodePtr = source -> tailNodePtr;
+	}
+	else 
+	{
+		list -> tailNodePtr = source -> tailNodePtr;
+	}
+
+	list -> currentNodePtr = source -> tailNodePtr;
+	list -> currentNodeState = WITHIN_LIST;
+	list -> currentCapacity += source -> currentCapacity;
+
+	SetList ( source , NULL );
+	FreeAllocList ( source );
+	*list2 = NULL;
+}
+
+/* Builds a hash index over the list from keyOf ( item ), replacing any index it
+ * had. From then on ListSearchKey and ListRemoveKey are O(1) and every list
+ * operation keeps the index in step (moving items in with ListConcat or
+ * ListSplice costs O(moved) to index them). An item's key must not change
+ * while it is in the list; several items may share a key. */
+int ListAttachIndex ( LIST *list , unsigned long long ( *keyOf ) ( void *item ) ) 
+{
+	if ( !list || !keyOf ) 
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	ListDetachIndex ( list );
+
+	list -> keyIndex = KeyIndexCreate ( keyOf , list -> currentCapacity );
+	if ( !list -> keyIndex ) 
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	for ( NODE *node = list -> headNodePtr ; node ; node = node -> nextNodePtr ) 
+	{
+		IndexNode ( list , node );
+	}
+
+	return SUCCESS_OP_CODE;
+}
+
+void ListDetachIndex ( LIST *list ) 
+{
+	if ( !list ) 
+	{
+		return;
+	}
+
+	KeyIndexFree ( list -> keyIndex );
+	list -> keyIndex = NULL;
+}
+
+/* Makes an item with this key current and returns it. A miss returns NULL and
+ * leaves the cursor alone. Needs an attached index. */
+void *ListSearchKey ( LIST *list , unsigned long long key ) 
+{
+	if ( !list || !list -> keyIndex ) 
+	{
+		return NULL;
+	}
+
+	NODE *node = ( NODE *) KeyIndexFind ( list -> keyIndex , key );
+	if ( !node ) 
+	{
+		return NULL;
+	}
+
+	list -> currentNodePtr = node;
+	list -> currentNodeState = WITHIN_LIST;
+	return node -> valuePtr;
+}
+
+/* Removes and returns an item with this key (NULL if none). The cursor stays
+ * where it was, unless it was on that item, in which case it moves on like
+ * ListRemove. Needs an attached index. */
+void *ListRemoveKey ( LIST *list , unsigned long long key ) 
+{
+	if ( !list || !list -> keyIndex ) 
+	{
+		return NULL;
+	}
+
+	NODE *node = ( NODE *) KeyIndexFind ( list -> keyIndex , key );
+	if ( !node ) 
+	{
+		return NULL;
+	}
+
+	NODE *savedCurrentNode = list -> currentNodePtr;
+	list -> currentNodePtr = node;
+
+	void *value = ListRemove ( list );
+
+	if ( savedCurrentNode != node ) 
+	{
+		list -> currentNodePtr = savedCurrentNode;
+	}
+
+	return value;
+}
+
+/* ITERATORS: same moves as ListFirst/ListNext/..., but on the iterator's own
+ * cursor, and every link is loaded with acquire so a LIST_ITER can walk a list
+ * with concurrent reads enabled while its writer runs. */
+void ListIterInit ( LIST_ITER *iter , LIST *list ) 
+{
+	if ( !iter ) 
+	{
+		return;
+	}
+
+	iter -> list = list;
+	iter -> currentNodePtr = NULL;
+	iter -> currentNodeState = BEFORE_HEAD;
+}
+
+void *IterMoveTo ( LIST_ITER *iter , NODE *node , enum CURRENT_NODE_STATE stateIfNone ) 
+{
+	iter -> currentNodePtr = node;
+	if ( !node ) 
+	{
+		iter -> currentNodeState = stateIfNone;
+		return NULL;
+	}
+
+	iter -> currentNodeState = WITHIN_LIST;
+	return node -> valuePtr;
+}
+
+void *ListIterFirst ( LIST_ITER *iter ) 
+{
+	if ( !iter || !iter -> list ) 
+	{
+		return NULL;
+	}
+
+	return IterMoveTo ( iter , LoadLink ( &iter -> list -> headNodePtr ) , AFTER_TAIL );
+}
+
+void *ListIterLast ( LIST_ITER *iter ) 
+{
+	if ( !iter || !iter -> list ) 
+	{
+		return NULL;
+	}
+
+	return IterMoveTo ( iter , LoadLink ( &iter -> list -> tailNodePtr ) , BEFORE_HEAD );
+}
+
+void *ListIterNext ( LIST_ITER *iter ) 
+{
+	if ( !iter || iter -> currentNodeState == AFTER_TAIL ) 
+	{
+		return NULL;
+	}
+
+	if ( iter -> currentNodeState == BEFORE_HEAD ) 
+	{
+		return ListIterFirst ( iter );
+	}
+
+	return IterMoveTo ( iter , LoadLink ( &iter -> currentNodePtr -> nextNodePtr ) , AFTER_TAIL );
+}
+
+void *ListIterPrev ( LIST_ITER *iter ) 
+{
+	if ( !iter || iter -> currentNodeState == BEFORE_HEAD ) 
+	{
+		return NULL;
+	}
+
+	if ( iter -> currentNodeState == AFTER_TAIL ) 
+	{
+		return ListIterLast ( iter );
+	}
+
+	return IterMoveTo ( iter , LoadLink ( &iter -> currentNodePtr -> prevNodePtr ) , BEFORE_HEAD );
+}
+
+void *ListIterCurr ( LIST_ITER *iter ) 
+{
+	if ( !iter || iter -> currentNodeState != WITHIN_LIST ) 
+	{
+		return NULL;
+	}
+
+	return iter -> currentNodePtr -> valuePtr;
+}
+
+/* Searches forward from the iterator's current item (the head if it is before
+ * it) and stops on the first match; a miss leaves it beyond the end. Calling
+ * ListIterNext then searching again finds the next match. */
+void *ListIterSearch ( LIST_ITER *iter , int ( *comparator ) ( void* , void* ) , void *comparisonArg ) 
+{
+	if ( !iter || !comparator ) 
+	{
+		return NULL;
+	}
+
+	void *item = iter -> currentNodeState == WITHIN_LIST ? ListIterCurr ( iter ) : ListIterNext ( iter );
+	while ( iter -> currentNodeState == WITHIN_LIST ) 
+	{
+		if ( ( *comparator ) ( item , comparisonArg ) ) 
+		{
+			return item;
+		}
+
+		item = ListIterNext ( iter );
+	}
+
+	return NULL;
+}
+
+/* From now on nodes unlinked from this list (and the LIST head itself, once
+ * freed) are retired through ListEpoch.c instead of being reused at once. The
+ * list's own mutators still need a single writer at a time; ListSearchKey,
+ * ListRemoveKey and the LIST cursor are the writer's, not the readers'. */
+int ListEnableConcurrentReads ( LIST *list ) 
+{
+	if ( !list ) 
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	list -> concurrentReads = 1;
+	return SUCCESS_OP_CODE;
+}
@@ -6,8 +6,8 @@
 #define LIST_H 
 
 /* PUBLIC ACCESS CONSTANT VARIABLES FOR TEST DRIVER */
-const int SUCCESS_OP_CODE;
-const int FAILURE_OP_CODE;
+extern const int SUCCESS_OP_CODE;
+extern const int FAILURE_OP_CODE;
 
 enum CURRENT_NODE_STATE {
 	BEFORE_HEAD,
@@ -15,12 +15,43 @@ enum CURRENT_NODE_STATE {
 	AFTER_TAIL
 };
 
+struct listKeyIndex; // ListKeyIndex.h
+
+#ifdef LIST_COMPACT
+
+/* Compact backend (ListCompact.c, built with LIST_BACKEND=compact): a node is a
+ * 32-bit index into struct-of-arrays storage, 0 meaning no node. */
+typedef unsigned int LIST_INDEX;
+
+typedef struct list 
+{
+	LIST_INDEX currentIndex;
+	LIST_INDEX headIndex;
+	LIST_INDEX tailIndex;
+	int currentCapacity;
+	enum CURRENT_NODE_STATE currentNodeState;
+	struct listKeyIndex *keyIndex; // NULL unless ListAttachIndex was called
+	int concurrentReads; // set by ListEnableConcurrentReads
+	int allocID; // ID within its pool
+} LIST;
+
+/* External cursor: any number can walk one list without touching its own
+ * cursor. */
+typedef struct listIter
+{
+	LIST *list;
+	LIST_INDEX currentIndex;
+	enum CURRENT_NODE_STATE currentNodeState;
+} LIST_ITER;
+
+#else
+
 typedef struct node
 {
 	void *valuePtr;
 	struct node *prevNodePtr;	
 	struct node *nextNodePtr;
-	int allocID; // index in its array
+	int allocID; // ID within its pool
 } NODE;
 
 typedef struct list 
@@ -30,9 +61,22 @@ typedef struct list
 	NODE *tailNodePtr;
 	int currentCapacity;
 	enum CURRENT_NODE_STATE currentNodeState;
-	int allocID; // index in its array
+	struct listKeyIndex *keyIndex; // NULL unless ListAttachIndex was called
+	int concurrentReads; // set by ListEnableConcurrentReads
+	int allocID; // ID within its pool
 } LIST;
 
+/* External cursor: any number can walk one list without touching its own
+ * cursor. */
+typedef struct listIter
+{
+	LIST *list;
+	NODE *currentNodePtr;
+	enum CURRENT_NODE_STATE currentNodeState;
+} LIST_ITER;
+
+#endif
+
 
 LIST *ListCreate ();
 
@@ -66,4 +110,46 @@ void *ListTrim ( LIST *list );
 
 void *ListSearch ( LIST *list , int ( *comparator ) ( void* , void* ) , void* comparisonArg );
 
+int ListAppendBatch ( LIST *list , void **items , int numItems );
+
+int ListTrimBatch ( LIST *list , void **items , int maxItems );
+
+LIST *ListSplit ( LIST *list );
+
+void ListSplice ( LIST *list , LIST **list2 );
+
+int ListAttachIndex ( LIST *list , unsigned long long ( *keyOf ) ( void *item ) );
+
+void ListDetachIndex ( LIST *list );
+
+void *ListSearchKey ( LIST *list , unsigned long long key );
+
+void *ListRemoveKey ( LIST *list , unsigned long long key );
+
+void ListIterInit ( LIST_ITER *iter , LIST *list );
+
+void *ListIterFirst ( LIST_ITER *iter );
+
+void *ListIterLast ( LIST_ITER *iter );
+
+void *ListIterNext ( LIST_ITER *iter );
+
+void *ListIterPrev ( LIST_ITER *iter );
+
+void *ListIterCurr ( LIST_ITER *iter );
+
+void *ListIterSearch ( LIST_ITER *iter , int ( *comparator ) ( void* , void* ) , void *comparisonArg );
+
+/* Read-mostly mode (ListEpoch.c): one writer at a time mutates the list as
+ * usual while any number of threads walk it with LIST_ITERs inside
+ * ListReadBegin/ListReadEnd, without a lock. Nodes the writer unlinks are only
+ * reused once no reader can still be on them. */
+int ListEnableConcurrentReads ( LIST *list );
+
+int ListReadBegin ();
+
+void ListReadEnd ();
+
+void ListEpochSynchronize ();
+
 #endif
\ No newline at end of file
@@ -0,0 +1,659 @@
+/* Nic Pucci
+ * LIST BENCH IMPLEMENTATION
+ *
+ * Microbenchmarks for the List ADT. Every case is run in rounds of
+ * set up / timed run / tear down until enough operations were measured, and
+ * reports per operation: wall time, cache misses (perf_event, when the kernel
+ * exposes hardware counters) and allocations. Allocations are counted by
+ * wrapping the allocator at link time (see the Makefile), split into heap
+ * calls and pool (node/list head) allocations. Only the timed part is counted.
+ * The intrusive-* cases run the same workloads on an IntrusiveList.h list of
+ * elements that carry their own links.
+ *
+ * usage: listbench [case name ...]   (no names = every case)
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "List.h"
+#include "Pool.h"
+#include "IntrusiveList.h"
+
+const int LIST_BENCH_SIZES [] = { 16 , 1024 , 65536 , 1 << 20 };
+const int LIST_BENCH_NUM_SIZES = sizeof ( LIST_BENCH_SIZES ) / sizeof ( LIST_BENCH_SIZES [ 0 ] );
+const int LIST_BENCH_MAX_SIZE = 1 << 20;
+
+const long LIST_BENCH_MIN_OPS = 1 << 20; // each case/size runs rounds until it has measured this many ...
+const unsigned long long LIST_BENCH_MAX_NS = 300000000ULL; // ... or has run this long, set up included
+const long LIST_BENCH_MIN_ROUNDS = 3;
+const long LIST_BENCH_WALK_BUDGET = 1 << 24; // node visits per round for the O(n) per op cases
+#define LIST_BENCH_NUM_SCATTER_LISTS 64
+#define LIST_BENCH_BATCH_SIZE 32
+
+typedef struct listBenchCase
+{
+	const char *name;
+	const char *description;
+	void ( *setUp ) ( int size );
+	long ( *run ) ( int size ); // returns the number of operations done
+	void ( *tearDown ) ();
+} LIST_BENCH_CASE;
+
+typedef struct listBenchCounts
+{
+	unsigned long heapAllocs;
+	unsigned long poolAllocs;
+} LIST_BENCH_COUNTS;
+
+/* ALLOCATION COUNTING (linked with -Wl,--wrap=...) */
+int countingAllocations = 0;
+LIST_BENCH_COUNTS allocationCounts;
+
+void *__real_malloc ( size_t size );
+void *__real_calloc ( size_t count , size_t size );
+void *__real_aligned_alloc ( size_t alignment , size_t size );
+void *__real_PoolAlloc ( POOL *pool );
+
+void *__wrap_malloc ( size_t size )
+{
+	allocationCounts.heapAllocs += countingAllocations;
+	return __real_malloc ( size );
+}
+
+void *__wrap_calloc ( size_t count , size_t size )
+{
+	allocationCounts.heapAllocs += countingAllocations;
+	return __real_calloc ( count , size );
+}
+
+void *__wrap_aligned_alloc ( size_t alignment , size_t size )
+{
+	allocationCounts.heapAllocs += countingAllocations;
+	return __real_aligned_alloc ( alignment , size );
+}
+
+void *__wrap_PoolAlloc ( POOL *pool )
+{
+	allocationCounts.poolAllocs += countingAllocations;
+	return __real_PoolAlloc ( pool );
+}
+
+/* BENCH STATE */
+int *benchItems; // values stored in the lists; the list only holds pointers to them
+LIST *benchList;
+LIST *scatterLists [ LIST_BENCH_NUM_SCATTER_LISTS ];
+unsigned int benchSeed = 1;
+volatile unsigned long benchSink; // keeps walks from being optimised away
+
+typedef struct benchElement
+{
+	INTRUSIVE_LINK ( struct benchElement ) link;
+	int value;
+} BENCH_ELEMENT;
+
+static inline int BenchElementEqual ( BENCH_ELEMENT *element , void *target )
+{
+	return element -> value == *( int *) target;
+}
+
+static inline void BenchElementFree ( BENCH_ELEMENT *element )
+{
+}
+
+INTRUSIVE_LIST_DEFINE ( ElementList , ELEMENT_LIST , BENCH_ELEMENT , link , BenchElementEqual , BenchElementFree )
+
+BENCH_ELEMENT *benchElements; // benchItems again, as intrusive elements
+int *benchOrder; // a random permutation, for scattering elements
+ELEMENT_LIST benchElementList;
+
+int cacheMissFD = -1;
+
+unsigned long long NowNs ()
+{
+	struct timespec now;
+	clock_gettime ( CLOCK_MONOTONIC , &now );
+	return ( unsigned long long ) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* User space cache misses of this thread, or -1 if there is no such counter. */
+void OpenCacheMissCounter ()
+{
+	struct perf_event_attr attr;
+	memset ( &attr , 0 , sizeof ( attr ) );
+	attr.size = sizeof ( attr );
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	cacheMissFD = syscall ( SYS_perf_event_open , &attr , 0 , -1 , -1 , 0 );
+}
+
+void StartCounting ()
+{
+	if ( cacheMissFD >= 0 )
+	{
+		ioctl ( cacheMissFD , PERF_EVENT_IOC_ENABLE , 0 );
+	}
+
+	countingAllocations = 1;
+}
+
+void StopCounting ()
+{
+	countingAllocations = 0;
+
+	if ( cacheMissFD >= 0 )
+	{
+		ioctl ( cacheMissFD , PERF_EVENT_IOC_DISABLE , 0 );
+	}
+}
+
+unsigned long long ReadCacheMisses ()
+{
+	unsigned long long value = 0;
+	if ( cacheMissFD < 0 || read ( cacheMissFD , &value , sizeof ( value ) ) != sizeof ( value ) )
+	{
+		return 0;
+	}
+
+	return value;
+}
+
+void NoFree ( void *item )
+{
+}
+
+int ItemEqual ( void *item , void *target )
+{
+	return *( int *) item == *( int *) target;
+}
+
+unsigned long long ItemKey ( void *item )
+{
+	return ( unsigned long long ) *( int *) item;
+}
+
+void FillList ( LIST *list , int size )
+{
+	for ( int i = 0 ; i < size ; i++ )
+	{
+		ListAppend ( list , &benchItems [ i ] );
+	}
+}
+
+long WalkBudgetOps ( int size )
+{
+	long ops = LIST_BENCH_WALK_BUDGET / size;
+	return ops > 0 ? ops : 1;
+}
+
+/* CASES */
+void SetUpEmpty ( int size )
+{
+	benchList = ListCreate ();
+}
+
+void SetUpFilled ( int size )
+{
+	benchList = ListCreate ();
+	FillList ( benchList , size );
+}
+
+void SetUpIndexed ( int size )
+{
+	SetUpFilled ( size );
+	ListAttachIndex ( benchList , &ItemKey );
+}
+
+void SetUpConcurrent ( int size )
+{
+	SetUpFilled ( size );
+	ListEnableConcurrentReads ( benchList );
+}
+
+void SetUpElementsEmpty ( int size )
+{
+	ElementListInit ( &benchElementList );
+}
+
+void SetUpElementsFilled ( int size )
+{
+	ElementListInit ( &benchElementList );
+	for ( int i = 0 ; i < size ; i++ )
+	{
+		ElementListAppend ( &benchElementList , &benchElements [ i ] );
+	}
+}
+
+/* Elements linked in random memory order, the intrusive analogue of walk-scattered. */
+void SetUpElementsScattered ( int size )
+{
+	for ( int i = 0 ; i < size ; i++ )
+	{
+		benchOrder [ i ] = i;
+	}
+
+	for ( int i = size - 1 ; i > 0 ; i-- )
+	{
+		int j = rand_r ( &benchSeed ) % ( i + 1 );
+		int swap = benchOrder [ i ];
+		benchOrder [ i ] = benchOrder [ j ];
+		benchOrder [ j ] = swap;
+	}
+
+	ElementListInit ( &benchElementList );
+	for ( int i = 0 ; i < size ; i++ )
+	{
+		ElementListAppend ( &benchElementList , &benchElements [ benchOrder [ i ] ] );
+	}
+}
+
+/* Nodes of one list end up spread over the pool in random order, as they do
+ * after a long run of interleaved inserts and removes on many lists. */
+void SetUpScattered ( int size )
+{
+	for ( int i = 0 ; i < LIST_BENCH_NUM_SCATTER_LISTS ; i++ )
+	{
+		scatterLists [ i ] = ListCreate ();
+	}
+
+	for ( int i = 0 ; i < size ; i++ )
+	{
+		ListAppend ( scatterLists [ rand_r ( &benchSeed ) % LIST_BENCH_NUM_SCATTER_LISTS ] , &benchItems [ i ] );
+	}
+
+	benchList = scatterLists [ 0 ];
+	for ( int i = 1 ; i < LIST_BENCH_NUM_SCATTER_LISTS ; i++ )
+	{
+		ListConcat ( benchList , &scatterLists [ i ] );
+	}
+}
+
+void SetUpConcat ( int size )
+{
+	int listSize = size / LIST_BENCH_NUM_SCATTER_LISTS;
+	if ( listSize < 1 )
+	{
+		listSize = 1;
+	}
+
+	for ( int i = 0 ; i < LIST_BENCH_NUM_SCATTER_LISTS ; i++ )
+	{
+		scatterLists [ i ] = ListCreate ();
+		FillList ( scatterLists [ i ] , listSize );
+	}
+
+	benchList = scatterLists [ 0 ];
+}
+
+void TearDownList ()
+{
+	ListFree ( benchList , &NoFree );
+	benchList = NULL;
+}
+
+void TearDownElements ()
+{
+	ElementListFree ( &benchElementList );
+}
+
+void TearDownNothing ()
+{
+	benchList = NULL;
+}
+
+long RunAppend ( int size )
+{
+	for ( int i = 0 ; i < size ; i++ )
+	{
+		ListAppend ( benchList , &benchItems [ i ] );
+	}
+
+	return size;
+}
+
+long RunPrepend ( int size )
+{
+	for ( int i = 0 ; i < size ; i++ )
+	{
+		ListPrepend ( benchList , &benchItems [ i ] );
+	}
+
+	return size;
+}
+
+long RunAppendBatch ( int size )
+{
+	void *batch [ LIST_BENCH_BATCH_SIZE ];
+
+	for ( int i = 0 ; i < size ; i += LIST_BENCH_BATCH_SIZE )
+	{
+		int batchSize = size - i < LIST_BENCH_BATCH_SIZE ? size - i : LIST_BENCH_BATCH_SIZE;
+		for ( int j = 0 ; j < batchSize ; j++ )
+		{
+			batch [ j ] = &benchItems [ i + j ];
+		}
+
+		ListAppendBatch ( benchList , batch , batchSize );
+	}
+
+	return size;
+}
+
+long RunTrimBatch ( int size )
+{
+	void *batch [ LIST_BENCH_BATCH_SIZE ];
+
+	int numTrimmed;
+	while ( ( numTrimmed = ListTrimBatch ( benchList , batch , LIST_BENCH_BATCH_SIZE ) ) > 0 )
+	{
+		benchSink += ( unsigned long ) batch [ numTrimmed - 1 ];
+	}
+
+	return size;
+}
+
+long RunTrim ( int size )
+{
+	for ( int i = 0 ; i < size ; i++ )
+	{
+		benchSink += ( unsigned long ) ListTrim ( benchList );
+	}
+
+	return size;
+}
+
+/* How the chat queues used a LIST: producers prepend, the consumer trims. */
+long RunFifo ( int size )
+{
+	for ( int i = 0 ; i < size ; i++ )
+	{
+		ListPrepend ( benchList , &benchItems [ i ] );
+		benchSink += ( unsigned long ) ListTrim ( benchList );
+	}
+
+	return size;
+}
+
+/* Moves the cursor to a random item, removes it and appends it back. */
+long RunRandomRemove ( int size )
+{
+	long ops = WalkBudgetOps ( size ) * 2;
+	if ( ops > size )
+	{
+		ops = size;
+	}
+
+	for ( long op = 0 ; op < ops ; op++ )
+	{
+		int position = rand_r ( &benchSeed ) % size;
+
+		ListFirst ( benchList );
+		for ( int i = 0 ; i < position ; i++ )
+		{
+			ListNext ( benchList );
+		}
+
+		void *item = ListRemove ( benchList );
+		ListAppend ( benchList , item );
+	}
+
+	return ops;
+}
+
+long RunSearch ( int size )
+{
+	long ops = WalkBudgetOps ( size ) * 2;
+
+	for ( long op = 0 ; op < ops ; op++ )
+	{
+		int target = rand_r ( &benchSeed ) % size;
+		benchSink += ( unsigned long ) ListSearch ( benchList , &ItemEqual , &target );
+	}
+
+	return ops;
+}
+
+long RunSearchKey ( int size )
+{
+	for ( int i = 0 ; i < size ; i++ )
+	{
+		benchSink += ( unsigned long ) ListSearchKey ( benchList , rand_r ( &benchSeed ) % size );
+	}
+
+	return size;
+}
+
+long RunWalk ( int size )
+{
+	void *item = ListFirst ( benchList );
+	while ( item )
+	{
+		benchSink += *( int *) item;
+		item = ListNext ( benchList );
+	}
+
+	return size;
+}
+
+/* What a concurrent reader pays: a read section plus acquire loads per link. */
+long RunIterWalk ( int size )
+{
+	ListReadBegin ();
+
+	LIST_ITER iter;
+	ListIterInit ( &iter , benchList );
+
+	void *item = ListIterNext ( &iter );
+	while ( item )
+	{
+		benchSink += *( int *) item;
+		item = ListIterNext ( &iter );
+	}
+
+	ListReadEnd ();
+	return size;
+}
+
+long RunElementAppend ( int size )
+{
+	for ( int i = 0 ; i < size ; i++ )
+	{
+		ElementListAppend ( &benchElementList , &benchElements [ i ] );
+	}
+
+	return size;
+}
+
+long RunElementFifo ( int size )
+{
+	for ( int i = 0 ; i < size ; i++ )
+	{
+		BENCH_ELEMENT *element = ElementListTrim ( &benchElementList );
+		ElementListPrepend ( &benchElementList , element );
+		benchSink += element -> value;
+	}
+
+	return size;
+}
+
+long RunElementSearch ( int size )
+{
+	long ops = WalkBudgetOps ( size ) * 2;
+
+	for ( long op = 0 ; op < ops ; op++ )
+	{
+		int target = rand_r ( &benchSeed ) % size;
+		benchSink += ( unsigned long ) ElementListSearch ( &benchElementList , &target );
+	}
+
+	return ops;
+}
+
+long RunElementWalk ( int size )
+{
+	BENCH_ELEMENT *element;
+	INTRUSIVE_LIST_FOR_EACH ( element , &benchElementList , link )
+	{
+		benchSink += element -> value;
+	}
+
+	return size;
+}
+
+long RunConcat ( int size )
+{
+	for ( int i = 1 ; i < LIST_BENCH_NUM_SCATTER_LISTS ; i++ )
+	{
+		ListConcat ( benchList , &scatterLists [ i ] );
+	}
+
+	return LIST_BENCH_NUM_SCATTER_LISTS - 1;
+}
+
+long RunFree ( int size )
+{
+	ListFree ( benchList , &NoFree );
+	return size;
+}
+
+const LIST_BENCH_CASE LIST_BENCH_CASES [] = {
+	{ "append" , "ListAppend onto a growing list" , SetUpEmpty , RunAppend , TearDownList } ,
+	{ "prepend" , "ListPrepend onto a growing list" , SetUpEmpty , RunPrepend , TearDownList } ,
+	{ "trim" , "ListTrim until empty" , SetUpFilled , RunTrim , TearDownList } ,
+	{ "append-batch" , "ListAppendBatch, 32 items per call" , SetUpEmpty , RunAppendBatch , TearDownList } ,
+	{ "trim-batch" , "ListTrimBatch, 32 items per call, until empty" , SetUpFilled , RunTrimBatch , TearDownList } ,
+	{ "fifo" , "ListPrepend + ListTrim at a steady depth" , SetUpFilled , RunFifo , TearDownList } ,
+	{ "random-remove" , "cursor to a random item, ListRemove, ListAppend it back" , SetUpFilled , RunRandomRemove , TearDownList } ,
+	{ "search" , "ListSearch for a random item" , SetUpFilled , RunSearch , TearDownList } ,
+	{ "search-key" , "ListSearchKey for a random item on an indexed list" , SetUpIndexed , RunSearchKey , TearDownList } ,
+	{ "walk" , "ListFirst/ListNext over a list built in order" , SetUpFilled , RunWalk , TearDownList } ,
+	{ "iter-walk" , "LIST_ITER walk in a read section, concurrent reads enabled" , SetUpConcurrent , RunIterWalk , TearDownList } ,
+	{ "walk-scattered" , "ListFirst/ListNext over nodes spread across the pool" , SetUpScattered , RunWalk , TearDownList } ,
+	{ "intrusive-append" , "IntrusiveList append onto a growing list" , SetUpElementsEmpty , RunElementAppend , TearDownElements } ,
+	{ "intrusive-fifo" , "IntrusiveList prepend + trim at a steady depth" , SetUpElementsFilled , RunElementFifo , TearDownElements } ,
+	{ "intrusive-search" , "IntrusiveList search (inlined equality) for a random item" , SetUpElementsFilled , RunElementSearch , TearDownElements } ,
+	{ "intrusive-walk" , "IntrusiveList walk over elements linked in memory order" , SetUpElementsFilled , RunElementWalk , TearDownElements } ,
+	{ "intrusive-walk-scattered" , "IntrusiveList walk over elements linked in random order" , SetUpElementsScattered , RunElementWalk , TearDownElements } ,
+	{ "concat" , "ListConcat of 64 lists into one" , SetUpConcat , RunConcat , TearDownList } ,
+	{ "free" , "ListFree of a full list" , SetUpFilled , RunFree , TearDownNothing }
+};
+const int LIST_BENCH_NUM_CASES = sizeof ( LIST_BENCH_CASES ) / sizeof ( LIST_BENCH_CASES [ 0 ] );
+
+void RunBenchCase ( const LIST_BENCH_CASE *benchCase , int size )
+{
+	unsigned long long elapsedNs = 0;
+	unsigned long long cacheMisses = 0;
+	long numOps = 0;
+	long numRounds = 0;
+	memset ( &allocationCounts , 0 , sizeof ( allocationCounts ) );
+	unsigned long long caseStartNs = NowNs ();
+
+	while ( ( numOps < LIST_BENCH_MIN_OPS && NowNs () - caseStartNs < LIST_BENCH_MAX_NS ) || numRounds < LIST_BENCH_MIN_ROUNDS )
+	{
+		benchCase -> setUp ( size );
+
+		unsigned long long missesBefore = ReadCacheMisses ();
+		StartCounting ();
+		unsigned long long startNs = NowNs ();
+
+		numOps += benchCase -> run ( size );
+
+		elapsedNs += NowNs () - startNs;
+		StopCounting ();
+		cacheMisses += ReadCacheMisses () - missesBefore;
+
+		benchCase -> tearDown ();
+		numRounds += 1;
+	}
+
+	char missesText [ 32 ] = "n/a";
+	if ( cacheMissFD >= 0 )
+	{
+		snprintf ( missesText , sizeof ( missesText ) , "%.3f" , ( double ) cacheMisses / numOps );
+	}
+
+	printf (
+		"%-24s %8d %10ld %10.2f %12s %12.4f %12.4f\n" ,
+		benchCase -> name ,
+		size ,
+		numOps ,
+		( double ) elapsedNs / numOps ,
+		missesText ,
+		( double ) allocationCounts.heapAllocs / numOps ,
+		( double ) allocationCounts.poolAllocs / numOps
+	);
+	fflush ( stdout );
+}
+
+int CaseSelected ( const char *name , int argc , char *argv [] )
+{
+	if ( argc < 2 )
+	{
+		return 1;
+	}
+
+	for ( int i = 1 ; i < argc ; i++ )
+	{
+		if ( strcmp ( argv [ i ] , name ) == 0 )
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int main ( int argc , char *argv [] )
+{
+	benchItems = ( int *) __real_malloc ( LIST_BENCH_MAX_SIZE * sizeof ( int ) );
+	benchElements = ( BENCH_ELEMENT *) __real_malloc ( LIST_BENCH_MAX_SIZE * sizeof ( BENCH_ELEMENT ) );
+	benchOrder = ( int *) __real_malloc ( LIST_BENCH_MAX_SIZE * sizeof ( int ) );
+	if ( !benchItems || !benchElements || !benchOrder )
+	{
+		fprintf ( stderr , "listbench: out of memory\n" );
+		return -1;
+	}
+
+	for ( int i = 0 ; i < LIST_BENCH_MAX_SIZE ; i++ )
+	{
+		benchItems [ i ] = i;
+		benchElements [ i ].value = i;
+	}
+
+	OpenCacheMissCounter ();
+	if ( cacheMissFD < 0 )
+	{
+		fprintf ( stderr , "listbench: no hardware cache miss counter (perf_event_open failed), misses/op shows n/a\n" );
+	}
+
+	printf ( "%-24s %8s %10s %10s %12s %12s %12s\n" , "case" , "size" , "ops" , "ns/op" , "misses/op" , "heap/op" , "pool/op" );
+
+	for ( int c = 0 ; c < LIST_BENCH_NUM_CASES ; c++ )
+	{
+		if ( !CaseSelected ( LIST_BENCH_CASES [ c ].name , argc , argv ) )
+		{
+			continue;
+		}
+
+		for ( int s = 0 ; s < LIST_BENCH_NUM_SIZES ; s++ )
+		{
+			RunBenchCase ( &LIST_BENCH_CASES [ c ] , LIST_BENCH_SIZES [ s ] );
+		}
+	}
+
+	free ( benchItems );
+	free ( benchElements );
+	free ( benchOrder );
+	return 0;
+}
@@ -0,0 +1,1287 @@
+/* Nic Pucci
+ * LIST COMPACT IMPLEMENTATION
+ *
+ * Same API as List.c, but a node is a 32-bit index instead of a NODE struct.
+ * Node fields live in three parallel arrays (values, next and prev), 16 bytes
+ * per node instead of 32, and a traversal reads the dense link array instead of
+ * chasing pointers to scattered NODEs. Index 0 is never handed out and stands
+ * for "no node".
+ *
+ * The arrays are reserved once for MAX_NODES and only the pages that nodes have
+ * been handed out from get memory, so growing never moves a node and readers
+ * need no lock. Free indices are linked through the next array; each thread
+ * keeps a small cache of them and only takes nodeLock to refill, spill or grow.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include "List.h"
+#include "Pool.h"
+#include "ListKeyIndex.h"
+#include "ListEpoch.h"
+
+#define NODE_CACHE_SIZE 64
+
+const int SUCCESS_OP_CODE = 0;
+const int FAILURE_OP_CODE = -1;
+
+const LIST_INDEX NO_NODE = 0;
+const unsigned long MAX_NODES = 1UL << 26; // 1 GiB of address space, committed as used
+const unsigned int NODE_GROW_SIZE = 4096;
+const unsigned int INITIAL_LIST_CHUNK_SIZE = 64;
+const int NODE_CACHE_TRANSFER = NODE_CACHE_SIZE / 2; // indices moved per refill/spill
+
+/* INITIALIZE MEMORY STATE FLAGS */
+const int INITIALIZED_FREE_MEM_ALLOC = 1;
+
+typedef struct nodeCache
+{
+	LIST_INDEX indices [ NODE_CACHE_SIZE ];
+	int count;
+} NODE_CACHE;
+
+/* ALLOCATED MEMORY */
+pthread_once_t initFreeAllocMemoryOnce = PTHREAD_ONCE_INIT;
+int initializedFreeMemAllocFlag = 0;
+
+void **nodeValues;
+LIST_INDEX *nodeNext;
+LIST_INDEX *nodePrev;
+unsigned long numNodes = 0; // indices handed to the free stack so far, guarded by nodeLock
+LIST_INDEX freeNodesTop = 0; // stack linked through next, guarded by nodeLock
+pthread_mutex_t nodeLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t nodeCacheKey;
+
+POOL listPool;
+
+static inline void *NodeValue ( LIST_INDEX node )
+{
+	return nodeValues [ node ];
+}
+
+static inline void SetNodeValue ( LIST_INDEX node , void *value )
+{
+	nodeValues [ node ] = value;
+}
+
+static inline LIST_INDEX NextNode ( LIST_INDEX node )
+{
+	return nodeNext [ node ];
+}
+
+static inline void SetNextNode ( LIST_INDEX node , LIST_INDEX next )
+{
+	nodeNext [ node ] = next;
+}
+
+/* Orders a node's own fields before the store that links it in, so a concurrent
+ * reader that reaches it sees it whole. Compiles to nothing on x86. */
+static inline void PublishLinks ()
+{
+	atomic_thread_fence ( memory_order_release );
+}
+
+static inline LIST_INDEX LoadLink ( LIST_INDEX *link )
+{
+	return __atomic_load_n ( link , __ATOMIC_ACQUIRE );
+}
+
+static inline LIST_INDEX PrevNode ( LIST_INDEX node )
+{
+	return nodePrev [ node ];
+}
+
+static inline void SetPrevNode ( LIST_INDEX node , LIST_INDEX prev )
+{
+	nodePrev [ node ] = prev;
+}
+
+/* Warms up what a traversal reads one step after node: the item it points to
+ * (comparators and itemFree usually touch it) and the link of the node after. */
+static inline void PrefetchNode ( LIST_INDEX node , const LIST_INDEX *links )
+{
+	if ( node == NO_NODE )
+	{
+		return;
+	}
+
+	__builtin_prefetch ( nodeValues [ node ] );
+	__builtin_prefetch ( &links [ links [ node ] ] );
+}
+
+void DEBUG_PRINT_FREE_ALLOC_INFO () {
+	printf ( "\n-------------- DEBUG_PRINT_FREE_ALLOC_INFO\n" );
+
+	printf ( "Total Allocated Nodes: %lu\n", numNodes );
+	printf ( "Total Allocated List Heads: %lu\n\n", PoolNumObjects ( &listPool ) );
+}
+
+static void *ReserveNodeArray ( size_t elementSize )
+{
+	void *array = mmap ( NULL , MAX_NODES * elementSize , PROT_READ | PROT_WRITE , MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE , -1 , 0 );
+	return array == MAP_FAILED ? NULL : array;
+}
+
+/* nodeLock must be held. Links the next NODE_GROW_SIZE indices onto the free stack. */
+static int GrowNodesLocked ()
+{
+	if ( numNodes + NODE_GROW_SIZE > MAX_NODES )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	// index 0 is NO_NODE and is never handed out
+	LIST_INDEX firstNode = numNodes == 0 ? 1 : numNodes;
+	LIST_INDEX endNode = numNodes + NODE_GROW_SIZE;
+
+	for ( LIST_INDEX node = firstNode ; node < endNode ; node++ )
+	{
+		nodeNext [ node ] = node + 1 < endNode ? node + 1 : freeNodesTop;
+	}
+
+	freeNodesTop = firstNode;
+	numNodes = endNode;
+	return SUCCESS_OP_CODE;
+}
+
+static void RefillNodeCache ( NODE_CACHE *cache )
+{
+	pthread_mutex_lock ( &nodeLock );
+
+	while ( cache -> count < NODE_CACHE_TRANSFER )
+	{
+		if ( freeNodesTop == NO_NODE && GrowNodesLocked () == FAILURE_OP_CODE )
+		{
+			break;
+		}
+
+		cache -> indices [ cache -> count ] = freeNodesTop;
+		cache -> count += 1;
+		freeNodesTop = NextNode ( freeNodesTop );
+	}
+
+	pthread_mutex_unlock ( &nodeLock );
+}
+
+static void SpillNodeCache ( NODE_CACHE *cache , int numSpilled )
+{
+	pthread_mutex_lock ( &nodeLock );
+
+	for ( int i = 0 ; i < numSpilled ; i++ )
+	{
+		cache -> count -= 1;
+		LIST_INDEX node = cache -> indices [ cache -> count ];
+		SetNextNode ( node , freeNodesTop );
+		freeNodesTop = node;
+	}
+
+	pthread_mutex_unlock ( &nodeLock );
+}
+
+static void FlushNodeCache ( void *object )
+{
+	NODE_CACHE *cache = ( NODE_CACHE *) object;
+	SpillNodeCache ( cache , cache -> count );
+	free ( cache );
+}
+
+static NODE_CACHE *GetNodeCache ()
+{
+	NODE_CACHE *cache = pthread_getspecific ( nodeCacheKey );
+	if ( cache )
+	{
+		return cache;
+	}
+
+	cache = calloc ( 1 , sizeof ( NODE_CACHE ) );
+	if ( cache )
+	{
+		pthread_setspecific ( nodeCacheKey , cache );
+	}
+
+	return cache;
+}
+
+LIST_INDEX PopNextFreeNode ()
+{
+	NODE_CACHE *cache = GetNodeCache ();
+	if ( !cache )
+	{
+		return NO_NODE;
+	}
+
+	if ( cache -> count == 0 )
+	{
+		RefillNodeCache ( cache );
+		if ( cache -> count == 0 )
+		{
+			return NO_NODE;
+		}
+	}
+
+	cache -> count -= 1;
+	return cache -> indices [ cache -> count ];
+}
+
+void PushFreedNode ( LIST_INDEX node )
+{
+	if ( node == NO_NODE )
+	{
+		return;
+	}
+
+	NODE_CACHE *cache = GetNodeCache ();
+	if ( !cache )
+	{
+		pthread_mutex_lock ( &nodeLock );
+		SetNextNode ( node , freeNodesTop );
+		freeNodesTop = node;
+		pthread_mutex_unlock ( &nodeLock );
+		return;
+	}
+
+	if ( cache -> count == NODE_CACHE_SIZE )
+	{
+		SpillNodeCache ( cache , NODE_CACHE_TRANSFER );
+	}
+
+	cache -> indices [ cache -> count ] = node;
+	cache -> count += 1;
+}
+
+/* Returns a whole chain, already linked head to tail through next, with one lock. */
+void PushFreedChain ( LIST_INDEX headNode , LIST_INDEX tailNode )
+{
+	pthread_mutex_lock ( &nodeLock );
+	SetNextNode ( tailNode , freeNodesTop );
+	freeNodesTop = headNode;
+	pthread_mutex_unlock ( &nodeLock );
+}
+
+int SetList ( LIST *list , LIST_INDEX initHeadNode )
+{
+	if ( !list ) {
+		return FAILURE_OP_CODE;
+	}
+
+	list -> currentIndex = initHeadNode;
+	list -> headIndex = initHeadNode;
+	list -> tailIndex = initHeadNode;
+
+	if ( initHeadNode == NO_NODE ) {
+		list -> currentCapacity = 0;
+		list -> currentNodeState = BEFORE_HEAD;
+	}
+	else {
+		list -> currentCapacity = 1;
+		list -> currentNodeState = WITHIN_LIST;
+	}
+
+	return SUCCESS_OP_CODE;
+}
+
+static void ReclaimNode ( void *object )
+{
+	PushFreedNode ( ( LIST_INDEX ) ( unsigned long ) object );
+}
+
+static void ReclaimList ( void *object )
+{
+	PoolFree ( &listPool , object );
+}
+
+void FreeAllocList ( LIST *list )
+{
+	if ( !list )
+	{
+		return;
+	}
+
+	SetList ( list , NO_NODE );
+	KeyIndexFree ( list -> keyIndex );
+	list -> keyIndex = NULL;
+
+	// a reader may still be about to load its head
+	if ( list -> concurrentReads )
+	{
+		list -> concurrentReads = 0;
+		ListEpochRetire ( &ReclaimList , list );
+		return;
+	}
+
+	PoolFree ( &listPool , list );
+}
+
+/* KEY INDEX HOOKS: every node joining or leaving an indexed list goes through
+ * GetNewNode/ReleaseNode, or is re-indexed by the bulk moves below. */
+static void IndexNode ( LIST *list , LIST_INDEX node )
+{
+	if ( list -> keyIndex )
+	{
+		KeyIndexInsert ( list -> keyIndex , list -> keyIndex -> keyOf ( NodeValue ( node ) ) , node );
+	}
+}
+
+static void UnindexNode ( LIST *list , LIST_INDEX node )
+{
+	if ( list -> keyIndex )
+	{
+		KeyIndexErase ( list -> keyIndex , list -> keyIndex -> keyOf ( NodeValue ( node ) ) , node );
+	}
+}
+
+/* The index is grown before a node is taken, so a node is never linked without
+ * its index entry. */
+LIST_INDEX GetNewNode ( LIST *list , void *item ) {
+	if ( list -> keyIndex && KeyIndexReserve ( list -> keyIndex , 1 ) == FAILURE_OP_CODE )
+	{
+		return NO_NODE;
+	}
+
+	LIST_INDEX node = PopNextFreeNode ();
+	if ( node != NO_NODE )
+	{
+		SetNodeValue ( node , item );
+		SetPrevNode ( node , NO_NODE );
+		SetNextNode ( node , NO_NODE );
+		IndexNode ( list , node );
+		PublishLinks ();
+	}
+
+	return node;
+}
+
+void ReleaseNode ( LIST *list , LIST_INDEX node )
+{
+	UnindexNode ( list , node );
+
+	// a free node's next link is reused by the free stack, so readers are waited out first
+	if ( list -> concurrentReads )
+	{
+		ListEpochRetire ( &ReclaimNode , ( void *) ( unsigned long ) node );
+		return;
+	}
+
+	PushFreedNode ( node );
+}
+
+/* Gives back an unlinked, unindexed chain linked head to tail through next. */
+static void RecycleChain ( LIST *list , LIST_INDEX headNode , LIST_INDEX tailNode )
+{
+	if ( !list -> concurrentReads )
+	{
+		PushFreedChain ( headNode , tailNode );
+		return;
+	}
+
+	LIST_INDEX node = headNode;
+	while ( node != NO_NODE )
+	{
+		LIST_INDEX nextNode = node == tailNode ? NO_NODE : NextNode ( node );
+		ListEpochRetire ( &ReclaimNode , ( void *) ( unsigned long ) node );
+		node = nextNode;
+	}
+}
+
+/* Indexes the nodes from firstNode on that just moved into list. If the index
+ * cannot grow it is dropped rather than left incomplete. */
+static void IndexMovedNodes ( LIST *list , LIST_INDEX firstNode , int numMoved )
+{
+	if ( !list -> keyIndex )
+	{
+		return;
+	}
+
+	if ( KeyIndexReserve ( list -> keyIndex , numMoved ) == FAILURE_OP_CODE )
+	{
+		ListDetachIndex ( list );
+		return;
+	}
+
+	LIST_INDEX node = firstNode;
+	for ( int i = 0 ; i < numMoved ; i++ )
+	{
+		IndexNode ( list , node );
+		node = NextNode ( node );
+	}
+}
+
+void InitFreeList ( void *object , unsigned long objectID )
+{
+	LIST *list = ( LIST *) object;
+	SetList ( list , NO_NODE );
+	list -> keyIndex = NULL;
+	list -> concurrentReads = 0;
+	list -> allocID = ( int ) objectID;
+}
+
+void InitFreeAllocMemory ()
+{
+	nodeValues = ( void **) ReserveNodeArray ( sizeof ( void *) );
+	nodeNext = ( LIST_INDEX *) ReserveNodeArray ( sizeof ( LIST_INDEX ) );
+	nodePrev = ( LIST_INDEX *) ReserveNodeArray ( sizeof ( LIST_INDEX ) );
+	if ( !nodeValues || !nodeNext || !nodePrev )
+	{
+		return;
+	}
+
+	int listsReady = PoolInit ( &listPool , sizeof ( LIST ) , INITIAL_LIST_CHUNK_SIZE , &InitFreeList );
+	int cacheReady = pthread_key_create ( &nodeCacheKey , &FlushNodeCache ) == 0;
+
+	if ( listsReady == SUCCESS_OP_CODE && cacheReady )
+	{
+		initializedFreeMemAllocFlag = INITIALIZED_FREE_MEM_ALLOC;
+	}
+}
+
+LIST *ListCreate () {
+	pthread_once ( &initFreeAllocMemoryOnce , &InitFreeAllocMemory );
+	if ( initializedFreeMemAllocFlag != INITIALIZED_FREE_MEM_ALLOC )
+	{
+		return NULL;
+	}
+
+	LIST *list = ( LIST *) PoolAlloc ( &listPool );
+	return list;
+}
+
+void *ListFirst ( LIST *list )
+{
+	if ( !list || list -> headIndex == NO_NODE ) {
+		return NULL;
+	}
+
+	list -> currentIndex = list -> headIndex;
+	list -> currentNodeState = WITHIN_LIST;
+	return NodeValue ( list -> headIndex );
+}
+
+void *ListLast ( LIST *list )
+{
+	if ( !list || list -> tailIndex == NO_NODE ) {
+		return NULL;
+	}
+
+	list -> currentIndex = list -> tailIndex;
+	list -> currentNodeState = WITHIN_LIST;
+	return NodeValue ( list -> tailIndex );
+}
+
+void *ListCurr ( LIST *list )
+{
+	if ( !list ) {
+		return NULL;
+	}
+
+	if ( list -> currentNodeState != WITHIN_LIST || list -> currentIndex == NO_NODE )
+	{
+		return NULL;
+	}
+
+	return NodeValue ( list -> currentIndex );
+}
+
+void *ListNext ( LIST *list )
+{
+	if ( !list || list -> currentCapacity <= 0 ) {
+		return NULL;
+	}
+
+	if ( list -> currentNodeState == AFTER_TAIL )
+	{
+		return NULL;
+	}
+
+	if ( list -> currentNodeState == BEFORE_HEAD )
+	{
+		list -> currentIndex = list -> headIndex;
+		list -> currentNodeState = WITHIN_LIST;
+		return NodeValue ( list -> currentIndex );
+	}
+
+	list -> currentIndex = NextNode ( list -> currentIndex );
+	if ( list -> currentIndex == NO_NODE )
+	{
+		list -> currentNodeState = AFTER_TAIL;
+		return NULL;
+	}
+
+	return NodeValue ( list -> currentIndex );
+}
+
+void *ListPrev ( LIST *list )
+{
+	if ( !list || list -> currentCapacity <= 0 ) {
+		return NULL;
+	}
+
+	if ( list -> currentNodeState == BEFORE_HEAD )
+	{
+		return NULL;
+	}
+
+	if ( list -> currentNodeState == AFTER_TAIL )
+	{
+		list -> currentIndex = list -> tailIndex;
+		list -> currentNodeState = WITHIN_LIST;
+		return NodeValue ( list -> currentIndex );
+	}
+
+	list -> currentIndex = PrevNode ( list -> currentIndex );
+	if ( list -> currentIndex == NO_NODE )
+	{
+		list -> currentNodeState = BEFORE_HEAD;
+		return NULL;
+	}
+
+	return NodeValue ( list -> currentIndex );
+}
+
+/* Links node between prevNode and nextNode (either may be NO_NODE). */
+static void LinkNode ( LIST *list , LIST_INDEX prevNode , LIST_INDEX node , LIST_INDEX nextNode )
+{
+	SetPrevNode ( node , prevNode );
+	SetNextNode ( node , nextNode );
+	PublishLinks ();
+
+	if ( prevNode != NO_NODE )
+	{
+		SetNextNode ( prevNode , node );
+	}
+	else
+	{
+		list -> headIndex = node;
+	}
+
+	if ( nextNode != NO_NODE )
+	{
+		SetPrevNode ( nextNode , node );
+	}
+	else
+	{
+		list -> tailIndex = node;
+	}
+
+	list -> currentIndex = node;
+	list -> currentNodeState = WITHIN_LIST;
+	list -> currentCapacity += 1;
+}
+
+int ListAppend ( LIST *list , void *item )
+{
+	if ( !list )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	LIST_INDEX newItemNode = GetNewNode ( list , item );
+	if ( newItemNode == NO_NODE )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	if ( list -> currentCapacity <= 0 )
+	{
+		return SetList ( list , newItemNode );
+	}
+
+	LinkNode ( list , list -> tailIndex , newItemNode , NO_NODE );
+	return SUCCESS_OP_CODE;
+}
+
+int ListPrepend ( LIST *list , void *item )
+{
+	if ( !list )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	LIST_INDEX newItemNode = GetNewNode ( list , item );
+	if ( newItemNode == NO_NODE )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	if ( list -> currentCapacity <= 0 )
+	{
+		return SetList ( list , newItemNode );
+	}
+
+	LinkNode ( list , NO_NODE , newItemNode , list -> headIndex );
+	return SUCCESS_OP_CODE;
+}
+
+int ListInsert ( LIST *list , void *item )
+{
+	if ( !list )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	if ( list -> currentNodeState == BEFORE_HEAD || list -> currentIndex == list -> headIndex )
+	{
+		return ListPrepend ( list , item );
+	}
+
+	if ( list -> currentNodeState == AFTER_TAIL || list -> currentIndex == NO_NODE )
+	{
+		return ListAppend ( list , item );
+	}
+
+	LIST_INDEX newItemNode = GetNewNode ( list , item );
+	if ( newItemNode == NO_NODE )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	LinkNode ( list , PrevNode ( list -> currentIndex ) , newItemNode , list -> currentIndex );
+	return SUCCESS_OP_CODE;
+}
+
+int ListAdd ( LIST *list , void *item )
+{
+	if ( !list )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	if ( list -> currentNodeState == BEFORE_HEAD )
+	{
+		return ListPrepend ( list , item );
+	}
+
+	if ( list -> currentNodeState == AFTER_TAIL || list -> currentIndex == NO_NODE )
+	{
+		return ListAppend ( list , item );
+	}
+
+	LIST_INDEX newItemNode = GetNewNode ( list , item );
+	if ( newItemNode == NO_NODE )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	LinkNode ( list , list -> currentIndex , newItemNode , NextNode ( list -> currentIndex ) );
+	return SUCCESS_OP_CODE;
+}
+
+void *ListRemove ( LIST *list )
+{
+	if ( !list )
+	{
+		return NULL;
+	}
+
+	LIST_INDEX oldCurrentNode = list -> currentIndex;
+	if ( oldCurrentNode == NO_NODE )
+	{
+		return NULL;
+	}
+
+	LIST_INDEX prevNode = PrevNode ( oldCurrentNode );
+	LIST_INDEX nextNode = NextNode ( oldCurrentNode );
+
+	if ( prevNode != NO_NODE )
+	{
+		SetNextNode ( prevNode , nextNode );
+	}
+	else // at head
+	{
+		list -> headIndex = nextNode;
+	}
+
+	if ( nextNode != NO_NODE )
+	{
+		SetPrevNode ( nextNode , prevNode );
+	}
+	else // at tail
+	{
+		list -> tailIndex = prevNode;
+	}
+
+	list -> currentIndex = nextNode;
+	list -> currentCapacity -= 1;
+
+	void *value = NodeValue ( oldCurrentNode );
+	ReleaseNode ( list , oldCurrentNode );
+
+	return value;
+}
+
+int ListCount ( LIST *list )
+{
+	if ( !list )
+	{
+		return 0;
+	}
+
+	return list -> currentCapacity;
+}
+
+void *ListTrim ( LIST *list )
+{
+	if ( !list || list -> currentCapacity <= 0 )
+	{
+		return NULL;
+	}
+
+	LIST_INDEX trimmedNode = list -> tailIndex;
+	list -> tailIndex = PrevNode ( trimmedNode );
+
+	if ( list -> tailIndex != NO_NODE )
+	{
+		SetNextNode ( list -> tailIndex , NO_NODE );
+		list -> currentIndex = list -> tailIndex;
+		list -> currentCapacity -= 1;
+	}
+	else
+	{
+		SetList ( list , NO_NODE );
+	}
+
+	void *value = NodeValue ( trimmedNode );
+	ReleaseNode ( list , trimmedNode );
+
+	return value;
+}
+
+/* Items are handed to itemFree tail first, like List.c; the nodes then go back
+ * to the free stack as one chain (GetNewNode resets every field on reuse). */
+void ListFree ( LIST *list , void ( *itemFree ) ( void* ) )
+{
+	if ( !list || !itemFree )
+	{
+		return;
+	}
+
+	ListDetachIndex ( list ); // dropped whole rather than emptied entry by entry
+
+	LIST_INDEX node = list -> tailIndex;
+	while ( node != NO_NODE )
+	{
+		LIST_INDEX prevNode = PrevNode ( node );
+		PrefetchNode ( prevNode , nodePrev );
+
+		( *itemFree ) ( NodeValue ( node ) );
+		node = prevNode;
+	}
+
+	LIST_INDEX headNode = list -> headIndex;
+	LIST_INDEX tailNode = list -> tailIndex;
+	SetList ( list , NO_NODE );
+
+	if ( headNode != NO_NODE )
+	{
+		RecycleChain ( list , headNode , tailNode );
+	}
+
+	FreeAllocList ( list );
+}
+
+void ListConcat ( LIST *list1 , LIST **list2 )
+{
+	if ( !list1 || !( *list2 ) || ( *list2 ) -> currentCapacity <= 0 )
+	{
+		FreeAllocList ( *list2 );
+		*list2 = NULL;
+		return;
+	}
+
+	IndexMovedNodes ( list1 , ( *list2 ) -> headIndex , ( *list2 ) -> currentCapacity );
+
+	SetPrevNode ( ( *list2 ) -> headIndex , list1 -> tailIndex ); // NO_NODE when list1 is empty
+	PublishLinks ();
+
+	if ( list1 -> currentCapacity <= 0 )
+	{
+		list1 -> headIndex = ( *list2 ) -> headIndex;
+		list1 -> tailIndex = ( *list2 ) -> tailIndex;
+		list1 -> currentCapacity = ( *list2 ) -> currentCapacity;
+	}
+	else
+	{
+		SetNextNode ( list1 -> tailIndex , ( *list2 ) -> headIndex );
+		list1 -> tailIndex = ( *list2 ) -> tailIndex;
+		list1 -> currentCapacity += ( *list2 ) -> currentCapacity;
+	}
+
+	FreeAllocList ( *list2 );
+	*list2 = NULL;
+}
+
+void *ListSearch ( LIST *list , int ( *comparator ) ( void* , void* ) , void *comparisonArg )
+{
+	if ( !list || list -> currentCapacity <= 0 || !comparator )
+	{
+		return NULL;
+	}
+
+	LIST_INDEX node = list -> headIndex;
+	while ( node != NO_NODE )
+	{
+		LIST_INDEX nextNode = NextNode ( node );
+		PrefetchNode ( nextNode , nodeNext );
+
+		void *item = NodeValue ( node );
+		if ( ( *comparator ) ( item , comparisonArg ) )
+		{
+			list -> currentIndex = node;
+			list -> currentNodeState = WITHIN_LIST;
+			return item;
+		}
+
+		node = nextNode;
+	}
+
+	// no match leaves the cursor beyond the end, as List.c does
+	list -> currentIndex = NO_NODE;
+	list -> currentNodeState = AFTER_TAIL;
+	return NULL;
+}
+
+/* Appends items in order, linking the new nodes among themselves before the
+ * list is touched once. Stops early if no node is free; returns how many items
+ * were appended. The cursor ends on the last appended item. */
+int ListAppendBatch ( LIST *list , void **items , int numItems )
+{
+	if ( !list || !items || numItems <= 0 )
+	{
+		return 0;
+	}
+
+	LIST_INDEX firstNode = NO_NODE;
+	LIST_INDEX lastNode = NO_NODE;
+	int numAppended = 0;
+
+	while ( numAppended < numItems )
+	{
+		LIST_INDEX node = GetNewNode ( list , items [ numAppended ] );
+		if ( node == NO_NODE )
+		{
+			break;
+		}
+
+		SetPrevNode ( node , lastNode );
+		if ( lastNode != NO_NODE )
+		{
+			SetNextNode ( lastNode , node );
+		}
+		else
+		{
+			firstNode = node;
+		}
+
+		lastNode = node;
+		numAppended += 1;
+	}
+
+	if ( numAppended == 0 )
+	{
+		return 0;
+	}
+
+	SetPrevNode ( firstNode , list -> tailIndex ); // NO_NODE when the list is empty
+	PublishLinks ();
+
+	if ( list -> currentCapacity <= 0 )
+	{
+		list -> headIndex = firstNode;
+	}
+	else
+	{
+		SetNextNode ( list -> tailIndex , firstNode );
+	}
+
+	list -> tailIndex = lastNode;
+	list -> currentIndex = lastNode;
+	list -> currentNodeState = WITHIN_LIST;
+	list -> currentCapacity += numAppended;
+
+	return numAppended;
+}
+
+/* Removes up to maxItems from the tail into items, tail first (the order that
+ * repeated ListTrim calls would give). Returns how many were removed; the nodes
+ * go back to the free stack as one chain. */
+int ListTrimBatch ( LIST *list , void **items , int maxItems )
+{
+	if ( !list || !items || maxItems <= 0 || list -> currentCapacity <= 0 )
+	{
+		return 0;
+	}
+
+	int numTrimmed = 0;
+	LIST_INDEX trimmedTail = list -> tailIndex;
+	LIST_INDEX node = trimmedTail;
+	LIST_INDEX trimmedHead = NO_NODE;
+
+	while ( node != NO_NODE && numTrimmed < maxItems )
+	{
+		items [ numTrimmed ] = NodeValue ( node );
+		numTrimmed += 1;
+		UnindexNode ( list , node );
+
+		trimmedHead = node;
+		node = PrevNode ( node );
+	}
+
+	if ( node == NO_NODE )
+	{
+		SetList ( list , NO_NODE );
+	}
+	else
+	{
+		SetNextNode ( node , NO_NODE );
+		list -> tailIndex = node;
+		list -> currentIndex = node;
+		list -> currentCapacity -= numTrimmed;
+	}
+
+	RecycleChain ( list , trimmedHead , trimmedTail );
+	return numTrimmed;
+}
+
+/* Detaches the current item and everything after it into a new list, which is
+ * returned (NULL if there is no current item or no list head is free). The links
+ * are cut in O(1); the moved items are counted by walking out from the cursor in
+ * both directions at once, so that costs the shorter of the two sides. The
+ * original list's cursor is left on its new tail. */
+LIST *ListSplit ( LIST *list )
+{
+	if ( !list || list -> currentNodeState != WITHIN_LIST || list -> currentIndex == NO_NODE )
+	{
+		return NULL;
+	}
+
+	LIST *splitList = ListCreate ();
+	if ( !splitList )
+	{
+		return NULL;
+	}
+
+	LIST_INDEX splitNode = list -> currentIndex;
+
+	int numBefore = 0;
+	int numAfter = 1;
+	LIST_INDEX backward = PrevNode ( splitNode );
+	LIST_INDEX forward = NextNode ( splitNode );
+	while ( backward != NO_NODE && forward != NO_NODE )
+	{
+		numBefore += 1;
+		numAfter += 1;
+		backward = PrevNode ( backward );
+		forward = NextNode ( forward );
+	}
+
+	if ( backward == NO_NODE )
+	{
+		numAfter = list -> currentCapacity - numBefore;
+	}
+
+	// the moved nodes leave this list's index; the new list starts without one
+	if ( list -> keyIndex )
+	{
+		LIST_INDEX node = splitNode;
+		for ( int i = 0 ; i < numAfter ; i++ )
+		{
+			UnindexNode ( list , node );
+			node = NextNode ( node );
+		}
+	}
+
+	splitList -> headIndex = splitNode;
+	splitList -> tailIndex = list -> tailIndex;
+	splitList -> currentIndex = splitNode;
+	splitList -> currentNodeState = WITHIN_LIST;
+	splitList -> currentCapacity = numAfter;
+
+	LIST_INDEX newTail = PrevNode ( splitNode );
+	SetPrevNode ( splitNode , NO_NODE );
+
+	if ( newTail == NO_NODE )
+	{
+		SetList ( list , NO_NODE );
+		return splitList;
+	}
+
+	SetNextNode ( newTail , NO_NODE );
+	list -> tailIndex = newTail;
+	list -> currentIndex = newTail;
+	list -> currentCapacity -= numAfter;
+
+	return splitList;
+}
+
+/* Moves every item of *list2 into list right after the current item (before the
+ * head if the cursor is before it, after the tail if beyond it) in O(1), then
+ * frees *list2 and sets it to NULL like ListConcat. The cursor ends on the last
+ * spliced item. */
+void ListSplice ( LIST *list , LIST **list2 )
+{
+	if ( !list || !list2 || !( *list2 ) )
+	{
+		return;
+	}
+
+	LIST *source = *list2;
+	if ( source -> currentCapacity <= 0 )
+	{
+		FreeAllocList ( source );
+		*list2 = NULL;
+		return;
+	}
+
+	IndexMovedNodes ( list , source -> headIndex , source -> currentCapacity );
+
+	LIST_INDEX prevNode;
+	LIST_INDEX nextNode;
+	if ( list -> currentCapacity <= 0 || list -> currentNodeState == BEFORE_HEAD )
+	{
+		prevNode = NO_NODE;
+		nextNode = list -> headIndex;
+	}
+	else if ( list -> currentNodeState == AFTER_TAIL || list -> currentIndex == NO_NODE )
+	{
+		prevNode = list -> tailIndex;
+		nextNode = NO_NODE;
+	}
+	else
+	{
+		prevNode = list -> currentIndex;
+		nextNode = NextNode ( list -> currentIndex );
+	}
+
+	SetPrevNode ( source -> headIndex , prevNode );
+	SetNextNode ( source -> tailIndex , nextNode );
+	PublishLinks ();
+
+	if ( prevNode != NO_NODE )
+	{
+		SetNextNode ( prevNode , source -> headIndex );
+	}
+	else
+	{
+		list -> headIndex = source -> headIndex;
+	}
+
+	if ( nextNode != NO_NODE )
+	{
+		SetPrevNode ( nextNode , source -> tailIndex );
+	}
+	else
+	{
+		list -> tailIndex = source -> tailIndex;
+	}
+
+	list -> currentIndex = source -> tailIndex;
+	list -> currentNodeState = WITHIN_LIST;
+	list -> currentCapacity += source -> currentCapacity;
+
+	FreeAllocList ( source );
+	*list2 = NULL;
+}
+
+/* Builds a hash index over the list from keyOf ( item ), replacing any index it
+ * had; see List.c for the contract. */
+int ListAttachIndex ( LIST *list , unsigned long long ( *keyOf ) ( void *item ) )
+{
+	if ( !list || !keyOf )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	ListDetachIndex ( list );
+
+	list -> keyIndex = KeyIndexCreate ( keyOf , list -> currentCapacity );
+	if ( !list -> keyIndex )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	for ( LIST_INDEX node = list -> headIndex ; node != NO_NODE ; node = NextNode ( node ) )
+	{
+		IndexNode ( list , node );
+	}
+
+	return SUCCESS_OP_CODE;
+}
+
+void ListDetachIndex ( LIST *list )
+{
+	if ( !list )
+	{
+		return;
+	}
+
+	KeyIndexFree ( list -> keyIndex );
+	list -> keyIndex = NULL;
+}
+
+void *ListSearchKey ( LIST *list , unsigned long long key )
+{
+	if ( !list || !list -> keyIndex )
+	{
+		return NULL;
+	}
+
+	LIST_INDEX node = ( LIST_INDEX ) KeyIndexFind ( list -> keyIndex , key );
+	if ( node == NO_NODE )
+	{
+		return NULL;
+	}
+
+	list -> currentIndex = node;
+	list -> currentNodeState = WITHIN_LIST;
+	return NodeValue ( node );
+}
+
+void *ListRemoveKey ( LIST *list , unsigned long long key )
+{
+	if ( !list || !list -> keyIndex )
+	{
+		return NULL;
+	}
+
+	LIST_INDEX node = ( LIST_INDEX ) KeyIndexFind ( list -> keyIndex , key );
+	if ( node == NO_NODE )
+	{
+		return NULL;
+	}
+
+	LIST_INDEX savedCurrentNode = list -> currentIndex;
+	list -> currentIndex = node;
+
+	void *value = ListRemove ( list );
+
+	if ( savedCurrentNode != node )
+	{
+		list -> currentIndex = savedCurrentNode;
+	}
+
+	return value;
+}
+
+/* ITERATORS: see List.c. Links are loaded with acquire so a LIST_ITER can walk
+ * a list with concurrent reads enabled while its writer runs. */
+void ListIterInit ( LIST_ITER *iter , LIST *list )
+{
+	if ( !iter )
+	{
+		return;
+	}
+
+	iter -> list = list;
+	iter -> currentIndex = NO_NODE;
+	iter -> currentNodeState = BEFORE_HEAD;
+}
+
+static void *IterMoveTo ( LIST_ITER *iter , LIST_INDEX node , enum CURRENT_NODE_STATE stateIfNone )
+{
+	iter -> currentIndex = node;
+	if ( node == NO_NODE )
+	{
+		iter -> currentNodeState = stateIfNone;
+		return NULL;
+	}
+
+	iter -> currentNodeState = WITHIN_LIST;
+	return NodeValue ( node );
+}
+
+void *ListIterFirst ( LIST_ITER *iter )
+{
+	if ( !iter || !iter -> list )
+	{
+		return NULL;
+	}
+
+	return IterMoveTo ( iter , LoadLink ( &iter -> list -> headIndex ) , AFTER_TAIL );
+}
+
+void *ListIterLast ( LIST_ITER *iter )
+{
+	if ( !iter || !iter -> list )
+	{
+		return NULL;
+	}
+
+	return IterMoveTo ( iter , LoadLink ( &iter -> list -> tailIndex ) , BEFORE_HEAD );
+}
+
+void *ListIterNext ( LIST_ITER *iter )
+{
+	if ( !iter || iter -> currentNodeState == AFTER_TAIL )
+	{
+		return NULL;
+	}
+
+	if ( iter -> currentNodeState == BEFORE_HEAD )
+	{
+		return ListIterFirst ( iter );
+	}
+
+	return IterMoveTo ( iter , LoadLink ( &nodeNext [ iter -> currentIndex ] ) , AFTER_TAIL );
+}
+
+void *ListIterPrev ( LIST_ITER *iter )
+{
+	if ( !iter || iter -> currentNodeState == BEFORE_HEAD )
+	{
+		return NULL;
+	}
+
+	if ( iter -> currentNodeState == AFTER_TAIL )
+	{
+		return ListIterLast ( iter );
+	}
+
+	return IterMoveTo ( iter , LoadLink ( &nodePrev [ iter -> currentIndex ] ) , BEFORE_HEAD );
+}
+
+void *ListIterCurr ( LIST_ITER *iter )
+{
+	if ( !iter || iter -> currentNodeState != WITHIN_LIST )
+	{
+		return NULL;
+	}
+
+	return NodeValue ( iter -> currentIndex );
+}
+
+/* Searches forward from the iterator's current item (the head if it is before
+ * it); a miss leaves it beyond the end. */
+void *ListIterSearch ( LIST_ITER *iter , int ( *comparator ) ( void* , void* ) , void *comparisonArg )
+{
+	if ( !iter || !comparator )
+	{
+		return NULL;
+	}
+
+	void *item = iter -> currentNodeState == WITHIN_LIST ? ListIterCurr ( iter ) : ListIterNext ( iter );
+	while ( iter -> currentNodeState == WITHIN_LIST )
+	{
+		if ( ( *comparator ) ( item , comparisonArg ) )
+		{
+			return item;
+		}
+
+		item = ListIterNext ( iter );
+	}
+
+	return NULL;
+}
+
+/* See List.c. Nodes are retired one by one here rather than as a chain. */
+int ListEnableConcurrentReads ( LIST *list )
+{
+	if ( !list )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	list -> concurrentReads = 1;
+	return SUCCESS_OP_CODE;
+}
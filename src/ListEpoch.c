@@ -0,0 +1,223 @@
+/* Nic Pucci
+ * LIST EPOCH IMPLEMENTATION
+*/
+
+#include <stdlib.h>
+#include <limits.h>
+#include <sched.h>
+#include <pthread.h>
+#include "List.h"
+#include "ListEpoch.h"
+
+const int LIST_EPOCH_INITIAL_RETIRED = 256;
+
+pthread_once_t listEpochInitOnce = PTHREAD_ONCE_INIT;
+pthread_key_t listEpochReaderKey;
+int listEpochKeyReady = 0;
+
+LIST_EPOCH_READER listEpochReaders [ LIST_EPOCH_MAX_READERS ];
+atomic_ulong globalEpoch = 1; // 0 is "not reading", so epochs start at 1
+
+pthread_mutex_t retiredLock = PTHREAD_MUTEX_INITIALIZER;
+LIST_EPOCH_RETIRED *retired = NULL; // guarded by retiredLock
+int numRetired = 0;
+int retiredCapacity = 0;
+int reclaimThreshold = LIST_EPOCH_RECLAIM_BATCH;
+
+static void ReleaseReader ( void *object )
+{
+	LIST_EPOCH_READER *reader = ( LIST_EPOCH_READER *) object;
+	reader -> depth = 0;
+	atomic_store_explicit ( &reader -> epoch , 0 , memory_order_release );
+	atomic_store_explicit ( &reader -> inUse , 0 , memory_order_release );
+}
+
+static void InitListEpoch ()
+{
+	listEpochKeyReady = pthread_key_create ( &listEpochReaderKey , &ReleaseReader ) == 0;
+}
+
+/* The calling thread's reader slot, claimed on first use and given back when
+ * the thread exits. NULL if every slot is taken. */
+static LIST_EPOCH_READER *GetReader ()
+{
+	pthread_once ( &listEpochInitOnce , &InitListEpoch );
+	if ( !listEpochKeyReady )
+	{
+		return NULL;
+	}
+
+	LIST_EPOCH_READER *reader = pthread_getspecific ( listEpochReaderKey );
+	if ( reader )
+	{
+		return reader;
+	}
+
+	for ( int i = 0 ; i < LIST_EPOCH_MAX_READERS ; i++ )
+	{
+		int expected = 0;
+		if ( atomic_compare_exchange_strong ( &listEpochReaders [ i ].inUse , &expected , 1 ) )
+		{
+			reader = &listEpochReaders [ i ];
+			reader -> depth = 0;
+			pthread_setspecific ( listEpochReaderKey , reader );
+			return reader;
+		}
+	}
+
+	return NULL;
+}
+
+/* Lowest epoch any reader is inside now, or ULONG_MAX if none is reading. */
+static unsigned long OldestReaderEpoch ()
+{
+	unsigned long oldest = ULONG_MAX;
+
+	for ( int i = 0 ; i < LIST_EPOCH_MAX_READERS ; i++ )
+	{
+		unsigned long epoch = atomic_load ( &listEpochReaders [ i ].epoch );
+		if ( epoch != 0 && epoch < oldest )
+		{
+			oldest = epoch;
+		}
+	}
+
+	return oldest;
+}
+
+/* Starts a new epoch and waits until every reader that entered before it has
+ * left; returns the epoch that ended. Must not be called from inside a read
+ * section. */
+static unsigned long WaitForReaders ()
+{
+	unsigned long epoch = atomic_fetch_add ( &globalEpoch , 1 );
+	while ( OldestReaderEpoch () <= epoch )
+	{
+		sched_yield ();
+	}
+
+	return epoch;
+}
+
+/* retiredLock must be held. Reclaims everything retired before safeEpoch and
+ * keeps the rest in order. */
+static void ReclaimRetiredLocked ( unsigned long safeEpoch )
+{
+	int numKept = 0;
+
+	for ( int i = 0 ; i < numRetired ; i++ )
+	{
+		if ( retired [ i ].epoch < safeEpoch )
+		{
+			( *retired [ i ].reclaim ) ( retired [ i ].object );
+		}
+		else
+		{
+			retired [ numKept ] = retired [ i ];
+			numKept += 1;
+		}
+	}
+
+	numRetired = numKept;
+
+	// a long read section can pin many records; don't rescan them on every retire
+	reclaimThreshold = numRetired * 2 > LIST_EPOCH_RECLAIM_BATCH ? numRetired * 2 : LIST_EPOCH_RECLAIM_BATCH;
+}
+
+static int GrowRetiredLocked ()
+{
+	int capacity = retiredCapacity > 0 ? retiredCapacity * 2 : LIST_EPOCH_INITIAL_RETIRED;
+	LIST_EPOCH_RETIRED *grown = realloc ( retired , capacity * sizeof ( LIST_EPOCH_RETIRED ) );
+	if ( !grown )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	retired = grown;
+	retiredCapacity = capacity;
+	return SUCCESS_OP_CODE;
+}
+
+/* Enters a read section: until the matching ListReadEnd, nothing reachable from
+ * a list with concurrent reads enabled is reclaimed under this thread. Sections
+ * nest. Fails only if more than LIST_EPOCH_MAX_READERS threads read at once. */
+int ListReadBegin ()
+{
+	LIST_EPOCH_READER *reader = GetReader ();
+	if ( !reader )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	if ( reader -> depth == 0 )
+	{
+		// seq_cst so the announcement is visible before the first link is loaded
+		atomic_store ( &reader -> epoch , atomic_load ( &globalEpoch ) );
+	}
+
+	reader -> depth += 1;
+	return SUCCESS_OP_CODE;
+}
+
+void ListReadEnd ()
+{
+	if ( !listEpochKeyReady )
+	{
+		return;
+	}
+
+	LIST_EPOCH_READER *reader = pthread_getspecific ( listEpochReaderKey );
+	if ( !reader || reader -> depth == 0 )
+	{
+		return;
+	}
+
+	reader -> depth -= 1;
+	if ( reader -> depth == 0 )
+	{
+		atomic_store_explicit ( &reader -> epoch , 0 , memory_order_release );
+	}
+}
+
+/* Called by a writer once object is unreachable from its list; reclaim ( object )
+ * runs after the readers that might still hold it are gone. */
+void ListEpochRetire ( void ( *reclaim ) ( void *object ) , void *object )
+{
+	// the unlink must be visible before the epoch it is tagged with is read
+	atomic_thread_fence ( memory_order_seq_cst );
+
+	pthread_mutex_lock ( &retiredLock );
+
+	if ( numRetired == retiredCapacity && GrowRetiredLocked () == FAILURE_OP_CODE )
+	{
+		pthread_mutex_unlock ( &retiredLock );
+		WaitForReaders ();
+		( *reclaim ) ( object );
+		return;
+	}
+
+	retired [ numRetired ].object = object;
+	retired [ numRetired ].reclaim = reclaim;
+	retired [ numRetired ].epoch = atomic_load ( &globalEpoch );
+	numRetired += 1;
+
+	if ( numRetired >= reclaimThreshold )
+	{
+		atomic_fetch_add ( &globalEpoch , 1 );
+		ReclaimRetiredLocked ( OldestReaderEpoch () );
+	}
+
+	pthread_mutex_unlock ( &retiredLock );
+}
+
+/* Waits out every current reader, then reclaims everything retired before the
+ * call. Must not be called from inside a read section. */
+void ListEpochSynchronize ()
+{
+	atomic_thread_fence ( memory_order_seq_cst );
+	unsigned long endedEpoch = WaitForReaders ();
+
+	pthread_mutex_lock ( &retiredLock );
+	ReclaimRetiredLocked ( endedEpoch + 1 );
+	pthread_mutex_unlock ( &retiredLock );
+}
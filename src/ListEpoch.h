@@ -0,0 +1,37 @@
+/* Nic Pucci
+ * LIST EPOCH HEADER
+ *
+ * Epoch-based reclamation behind ListEnableConcurrentReads. Readers announce the
+ * global epoch they entered at (ListReadBegin) and clear it on the way out; a
+ * writer hands every node it unlinks to ListEpochRetire instead of freeing it.
+ * A retired object is only reclaimed once every reader that was inside a read
+ * section when it was retired has left, so a reader holding a node (or a LIST
+ * head) never sees it recycled under it. Shared by both list backends.
+*/
+
+#ifndef LIST_EPOCH_H
+#define LIST_EPOCH_H
+
+#include <stdatomic.h>
+
+#define LIST_EPOCH_CACHE_LINE_SIZE 64
+#define LIST_EPOCH_MAX_READERS 64
+#define LIST_EPOCH_RECLAIM_BATCH 128 // retires between reclaim passes
+
+typedef struct listEpochReader
+{
+	_Alignas ( LIST_EPOCH_CACHE_LINE_SIZE ) atomic_ulong epoch; // 0 = not reading
+	atomic_int inUse; // claimed by a thread
+	int depth; // nested ListReadBegin calls, owner thread only
+} LIST_EPOCH_READER;
+
+typedef struct listEpochRetired
+{
+	void *object;
+	void ( *reclaim ) ( void *object );
+	unsigned long epoch; // global epoch when it was retired
+} LIST_EPOCH_RETIRED;
+
+void ListEpochRetire ( void ( *reclaim ) ( void *object ) , void *object );
+
+#endif
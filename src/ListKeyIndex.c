@@ -0,0 +1,189 @@
+/* Nic Pucci
+ * LIST KEY INDEX IMPLEMENTATION
+*/
+
+#include <stdlib.h>
+#include "List.h"
+#include "ListKeyIndex.h"
+
+const unsigned long KEY_INDEX_MIN_CAPACITY = 16;
+
+/* splitmix64 finaliser: keys are often small or sequential (IDs, ports), so
+ * they are mixed before being masked down to a slot. */
+static unsigned long HashKey ( unsigned long long key )
+{
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+	return ( unsigned long ) key;
+}
+
+static int KeyIndexResize ( LIST_KEY_INDEX *index , unsigned long capacity )
+{
+	LIST_KEY_INDEX_ENTRY *entries = calloc ( capacity , sizeof ( LIST_KEY_INDEX_ENTRY ) );
+	if ( !entries )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	LIST_KEY_INDEX_ENTRY *oldEntries = index -> entries;
+	unsigned long oldCapacity = index -> capacity;
+	unsigned long mask = capacity - 1;
+
+	for ( unsigned long i = 0 ; i < oldCapacity ; i++ )
+	{
+		if ( oldEntries [ i ].node == 0 )
+		{
+			continue;
+		}
+
+		unsigned long slot = HashKey ( oldEntries [ i ].key ) & mask;
+		while ( entries [ slot ].node != 0 )
+		{
+			slot = ( slot + 1 ) & mask;
+		}
+
+		entries [ slot ] = oldEntries [ i ];
+	}
+
+	free ( oldEntries );
+	index -> entries = entries;
+	index -> capacity = capacity;
+	return SUCCESS_OP_CODE;
+}
+
+LIST_KEY_INDEX *KeyIndexCreate ( LIST_KEY_FUNC keyOf , unsigned long expectedCount )
+{
+	LIST_KEY_INDEX *index = calloc ( 1 , sizeof ( LIST_KEY_INDEX ) );
+	if ( !index )
+	{
+		return NULL;
+	}
+
+	// sized so expectedCount entries stay under the 3/4 load limit
+	unsigned long capacity = KEY_INDEX_MIN_CAPACITY;
+	while ( capacity * 3 / 4 <= expectedCount )
+	{
+		capacity *= 2;
+	}
+
+	index -> keyOf = keyOf;
+	if ( KeyIndexResize ( index , capacity ) == FAILURE_OP_CODE )
+	{
+		free ( index );
+		return NULL;
+	}
+
+	return index;
+}
+
+void KeyIndexFree ( LIST_KEY_INDEX *index )
+{
+	if ( !index )
+	{
+		return;
+	}
+
+	free ( index -> entries );
+	free ( index );
+}
+
+/* Grows the table so numNew more entries fit under the 3/4 load limit; after a
+ * successful reserve that many inserts cannot fail. */
+int KeyIndexReserve ( LIST_KEY_INDEX *index , unsigned long numNew )
+{
+	unsigned long capacity = index -> capacity;
+	while ( ( index -> count + numNew ) * 4 > capacity * 3 )
+	{
+		capacity *= 2;
+	}
+
+	if ( capacity == index -> capacity )
+	{
+		return SUCCESS_OP_CODE;
+	}
+
+	return KeyIndexResize ( index , capacity );
+}
+
+int KeyIndexInsert ( LIST_KEY_INDEX *index , unsigned long long key , unsigned long node )
+{
+	if ( KeyIndexReserve ( index , 1 ) == FAILURE_OP_CODE )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	unsigned long mask = index -> capacity - 1;
+	unsigned long slot = HashKey ( key ) & mask;
+	while ( index -> entries [ slot ].node != 0 )
+	{
+		slot = ( slot + 1 ) & mask;
+	}
+
+	index -> entries [ slot ].key = key;
+	index -> entries [ slot ].node = node;
+	index -> count += 1;
+	return SUCCESS_OP_CODE;
+}
+
+/* Any node whose item has this key, or 0. */
+unsigned long KeyIndexFind ( LIST_KEY_INDEX *index , unsigned long long key )
+{
+	unsigned long mask = index -> capacity - 1;
+	unsigned long slot = HashKey ( key ) & mask;
+
+	while ( index -> entries [ slot ].node != 0 )
+	{
+		if ( index -> entries [ slot ].key == key )
+		{
+			return index -> entries [ slot ].node;
+		}
+
+		slot = ( slot + 1 ) & mask;
+	}
+
+	return 0;
+}
+
+/* Removes the entry for exactly this node, then pulls later entries of the probe
+ * run back into the hole so no lookup ever stops early. */
+void KeyIndexErase ( LIST_KEY_INDEX *index , unsigned long long key , unsigned long node )
+{
+	unsigned long mask = index -> capacity - 1;
+	unsigned long slot = HashKey ( key ) & mask;
+
+	while ( index -> entries [ slot ].node != node )
+	{
+		if ( index -> entries [ slot ].node == 0 )
+		{
+			return;
+		}
+
+		slot = ( slot + 1 ) & mask;
+	}
+
+	unsigned long hole = slot;
+	for ( ;; )
+	{
+		slot = ( slot + 1 ) & mask;
+		if ( index -> entries [ slot ].node == 0 )
+		{
+			break;
+		}
+
+		// an entry may move back only if the hole lies between its home slot and where it is now
+		unsigned long home = HashKey ( index -> entries [ slot ].key ) & mask;
+		unsigned long distanceToEntry = ( slot - home ) & mask;
+		unsigned long distanceToHole = ( hole - home ) & mask;
+		if ( distanceToHole <= distanceToEntry )
+		{
+			index -> entries [ hole ] = index -> entries [ slot ];
+			hole = slot;
+		}
+	}
+
+	index -> entries [ hole ].node = 0;
+	index -> count -= 1;
+}
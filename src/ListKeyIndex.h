@@ -0,0 +1,42 @@
+/* Nic Pucci
+ * LIST KEY INDEX HEADER
+ *
+ * Open-addressing hash from a 64-bit item key to the list node holding it, used
+ * by both list backends for ListAttachIndex. Nodes are opaque nonzero handles
+ * (a NODE pointer or a compact index), so one key may map to several nodes.
+ * Linear probing with backward-shift deletion: no tombstones, so lookups stay
+ * short however many removals there have been.
+*/
+
+#ifndef LIST_KEY_INDEX_H
+#define LIST_KEY_INDEX_H
+
+typedef unsigned long long ( *LIST_KEY_FUNC ) ( void *item );
+
+typedef struct listKeyIndexEntry
+{
+	unsigned long long key;
+	unsigned long node; // 0 = empty slot
+} LIST_KEY_INDEX_ENTRY;
+
+typedef struct listKeyIndex
+{
+	LIST_KEY_INDEX_ENTRY *entries;
+	unsigned long capacity; // always a power of 2
+	unsigned long count;
+	LIST_KEY_FUNC keyOf;
+} LIST_KEY_INDEX;
+
+LIST_KEY_INDEX *KeyIndexCreate ( LIST_KEY_FUNC keyOf , unsigned long expectedCount );
+
+void KeyIndexFree ( LIST_KEY_INDEX *index );
+
+int KeyIndexReserve ( LIST_KEY_INDEX *index , unsigned long numNew );
+
+int KeyIndexInsert ( LIST_KEY_INDEX *index , unsigned long long key , unsigned long node );
+
+unsigned long KeyIndexFind ( LIST_KEY_INDEX *index , unsigned long long key );
+
+void KeyIndexErase ( LIST_KEY_INDEX *index , unsigned long long key , unsigned long node );
+
+#endif
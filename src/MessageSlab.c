@@ -0,0 +1,203 @@
+/* Nic Pucci
+ * MESSAGE SLAB IMPLEMENTATION
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "List.h"
+#include "MessageSlab.h"
+
+const int MESSAGE_SLAB_CLASS_SIZES [ MESSAGE_SLAB_NUM_CLASSES ] = { 64 , 256 , 2048 };
+const unsigned int MESSAGE_SLAB_INITIAL_CHUNK_SIZE = 256;
+const uint16_t MESSAGE_SLAB_LARGE_CLASS = MESSAGE_SLAB_NUM_CLASSES;
+
+/* sits in front of every buffer and doubles as its descriptor; 16 bytes keeps the
+ * payload aligned */
+typedef struct messageHeader
+{
+	uint16_t sizeClass;
+	uint16_t source; // peer a received datagram came from, set by the receiver
+	uint32_t capacity;
+	uint32_t length; // bytes in use, set by whoever fills the buffer
+	uint32_t stamp; // StatsStamp () of the last pipeline stage that touched it
+} MESSAGE_HEADER;
+
+pthread_once_t messageSlabInitOnce = PTHREAD_ONCE_INIT;
+int messageSlabReady = 0;
+
+POOL messageClassPools [ MESSAGE_SLAB_NUM_CLASSES ];
+atomic_ulong messageLargeAllocs;
+
+static void InitMessageSlab ()
+{
+	for ( int i = 0 ; i < MESSAGE_SLAB_NUM_CLASSES ; i++ )
+	{
+		size_t objectSize = sizeof ( MESSAGE_HEADER ) + MESSAGE_SLAB_CLASS_SIZES [ i ];
+		if ( PoolInit ( &messageClassPools [ i ] , objectSize , MESSAGE_SLAB_INITIAL_CHUNK_SIZE , NULL ) != SUCCESS_OP_CODE )
+		{
+			return;
+		}
+	}
+
+	atomic_init ( &messageLargeAllocs , 0 );
+	messageSlabReady = 1;
+}
+
+static MESSAGE_HEADER *HeaderOf ( const void *message )
+{
+	return ( MESSAGE_HEADER *) ( ( char *) message - sizeof ( MESSAGE_HEADER ) );
+}
+
+char *MessageAlloc ( int size )
+{
+	if ( size <= 0 )
+	{
+		size = 1;
+	}
+
+	pthread_once ( &messageSlabInitOnce , &InitMessageSlab );
+
+	MESSAGE_HEADER *header = NULL;
+	uint16_t sizeClass = MESSAGE_SLAB_LARGE_CLASS;
+
+	for ( int i = 0 ; messageSlabReady && i < MESSAGE_SLAB_NUM_CLASSES ; i++ )
+	{
+		if ( size <= MESSAGE_SLAB_CLASS_SIZES [ i ] )
+		{
+			header = ( MESSAGE_HEADER *) PoolAlloc ( &messageClassPools [ i ] );
+			sizeClass = i;
+			size = MESSAGE_SLAB_CLASS_SIZES [ i ];
+			break;
+		}
+	}
+
+	if ( sizeClass == MESSAGE_SLAB_LARGE_CLASS )
+	{
+		header = ( MESSAGE_HEADER *) malloc ( sizeof ( MESSAGE_HEADER ) + size );
+		atomic_fetch_add_explicit ( &messageLargeAllocs , 1 , memory_order_relaxed );
+	}
+
+	if ( !header )
+	{
+		return NULL;
+	}
+
+	header -> sizeClass = sizeClass;
+	header -> source = 0;
+	header -> capacity = size;
+	header -> length = 0;
+	header -> stamp = 0;
+
+	return ( char *) ( header + 1 );
+}
+
+void MessageFree ( void *message )
+{
+	if ( !message )
+	{
+		return;
+	}
+
+	MESSAGE_HEADER *header = HeaderOf ( message );
+	if ( header -> sizeClass == MESSAGE_SLAB_LARGE_CLASS )
+	{
+		free ( header );
+		return;
+	}
+
+	PoolFree ( &messageClassPools [ header -> sizeClass ] , header );
+}
+
+int MessageCapacity ( const char *message )
+{
+	if ( !message )
+	{
+		return 0;
+	}
+
+	return HeaderOf ( message ) -> capacity;
+}
+
+int MessageLength ( const char *message )
+{
+	if ( !message )
+	{
+		return 0;
+	}
+
+	return HeaderOf ( message ) -> length;
+}
+
+void MessageSetLength ( char *message , int length )
+{
+	HeaderOf ( message ) -> length = length;
+}
+
+unsigned int MessageStamp ( const char *message )
+{
+	return HeaderOf ( message ) -> stamp;
+}
+
+void MessageSetStamp ( char *message , unsigned int stamp )
+{
+	HeaderOf ( message ) -> stamp = stamp;
+}
+
+unsigned int MessageSource ( const char *message )
+{
+	return HeaderOf ( message ) -> source;
+}
+
+void MessageSetSource ( char *message , unsigned int source )
+{
+	HeaderOf ( message ) -> source = source;
+}
+
+void MessageSlabGetStats ( MESSAGE_SLAB_STATS *stats )
+{
+	if ( !stats )
+	{
+		return;
+	}
+
+	pthread_once ( &messageSlabInitOnce , &InitMessageSlab );
+
+	for ( int i = 0 ; i < MESSAGE_SLAB_NUM_CLASSES ; i++ )
+	{
+		PoolGetStats ( &messageClassPools [ i ] , &stats -> classStats [ i ] );
+	}
+
+	stats -> largeAllocs = atomic_load ( &messageLargeAllocs );
+}
+
+/* Appends a human readable snapshot to buffer; returns the bytes written (truncated to size). */
+int MessageSlabFormatStats ( char *buffer , int size )
+{
+	MESSAGE_SLAB_STATS stats;
+	MessageSlabGetStats ( &stats );
+
+	int length = snprintf ( buffer , size , "  message slab: class  buffers  hits  misses  high-water\n" );
+	for ( int i = 0 ; i < MESSAGE_SLAB_NUM_CLASSES && length < size ; i++ )
+	{
+		POOL_STATS *classStats = &stats.classStats [ i ];
+		length += snprintf (
+			buffer + length ,
+			size - length ,
+			"    %5d  %lu  %lu  %lu  %lu\n" ,
+			MESSAGE_SLAB_CLASS_SIZES [ i ] ,
+			classStats -> numObjects ,
+			classStats -> cacheHits ,
+			classStats -> cacheMisses ,
+			classStats -> highWaterMark
+		);
+	}
+
+	if ( length < size )
+	{
+		length += snprintf ( buffer + length , size - length , "    large  %lu\n" , stats.largeAllocs );
+	}
+
+	return length < size ? length : size - 1;
+}
@@ -0,0 +1,51 @@
+/* Nic Pucci
+ * MESSAGE SLAB HEADER
+ *
+ * Message buffers come from one pool per size class, so a one-character chat
+ * line no longer costs a 2 KB malloc and buffers freed on another thread go back
+ * through the pool's magazines instead of a glibc arena lock. Requests larger
+ * than the biggest class fall back to malloc.
+ *
+ * Each buffer carries its capacity and the length in use, so a message pointer
+ * is a complete (pointer, length, capacity) descriptor: buffers are filled in
+ * place and handed along without copying or rescanning them.
+*/
+
+#ifndef MESSAGE_SLAB_H
+#define MESSAGE_SLAB_H
+
+#include "Pool.h"
+
+#define MESSAGE_SLAB_NUM_CLASSES 3
+
+extern const int MESSAGE_SLAB_CLASS_SIZES [ MESSAGE_SLAB_NUM_CLASSES ];
+
+typedef struct messageSlabStats
+{
+	POOL_STATS classStats [ MESSAGE_SLAB_NUM_CLASSES ];
+	unsigned long largeAllocs; // requests that bypassed the slab
+} MESSAGE_SLAB_STATS;
+
+char *MessageAlloc ( int size );
+
+void MessageFree ( void *message );
+
+int MessageCapacity ( const char *message );
+
+int MessageLength ( const char *message );
+
+void MessageSetLength ( char *message , int length );
+
+unsigned int MessageStamp ( const char *message );
+
+void MessageSetStamp ( char *message , unsigned int stamp );
+
+unsigned int MessageSource ( const char *message );
+
+void MessageSetSource ( char *message , unsigned int source );
+
+void MessageSlabGetStats ( MESSAGE_SLAB_STATS *stats );
+
+int MessageSlabFormatStats ( char *buffer , int size );
+
+#endif
@@ -0,0 +1,196 @@
+/* Nic Pucci
+ * PEER TABLE IMPLEMENTATION
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include "List.h"
+#include "PeerTable.h"
+
+const int PEER_TABLE_INITIAL_CAPACITY = 16;
+const int PEER_FILE_LINE_SIZE = 512;
+
+int PeerTableInit ( PEER_TABLE *table )
+{
+	memset ( table , 0 , sizeof ( PEER_TABLE ) );
+	atomic_init ( &table -> numPresent , 0 );
+
+	table -> index = KeyIndexCreate ( NULL , PEER_TABLE_INITIAL_CAPACITY );
+	if ( !table -> index )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	return SUCCESS_OP_CODE;
+}
+
+void PeerTableFree ( PEER_TABLE *table )
+{
+	KeyIndexFree ( table -> index );
+	free ( table -> peers );
+	memset ( table , 0 , sizeof ( PEER_TABLE ) );
+}
+
+static int GrowPeers ( PEER_TABLE *table )
+{
+	int capacity = table -> capacity > 0 ? table -> capacity * 2 : PEER_TABLE_INITIAL_CAPACITY;
+	PEER *grown = realloc ( table -> peers , capacity * sizeof ( PEER ) );
+	if ( !grown )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	table -> peers = grown;
+	table -> capacity = capacity;
+	return SUCCESS_OP_CODE;
+}
+
+/* Resolves host (IPv4: group traffic goes through the IPv4 receive socket) and
+ * adds it. A peer that is already in the table is not added twice. */
+int PeerTableAdd ( PEER_TABLE *table , const char *host , const char *port )
+{
+	struct addrinfo hints;
+	memset ( &hints , 0 , sizeof ( hints ) );
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	struct addrinfo *info;
+	int err = getaddrinfo ( host , port , &hints , &info );
+	if ( err != 0 )
+	{
+		fprintf ( stderr , "peer %s:%s: %s\n" , host , port , gai_strerror ( err ) );
+		return FAILURE_OP_CODE;
+	}
+
+	struct sockaddr_in address;
+	memcpy ( &address , info -> ai_addr , sizeof ( address ) );
+	freeaddrinfo ( info );
+
+	if ( PeerTableFind ( table , &address ) >= 0 )
+	{
+		return SUCCESS_OP_CODE;
+	}
+
+	if ( table -> numPeers == PEER_TABLE_MAX_PEERS )
+	{
+		fprintf ( stderr , "peer %s:%s: a group holds at most %d peers\n" , host , port , PEER_TABLE_MAX_PEERS );
+		return FAILURE_OP_CODE;
+	}
+
+	if ( table -> numPeers == table -> capacity && GrowPeers ( table ) == FAILURE_OP_CODE )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	int peerNumber = table -> numPeers;
+	if ( KeyIndexInsert ( table -> index , PeerAddressKey ( &address ) , peerNumber + 1 ) == FAILURE_OP_CODE )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	PEER *peer = &table -> peers [ peerNumber ];
+	peer -> address = address;
+	peer -> labelLength = snprintf ( peer -> label , PEER_LABEL_SIZE , "\n%s:%s: " , host , port );
+	if ( peer -> labelLength >= PEER_LABEL_SIZE )
+	{
+		peer -> labelLength = PEER_LABEL_SIZE - 1;
+	}
+	atomic_init ( &peer -> present , 1 );
+
+	table -> numPeers += 1;
+	atomic_fetch_add ( &table -> numPresent , 1 );
+	return SUCCESS_OP_CODE;
+}
+
+/* Adds one "host:port" entry; the port follows the last colon. */
+static int AddEntry ( PEER_TABLE *table , char *entry )
+{
+	char *colon = strrchr ( entry , ':' );
+	if ( !colon || colon == entry || colon [ 1 ] == '\0' )
+	{
+		fprintf ( stderr , "peer \"%s\" is not host:port\n" , entry );
+		return FAILURE_OP_CODE;
+	}
+
+	*colon = '\0';
+	int added = PeerTableAdd ( table , entry , colon + 1 );
+	*colon = ':';
+	return added;
+}
+
+/* Adds every peer of a "host:port,host:port,..." list; list is modified. */
+int PeerTableAddList ( PEER_TABLE *table , char *list )
+{
+	char *savePtr;
+	for ( char *entry = strtok_r ( list , "," , &savePtr ) ; entry ; entry = strtok_r ( NULL , "," , &savePtr ) )
+	{
+		if ( AddEntry ( table , entry ) == FAILURE_OP_CODE )
+		{
+			return FAILURE_OP_CODE;
+		}
+	}
+
+	return SUCCESS_OP_CODE;
+}
+
+/* Adds one peer per line of host:port; blank lines and lines starting with '#'
+ * are skipped. */
+int PeerTableLoadFile ( PEER_TABLE *table , const char *path )
+{
+	FILE *file = fopen ( path , "r" );
+	if ( !file )
+	{
+		perror ( path );
+		return FAILURE_OP_CODE;
+	}
+
+	char line [ PEER_FILE_LINE_SIZE ];
+	int result = SUCCESS_OP_CODE;
+
+	while ( result == SUCCESS_OP_CODE && fgets ( line , sizeof ( line ) , file ) )
+	{
+		char *entry = line;
+		while ( isspace ( ( unsigned char ) *entry ) )
+		{
+			entry += 1;
+		}
+
+		int length = strlen ( entry );
+		while ( length > 0 && isspace ( ( unsigned char ) entry [ length - 1 ] ) )
+		{
+			length -= 1;
+		}
+		entry [ length ] = '\0';
+
+		if ( length > 0 && entry [ 0 ] != '#' )
+		{
+			result = AddEntry ( table , entry );
+		}
+	}
+
+	fclose ( file );
+	return result;
+}
+
+/* The number of the peer at this address, or -1 if it is not in the group. */
+int PeerTableFind ( PEER_TABLE *table , const struct sockaddr_in *address )
+{
+	return ( int ) KeyIndexFind ( table -> index , PeerAddressKey ( address ) ) - 1;
+}
+
+/* Marks a peer as present or gone; returns how many peers are still present.
+ * Called from one thread only (whichever renders received frames). */
+int PeerSetPresent ( PEER_TABLE *table , int peerNumber , int present )
+{
+	PEER *peer = &table -> peers [ peerNumber ];
+	if ( atomic_exchange ( &peer -> present , present ) != present )
+	{
+		atomic_fetch_add ( &table -> numPresent , present ? 1 : -1 );
+	}
+
+	return atomic_load ( &table -> numPresent );
+}
@@ -0,0 +1,59 @@
+/* Nic Pucci
+ * PEER TABLE HEADER
+ *
+ * The members of a group chat. Peers live in one array, numbered in the order
+ * they were added; a key index from (IPv4 address, port) to that number finds
+ * the sender of a received datagram in O(1) however large the group is. The
+ * table is filled before any thread starts and is read-only afterwards, apart
+ * from each peer's present flag.
+*/
+
+#ifndef PEER_TABLE_H
+#define PEER_TABLE_H
+
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include "ListKeyIndex.h"
+
+#define PEER_LABEL_SIZE 80
+#define PEER_TABLE_MAX_PEERS 65535 // peer numbers travel in a 16-bit message field
+
+typedef struct peer
+{
+	struct sockaddr_in address;
+	char label [ PEER_LABEL_SIZE ]; // "\nhost:port: ", shown in front of its messages
+	int labelLength;
+	atomic_int present; // cleared when it leaves, set again if it speaks
+} PEER;
+
+typedef struct peerTable
+{
+	PEER *peers;
+	int numPeers;
+	int capacity;
+	atomic_int numPresent;
+	LIST_KEY_INDEX *index; // address key -> peer number + 1
+} PEER_TABLE;
+
+/* key of an (IPv4 address, port) pair in a key index, shared with the relay's
+ * membership; both in network byte order, together they fit in 48 bits */
+static inline unsigned long long PeerAddressKey ( const struct sockaddr_in *address )
+{
+	return ( ( unsigned long long ) address -> sin_addr.s_addr << 16 ) | address -> sin_port;
+}
+
+int PeerTableInit ( PEER_TABLE *table );
+
+void PeerTableFree ( PEER_TABLE *table );
+
+int PeerTableAdd ( PEER_TABLE *table , const char *host , const char *port );
+
+int PeerTableAddList ( PEER_TABLE *table , char *list );
+
+int PeerTableLoadFile ( PEER_TABLE *table , const char *path );
+
+int PeerTableFind ( PEER_TABLE *table , const struct sockaddr_in *address );
+
+int PeerSetPresent ( PEER_TABLE *table , int peerNumber , int present );
+
+#endif
@@ -0,0 +1,477 @@
+/* Nic Pucci
+ * POOL IMPLEMENTATION
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "List.h"
+#include "Pool.h"
+
+const unsigned int POOL_MIN_CHUNK_NUM_OBJECTS = POOL_MAGAZINE_SIZE;
+const unsigned int POOL_MAX_CHUNK_NUM_OBJECTS = 65536;
+const size_t POOL_OBJECT_ALIGNMENT = 16;
+const size_t POOL_CHUNK_HEADER_SIZE = POOL_CACHE_LINE_SIZE;
+
+typedef struct poolThreadCache
+{
+	POOL *pool;
+	POOL_MAGAZINE *loaded;
+	POOL_MAGAZINE *previous;
+	unsigned long pendingHits;
+} POOL_THREAD_CACHE;
+
+static POOL_MAGAZINE *MagazineAt ( POOL *pool , unsigned int magazineID )
+{
+	unsigned int index = magazineID - 1;
+	POOL_MAGAZINE *chunk = pool -> magazineChunks [ index / POOL_MAGAZINES_PER_CHUNK ];
+	return &chunk [ index % POOL_MAGAZINES_PER_CHUNK ];
+}
+
+static void DepotPush ( POOL *pool , atomic_ullong *top , POOL_MAGAZINE *magazine )
+{
+	unsigned long long oldTop = atomic_load_explicit ( top , memory_order_relaxed );
+	unsigned long long newTop;
+
+	do
+	{
+		unsigned int topID = ( unsigned int ) ( oldTop & 0xffffffffULL );
+		atomic_store_explicit ( &magazine -> nextMagazineID , topID , memory_order_relaxed );
+
+		unsigned long long tag = ( oldTop >> 32 ) + 1;
+		newTop = ( tag << 32 ) | magazine -> magazineID;
+	}
+	while ( !atomic_compare_exchange_weak_explicit (
+		top , &oldTop , newTop , memory_order_release , memory_order_relaxed
+	) );
+}
+
+static POOL_MAGAZINE *DepotPop ( POOL *pool , atomic_ullong *top )
+{
+	unsigned long long oldTop = atomic_load_explicit ( top , memory_order_acquire );
+	POOL_MAGAZINE *magazine;
+	unsigned long long newTop;
+
+	do
+	{
+		unsigned int topID = ( unsigned int ) ( oldTop & 0xffffffffULL );
+		if ( topID == 0 )
+		{
+			return NULL;
+		}
+
+		// magazines are never freed while the pool lives, so a stale read here is harmless;
+		// the tag makes the CAS fail if the stack changed underneath us
+		magazine = MagazineAt ( pool , topID );
+		unsigned int nextID = atomic_load_explicit ( &magazine -> nextMagazineID , memory_order_relaxed );
+
+		unsigned long long tag = ( oldTop >> 32 ) + 1;
+		newTop = ( tag << 32 ) | nextID;
+	}
+	while ( !atomic_compare_exchange_weak_explicit (
+		top , &oldTop , newTop , memory_order_acquire , memory_order_acquire
+	) );
+
+	return magazine;
+}
+
+static void PushFullMagazine ( POOL *pool , POOL_MAGAZINE *magazine )
+{
+	atomic_fetch_add_explicit ( &pool -> depotNumObjects , magazine -> count , memory_order_relaxed );
+	DepotPush ( pool , &pool -> fullMagazinesTop , magazine );
+}
+
+static POOL_MAGAZINE *PopFullMagazine ( POOL *pool )
+{
+	POOL_MAGAZINE *magazine = DepotPop ( pool , &pool -> fullMagazinesTop );
+	if ( magazine )
+	{
+		atomic_fetch_sub_explicit ( &pool -> depotNumObjects , magazine -> count , memory_order_relaxed );
+	}
+
+	return magazine;
+}
+
+static void RecordMiss ( POOL *pool , POOL_THREAD_CACHE *cache )
+{
+	atomic_fetch_add_explicit ( &pool -> cacheHits , cache -> pendingHits , memory_order_relaxed );
+	atomic_fetch_add_explicit ( &pool -> cacheMisses , 1 , memory_order_relaxed );
+	cache -> pendingHits = 0;
+
+	unsigned long numObjects = atomic_load_explicit ( &pool -> numObjects , memory_order_relaxed );
+	unsigned long depotNumObjects = atomic_load_explicit ( &pool -> depotNumObjects , memory_order_relaxed );
+	unsigned long inUse = numObjects > depotNumObjects ? numObjects - depotNumObjects : 0;
+
+	unsigned long highWaterMark = atomic_load_explicit ( &pool -> highWaterMark , memory_order_relaxed );
+	while ( inUse > highWaterMark && !atomic_compare_exchange_weak_explicit (
+		&pool -> highWaterMark , &highWaterMark , inUse , memory_order_relaxed , memory_order_relaxed
+	) );
+}
+
+/* growLock must be held */
+static POOL_MAGAZINE *NewMagazineLocked ( POOL *pool )
+{
+	unsigned int numMagazines = atomic_load_explicit ( &pool -> numMagazines , memory_order_relaxed );
+	unsigned int chunkIndex = numMagazines / POOL_MAGAZINES_PER_CHUNK;
+	if ( chunkIndex >= POOL_MAX_MAGAZINE_CHUNKS )
+	{
+		return NULL;
+	}
+
+	if ( !pool -> magazineChunks [ chunkIndex ] )
+	{
+		pool -> magazineChunks [ chunkIndex ] = calloc ( POOL_MAGAZINES_PER_CHUNK , sizeof ( POOL_MAGAZINE ) );
+		if ( !pool -> magazineChunks [ chunkIndex ] )
+		{
+			return NULL;
+		}
+	}
+
+	POOL_MAGAZINE *magazine = &pool -> magazineChunks [ chunkIndex ] [ numMagazines % POOL_MAGAZINES_PER_CHUNK ];
+	magazine -> count = 0;
+	magazine -> magazineID = numMagazines + 1;
+	atomic_init ( &magazine -> nextMagazineID , 0 );
+
+	atomic_store_explicit ( &pool -> numMagazines , numMagazines + 1 , memory_order_release );
+	return magazine;
+}
+
+static POOL_MAGAZINE *GetEmptyMagazine ( POOL *pool )
+{
+	POOL_MAGAZINE *magazine = DepotPop ( pool , &pool -> emptyMagazinesTop );
+	if ( magazine )
+	{
+		return magazine;
+	}
+
+	pthread_mutex_lock ( &pool -> growLock );
+	magazine = NewMagazineLocked ( pool );
+	pthread_mutex_unlock ( &pool -> growLock );
+
+	return magazine;
+}
+
+/* Carves a new chunk of objects into full magazines and pushes them to the depot.
+ * Chunk sizes double up to POOL_MAX_CHUNK_NUM_OBJECTS. */
+static int GrowPool ( POOL *pool )
+{
+	pthread_mutex_lock ( &pool -> growLock );
+
+	// another thread may have grown the pool while we waited
+	int alreadyGrown = ( atomic_load ( &pool -> fullMagazinesTop ) & 0xffffffffULL ) != 0;
+	if ( alreadyGrown )
+	{
+		pthread_mutex_unlock ( &pool -> growLock );
+		return SUCCESS_OP_CODE;
+	}
+
+	unsigned int numObjects = pool -> nextChunkNumObjects;
+	size_t chunkSize = POOL_CHUNK_HEADER_SIZE + ( size_t ) numObjects * pool -> objectSize;
+
+	char *chunk = aligned_alloc ( POOL_CACHE_LINE_SIZE , chunkSize );
+	if ( !chunk )
+	{
+		pthread_mutex_unlock ( &pool -> growLock );
+		return FAILURE_OP_CODE;
+	}
+
+	*( void **) chunk = pool -> objectChunksHead;
+	pool -> objectChunksHead = chunk;
+
+	unsigned long firstObjectID = atomic_load ( &pool -> numObjects );
+	char *objects = chunk + POOL_CHUNK_HEADER_SIZE;
+	POOL_MAGAZINE *magazine = NULL;
+
+	for ( unsigned int i = 0 ; i < numObjects ; i++ )
+	{
+		if ( !magazine )
+		{
+			magazine = DepotPop ( pool , &pool -> emptyMagazinesTop );
+			if ( !magazine )
+			{
+				magazine = NewMagazineLocked ( pool );
+			}
+
+			if ( !magazine )
+			{
+				break;
+			}
+		}
+
+		void *object = objects + ( size_t ) i * pool -> objectSize;
+		if ( pool -> objectInit )
+		{
+			( *pool -> objectInit ) ( object , firstObjectID + i );
+		}
+
+		magazine -> objects [ magazine -> count ] = object;
+		magazine -> count += 1;
+
+		if ( magazine -> count == POOL_MAGAZINE_SIZE || i == numObjects - 1 )
+		{
+			PushFullMagazine ( pool , magazine );
+			magazine = NULL;
+		}
+	}
+
+	atomic_fetch_add ( &pool -> numObjects , numObjects );
+
+	if ( pool -> nextChunkNumObjects < pool -> maxChunkNumObjects )
+	{
+		pool -> nextChunkNumObjects *= 2;
+	}
+
+	pthread_mutex_unlock ( &pool -> growLock );
+	return SUCCESS_OP_CODE;
+}
+
+static void FlushThreadCache ( void *cachePtr )
+{
+	POOL_THREAD_CACHE *cache = ( POOL_THREAD_CACHE *) cachePtr;
+	if ( !cache )
+	{
+		return;
+	}
+
+	POOL_MAGAZINE *magazines [ 2 ] = { cache -> loaded , cache -> previous };
+	for ( int i = 0 ; i < 2 ; i++ )
+	{
+		POOL_MAGAZINE *magazine = magazines [ i ];
+		if ( !magazine )
+		{
+			continue;
+		}
+
+		// partially filled magazines go to the full stack; PoolAlloc checks the count
+		if ( magazine -> count > 0 )
+		{
+			PushFullMagazine ( cache -> pool , magazine );
+		}
+		else
+		{
+			DepotPush ( cache -> pool , &cache -> pool -> emptyMagazinesTop , magazine );
+		}
+	}
+
+	atomic_fetch_add_explicit ( &cache -> pool -> cacheHits , cache -> pendingHits , memory_order_relaxed );
+	free ( cache );
+}
+
+static POOL_THREAD_CACHE *GetThreadCache ( POOL *pool )
+{
+	POOL_THREAD_CACHE *cache = pthread_getspecific ( pool -> threadCacheKey );
+	if ( cache )
+	{
+		return cache;
+	}
+
+	cache = calloc ( 1 , sizeof ( POOL_THREAD_CACHE ) );
+	if ( !cache )
+	{
+		return NULL;
+	}
+
+	cache -> pool = pool;
+	cache -> loaded = GetEmptyMagazine ( pool );
+	cache -> previous = GetEmptyMagazine ( pool );
+	if ( !cache -> loaded || !cache -> previous )
+	{
+		FlushThreadCache ( cache );
+		return NULL;
+	}
+
+	pthread_setspecific ( pool -> threadCacheKey , cache );
+	return cache;
+}
+
+int PoolInit (
+	POOL *pool ,
+	size_t objectSize ,
+	unsigned int initialChunkNumObjects ,
+	void ( *objectInit ) ( void *object , unsigned long objectID )
+) {
+	if ( !pool || objectSize == 0 )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	memset ( pool , 0 , sizeof ( POOL ) );
+
+	size_t alignedSize = ( objectSize + POOL_OBJECT_ALIGNMENT - 1 ) & ~( POOL_OBJECT_ALIGNMENT - 1 );
+	pool -> objectSize = alignedSize;
+	pool -> objectInit = objectInit;
+
+	unsigned int chunkNumObjects = initialChunkNumObjects;
+	if ( chunkNumObjects < POOL_MIN_CHUNK_NUM_OBJECTS )
+	{
+		chunkNumObjects = POOL_MIN_CHUNK_NUM_OBJECTS;
+	}
+
+	pool -> nextChunkNumObjects = chunkNumObjects;
+	pool -> maxChunkNumObjects = chunkNumObjects > POOL_MAX_CHUNK_NUM_OBJECTS ? chunkNumObjects : POOL_MAX_CHUNK_NUM_OBJECTS;
+
+	atomic_init ( &pool -> fullMagazinesTop , 0 );
+	atomic_init ( &pool -> emptyMagazinesTop , 0 );
+	atomic_init ( &pool -> numObjects , 0 );
+	atomic_init ( &pool -> numMagazines , 0 );
+
+	if ( pthread_mutex_init ( &pool -> growLock , NULL ) != 0 )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	if ( pthread_key_create ( &pool -> threadCacheKey , &FlushThreadCache ) != 0 )
+	{
+		pthread_mutex_destroy ( &pool -> growLock );
+		return FAILURE_OP_CODE;
+	}
+
+	return SUCCESS_OP_CODE;
+}
+
+/* Only safe once no other thread uses the pool. */
+void PoolDestroy ( POOL *pool )
+{
+	if ( !pool )
+	{
+		return;
+	}
+
+	POOL_THREAD_CACHE *cache = pthread_getspecific ( pool -> threadCacheKey );
+	free ( cache );
+	pthread_key_delete ( pool -> threadCacheKey );
+
+	void *chunk = pool -> objectChunksHead;
+	while ( chunk )
+	{
+		void *nextChunk = *( void **) chunk;
+		free ( chunk );
+		chunk = nextChunk;
+	}
+
+	for ( int i = 0 ; i < POOL_MAX_MAGAZINE_CHUNKS ; i++ )
+	{
+		free ( pool -> magazineChunks [ i ] );
+	}
+
+	pthread_mutex_destroy ( &pool -> growLock );
+	memset ( pool , 0 , sizeof ( POOL ) );
+}
+
+void *PoolAlloc ( POOL *pool )
+{
+	if ( !pool )
+	{
+		return NULL;
+	}
+
+	POOL_THREAD_CACHE *cache = GetThreadCache ( pool );
+	if ( !cache )
+	{
+		return NULL;
+	}
+
+	int missed = 0;
+
+	for ( ;; )
+	{
+		POOL_MAGAZINE *loaded = cache -> loaded;
+		if ( loaded -> count > 0 )
+		{
+			loaded -> count -= 1;
+			cache -> pendingHits += !missed;
+			return loaded -> objects [ loaded -> count ];
+		}
+
+		if ( cache -> previous -> count > 0 )
+		{
+			cache -> loaded = cache -> previous;
+			cache -> previous = loaded;
+			continue;
+		}
+
+		if ( !missed )
+		{
+			RecordMiss ( pool , cache );
+			missed = 1;
+		}
+
+		POOL_MAGAZINE *full = PopFullMagazine ( pool );
+		if ( full )
+		{
+			DepotPush ( pool , &pool -> emptyMagazinesTop , cache -> previous );
+			cache -> previous = loaded;
+			cache -> loaded = full;
+			continue;
+		}
+
+		if ( GrowPool ( pool ) == FAILURE_OP_CODE )
+		{
+			return NULL;
+		}
+	}
+}
+
+void PoolFree ( POOL *pool , void *object )
+{
+	if ( !pool || !object )
+	{
+		return;
+	}
+
+	POOL_THREAD_CACHE *cache = GetThreadCache ( pool );
+	if ( !cache )
+	{
+		return; // leaks the object rather than corrupting the depot
+	}
+
+	for ( ;; )
+	{
+		POOL_MAGAZINE *loaded = cache -> loaded;
+		if ( loaded -> count < POOL_MAGAZINE_SIZE )
+		{
+			loaded -> objects [ loaded -> count ] = object;
+			loaded -> count += 1;
+			return;
+		}
+
+		if ( cache -> previous -> count == 0 )
+		{
+			cache -> loaded = cache -> previous;
+			cache -> previous = loaded;
+			continue;
+		}
+
+		POOL_MAGAZINE *empty = GetEmptyMagazine ( pool );
+		if ( !empty )
+		{
+			return;
+		}
+
+		PushFullMagazine ( pool , cache -> previous );
+		cache -> previous = loaded;
+		cache -> loaded = empty;
+	}
+}
+
+unsigned long PoolNumObjects ( POOL *pool )
+{
+	if ( !pool )
+	{
+		return 0;
+	}
+
+	return atomic_load ( &pool -> numObjects );
+}
+
+void PoolGetStats ( POOL *pool , POOL_STATS *stats )
+{
+	if ( !pool || !stats )
+	{
+		return;
+	}
+
+	stats -> numObjects = atomic_load ( &pool -> numObjects );
+	stats -> cacheHits = atomic_load ( &pool -> cacheHits );
+	stats -> cacheMisses = atomic_load ( &pool -> cacheMisses );
+	stats -> highWaterMark = atomic_load ( &pool -> highWaterMark );
+}
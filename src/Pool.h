@@ -0,0 +1,81 @@
+/* Nic Pucci
+ * POOL HEADER
+ *
+ * Growable pool of fixed-size objects. Each thread keeps two magazines (small
+ * stacks of free objects) and only talks to the shared depot when both are
+ * exhausted (allocating) or full (freeing). The depot is a pair of lock-free
+ * stacks of magazines; only growing the pool by a new chunk takes a lock.
+ * Objects are never returned to the system until the pool is destroyed.
+*/
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define POOL_MAGAZINE_SIZE 64
+#define POOL_MAGAZINES_PER_CHUNK 1024
+#define POOL_MAX_MAGAZINE_CHUNKS 1024 // 64M objects per pool
+#define POOL_CACHE_LINE_SIZE 64
+
+typedef struct poolMagazine
+{
+	void *objects [ POOL_MAGAZINE_SIZE ];
+	int count;
+	unsigned int magazineID; // 1-based index into the pool's magazine table
+	atomic_uint nextMagazineID; // depot stack link, 0 = end
+} POOL_MAGAZINE;
+
+typedef struct pool
+{
+	/* depot stacks: low 32 bits = top magazineID, high 32 bits = ABA tag */
+	_Alignas ( POOL_CACHE_LINE_SIZE ) atomic_ullong fullMagazinesTop;
+	_Alignas ( POOL_CACHE_LINE_SIZE ) atomic_ullong emptyMagazinesTop;
+
+	_Alignas ( POOL_CACHE_LINE_SIZE ) size_t objectSize;
+	unsigned int nextChunkNumObjects;
+	unsigned int maxChunkNumObjects;
+	void ( *objectInit ) ( void *object , unsigned long objectID );
+	pthread_key_t threadCacheKey;
+
+	/* stats: hits are batched per thread and folded in on every miss */
+	_Alignas ( POOL_CACHE_LINE_SIZE ) atomic_ulong cacheHits;
+	atomic_ulong cacheMisses;
+	atomic_ulong depotNumObjects;
+	atomic_ulong highWaterMark;
+
+	pthread_mutex_t growLock;
+	void *objectChunksHead; // singly linked through the first word of each chunk
+	atomic_ulong numObjects;
+	atomic_uint numMagazines;
+	POOL_MAGAZINE *magazineChunks [ POOL_MAX_MAGAZINE_CHUNKS ];
+} POOL;
+
+typedef struct poolStats
+{
+	unsigned long numObjects;
+	unsigned long cacheHits; // allocations served from the thread's own magazines
+	unsigned long cacheMisses; // allocations that had to visit the depot or grow the pool
+	unsigned long highWaterMark; // most objects outside the depot, counted per magazine
+} POOL_STATS;
+
+int PoolInit (
+	POOL *pool ,
+	size_t objectSize ,
+	unsigned int initialChunkNumObjects ,
+	void ( *objectInit ) ( void *object , unsigned long objectID )
+);
+
+void PoolDestroy ( POOL *pool );
+
+void *PoolAlloc ( POOL *pool );
+
+void PoolFree ( POOL *pool , void *object );
+
+unsigned long PoolNumObjects ( POOL *pool );
+
+void PoolGetStats ( POOL *pool , POOL_STATS *stats );
+
+#endif
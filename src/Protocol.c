@@ -0,0 +1,148 @@
+/* Nic Pucci
+ * PROTOCOL IMPLEMENTATION
+*/
+
+#include <string.h>
+#include <arpa/inet.h>
+#include "List.h"
+#include "Protocol.h"
+
+const int FRAME_VERSION_OFFSET = 0;
+const int FRAME_TYPE_OFFSET = 1;
+const int FRAME_FLAGS_OFFSET = 2;
+const int FRAME_SEQUENCE_OFFSET = 4;
+const int FRAME_LENGTH_OFFSET = 8;
+
+void FrameEncodeHeader ( char *buffer , const FRAME_HEADER *header )
+{
+	unsigned short flags = htons ( header -> flags );
+	unsigned int sequence = htonl ( header -> sequence );
+	unsigned short payloadLength = htons ( header -> payloadLength );
+
+	buffer [ FRAME_VERSION_OFFSET ] = ( char ) header -> version;
+	buffer [ FRAME_TYPE_OFFSET ] = ( char ) header -> type;
+	memcpy ( buffer + FRAME_FLAGS_OFFSET , &flags , sizeof ( flags ) );
+	memcpy ( buffer + FRAME_SEQUENCE_OFFSET , &sequence , sizeof ( sequence ) );
+	memcpy ( buffer + FRAME_LENGTH_OFFSET , &payloadLength , sizeof ( payloadLength ) );
+}
+
+/* Fails if fewer than a header's worth of bytes are left, the version is not
+ * ours, or the payload would run past length. */
+int FrameDecodeHeader ( const char *buffer , int length , FRAME_HEADER *header )
+{
+	if ( length < FRAME_HEADER_SIZE )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	unsigned short flags;
+	unsigned int sequence;
+	unsigned short payloadLength;
+	memcpy ( &flags , buffer + FRAME_FLAGS_OFFSET , sizeof ( flags ) );
+	memcpy ( &sequence , buffer + FRAME_SEQUENCE_OFFSET , sizeof ( sequence ) );
+	memcpy ( &payloadLength , buffer + FRAME_LENGTH_OFFSET , sizeof ( payloadLength ) );
+
+	header -> version = ( unsigned char ) buffer [ FRAME_VERSION_OFFSET ];
+	header -> type = ( unsigned char ) buffer [ FRAME_TYPE_OFFSET ];
+	header -> flags = ntohs ( flags );
+	header -> sequence = ntohl ( sequence );
+	header -> payloadLength = ntohs ( payloadLength );
+
+	int knownVersion = header -> version == FRAME_PROTOCOL_VERSION;
+	int payloadFits = header -> payloadLength <= length - FRAME_HEADER_SIZE;
+	if ( !knownVersion || !payloadFits )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	return SUCCESS_OP_CODE;
+}
+
+/* Sequence numbers are stamped by whoever puts the frame on the wire. */
+void FrameSetSequence ( char *frame , unsigned int sequence )
+{
+	unsigned int networkSequence = htonl ( sequence );
+	memcpy ( frame + FRAME_SEQUENCE_OFFSET , &networkSequence , sizeof ( networkSequence ) );
+}
+
+unsigned int FrameSequence ( const char *frame )
+{
+	unsigned int networkSequence;
+	memcpy ( &networkSequence , frame + FRAME_SEQUENCE_OFFSET , sizeof ( networkSequence ) );
+	return ntohl ( networkSequence );
+}
+
+void FrameSetFlags ( char *frame , unsigned short flags )
+{
+	unsigned short networkFlags = htons ( flags );
+	memcpy ( frame + FRAME_FLAGS_OFFSET , &networkFlags , sizeof ( networkFlags ) );
+}
+
+unsigned short FrameFlags ( const char *frame )
+{
+	unsigned short networkFlags;
+	memcpy ( &networkFlags , frame + FRAME_FLAGS_OFFSET , sizeof ( networkFlags ) );
+	return ntohs ( networkFlags );
+}
+
+int FrameType ( const char *frame )
+{
+	return ( unsigned char ) frame [ FRAME_TYPE_OFFSET ];
+}
+
+/* Header plus payload of an already validated (or locally built) frame. */
+int FrameLength ( const char *frame )
+{
+	unsigned short payloadLength;
+	memcpy ( &payloadLength , frame + FRAME_LENGTH_OFFSET , sizeof ( payloadLength ) );
+	return FRAME_HEADER_SIZE + ntohs ( payloadLength );
+}
+
+/* Steps *cursor over the next frame of a datagram. Returns 0 once the datagram is
+ * exhausted or the rest of it is malformed. */
+int FrameNext ( const char **cursor , const char *datagramEnd , FRAME_HEADER *header , const char **payload )
+{
+	const char *frame = *cursor;
+	if ( frame >= datagramEnd )
+	{
+		return 0;
+	}
+
+	if ( FrameDecodeHeader ( frame , datagramEnd - frame , header ) == FAILURE_OP_CODE )
+	{
+		*cursor = datagramEnd;
+		return 0;
+	}
+
+	*payload = frame + FRAME_HEADER_SIZE;
+	*cursor = *payload + header -> payloadLength;
+	return 1;
+}
+
+/* Hands every frame of a datagram to the handler for its type. Types without a
+ * handler (including ones from newer peers) are skipped. Returns the first
+ * nonzero handler result, or 0. */
+int FrameDispatch ( const char *datagram , int length , const FRAME_HANDLER handlers [ FRAME_NUM_TYPES ] , void *context )
+{
+	const char *cursor = datagram;
+	const char *datagramEnd = datagram + length;
+	FRAME_HEADER header;
+	const char *payload;
+
+	while ( FrameNext ( &cursor , datagramEnd , &header , &payload ) )
+	{
+		int knownType = header.type < FRAME_NUM_TYPES && handlers [ header.type ];
+		if ( !knownType )
+		{
+			continue;
+		}
+
+		int result = handlers [ header.type ] ( &header , payload , context );
+		if ( result )
+		{
+			return result;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,95 @@
+/* Nic Pucci
+ * PROTOCOL HEADER
+ *
+ * Wire format. Every datagram carries one or more frames back to back, each a
+ * fixed 10-byte header (network byte order) followed by its payload:
+ *
+ *   0       1       2       4               8       10
+ *   +-------+-------+-------+---------------+-------+------------
+ *   |version| type  | flags |   sequence    |length | payload ...
+ *   +-------+-------+-------+---------------+-------+------------
+ *
+ * The type alone decides what a frame means, so control frames (a peer leaving)
+ * can never be confused with chat text, and receivers dispatch through a table
+ * indexed by type instead of comparing strings.
+ *
+ * With --encrypt a datagram is sent whole inside one sealed frame instead
+ * (Secure.h): its payload is a 64-bit send counter, the datagram's frames
+ * encrypted with ChaCha20-Poly1305, then the 16-byte tag. Only handshake frames
+ * travel beside it in the clear.
+*/
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#define FRAME_HEADER_SIZE 10
+#define FRAME_PROTOCOL_VERSION 1
+
+enum FRAME_TYPE {
+	FRAME_TYPE_INVALID = 0,
+	FRAME_TYPE_DATA, // payload is one chat line
+	FRAME_TYPE_LEAVE, // the sender ended its session; no payload
+	FRAME_TYPE_JOIN, // asks a relay to put the sender in the room the payload names
+	FRAME_TYPE_ORIGIN, // put by a relay in front of the frames it forwards: who sent them
+	FRAME_TYPE_ACK, // reliable mode: the next sequence expected, then a bitmap of later frames held
+	FRAME_TYPE_FRAGMENT, // one piece of a message too long for a frame: message id, fragment index, then the text
+	FRAME_TYPE_FILE_OFFER, // a file the sender wants to send: transfer id, size, then its name
+	FRAME_TYPE_FILE_ANSWER, // the reply to an offer: transfer id, then 1 to accept it or 0 to refuse
+	FRAME_TYPE_FILE_CHUNK, // part of a file: transfer id, offset, then the bytes
+	FRAME_TYPE_FILE_COMPLETE, // the receiver has written every byte of the transfer the payload names
+	FRAME_TYPE_HELLO, // what the sender can decode: 1 if it wants a hello back, then its compression dictionary's id
+	FRAME_TYPE_HANDSHAKE, // 1 if the sender wants a handshake back, its X25519 public key, then with a pre-shared key a MAC of both
+	FRAME_TYPE_SEALED, // a whole datagram of frames, encrypted: send counter, ciphertext, then the tag
+	FRAME_NUM_TYPES
+};
+
+#define FRAME_FLAG_RELIABLE 0x0001 // retransmitted until acknowledged; delivered in sequence order
+#define FRAME_FLAG_LAST_FRAGMENT 0x0002 // the fragment that ends its message
+#define FRAME_FLAG_UNORDERED 0x0004 // with FRAME_FLAG_RELIABLE: delivered as soon as it arrives, not in sequence order
+#define FRAME_FLAG_COMPRESSED 0x0008 // the payload is LZ compressed (Compress.h)
+#define FRAME_FLAG_DICTIONARY 0x0010 // with FRAME_FLAG_COMPRESSED: compressed against the dictionary both ends loaded
+
+#define FRAME_ORIGIN_PAYLOAD_SIZE 6 // IPv4 address and port, network byte order
+#define FRAME_FRAGMENT_HEADER_SIZE 8 // message id and fragment index, network byte order
+#define FRAME_FILE_ID_SIZE 4 // transfer id, network byte order
+#define FRAME_FILE_OFFER_HEADER_SIZE 12 // transfer id and size, network byte order
+#define FRAME_FILE_CHUNK_HEADER_SIZE 12 // transfer id and offset, network byte order
+#define FRAME_HELLO_PAYLOAD_SIZE 5 // reply wanted, then a dictionary id in network byte order (0 = none)
+#define FRAME_HANDSHAKE_PAYLOAD_SIZE 33 // reply wanted, then a public key; a MAC follows when a pre-shared key is used
+#define FRAME_SEALED_HEADER_SIZE 8 // send counter, network byte order
+#define FRAME_SEALED_OVERHEAD ( FRAME_HEADER_SIZE + FRAME_SEALED_HEADER_SIZE + 16 ) // sealing grows a datagram by this much
+#define FRAME_MAX_ROOM_NAME_SIZE 64
+
+typedef struct frameHeader
+{
+	unsigned char version;
+	unsigned char type;
+	unsigned short flags;
+	unsigned int sequence;
+	unsigned short payloadLength;
+} FRAME_HEADER;
+
+/* Handles one received frame; a nonzero return stops the dispatch and is passed back. */
+typedef int ( *FRAME_HANDLER ) ( const FRAME_HEADER *header , const char *payload , void *context );
+
+void FrameEncodeHeader ( char *buffer , const FRAME_HEADER *header );
+
+int FrameDecodeHeader ( const char *buffer , int length , FRAME_HEADER *header );
+
+void FrameSetSequence ( char *frame , unsigned int sequence );
+
+unsigned int FrameSequence ( const char *frame );
+
+void FrameSetFlags ( char *frame , unsigned short flags );
+
+unsigned short FrameFlags ( const char *frame );
+
+int FrameType ( const char *frame );
+
+int FrameLength ( const char *frame );
+
+int FrameNext ( const char **cursor , const char *datagramEnd , FRAME_HEADER *header , const char **payload );
+
+int FrameDispatch ( const char *datagram , int length , const FRAME_HANDLER handlers [ FRAME_NUM_TYPES ] , void *context );
+
+#endif
@@ -0,0 +1,790 @@
+/* Nic Pucci
+ * RELAY IMPLEMENTATION
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "List.h"
+#include "ListKeyIndex.h"
+#include "IntrusiveList.h"
+#include "MessageSlab.h"
+#include "PeerTable.h"
+#include "Pool.h"
+#include "Stats.h"
+#include "Protocol.h"
+#include "RingQueue.h"
+#include "Relay.h"
+
+const char RELAY_LOBBY_ROOM [] = "lobby";
+
+const unsigned int RELAY_QUEUE_CAPACITY = 4096;
+const unsigned long RELAY_INITIAL_MEMBERS = 1024;
+const unsigned int RELAY_MESSAGE_CHUNK_SIZE = 1024;
+const int RELAY_EXPIRY_CHECK_MS = 1000; // a worker with nothing to do still wakes this often to expire idle members
+
+typedef struct relayMember
+{
+	INTRUSIVE_LINK ( struct relayMember ) roomLink;
+	INTRUSIVE_LINK ( struct relayMember ) heardLink;
+	struct sockaddr_in address;
+	unsigned long long addressKey;
+	unsigned long long lastHeardNs;
+	struct relayRoom *room;
+} RELAY_MEMBER;
+
+static inline int MemberHasAddress ( RELAY_MEMBER *member , void *address )
+{
+	return memcmp ( &member -> address , address , sizeof ( struct sockaddr_in ) ) == 0;
+}
+
+static inline void FreeMember ( RELAY_MEMBER *member )
+{
+	free ( member );
+}
+
+INTRUSIVE_LIST_DEFINE ( MemberList , RELAY_MEMBER_LIST , RELAY_MEMBER , roomLink , MemberHasAddress , FreeMember )
+INTRUSIVE_LIST_DEFINE ( HeardList , RELAY_HEARD_LIST , RELAY_MEMBER , heardLink , MemberHasAddress , FreeMember )
+
+/* one worker's view of a room: only the members that worker owns */
+typedef struct relayRoom
+{
+	unsigned long long key;
+	RELAY_MEMBER_LIST members;
+} RELAY_ROOM;
+
+/* One datagram on its way to a room. Every worker delivers it to its own members
+ * and drops its reference; the last one frees it. */
+typedef struct relayMessage
+{
+	atomic_int refs;
+	unsigned long long roomKey;
+	int fromWorker; // the worker that received it, and owns its sender
+	RELAY_MEMBER *sender;
+	char originFrame [ FRAME_HEADER_SIZE + FRAME_ORIGIN_PAYLOAD_SIZE ];
+	char *datagram; // slab buffer it was received into
+	int length;
+} RELAY_MESSAGE;
+
+typedef struct relayWorker
+{
+	_Alignas ( RELAY_CACHE_LINE_SIZE ) int id;
+	int socketFD;
+	int wakeFD; // eventfd, written by workers that queued messages for this one
+	int epollFD;
+	pthread_t thread;
+
+	RING_QUEUE *inbound [ RELAY_MAX_WORKERS ]; // inbound [ from ]: filled by worker from only
+	unsigned long long wakeMask; // workers given messages this round
+
+	LIST_KEY_INDEX *members; // address key -> RELAY_MEMBER *, the clients this worker owns
+	LIST_KEY_INDEX *rooms; // room key -> RELAY_ROOM *, rooms with a member here
+	RELAY_HEARD_LIST heard; // the same members, least recently heard from first
+
+	char *receiveBuffers [ RELAY_RECEIVE_BATCH_SIZE ];
+	struct mmsghdr receiveHeaders [ RELAY_RECEIVE_BATCH_SIZE ];
+	struct iovec receiveVectors [ RELAY_RECEIVE_BATCH_SIZE ];
+	struct sockaddr_in receiveAddresses [ RELAY_RECEIVE_BATCH_SIZE ];
+
+	// deliveries wait here for one sendmmsg; the messages they point into wait in releases
+	struct mmsghdr sendHeaders [ RELAY_SEND_BATCH_SIZE ];
+	struct iovec sendVectors [ RELAY_SEND_BATCH_SIZE ] [ 2 ];
+	int numStaged;
+	RELAY_MESSAGE *releases [ RELAY_RECEIVE_BATCH_SIZE ];
+	int numReleases;
+
+	// owner thread only, read after it exits
+	unsigned long numMembers;
+	unsigned long numExpired;
+	unsigned long numReceived;
+	unsigned long numDelivered;
+	unsigned long numDrops;
+} RELAY_WORKER;
+
+POOL relayMessagePool;
+RELAY_WORKER *relayWorkers = NULL;
+int relayWorkerCount = 0;
+atomic_int relayStopping;
+
+/* FNV-1a over the room name */
+static unsigned long long RoomKey ( const char *name , int length )
+{
+	unsigned long long key = 0xcbf29ce484222325ULL;
+	for ( int i = 0 ; i < length ; i++ )
+	{
+		key ^= ( unsigned char ) name [ i ];
+		key *= 0x100000001b3ULL;
+	}
+
+	return key;
+}
+
+static void ReleaseMessage ( void *object )
+{
+	RELAY_MESSAGE *message = ( RELAY_MESSAGE *) object;
+	if ( atomic_fetch_sub ( &message -> refs , 1 ) == 1 )
+	{
+		MessageFree ( message -> datagram );
+		PoolFree ( &relayMessagePool , message );
+	}
+}
+
+/* Sends every staged delivery, then lets go of the messages they pointed into.
+ * A delivery the kernel refuses is skipped so one bad client cannot hold up the
+ * rest; a full socket buffer is waited out. */
+static void FlushDeliveries ( RELAY_WORKER *worker )
+{
+	int next = 0;
+	while ( next < worker -> numStaged )
+	{
+		int sent = sendmmsg ( worker -> socketFD , worker -> sendHeaders + next , worker -> numStaged - next , 0 );
+		if ( sent < 0 && ( errno == EAGAIN || errno == EINTR ) )
+		{
+			struct pollfd sendPoll = { .fd = worker -> socketFD , .events = POLLOUT };
+			poll ( &sendPoll , 1 , -1 );
+			continue;
+		}
+
+		if ( sent < 0 )
+		{
+			worker -> numDrops += 1;
+			next += 1;
+			continue;
+		}
+
+		worker -> numDelivered += sent;
+		next += sent;
+	}
+
+	worker -> numStaged = 0;
+
+	for ( int i = 0 ; i < worker -> numReleases ; i++ )
+	{
+		ReleaseMessage ( worker -> releases [ i ] );
+	}
+
+	worker -> numReleases = 0;
+}
+
+/* Queues message for every member of its room that this worker owns, except its
+ * sender, and takes over the caller's reference to it. */
+static void StageDeliveries ( RELAY_WORKER *worker , RELAY_MESSAGE *message )
+{
+	if ( worker -> numReleases == RELAY_RECEIVE_BATCH_SIZE )
+	{
+		FlushDeliveries ( worker );
+	}
+
+	RELAY_ROOM *room = ( RELAY_ROOM *) KeyIndexFind ( worker -> rooms , message -> roomKey );
+	RELAY_MEMBER *member = room ? MemberListFirst ( &room -> members ) : NULL;
+
+	// a datagram already at the size limit is forwarded without its origin frame
+	int withOrigin = message -> length + ( int ) sizeof ( message -> originFrame ) <= RELAY_MAX_DATAGRAM_SIZE;
+
+	for ( ; member ; member = MemberListNext ( member ) )
+	{
+		if ( member == message -> sender && worker -> id == message -> fromWorker )
+		{
+			continue;
+		}
+
+		if ( worker -> numStaged == RELAY_SEND_BATCH_SIZE )
+		{
+			FlushDeliveries ( worker ); // message is not in releases yet, so it stays alive
+		}
+
+		struct iovec *vectors = worker -> sendVectors [ worker -> numStaged ];
+		int numVectors = 0;
+		if ( withOrigin )
+		{
+			vectors [ numVectors ].iov_base = message -> originFrame;
+			vectors [ numVectors ].iov_len = sizeof ( message -> originFrame );
+			numVectors += 1;
+		}
+		vectors [ numVectors ].iov_base = message -> datagram;
+		vectors [ numVectors ].iov_len = message -> length;
+		numVectors += 1;
+
+		struct mmsghdr *header = &worker -> sendHeaders [ worker -> numStaged ];
+		memset ( header , 0 , sizeof ( struct mmsghdr ) );
+		header -> msg_hdr.msg_name = &member -> address;
+		header -> msg_hdr.msg_namelen = sizeof ( member -> address );
+		header -> msg_hdr.msg_iov = vectors;
+		header -> msg_hdr.msg_iovlen = numVectors;
+		worker -> numStaged += 1;
+	}
+
+	worker -> releases [ worker -> numReleases ] = message;
+	worker -> numReleases += 1;
+}
+
+static void LeaveRoom ( RELAY_WORKER *worker , RELAY_MEMBER *member )
+{
+	RELAY_ROOM *room = member -> room;
+	MemberListRemove ( &room -> members , member );
+	member -> room = NULL;
+
+	if ( MemberListCount ( &room -> members ) == 0 )
+	{
+		KeyIndexErase ( worker -> rooms , room -> key , ( unsigned long ) room );
+		free ( room );
+	}
+}
+
+static RELAY_ROOM *GetRoom ( RELAY_WORKER *worker , unsigned long long roomKey )
+{
+	RELAY_ROOM *room = ( RELAY_ROOM *) KeyIndexFind ( worker -> rooms , roomKey );
+	if ( room )
+	{
+		return room;
+	}
+
+	room = malloc ( sizeof ( RELAY_ROOM ) );
+	if ( !room )
+	{
+		return NULL;
+	}
+
+	room -> key = roomKey;
+	MemberListInit ( &room -> members );
+
+	if ( KeyIndexInsert ( worker -> rooms , roomKey , ( unsigned long ) room ) == FAILURE_OP_CODE )
+	{
+		free ( room );
+		return NULL;
+	}
+
+	return room;
+}
+
+/* Moves member (NULL: a client this worker has not seen, which becomes one) into
+ * room roomKey. Returns the member, or NULL if it could not be placed. */
+static RELAY_MEMBER *JoinRoom (
+	RELAY_WORKER *worker ,
+	RELAY_MEMBER *member ,
+	const struct sockaddr_in *address ,
+	unsigned long long roomKey
+)
+{
+	if ( member && member -> room -> key == roomKey )
+	{
+		return member;
+	}
+
+	RELAY_ROOM *room = GetRoom ( worker , roomKey );
+	if ( !room )
+	{
+		return member;
+	}
+
+	if ( !member )
+	{
+		member = calloc ( 1 , sizeof ( RELAY_MEMBER ) );
+		unsigned long long addressKey = PeerAddressKey ( address );
+		if ( !member || KeyIndexInsert ( worker -> members , addressKey , ( unsigned long ) member ) == FAILURE_OP_CODE )
+		{
+			free ( member );
+			if ( MemberListCount ( &room -> members ) == 0 )
+			{
+				KeyIndexErase ( worker -> rooms , roomKey , ( unsigned long ) room );
+				free ( room );
+			}
+			return NULL;
+		}
+
+		member -> address = *address;
+		member -> addressKey = addressKey;
+		HeardListAppend ( &worker -> heard , member );
+		worker -> numMembers += 1;
+	}
+	else
+	{
+		LeaveRoom ( worker , member );
+	}
+
+	MemberListAppend ( &room -> members , member );
+	member -> room = room;
+	return member;
+}
+
+static void RemoveMember ( RELAY_WORKER *worker , RELAY_MEMBER *member )
+{
+	FlushDeliveries ( worker ); // staged deliveries may still point at its address
+
+	LeaveRoom ( worker , member );
+	HeardListRemove ( &worker -> heard , member );
+	KeyIndexErase ( worker -> members , member -> addressKey , ( unsigned long ) member );
+	FreeMember ( member );
+	worker -> numMembers -= 1;
+}
+
+static RELAY_MESSAGE *NewRelayMessage ( RELAY_WORKER *worker , char *datagram , int length , RELAY_MEMBER *sender )
+{
+	RELAY_MESSAGE *message = ( RELAY_MESSAGE *) PoolAlloc ( &relayMessagePool );
+	if ( !message )
+	{
+		return NULL;
+	}
+
+	atomic_init ( &message -> refs , relayWorkerCount );
+	message -> roomKey = sender -> room -> key;
+	message -> fromWorker = worker -> id;
+	message -> sender = sender;
+	message -> datagram = datagram;
+	message -> length = length;
+
+	FRAME_HEADER originHeader = {
+		.version = FRAME_PROTOCOL_VERSION ,
+		.type = FRAME_TYPE_ORIGIN ,
+		.flags = 0 ,
+		.sequence = 0 ,
+		.payloadLength = FRAME_ORIGIN_PAYLOAD_SIZE
+	};
+	FrameEncodeHeader ( message -> originFrame , &originHeader );
+	memcpy ( message -> originFrame + FRAME_HEADER_SIZE , &sender -> address.sin_addr.s_addr , 4 );
+	memcpy ( message -> originFrame + FRAME_HEADER_SIZE + 4 , &sender -> address.sin_port , 2 );
+
+	return message;
+}
+
+/* Hands message to every other worker; the ones whose queue is full lose it. */
+static void ShareMessage ( RELAY_WORKER *worker , RELAY_MESSAGE *message )
+{
+	for ( int i = 0 ; i < relayWorkerCount ; i++ )
+	{
+		if ( i == worker -> id )
+		{
+			continue;
+		}
+
+		if ( RingQueuePush ( relayWorkers [ i ].inbound [ worker -> id ] , message ) == FAILURE_OP_CODE )
+		{
+			worker -> numDrops += 1;
+			ReleaseMessage ( message );
+			continue;
+		}
+
+		worker -> wakeMask |= 1ULL << i;
+	}
+}
+
+/* Applies the join frames of one datagram from a client this worker owns and
+ * forwards it if it carries chat (data, fragment or leave frames). Returns 1 if
+ * the datagram's buffer was kept for forwarding. */
+static int HandleClientDatagram ( RELAY_WORKER *worker , char *datagram , int length , const struct sockaddr_in *address )
+{
+	RELAY_MEMBER *member = ( RELAY_MEMBER *) KeyIndexFind ( worker -> members , PeerAddressKey ( address ) );
+
+	const char *cursor = datagram;
+	const char *payload;
+	FRAME_HEADER header;
+	int forward = 0;
+	int leaving = 0;
+
+	while ( FrameNext ( &cursor , datagram + length , &header , &payload ) )
+	{
+		if ( header.type == FRAME_TYPE_JOIN )
+		{
+			int nameLength = header.payloadLength < FRAME_MAX_ROOM_NAME_SIZE ? header.payloadLength : FRAME_MAX_ROOM_NAME_SIZE;
+			member = JoinRoom ( worker , member , address , RoomKey ( payload , nameLength ) );
+		}
+		else if ( header.type == FRAME_TYPE_DATA || header.type == FRAME_TYPE_FRAGMENT )
+		{
+			forward = 1;
+		}
+		else if ( header.type == FRAME_TYPE_LEAVE )
+		{
+			forward = 1;
+			leaving = 1;
+		}
+	}
+
+	if ( forward && !member )
+	{
+		member = JoinRoom ( worker , member , address , RoomKey ( RELAY_LOBBY_ROOM , sizeof ( RELAY_LOBBY_ROOM ) - 1 ) );
+	}
+
+	if ( member )
+	{
+		HeardListRemove ( &worker -> heard , member );
+		HeardListAppend ( &worker -> heard , member );
+		member -> lastHeardNs = StatsNow ();
+	}
+
+	if ( !forward )
+	{
+		return 0;
+	}
+
+	if ( !member )
+	{
+		worker -> numDrops += 1;
+		return 0;
+	}
+
+	RELAY_MESSAGE *message = NewRelayMessage ( worker , datagram , length , member );
+	if ( !message )
+	{
+		worker -> numDrops += 1;
+		return 0;
+	}
+
+	ShareMessage ( worker , message );
+	StageDeliveries ( worker , message );
+
+	if ( leaving )
+	{
+		RemoveMember ( worker , member ); // flushes first, so message -> sender is never read again
+	}
+
+	return 1;
+}
+
+static void ReceiveClientDatagrams ( RELAY_WORKER *worker )
+{
+	int numReceived = recvmmsg ( worker -> socketFD , worker -> receiveHeaders , RELAY_RECEIVE_BATCH_SIZE , MSG_DONTWAIT , NULL );
+	if ( numReceived <= 0 )
+	{
+		return;
+	}
+
+	worker -> numReceived += numReceived;
+
+	for ( int i = 0 ; i < numReceived ; i++ )
+	{
+		char *datagram = worker -> receiveBuffers [ i ];
+		int length = worker -> receiveHeaders [ i ].msg_len;
+		worker -> receiveHeaders [ i ].msg_hdr.msg_namelen = sizeof ( struct sockaddr_in );
+
+		// a forwarded datagram keeps its buffer, so a replacement is had up front
+		char *freshBuffer = MessageAlloc ( RELAY_MAX_DATAGRAM_SIZE );
+		if ( !freshBuffer )
+		{
+			worker -> numDrops += 1;
+			continue;
+		}
+
+		if ( !HandleClientDatagram ( worker , datagram , length , &worker -> receiveAddresses [ i ] ) )
+		{
+			MessageFree ( freshBuffer );
+			continue;
+		}
+
+		worker -> receiveBuffers [ i ] = freshBuffer;
+		worker -> receiveVectors [ i ].iov_base = freshBuffer;
+	}
+}
+
+/* Delivers what the other workers queued here to this worker's members. */
+static void DeliverSharedMessages ( RELAY_WORKER *worker )
+{
+	eventfd_t wakeups;
+	eventfd_read ( worker -> wakeFD , &wakeups );
+
+	RELAY_MESSAGE *messages [ RELAY_RECEIVE_BATCH_SIZE ];
+
+	for ( int from = 0 ; from < relayWorkerCount ; from++ )
+	{
+		if ( from == worker -> id )
+		{
+			continue;
+		}
+
+		int numMessages = RingQueuePopBatch ( worker -> inbound [ from ] , ( void **) messages , RELAY_RECEIVE_BATCH_SIZE );
+		for ( int i = 0 ; i < numMessages ; i++ )
+		{
+			StageDeliveries ( worker , messages [ i ] );
+		}
+
+		if ( numMessages == RELAY_RECEIVE_BATCH_SIZE )
+		{
+			eventfd_write ( worker -> wakeFD , 1 ); // more behind; take them next round
+		}
+	}
+}
+
+/* Forgets the members not heard from for RELAY_MEMBER_TIMEOUT_MS, oldest first,
+ * stopping at the first one still live. */
+static void ExpireIdleMembers ( RELAY_WORKER *worker )
+{
+	unsigned long long nowNs = StatsNow ();
+	unsigned long long timeoutNs = ( unsigned long long ) RELAY_MEMBER_TIMEOUT_MS * 1000000ULL;
+
+	RELAY_MEMBER *member;
+	while ( ( member = HeardListFirst ( &worker -> heard ) ) && nowNs - member -> lastHeardNs >= timeoutNs )
+	{
+		RemoveMember ( worker , member );
+		worker -> numExpired += 1;
+	}
+}
+
+static void EndRound ( RELAY_WORKER *worker )
+{
+	FlushDeliveries ( worker );
+	ExpireIdleMembers ( worker );
+
+	for ( int i = 0 ; worker -> wakeMask ; i++ )
+	{
+		if ( worker -> wakeMask & ( 1ULL << i ) )
+		{
+			eventfd_write ( relayWorkers [ i ].wakeFD , 1 );
+			worker -> wakeMask &= ~( 1ULL << i );
+		}
+	}
+}
+
+static void *RunRelayWorker ( void *arg )
+{
+	RELAY_WORKER *worker = ( RELAY_WORKER *) arg;
+
+	long numCPUs = sysconf ( _SC_NPROCESSORS_ONLN );
+	if ( numCPUs > 0 )
+	{
+		cpu_set_t cpus;
+		CPU_ZERO ( &cpus );
+		CPU_SET ( worker -> id % numCPUs , &cpus );
+		pthread_setaffinity_np ( pthread_self () , sizeof ( cpus ) , &cpus );
+	}
+
+	while ( !atomic_load ( &relayStopping ) )
+	{
+		struct epoll_event events [ 2 ];
+		int numEvents = epoll_wait ( worker -> epollFD , events , 2 , RELAY_EXPIRY_CHECK_MS );
+
+		for ( int i = 0 ; i < numEvents ; i++ )
+		{
+			if ( events [ i ].data.fd == worker -> socketFD )
+			{
+				ReceiveClientDatagrams ( worker );
+			}
+			else
+			{
+				DeliverSharedMessages ( worker );
+			}
+		}
+
+		EndRound ( worker );
+	}
+
+	return NULL;
+}
+
+static int InitRelayWorker ( RELAY_WORKER *worker , int portNum )
+{
+	worker -> members = KeyIndexCreate ( NULL , RELAY_INITIAL_MEMBERS );
+	worker -> rooms = KeyIndexCreate ( NULL , RELAY_INITIAL_MEMBERS );
+	HeardListInit ( &worker -> heard );
+	if ( !worker -> members || !worker -> rooms )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	for ( int from = 0 ; from < relayWorkerCount ; from++ )
+	{
+		if ( from != worker -> id && !( worker -> inbound [ from ] = RingQueueCreate ( RELAY_QUEUE_CAPACITY ) ) )
+		{
+			return FAILURE_OP_CODE;
+		}
+	}
+
+	for ( int i = 0 ; i < RELAY_RECEIVE_BATCH_SIZE ; i++ )
+	{
+		worker -> receiveBuffers [ i ] = MessageAlloc ( RELAY_MAX_DATAGRAM_SIZE );
+		if ( !worker -> receiveBuffers [ i ] )
+		{
+			return FAILURE_OP_CODE;
+		}
+
+		worker -> receiveVectors [ i ].iov_base = worker -> receiveBuffers [ i ];
+		worker -> receiveVectors [ i ].iov_len = RELAY_MAX_DATAGRAM_SIZE;
+		worker -> receiveHeaders [ i ].msg_hdr.msg_iov = &worker -> receiveVectors [ i ];
+		worker -> receiveHeaders [ i ].msg_hdr.msg_iovlen = 1;
+		worker -> receiveHeaders [ i ].msg_hdr.msg_name = &worker -> receiveAddresses [ i ];
+		worker -> receiveHeaders [ i ].msg_hdr.msg_namelen = sizeof ( struct sockaddr_in );
+	}
+
+	worker -> socketFD = socket ( AF_INET , SOCK_DGRAM | SOCK_NONBLOCK , 0 );
+	if ( worker -> socketFD < 0 )
+	{
+		perror ( "cannot create relay socket" );
+		return FAILURE_OP_CODE;
+	}
+
+	int reusePort = 1;
+	setsockopt ( worker -> socketFD , SOL_SOCKET , SO_REUSEPORT , &reusePort , sizeof ( reusePort ) );
+
+	struct sockaddr_in relayAddr;
+	memset ( &relayAddr , 0 , sizeof ( relayAddr ) );
+	relayAddr.sin_family = AF_INET;
+	relayAddr.sin_addr.s_addr = htonl ( INADDR_ANY );
+	relayAddr.sin_port = htons ( portNum );
+
+	if ( bind ( worker -> socketFD , ( struct sockaddr *) &relayAddr , sizeof ( relayAddr ) ) < 0 )
+	{
+		perror ( "relay bind failed" );
+		return FAILURE_OP_CODE;
+	}
+
+	worker -> wakeFD = eventfd ( 0 , EFD_NONBLOCK );
+	worker -> epollFD = epoll_create1 ( 0 );
+	if ( worker -> wakeFD < 0 || worker -> epollFD < 0 )
+	{
+		perror ( "relay worker setup failed" );
+		return FAILURE_OP_CODE;
+	}
+
+	struct epoll_event socketEvent = { .events = EPOLLIN , .data.fd = worker -> socketFD };
+	struct epoll_event wakeEvent = { .events = EPOLLIN , .data.fd = worker -> wakeFD };
+	epoll_ctl ( worker -> epollFD , EPOLL_CTL_ADD , worker -> socketFD , &socketEvent );
+	epoll_ctl ( worker -> epollFD , EPOLL_CTL_ADD , worker -> wakeFD , &wakeEvent );
+
+	return SUCCESS_OP_CODE;
+}
+
+/* Frees a worker's members and rooms; every worker's thread must have exited
+ * and every queue must be drained. */
+static void FreeRelayWorker ( RELAY_WORKER *worker )
+{
+	for ( unsigned long i = 0 ; worker -> rooms && i < worker -> rooms -> capacity ; i++ )
+	{
+		RELAY_ROOM *room = ( RELAY_ROOM *) worker -> rooms -> entries [ i ].node;
+		if ( room )
+		{
+			MemberListFree ( &room -> members );
+			free ( room );
+		}
+	}
+
+	KeyIndexFree ( worker -> members );
+	KeyIndexFree ( worker -> rooms );
+
+	for ( int i = 0 ; i < RELAY_RECEIVE_BATCH_SIZE ; i++ )
+	{
+		MessageFree ( worker -> receiveBuffers [ i ] );
+	}
+
+	close ( worker -> socketFD );
+	close ( worker -> wakeFD );
+	close ( worker -> epollFD );
+}
+
+/* Runs the relay on port with numWorkers worker threads until SIGINT or
+ * SIGTERM, then prints how the clients and traffic were spread. */
+int RunRelay ( const char *port , int numWorkers )
+{
+	if ( numWorkers < 1 || numWorkers > RELAY_MAX_WORKERS )
+	{
+		fprintf ( stderr , "a relay runs 1 to %d workers\n" , RELAY_MAX_WORKERS );
+		return FAILURE_OP_CODE;
+	}
+
+	if ( PoolInit ( &relayMessagePool , sizeof ( RELAY_MESSAGE ) , RELAY_MESSAGE_CHUNK_SIZE , NULL ) == FAILURE_OP_CODE )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	relayWorkers = aligned_alloc ( RELAY_CACHE_LINE_SIZE , numWorkers * sizeof ( RELAY_WORKER ) );
+	if ( !relayWorkers )
+	{
+		PoolDestroy ( &relayMessagePool );
+		return FAILURE_OP_CODE;
+	}
+
+	memset ( relayWorkers , 0 , numWorkers * sizeof ( RELAY_WORKER ) );
+	for ( int i = 0 ; i < numWorkers ; i++ )
+	{
+		relayWorkers [ i ].id = i;
+		relayWorkers [ i ].socketFD = -1;
+		relayWorkers [ i ].wakeFD = -1;
+		relayWorkers [ i ].epollFD = -1;
+	}
+	relayWorkerCount = numWorkers;
+	atomic_init ( &relayStopping , 0 );
+
+	int result = SUCCESS_OP_CODE;
+	int numStarted = 0;
+
+	// the workers inherit the blocked set, so only sigwait below sees the stop signals
+	sigset_t stopSignals;
+	sigemptyset ( &stopSignals );
+	sigaddset ( &stopSignals , SIGINT );
+	sigaddset ( &stopSignals , SIGTERM );
+	pthread_sigmask ( SIG_BLOCK , &stopSignals , NULL );
+
+	for ( int i = 0 ; i < numWorkers && result == SUCCESS_OP_CODE ; i++ )
+	{
+		result = InitRelayWorker ( &relayWorkers [ i ] , atoi ( port ) );
+	}
+
+	for ( int i = 0 ; i < numWorkers && result == SUCCESS_OP_CODE ; i++ )
+	{
+		if ( pthread_create ( &relayWorkers [ i ].thread , NULL , RunRelayWorker , &relayWorkers [ i ] ) != 0 )
+		{
+			result = FAILURE_OP_CODE;
+			break;
+		}
+
+		numStarted += 1;
+	}
+
+	if ( result == SUCCESS_OP_CODE )
+	{
+		printf ( "relay listening on port %s with %d workers\n" , port , numWorkers );
+		fflush ( stdout );
+
+		int signal;
+		sigwait ( &stopSignals , &signal );
+	}
+
+	atomic_store ( &relayStopping , 1 );
+	for ( int i = 0 ; i < numStarted ; i++ )
+	{
+		eventfd_write ( relayWorkers [ i ].wakeFD , 1 );
+	}
+
+	for ( int i = 0 ; i < numStarted ; i++ )
+	{
+		pthread_join ( relayWorkers [ i ].thread , NULL );
+	}
+
+	for ( int i = 0 ; i < numWorkers ; i++ )
+	{
+		RELAY_WORKER *worker = &relayWorkers [ i ];
+		if ( result == SUCCESS_OP_CODE )
+		{
+			printf (
+				"relay worker %d: %lu clients, %lu datagrams in, %lu delivered, %lu dropped, %lu expired\n" ,
+				i , worker -> numMembers , worker -> numReceived , worker -> numDelivered , worker -> numDrops , worker -> numExpired
+			);
+		}
+
+		for ( int from = 0 ; from < numWorkers ; from++ )
+		{
+			RingQueueFree ( worker -> inbound [ from ] , &ReleaseMessage );
+		}
+	}
+
+	for ( int i = 0 ; i < numWorkers ; i++ )
+	{
+		FreeRelayWorker ( &relayWorkers [ i ] );
+	}
+
+	free ( relayWorkers );
+	relayWorkers = NULL;
+	PoolDestroy ( &relayMessagePool );
+	pthread_sigmask ( SIG_UNBLOCK , &stopSignals , NULL );
+
+	return result;
+}
@@ -0,0 +1,35 @@
+/* Nic Pucci
+ * RELAY HEADER
+ *
+ * Hub mode: clients send to the relay, and it forwards every datagram to the
+ * other members of the sender's room, so participants no longer have to reach
+ * each other directly. A client picks its room with a join frame; one that
+ * speaks without joining lands in the lobby.
+ *
+ * Each worker thread binds the relay port with SO_REUSEPORT. The kernel
+ * chooses a socket by hashing the client's address, so a client always lands
+ * on the same worker and that worker alone owns its membership. A forwarded
+ * datagram goes straight to the members its worker owns and is handed to every
+ * other worker through a single-producer/single-consumer queue (one per pair
+ * of workers), so the fast path shares no lock.
+ *
+ * A member leaves with a leave frame, or is forgotten once nothing has come
+ * from it for RELAY_MEMBER_TIMEOUT_MS. Each worker keeps its members in the
+ * order it last heard from them, so expiring the idle ones takes no scan.
+*/
+
+#ifndef RELAY_H
+#define RELAY_H
+
+#define RELAY_MAX_WORKERS 64
+#define RELAY_CACHE_LINE_SIZE 64
+#define RELAY_RECEIVE_BATCH_SIZE 64 // datagrams per recvmmsg, and queued messages taken per round
+#define RELAY_SEND_BATCH_SIZE 256 // deliveries per sendmmsg
+#define RELAY_MAX_DATAGRAM_SIZE 2048 // the chat's largest datagram
+#define RELAY_MEMBER_TIMEOUT_MS 90000 // a client not heard from for this long is dropped; clients renew their join well within it
+
+extern const char RELAY_LOBBY_ROOM [];
+
+int RunRelay ( const char *port , int numWorkers );
+
+#endif
@@ -0,0 +1,811 @@
+/* Nic Pucci
+ * RELIABLE IMPLEMENTATION
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "List.h"
+#include "MessageSlab.h"
+#include "Stats.h"
+#include "Reliable.h"
+
+const long long RELIABLE_INITIAL_TIMEOUT_NS = 1000000000LL; // before the first round trip is measured (RFC 6298)
+const long long RELIABLE_MIN_TIMEOUT_NS = 200000000LL;
+const long long RELIABLE_MAX_TIMEOUT_NS = 60000000000LL;
+const long long RELIABLE_CLOCK_GRANULARITY_NS = 1000000LL;
+const double RELIABLE_INITIAL_WINDOW = 10.0; // frames sent before the first ack (RFC 6928)
+const double RELIABLE_MIN_SLOW_START_THRESHOLD = 2.0;
+const int RELIABLE_DUPLICATE_THRESHOLD = 3; // later frames acknowledged before a frame counts as lost
+const double RELIABLE_QUEUE_DELAY_FRACTION = 0.25; // a round trip this far above the minimum means a queue has built
+const long long RELIABLE_IDLE_WAIT_NS = 1000000000LL; // a blocked sender with no timer running rechecks this often
+
+static char unorderedDelivered; // its address holds the receive slot of an unordered frame already handed on
+
+/* true if sequence a comes before b, across wraparound */
+static int SequenceBefore ( unsigned int a , unsigned int b )
+{
+	return ( int ) ( a - b ) < 0;
+}
+
+static RELIABLE_SEND_SLOT *SendSlot ( RELIABLE_SESSION *session , unsigned int sequence )
+{
+	return &session -> sendSlots [ sequence & ( RELIABLE_WINDOW_SIZE - 1 ) ];
+}
+
+static char **ReceiveSlot ( RELIABLE_SESSION *session , unsigned int sequence )
+{
+	return &session -> receiveSlots [ sequence & ( RELIABLE_WINDOW_SIZE - 1 ) ];
+}
+
+int ReliableInit ( RELIABLE_SESSION *session , RELIABLE_TRANSMIT transmit , void *transmitContext )
+{
+	memset ( session , 0 , sizeof ( RELIABLE_SESSION ) );
+
+	session -> sendSlots = calloc ( RELIABLE_WINDOW_SIZE , sizeof ( RELIABLE_SEND_SLOT ) );
+	session -> receiveSlots = calloc ( RELIABLE_WINDOW_SIZE , sizeof ( char *) );
+	if ( !session -> sendSlots || !session -> receiveSlots )
+	{
+		free ( session -> sendSlots );
+		free ( session -> receiveSlots );
+		return FAILURE_OP_CODE;
+	}
+
+	// waits are timed against the retransmission timer, which runs on CLOCK_MONOTONIC
+	pthread_condattr_t conditionAttribute;
+	pthread_condattr_init ( &conditionAttribute );
+	pthread_condattr_setclock ( &conditionAttribute , CLOCK_MONOTONIC );
+	pthread_cond_init ( &session -> progress , &conditionAttribute );
+	pthread_condattr_destroy ( &conditionAttribute );
+	pthread_mutex_init ( &session -> lock , NULL );
+
+	session -> transmit = transmit;
+	session -> transmitContext = transmitContext;
+	session -> congestionWindow = RELIABLE_INITIAL_WINDOW;
+	session -> slowStartThreshold = RELIABLE_WINDOW_SIZE;
+	session -> timeoutNs = RELIABLE_INITIAL_TIMEOUT_NS;
+	session -> nextSendOrder = 1;
+	return SUCCESS_OP_CODE;
+}
+
+void ReliableFree ( RELIABLE_SESSION *session )
+{
+	for ( unsigned int sequence = session -> unacked ; sequence != session -> nextSequence ; sequence++ )
+	{
+		MessageFree ( SendSlot ( session , sequence ) -> frame );
+	}
+
+	for ( int i = 0 ; i < RELIABLE_WINDOW_SIZE ; i++ )
+	{
+		if ( session -> receiveSlots [ i ] != &unorderedDelivered )
+		{
+			MessageFree ( session -> receiveSlots [ i ] );
+		}
+	}
+
+	free ( session -> sendSlots );
+	free ( session -> receiveSlots );
+	pthread_cond_destroy ( &session -> progress );
+	pthread_mutex_destroy ( &session -> lock );
+	memset ( session , 0 , sizeof ( RELIABLE_SESSION ) );
+}
+
+/* RFC 6298: a first sample sets the smoothed round trip, later ones are folded
+ * in with gains 1/8 and 1/4. A fresh estimate also undoes any backoff. */
+static void SampleRoundTrip ( RELIABLE_SESSION *session , long long rttNs )
+{
+	if ( session -> minRttNs == 0 || rttNs < session -> minRttNs )
+	{
+		session -> minRttNs = rttNs > 0 ? rttNs : 1;
+	}
+
+	if ( session -> smoothedRttNs == 0 )
+	{
+		session -> smoothedRttNs = rttNs > 0 ? rttNs : 1;
+		session -> rttVarianceNs = rttNs / 2;
+	}
+	else
+	{
+		long long error = session -> smoothedRttNs - rttNs;
+		if ( error < 0 )
+		{
+			error = -error;
+		}
+
+		session -> rttVarianceNs = ( 3 * session -> rttVarianceNs + error ) / 4;
+		session -> smoothedRttNs = ( 7 * session -> smoothedRttNs + rttNs ) / 8;
+	}
+
+	long long varianceTerm = 4 * session -> rttVarianceNs;
+	if ( varianceTerm < RELIABLE_CLOCK_GRANULARITY_NS )
+	{
+		varianceTerm = RELIABLE_CLOCK_GRANULARITY_NS;
+	}
+
+	long long timeoutNs = session -> smoothedRttNs + varianceTerm;
+	if ( timeoutNs < RELIABLE_MIN_TIMEOUT_NS )
+	{
+		timeoutNs = RELIABLE_MIN_TIMEOUT_NS;
+	}
+	if ( timeoutNs > RELIABLE_MAX_TIMEOUT_NS )
+	{
+		timeoutNs = RELIABLE_MAX_TIMEOUT_NS;
+	}
+
+	session -> timeoutNs = timeoutNs;
+}
+
+/* Takes one acknowledgement of a slot that was not acknowledged before. Only a
+ * frame sent exactly once gives a round trip sample (Karn's rule). */
+static void AcknowledgeSlot ( RELIABLE_SESSION *session , RELIABLE_SEND_SLOT *slot , unsigned long long nowNs )
+{
+	if ( slot -> lost )
+	{
+		slot -> lost = 0; // the original got there after all
+		session -> numLost -= 1;
+	}
+	else
+	{
+		session -> numInFlight -= 1;
+	}
+
+	if ( slot -> numTransmissions == 1 )
+	{
+		SampleRoundTrip ( session , ( long long ) ( nowNs - slot -> sentNs ) );
+	}
+}
+
+/* Closes a delivery rate measurement once it has run a minimum round trip. */
+static void SampleDeliveryRate ( RELIABLE_SESSION *session , unsigned long long nowNs )
+{
+	if ( session -> minRttNs == 0 )
+	{
+		return;
+	}
+
+	if ( session -> roundStartNs == 0 )
+	{
+		session -> roundStartNs = nowNs;
+		session -> roundStartDelivered = session -> numDelivered;
+		return;
+	}
+
+	unsigned long long elapsedNs = nowNs - session -> roundStartNs;
+	if ( elapsedNs < ( unsigned long long ) session -> minRttNs )
+	{
+		return;
+	}
+
+	double rate = ( session -> numDelivered - session -> roundStartDelivered ) * 1e9 / elapsedNs;
+	session -> deliveryRates [ session -> nextDeliveryRate ] = rate;
+	session -> nextDeliveryRate = ( session -> nextDeliveryRate + 1 ) % RELIABLE_BANDWIDTH_ROUNDS;
+	session -> roundStartNs = nowNs;
+	session -> roundStartDelivered = session -> numDelivered;
+}
+
+/* Frames the path carries per minimum round trip: the best recent delivery
+ * rate times the minimum round trip. 0 before there are measurements. */
+static double EstimatedPathWindow ( RELIABLE_SESSION *session )
+{
+	double bestRate = 0;
+	for ( int i = 0 ; i < RELIABLE_BANDWIDTH_ROUNDS ; i++ )
+	{
+		if ( session -> deliveryRates [ i ] > bestRate )
+		{
+			bestRate = session -> deliveryRates [ i ];
+		}
+	}
+
+	return bestRate * session -> minRttNs / 1e9;
+}
+
+/* The slow start threshold after congestion: the measured path window, or half
+ * the congestion window while nothing has been measured yet. */
+static void LowerSlowStartThreshold ( RELIABLE_SESSION *session )
+{
+	double threshold = EstimatedPathWindow ( session );
+	if ( threshold <= 0 )
+	{
+		threshold = session -> congestionWindow / 2;
+	}
+
+	session -> slowStartThreshold = threshold > RELIABLE_MIN_SLOW_START_THRESHOLD ? threshold : RELIABLE_MIN_SLOW_START_THRESHOLD;
+}
+
+static void TransmitFrames ( RELIABLE_SESSION *session , char **frames , int *numFrames )
+{
+	if ( *numFrames > 0 )
+	{
+		session -> transmit ( frames , *numFrames , session -> transmitContext );
+		*numFrames = 0;
+	}
+}
+
+/* Sends what the congestion window allows: frames declared lost first, oldest
+ * first, then frames never sent. Called with the lock held. */
+static void TransmitLocked ( RELIABLE_SESSION *session )
+{
+	char *frames [ RELIABLE_TRANSMIT_BATCH_SIZE ];
+	int numFrames = 0;
+	int window = ( int ) session -> congestionWindow;
+	unsigned long long nowNs = StatsNow ();
+	unsigned long numRetransmissions = 0;
+
+	for ( unsigned int sequence = session -> unacked ; session -> numLost > 0 && session -> numInFlight < window ; sequence++ )
+	{
+		RELIABLE_SEND_SLOT *slot = SendSlot ( session , sequence );
+		if ( !slot -> lost )
+		{
+			continue;
+		}
+
+		slot -> lost = 0;
+		slot -> sentNs = nowNs;
+		slot -> sendOrder = session -> nextSendOrder++;
+		slot -> numTransmissions += 1;
+		session -> numLost -= 1;
+		session -> numInFlight += 1;
+		numRetransmissions += 1;
+
+		frames [ numFrames ] = slot -> frame;
+		numFrames += 1;
+		if ( numFrames == RELIABLE_TRANSMIT_BATCH_SIZE )
+		{
+			TransmitFrames ( session , frames , &numFrames );
+		}
+	}
+
+	while ( session -> nextToSend != session -> nextSequence && session -> numInFlight < window )
+	{
+		RELIABLE_SEND_SLOT *slot = SendSlot ( session , session -> nextToSend );
+		slot -> sentNs = nowNs;
+		slot -> sendOrder = session -> nextSendOrder++;
+		slot -> numTransmissions = 1;
+		session -> numInFlight += 1;
+		session -> nextToSend += 1;
+
+		frames [ numFrames ] = slot -> frame;
+		numFrames += 1;
+		if ( numFrames == RELIABLE_TRANSMIT_BATCH_SIZE )
+		{
+			TransmitFrames ( session , frames , &numFrames );
+		}
+	}
+
+	TransmitFrames ( session , frames , &numFrames );
+	StatsAdd ( STATS_RETRANSMISSIONS , numRetransmissions );
+
+	if ( session -> timerStartNs == 0 && session -> unacked != session -> nextToSend )
+	{
+		session -> timerStartNs = nowNs;
+	}
+}
+
+/* A frame is lost once RELIABLE_DUPLICATE_THRESHOLD frames sent after its last
+ * transmission have been acknowledged: walking down from the newest frame, keep
+ * the latest send orders among the acknowledged ones seen so far. The first loss
+ * that comes with a standing queue starts a congestion episode, which lasts
+ * until everything sent before it is acknowledged, so one burst of drops
+ * lowers the window once and the window does not grow meanwhile. */
+static void DetectLosses ( RELIABLE_SESSION *session )
+{
+	unsigned long long latestOrders [ RELIABLE_DUPLICATE_THRESHOLD ];
+	memset ( latestOrders , 0 , sizeof ( latestOrders ) );
+	int numNewlyLost = 0;
+
+	for ( unsigned int sequence = session -> nextToSend ; sequence != session -> unacked ; )
+	{
+		sequence -= 1;
+		RELIABLE_SEND_SLOT *slot = SendSlot ( session , sequence );
+
+		if ( slot -> sacked )
+		{
+			// insertion into the descending top-N; send orders start at 1, so 0 is empty
+			unsigned long long sendOrder = slot -> sendOrder;
+			for ( int i = 0 ; i < RELIABLE_DUPLICATE_THRESHOLD ; i++ )
+			{
+				if ( sendOrder > latestOrders [ i ] )
+				{
+					unsigned long long displaced = latestOrders [ i ];
+					latestOrders [ i ] = sendOrder;
+					sendOrder = displaced;
+				}
+			}
+			continue;
+		}
+
+		if ( slot -> lost || latestOrders [ RELIABLE_DUPLICATE_THRESHOLD - 1 ] <= slot -> sendOrder )
+		{
+			continue;
+		}
+
+		slot -> lost = 1;
+		session -> numLost += 1;
+		session -> numInFlight -= 1;
+		numNewlyLost += 1;
+	}
+
+	if ( numNewlyLost == 0 || session -> inRecovery )
+	{
+		return;
+	}
+
+	// no standing queue: the link dropped it, not congestion, and the window keeps growing
+	double queueDelayNs = session -> smoothedRttNs - session -> minRttNs;
+	if ( queueDelayNs <= session -> minRttNs * RELIABLE_QUEUE_DELAY_FRACTION )
+	{
+		return;
+	}
+
+	session -> inRecovery = 1;
+	session -> recoveryPoint = session -> nextToSend;
+	LowerSlowStartThreshold ( session );
+	if ( session -> congestionWindow > session -> slowStartThreshold )
+	{
+		session -> congestionWindow = session -> slowStartThreshold;
+	}
+}
+
+/* Ack payload: the next sequence the receiver expects (everything before it is
+ * delivered), then a bitmap in which bit i of byte j stands for that sequence
+ * + 1 + 8j + i. */
+static void HandleAck ( RELIABLE_SESSION *session , const char *payload , int payloadLength )
+{
+	if ( payloadLength < 4 )
+	{
+		return;
+	}
+
+	unsigned int cumulative;
+	memcpy ( &cumulative , payload , sizeof ( cumulative ) );
+	cumulative = ntohl ( cumulative );
+
+	const unsigned char *bitmap = ( const unsigned char *) payload + 4;
+	int numBits = ( payloadLength - 4 ) * 8;
+	if ( numBits > RELIABLE_SACK_BITS )
+	{
+		numBits = RELIABLE_SACK_BITS;
+	}
+
+	pthread_mutex_lock ( &session -> lock );
+
+	// anything outside what is in flight is stale or bogus
+	if ( SequenceBefore ( cumulative , session -> unacked ) || SequenceBefore ( session -> nextToSend , cumulative ) )
+	{
+		pthread_mutex_unlock ( &session -> lock );
+		return;
+	}
+
+	unsigned long long nowNs = StatsNow ();
+	int numAcknowledged = 0;
+	int unackedMoved = session -> unacked != cumulative;
+
+	while ( session -> unacked != cumulative )
+	{
+		RELIABLE_SEND_SLOT *slot = SendSlot ( session , session -> unacked );
+		if ( !slot -> sacked )
+		{
+			AcknowledgeSlot ( session , slot , nowNs );
+			numAcknowledged += 1;
+		}
+
+		MessageFree ( slot -> frame );
+		memset ( slot , 0 , sizeof ( RELIABLE_SEND_SLOT ) );
+		session -> unacked += 1;
+	}
+
+	int numSacked = 0;
+	for ( int i = 0 ; i < numBits ; i++ )
+	{
+		if ( !( bitmap [ i >> 3 ] & ( 1 << ( i & 7 ) ) ) )
+		{
+			continue;
+		}
+
+		unsigned int sequence = cumulative + 1 + i;
+		if ( !SequenceBefore ( sequence , session -> nextToSend ) )
+		{
+			break;
+		}
+
+		RELIABLE_SEND_SLOT *slot = SendSlot ( session , sequence );
+		if ( !slot -> sacked )
+		{
+			AcknowledgeSlot ( session , slot , nowNs );
+			slot -> sacked = 1;
+			numSacked += 1;
+		}
+	}
+
+	// the timer is for acks stopping altogether, so newly selected frames restart it too
+	if ( unackedMoved || numSacked > 0 )
+	{
+		session -> timerStartNs = session -> unacked != session -> nextToSend ? nowNs : 0;
+	}
+
+	if ( unackedMoved )
+	{
+		session -> lastProgressNs = nowNs;
+		pthread_cond_broadcast ( &session -> progress );
+	}
+
+	if ( session -> inRecovery && !SequenceBefore ( session -> unacked , session -> recoveryPoint ) )
+	{
+		session -> inRecovery = 0;
+	}
+
+	numAcknowledged += numSacked;
+	session -> numDelivered += numAcknowledged;
+	SampleDeliveryRate ( session , nowNs );
+
+	if ( !session -> inRecovery && numAcknowledged > 0 )
+	{
+		if ( session -> congestionWindow < session -> slowStartThreshold )
+		{
+			session -> congestionWindow += numAcknowledged;
+		}
+		else
+		{
+			session -> congestionWindow += numAcknowledged / session -> congestionWindow;
+		}
+
+		if ( session -> congestionWindow > RELIABLE_WINDOW_SIZE )
+		{
+			session -> congestionWindow = RELIABLE_WINDOW_SIZE;
+		}
+	}
+
+	if ( numSacked > 0 )
+	{
+		DetectLosses ( session );
+	}
+
+	TransmitLocked ( session );
+	pthread_mutex_unlock ( &session -> lock );
+}
+
+/* Called with the lock held. When the timer has run out every frame still
+ * unacknowledged is presumed lost, the window drops to one frame (slow start
+ * brings it back to the measured path window) and the timeout doubles; the
+ * oldest frame goes out again first. */
+static void OnTimerLocked ( RELIABLE_SESSION *session )
+{
+	unsigned long long nowNs = StatsNow ();
+	int expired = session -> timerStartNs != 0 && nowNs >= session -> timerStartNs + session -> timeoutNs;
+	if ( !expired || session -> unacked == session -> nextToSend )
+	{
+		return;
+	}
+
+	for ( unsigned int sequence = session -> unacked ; sequence != session -> nextToSend ; sequence++ )
+	{
+		RELIABLE_SEND_SLOT *slot = SendSlot ( session , sequence );
+		if ( !slot -> sacked && !slot -> lost )
+		{
+			slot -> lost = 1;
+			session -> numLost += 1;
+			session -> numInFlight -= 1;
+		}
+	}
+
+	LowerSlowStartThreshold ( session );
+	session -> congestionWindow = 1;
+	session -> inRecovery = 0;
+
+	session -> timeoutNs *= 2;
+	if ( session -> timeoutNs > RELIABLE_MAX_TIMEOUT_NS )
+	{
+		session -> timeoutNs = RELIABLE_MAX_TIMEOUT_NS;
+	}
+
+	session -> timerStartNs = nowNs;
+	StatsAdd ( STATS_RETRANSMISSION_TIMEOUTS , 1 );
+	TransmitLocked ( session );
+}
+
+void ReliableOnTimer ( RELIABLE_SESSION *session )
+{
+	pthread_mutex_lock ( &session -> lock );
+	OnTimerLocked ( session );
+	pthread_mutex_unlock ( &session -> lock );
+}
+
+/* Milliseconds until the retransmission timer runs out (rounded up), or -1 if
+ * nothing is in flight. */
+int ReliableTimeoutMs ( RELIABLE_SESSION *session )
+{
+	pthread_mutex_lock ( &session -> lock );
+
+	int timeoutMs = -1;
+	if ( session -> timerStartNs != 0 )
+	{
+		long long remainingNs = ( long long ) ( session -> timerStartNs + session -> timeoutNs - StatsNow () );
+		timeoutMs = remainingNs > 0 ? ( int ) ( ( remainingNs + 999999 ) / 1000000 ) : 0;
+	}
+
+	pthread_mutex_unlock ( &session -> lock );
+	return timeoutMs;
+}
+
+/* Sleeps until an ack moves things along, the retransmission timer runs out or
+ * untilNs passes (0 = no limit of its own); handles the timer. Lock held. */
+static void WaitForProgressLocked ( RELIABLE_SESSION *session , unsigned long long untilNs )
+{
+	unsigned long long deadlineNs = session -> timerStartNs != 0
+		? session -> timerStartNs + session -> timeoutNs
+		: StatsNow () + RELIABLE_IDLE_WAIT_NS;
+	if ( untilNs != 0 && untilNs < deadlineNs )
+	{
+		deadlineNs = untilNs;
+	}
+
+	struct timespec deadline = { .tv_sec = deadlineNs / 1000000000ULL , .tv_nsec = deadlineNs % 1000000000ULL };
+	pthread_cond_timedwait ( &session -> progress , &session -> lock , &deadline );
+	OnTimerLocked ( session );
+}
+
+/* Numbers a frame and puts it in the send buffer, which has room. Lock held. */
+static void BufferFrameLocked ( RELIABLE_SESSION *session , char *frame )
+{
+	FrameSetSequence ( frame , session -> nextSequence );
+	FrameSetFlags ( frame , FrameFlags ( frame ) | FRAME_FLAG_RELIABLE );
+
+	RELIABLE_SEND_SLOT *slot = SendSlot ( session , session -> nextSequence );
+	memset ( slot , 0 , sizeof ( RELIABLE_SEND_SLOT ) );
+	slot -> frame = frame;
+	session -> nextSequence += 1;
+}
+
+/* Room for one more frame, with fewer than maxUnsent buffered but never sent. Lock held. */
+static int SendBufferRoom ( RELIABLE_SESSION *session , int maxUnsent )
+{
+	return session -> nextSequence - session -> unacked < RELIABLE_WINDOW_SIZE
+		&& ( int ) ( session -> nextSequence - session -> nextToSend ) < maxUnsent;
+}
+
+/* Takes ownership of frames, numbers them and sends as many as the window
+ * allows; the rest go out as acks come back. Blocks while the send buffer is
+ * full (RELIABLE_WINDOW_SIZE frames unacknowledged), still serving the timer,
+ * unless sending has been stopped: then the frames that do not fit are freed.
+ * Returns the number of frames taken into the buffer. */
+int ReliableSend ( RELIABLE_SESSION *session , char **frames , int numFrames )
+{
+	return ReliableSendBulk ( session , frames , numFrames , RELIABLE_WINDOW_SIZE );
+}
+
+/* ReliableSend that also waits while maxUnsent frames are buffered and not yet
+ * sent. A bulk sender that keeps the buffer topped up only this far ahead of
+ * the window leaves frames queued after it (a chat line) waiting behind a
+ * little bulk data, not a whole buffer of it. */
+int ReliableSendBulk ( RELIABLE_SESSION *session , char **frames , int numFrames , int maxUnsent )
+{
+	pthread_mutex_lock ( &session -> lock );
+
+	int numBuffered = 0;
+	for ( ; numBuffered < numFrames ; numBuffered++ )
+	{
+		while ( !SendBufferRoom ( session , maxUnsent ) && !session -> stopped )
+		{
+			TransmitLocked ( session );
+			WaitForProgressLocked ( session , 0 );
+		}
+
+		if ( !SendBufferRoom ( session , maxUnsent ) )
+		{
+			break;
+		}
+
+		BufferFrameLocked ( session , frames [ numBuffered ] );
+	}
+
+	TransmitLocked ( session );
+	pthread_mutex_unlock ( &session -> lock );
+
+	for ( int i = numBuffered ; i < numFrames ; i++ )
+	{
+		MessageFree ( frames [ i ] );
+	}
+
+	return numBuffered;
+}
+
+/* ReliableSend for a thread that must never wait on the peer: the frame is
+ * taken only if the send buffer has room for it right now. On failure it stays
+ * the caller's. */
+int ReliableTrySend ( RELIABLE_SESSION *session , char *frame )
+{
+	pthread_mutex_lock ( &session -> lock );
+
+	int full = !SendBufferRoom ( session , RELIABLE_WINDOW_SIZE );
+	if ( !full )
+	{
+		BufferFrameLocked ( session , frame );
+		TransmitLocked ( session );
+	}
+
+	pthread_mutex_unlock ( &session -> lock );
+	return full ? FAILURE_OP_CODE : SUCCESS_OP_CODE;
+}
+
+/* From now on no send waits for buffer space, and any that is waiting returns:
+ * the session is closing and the peer may be gone. Frames already buffered are
+ * still sent and retransmitted. */
+void ReliableStopSending ( RELIABLE_SESSION *session )
+{
+	pthread_mutex_lock ( &session -> lock );
+	session -> stopped = 1;
+	pthread_cond_broadcast ( &session -> progress );
+	pthread_mutex_unlock ( &session -> lock );
+}
+
+/* Waits for everything sent to be acknowledged, retransmitting as needed, but
+ * gives up once acks have made no progress for lingerMs: the peer may be gone. */
+int ReliableFlush ( RELIABLE_SESSION *session , int lingerMs )
+{
+	pthread_mutex_lock ( &session -> lock );
+
+	unsigned long long nowNs = StatsNow ();
+	if ( session -> lastProgressNs < nowNs )
+	{
+		session -> lastProgressNs = nowNs;
+	}
+
+	while ( session -> unacked != session -> nextSequence )
+	{
+		unsigned long long giveUpNs = session -> lastProgressNs + ( unsigned long long ) lingerMs * 1000000ULL;
+		if ( StatsNow () >= giveUpNs )
+		{
+			break;
+		}
+
+		TransmitLocked ( session );
+		WaitForProgressLocked ( session , giveUpNs );
+	}
+
+	int flushed = session -> unacked == session -> nextSequence;
+	pthread_mutex_unlock ( &session -> lock );
+	return flushed ? SUCCESS_OP_CODE : FAILURE_OP_CODE;
+}
+
+/* Holds a reliable datagram in the slot for its sequence until everything before
+ * it has arrived. An unordered one is handed straight back to be delivered and
+ * only its slot is marked, so it is still acknowledged and a retransmitted copy
+ * is known for a duplicate. Duplicates, and frames too far ahead to hold, are
+ * dropped; either way the sender hears about it in the next ack. Returns 1 if
+ * the caller delivers the datagram now. */
+static int AcceptReliableDatagram ( RELIABLE_SESSION *session , char *datagram , unsigned int sequence , int unordered )
+{
+	session -> ackPending = 1;
+
+	unsigned int offset = sequence - session -> nextExpected;
+	char **slot = ReceiveSlot ( session , sequence );
+	if ( offset >= RELIABLE_WINDOW_SIZE || *slot )
+	{
+		MessageFree ( datagram );
+		return 0;
+	}
+
+	if ( unordered )
+	{
+		*slot = &unorderedDelivered;
+		return 1;
+	}
+
+	*slot = datagram;
+	return 0;
+}
+
+/* Takes a received datagram. Ack frames go to the sending side; a datagram that
+ * carries a reliable frame is kept and comes back out of ReliableNextInOrder
+ * when its turn comes, unless it is marked unordered. Returns 1 if the caller
+ * should deliver the datagram as it is (it is not reliable, or it is unordered
+ * and new), 0 if the session took it. */
+int ReliableReceive ( RELIABLE_SESSION *session , char *datagram )
+{
+	const char *cursor = datagram;
+	const char *datagramEnd = datagram + MessageLength ( datagram );
+	FRAME_HEADER header;
+	const char *payload;
+
+	int hasReliableFrame = 0;
+	int hasOtherFrames = 0;
+	int unordered = 0;
+	unsigned int sequence = 0;
+
+	while ( FrameNext ( &cursor , datagramEnd , &header , &payload ) )
+	{
+		if ( header.type == FRAME_TYPE_ACK )
+		{
+			HandleAck ( session , payload , header.payloadLength );
+		}
+		else if ( header.flags & FRAME_FLAG_RELIABLE )
+		{
+			if ( !hasReliableFrame )
+			{
+				sequence = header.sequence;
+				unordered = ( header.flags & FRAME_FLAG_UNORDERED ) != 0;
+			}
+			hasReliableFrame = 1;
+		}
+		else
+		{
+			hasOtherFrames = 1;
+		}
+	}
+
+	if ( hasReliableFrame )
+	{
+		return AcceptReliableDatagram ( session , datagram , sequence , unordered );
+	}
+
+	if ( hasOtherFrames )
+	{
+		return 1;
+	}
+
+	MessageFree ( datagram );
+	return 0;
+}
+
+/* The next datagram in sequence order if it has arrived, else NULL. Unordered
+ * frames, already delivered, are passed over. */
+char *ReliableNextInOrder ( RELIABLE_SESSION *session )
+{
+	for ( ;; )
+	{
+		char **slot = ReceiveSlot ( session , session -> nextExpected );
+		char *datagram = *slot;
+		if ( !datagram )
+		{
+			return NULL;
+		}
+
+		*slot = NULL;
+		session -> nextExpected += 1;
+		if ( datagram != &unorderedDelivered )
+		{
+			return datagram;
+		}
+	}
+}
+
+/* Writes an ack frame (at most RELIABLE_MAX_ACK_SIZE bytes) if anything arrived
+ * since the last one; returns its length, or 0 if no ack is due. The bitmap is
+ * cut after its last set byte. */
+int ReliableEncodeAck ( RELIABLE_SESSION *session , char *frame )
+{
+	if ( !session -> ackPending )
+	{
+		return 0;
+	}
+
+	char *payload = frame + FRAME_HEADER_SIZE;
+	unsigned int cumulative = htonl ( session -> nextExpected );
+	memcpy ( payload , &cumulative , sizeof ( cumulative ) );
+
+	unsigned char *bitmap = ( unsigned char *) payload + 4;
+	memset ( bitmap , 0 , RELIABLE_SACK_BITS / 8 );
+
+	int bitmapLength = 0;
+	for ( int i = 0 ; i < RELIABLE_SACK_BITS ; i++ )
+	{
+		if ( *ReceiveSlot ( session , session -> nextExpected + 1 + i ) )
+		{
+			bitmap [ i >> 3 ] |= 1 << ( i & 7 );
+			bitmapLength = ( i >> 3 ) + 1;
+		}
+	}
+
+	FRAME_HEADER header = {
+		.version = FRAME_PROTOCOL_VERSION ,
+		.type = FRAME_TYPE_ACK ,
+		.flags = 0 ,
+		.sequence = 0 ,
+		.payloadLength = 4 + bitmapLength
+	};
+	FrameEncodeHeader ( frame , &header );
+
+	session -> ackPending = 0;
+	return FRAME_HEADER_SIZE + header.payloadLength;
+}
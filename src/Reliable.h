@@ -0,0 +1,119 @@
+/* Nic Pucci
+ * RELIABLE HEADER
+ *
+ * Optional reliable, ordered delivery between two peers over the existing UDP
+ * socket pair. The sender gives every frame its own sequence number, marks it
+ * FRAME_FLAG_RELIABLE, sends it as a datagram of its own and keeps it until it
+ * is acknowledged. The receiver answers each batch it reads with one ack frame
+ * (the next sequence it expects plus a bitmap of the later frames it already
+ * holds) and hands frames on strictly in sequence order, except those the
+ * sender marks FRAME_FLAG_UNORDERED: they are still acknowledged and
+ * retransmitted, but handed on the moment they arrive, so a bulk transfer that
+ * places each frame itself never waits behind a gap.
+ *
+ * Frames are not sent one round trip at a time: a congestion window (slow
+ * start, then one frame per round trip) decides how many may be in flight, so
+ * on a long path throughput is bounded by the window and not by the latency. A
+ * frame is declared lost as soon as three frames sent after it are
+ * acknowledged and goes out again straight away; only when acks stop
+ * altogether does the retransmission timeout fire. That timeout follows the
+ * measured round trip (RFC 6298 smoothing, Karn's rule, doubling on every
+ * expiry).
+ *
+ * Loss alone does not shrink the window, since on a lossy link most losses are
+ * not congestion. A loss episode that comes with a standing queue (the round
+ * trip well above its minimum) sets the window to what the path was measured
+ * to deliver per minimum round trip (as TCP Westwood+ does) instead of halving
+ * it, so random loss no longer drags a long, fast path down to a trickle.
+ *
+ * The sending side may be driven from any thread (it has a lock of its own);
+ * the receiving side belongs to the thread that reads the socket.
+*/
+
+#ifndef RELIABLE_H
+#define RELIABLE_H
+
+#include <pthread.h>
+#include "Protocol.h"
+
+#define RELIABLE_WINDOW_SIZE 4096 // frames buffered on either side; power of 2
+#define RELIABLE_SACK_BITS 1024 // frames past the cumulative ack that one ack frame reports
+#define RELIABLE_TRANSMIT_BATCH_SIZE 64 // frames handed to transmit per call
+#define RELIABLE_BANDWIDTH_ROUNDS 10 // delivery rate is the best of this many recent round trips
+#define RELIABLE_MAX_ACK_SIZE ( FRAME_HEADER_SIZE + 4 + RELIABLE_SACK_BITS / 8 )
+
+/* Puts frames on the wire, one datagram each; returns how many went out. */
+typedef int ( *RELIABLE_TRANSMIT ) ( char **frames , int numFrames , void *context );
+
+typedef struct reliableSendSlot
+{
+	char *frame; // owned until acknowledged
+	unsigned long long sentNs; // last transmission
+	unsigned long long sendOrder; // of the last transmission, among all the session's transmissions
+	unsigned short numTransmissions;
+	unsigned char sacked; // the receiver holds it, but not yet everything before it
+	unsigned char lost; // declared lost and not sent again yet
+} RELIABLE_SEND_SLOT;
+
+typedef struct reliableSession
+{
+	/* sending side, under lock */
+	pthread_mutex_t lock;
+	pthread_cond_t progress; // broadcast when acks free buffer space
+	RELIABLE_TRANSMIT transmit;
+	void *transmitContext;
+	RELIABLE_SEND_SLOT *sendSlots; // [ sequence % RELIABLE_WINDOW_SIZE ], unacked up to nextSequence
+	unsigned int unacked; // oldest frame not acknowledged yet
+	unsigned int nextToSend; // oldest frame never sent
+	unsigned int nextSequence; // given to the next frame queued
+	int numInFlight; // sent, neither acknowledged nor declared lost
+	int numLost; // declared lost, waiting to be sent again
+	unsigned long long nextSendOrder;
+	double congestionWindow; // frames
+	double slowStartThreshold;
+	int inRecovery;
+	unsigned int recoveryPoint; // the loss episode ends once everything before this is acknowledged
+	long long smoothedRttNs; // 0 until the first sample
+	long long rttVarianceNs;
+	long long timeoutNs;
+	unsigned long long timerStartNs; // the retransmission timer runs from here while frames are in flight
+	unsigned long long lastProgressNs; // last time an ack moved unacked forward
+	int stopped; // sends no longer wait for buffer space
+	long long minRttNs; // 0 until the first sample
+	unsigned long numDelivered; // frames acknowledged, cumulatively or selectively
+	unsigned long long roundStartNs; // current delivery rate measurement
+	unsigned long roundStartDelivered;
+	double deliveryRates [ RELIABLE_BANDWIDTH_ROUNDS ]; // frames per second, one per round trip
+	int nextDeliveryRate;
+
+	/* receiving side, receiving thread only */
+	char **receiveSlots; // frames that arrived ahead of a gap, [ sequence % RELIABLE_WINDOW_SIZE ]
+	unsigned int nextExpected;
+	int ackPending;
+} RELIABLE_SESSION;
+
+int ReliableInit ( RELIABLE_SESSION *session , RELIABLE_TRANSMIT transmit , void *transmitContext );
+
+void ReliableFree ( RELIABLE_SESSION *session );
+
+int ReliableSend ( RELIABLE_SESSION *session , char **frames , int numFrames );
+
+int ReliableSendBulk ( RELIABLE_SESSION *session , char **frames , int numFrames , int maxUnsent );
+
+int ReliableTrySend ( RELIABLE_SESSION *session , char *frame );
+
+void ReliableStopSending ( RELIABLE_SESSION *session );
+
+int ReliableTimeoutMs ( RELIABLE_SESSION *session );
+
+void ReliableOnTimer ( RELIABLE_SESSION *session );
+
+int ReliableFlush ( RELIABLE_SESSION *session , int lingerMs );
+
+int ReliableReceive ( RELIABLE_SESSION *session , char *datagram );
+
+char *ReliableNextInOrder ( RELIABLE_SESSION *session );
+
+int ReliableEncodeAck ( RELIABLE_SESSION *session , char *frame );
+
+#endif
@@ -0,0 +1,399 @@
+/* Nic Pucci
+ * RING QUEUE IMPLEMENTATION
+*/
+
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "List.h"
+#include "RingQueue.h"
+
+const int RING_QUEUE_WAIT_FOREVER = -1;
+
+static int FutexWait ( atomic_int *word , int expected , int timeoutMs )
+{
+	struct timespec timeout;
+	struct timespec *timeoutPtr = NULL;
+
+	if ( timeoutMs >= 0 )
+	{
+		timeout.tv_sec = timeoutMs / 1000;
+		timeout.tv_nsec = ( long ) ( timeoutMs % 1000 ) * 1000000L;
+		timeoutPtr = &timeout;
+	}
+
+	int r = syscall ( SYS_futex , word , FUTEX_WAIT_PRIVATE , expected , timeoutPtr , NULL , 0 );
+	if ( r < 0 && errno == ETIMEDOUT )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	return SUCCESS_OP_CODE;
+}
+
+static long long NowMs ()
+{
+	struct timespec now;
+	clock_gettime ( CLOCK_MONOTONIC , &now );
+	return ( long long ) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void FutexWake ( atomic_int *word )
+{
+	syscall ( SYS_futex , word , FUTEX_WAKE_PRIVATE , 1 , NULL , NULL , 0 );
+}
+
+/* Called after publishing an index; the seq_cst fence pairs with the one in the
+ * sleeper so that either the sleeper sees the new index or we see its flag. */
+static void WakeIfWaiting ( atomic_int *waitingFlag )
+{
+	atomic_thread_fence ( memory_order_seq_cst );
+
+	if ( !atomic_load_explicit ( waitingFlag , memory_order_relaxed ) )
+	{
+		return;
+	}
+
+	if ( atomic_exchange ( waitingFlag , 0 ) )
+	{
+		FutexWake ( waitingFlag );
+	}
+}
+
+static unsigned int RoundUpPowerOf2 ( unsigned int value )
+{
+	unsigned int capacity = 2;
+	while ( capacity < value )
+	{
+		capacity <<= 1;
+	}
+
+	return capacity;
+}
+
+static void WaitForSpace ( RING_QUEUE *queue )
+{
+	atomic_store ( &queue -> producerWaiting , 1 );
+	atomic_thread_fence ( memory_order_seq_cst );
+
+	int stillFull = RingQueueCount ( queue ) >= ( int ) queue -> capacity;
+	if ( stillFull && !RingQueueClosed ( queue ) )
+	{
+		FutexWait ( &queue -> producerWaiting , 1 , RING_QUEUE_WAIT_FOREVER );
+	}
+
+	atomic_store ( &queue -> producerWaiting , 0 );
+}
+
+RING_QUEUE *RingQueueCreate ( unsigned int minCapacity )
+{
+	RING_QUEUE *queue = aligned_alloc ( RING_QUEUE_CACHE_LINE_SIZE , sizeof ( RING_QUEUE ) );
+	if ( !queue )
+	{
+		return NULL;
+	}
+
+	unsigned int capacity = RoundUpPowerOf2 ( minCapacity );
+	queue -> slots = calloc ( capacity , sizeof ( void *) );
+	if ( !queue -> slots )
+	{
+		free ( queue );
+		return NULL;
+	}
+
+	queue -> capacity = capacity;
+	queue -> mask = capacity - 1;
+
+	atomic_init ( &queue -> headIndex , 0 );
+	atomic_init ( &queue -> tailIndex , 0 );
+	atomic_init ( &queue -> consumerWaiting , 0 );
+	atomic_init ( &queue -> producerWaiting , 0 );
+	atomic_init ( &queue -> closed , 0 );
+	queue -> producerCachedTailIndex = 0;
+	queue -> consumerCachedHeadIndex = 0;
+
+	return queue;
+}
+
+void RingQueueFree ( RING_QUEUE *queue , void ( *itemFree ) ( void* ) )
+{
+	if ( !queue )
+	{
+		return;
+	}
+
+	void *item;
+	while ( ( item = RingQueuePop ( queue ) ) )
+	{
+		if ( itemFree )
+		{
+			( *itemFree ) ( item );
+		}
+	}
+
+	free ( queue -> slots );
+	free ( queue );
+}
+
+int RingQueueCount ( RING_QUEUE *queue )
+{
+	if ( !queue )
+	{
+		return 0;
+	}
+
+	unsigned int head = atomic_load_explicit ( &queue -> headIndex , memory_order_acquire );
+	unsigned int tail = atomic_load_explicit ( &queue -> tailIndex , memory_order_acquire );
+	return ( int ) ( head - tail );
+}
+
+int RingQueuePush ( RING_QUEUE *queue , void *item )
+{
+	if ( !queue || !item )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	if ( atomic_load_explicit ( &queue -> closed , memory_order_relaxed ) )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	unsigned int head = atomic_load_explicit ( &queue -> headIndex , memory_order_relaxed );
+
+	int looksFull = head - queue -> producerCachedTailIndex >= queue -> capacity;
+	if ( looksFull )
+	{
+		queue -> producerCachedTailIndex = atomic_load_explicit ( &queue -> tailIndex , memory_order_acquire );
+		if ( head - queue -> producerCachedTailIndex >= queue -> capacity )
+		{
+			return FAILURE_OP_CODE;
+		}
+	}
+
+	queue -> slots [ head & queue -> mask ] = item;
+	atomic_store_explicit ( &queue -> headIndex , head + 1 , memory_order_release );
+
+	WakeIfWaiting ( &queue -> consumerWaiting );
+	return SUCCESS_OP_CODE;
+}
+
+int RingQueuePushWait ( RING_QUEUE *queue , void *item )
+{
+	for ( ;; )
+	{
+		if ( RingQueuePush ( queue , item ) == SUCCESS_OP_CODE )
+		{
+			return SUCCESS_OP_CODE;
+		}
+
+		if ( !queue || !item || RingQueueClosed ( queue ) )
+		{
+			return FAILURE_OP_CODE;
+		}
+
+		WaitForSpace ( queue );
+	}
+}
+
+/* Publishes as many of items as fit with a single index store and at most one
+ * wake; returns how many were taken. */
+int RingQueuePushBatch ( RING_QUEUE *queue , void **items , int count )
+{
+	if ( !queue || !items || count <= 0 )
+	{
+		return 0;
+	}
+
+	if ( atomic_load_explicit ( &queue -> closed , memory_order_relaxed ) )
+	{
+		return 0;
+	}
+
+	unsigned int head = atomic_load_explicit ( &queue -> headIndex , memory_order_relaxed );
+
+	unsigned int freeSlots = queue -> capacity - ( head - queue -> producerCachedTailIndex );
+	if ( freeSlots < ( unsigned int ) count )
+	{
+		queue -> producerCachedTailIndex = atomic_load_explicit ( &queue -> tailIndex , memory_order_acquire );
+		freeSlots = queue -> capacity - ( head - queue -> producerCachedTailIndex );
+	}
+
+	unsigned int numPushed = freeSlots < ( unsigned int ) count ? freeSlots : ( unsigned int ) count;
+	if ( numPushed == 0 )
+	{
+		return 0;
+	}
+
+	for ( unsigned int i = 0 ; i < numPushed ; i++ )
+	{
+		queue -> slots [ ( head + i ) & queue -> mask ] = items [ i ];
+	}
+
+	atomic_store_explicit ( &queue -> headIndex , head + numPushed , memory_order_release );
+
+	WakeIfWaiting ( &queue -> consumerWaiting );
+	return ( int ) numPushed;
+}
+
+/* Blocks only while the queue is full; returns how many items were taken, which
+ * is less than count only if the queue was closed. */
+int RingQueuePushBatchWait ( RING_QUEUE *queue , void **items , int count )
+{
+	int numPushed = 0;
+
+	while ( numPushed < count )
+	{
+		numPushed += RingQueuePushBatch ( queue , items + numPushed , count - numPushed );
+		if ( numPushed == count )
+		{
+			break;
+		}
+
+		if ( !queue || RingQueueClosed ( queue ) )
+		{
+			break;
+		}
+
+		WaitForSpace ( queue );
+	}
+
+	return numPushed;
+}
+
+void *RingQueuePop ( RING_QUEUE *queue )
+{
+	if ( !queue )
+	{
+		return NULL;
+	}
+
+	unsigned int tail = atomic_load_explicit ( &queue -> tailIndex , memory_order_relaxed );
+
+	int looksEmpty = tail == queue -> consumerCachedHeadIndex;
+	if ( looksEmpty )
+	{
+		queue -> consumerCachedHeadIndex = atomic_load_explicit ( &queue -> headIndex , memory_order_acquire );
+		if ( tail == queue -> consumerCachedHeadIndex )
+		{
+			return NULL;
+		}
+	}
+
+	void *item = queue -> slots [ tail & queue -> mask ];
+	atomic_store_explicit ( &queue -> tailIndex , tail + 1 , memory_order_release );
+
+	WakeIfWaiting ( &queue -> producerWaiting );
+	return item;
+}
+
+void *RingQueuePopWait ( RING_QUEUE *queue , int timeoutMs )
+{
+	if ( !queue )
+	{
+		return NULL;
+	}
+
+	long long deadlineMs = NowMs () + timeoutMs;
+
+	for ( ;; )
+	{
+		void *item = RingQueuePop ( queue );
+		if ( item )
+		{
+			return item;
+		}
+
+		if ( RingQueueClosed ( queue ) )
+		{
+			return NULL;
+		}
+
+		int remainingMs = RING_QUEUE_WAIT_FOREVER;
+		if ( timeoutMs >= 0 )
+		{
+			long long remaining = deadlineMs - NowMs ();
+			remainingMs = remaining > 0 ? ( int ) remaining : 0;
+		}
+
+		atomic_store ( &queue -> consumerWaiting , 1 );
+		atomic_thread_fence ( memory_order_seq_cst );
+
+		int stillEmpty = RingQueueCount ( queue ) == 0;
+		int timedOut = remainingMs == 0;
+		if ( stillEmpty && !timedOut && !RingQueueClosed ( queue ) )
+		{
+			timedOut = FutexWait ( &queue -> consumerWaiting , 1 , remainingMs ) == FAILURE_OP_CODE;
+		}
+
+		atomic_store ( &queue -> consumerWaiting , 0 );
+
+		if ( timedOut )
+		{
+			return RingQueuePop ( queue );
+		}
+	}
+}
+
+/* Takes up to maxCount ready items with a single index store; never blocks. */
+int RingQueuePopBatch ( RING_QUEUE *queue , void **items , int maxCount )
+{
+	if ( !queue || !items || maxCount <= 0 )
+	{
+		return 0;
+	}
+
+	unsigned int tail = atomic_load_explicit ( &queue -> tailIndex , memory_order_relaxed );
+
+	unsigned int numReady = queue -> consumerCachedHeadIndex - tail;
+	if ( numReady < ( unsigned int ) maxCount )
+	{
+		queue -> consumerCachedHeadIndex = atomic_load_explicit ( &queue -> headIndex , memory_order_acquire );
+		numReady = queue -> consumerCachedHeadIndex - tail;
+	}
+
+	unsigned int numPopped = numReady < ( unsigned int ) maxCount ? numReady : ( unsigned int ) maxCount;
+	if ( numPopped == 0 )
+	{
+		return 0;
+	}
+
+	for ( unsigned int i = 0 ; i < numPopped ; i++ )
+	{
+		items [ i ] = queue -> slots [ ( tail + i ) & queue -> mask ];
+	}
+
+	atomic_store_explicit ( &queue -> tailIndex , tail + numPopped , memory_order_release );
+
+	WakeIfWaiting ( &queue -> producerWaiting );
+	return ( int ) numPopped;
+}
+
+void RingQueueClose ( RING_QUEUE *queue )
+{
+	if ( !queue )
+	{
+		return;
+	}
+
+	atomic_store ( &queue -> closed , 1 );
+
+	atomic_store ( &queue -> consumerWaiting , 0 );
+	FutexWake ( &queue -> consumerWaiting );
+
+	atomic_store ( &queue -> producerWaiting , 0 );
+	FutexWake ( &queue -> producerWaiting );
+}
+
+int RingQueueClosed ( RING_QUEUE *queue )
+{
+	if ( !queue )
+	{
+		return 1;
+	}
+
+	return atomic_load ( &queue -> closed );
+}
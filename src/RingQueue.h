@@ -0,0 +1,65 @@
+/* Nic Pucci
+ * RING QUEUE HEADER
+ *
+ * Bounded single-producer/single-consumer queue of item pointers. The producer
+ * only writes headIndex and the consumer only writes tailIndex, so neither side
+ * takes a lock. A side only sleeps (futex) when it cannot make progress: the
+ * consumer when the queue is empty, the producer when it is full. The other side
+ * issues a wake syscall only if it finds a sleeper flagged.
+*/
+
+#ifndef RING_QUEUE_H
+#define RING_QUEUE_H
+
+#include <stdatomic.h>
+
+#define RING_QUEUE_CACHE_LINE_SIZE 64
+
+extern const int RING_QUEUE_WAIT_FOREVER;
+
+typedef struct ringQueue
+{
+	/* written by the producer only */
+	_Alignas ( RING_QUEUE_CACHE_LINE_SIZE ) atomic_uint headIndex;
+	unsigned int producerCachedTailIndex;
+
+	/* written by the consumer only */
+	_Alignas ( RING_QUEUE_CACHE_LINE_SIZE ) atomic_uint tailIndex;
+	unsigned int consumerCachedHeadIndex;
+
+	/* futex words, each on its own line so polling them stays cheap */
+	_Alignas ( RING_QUEUE_CACHE_LINE_SIZE ) atomic_int consumerWaiting;
+	_Alignas ( RING_QUEUE_CACHE_LINE_SIZE ) atomic_int producerWaiting;
+
+	/* read-only after creation (except closed) */
+	_Alignas ( RING_QUEUE_CACHE_LINE_SIZE ) void **slots;
+	unsigned int capacity; // always a power of 2
+	unsigned int mask;
+	atomic_int closed;
+} RING_QUEUE;
+
+RING_QUEUE *RingQueueCreate ( unsigned int minCapacity );
+
+void RingQueueFree ( RING_QUEUE *queue , void ( *itemFree ) ( void* ) );
+
+int RingQueueCount ( RING_QUEUE *queue );
+
+int RingQueuePush ( RING_QUEUE *queue , void *item );
+
+int RingQueuePushWait ( RING_QUEUE *queue , void *item );
+
+int RingQueuePushBatch ( RING_QUEUE *queue , void **items , int count );
+
+int RingQueuePushBatchWait ( RING_QUEUE *queue , void **items , int count );
+
+void *RingQueuePop ( RING_QUEUE *queue );
+
+void *RingQueuePopWait ( RING_QUEUE *queue , int timeoutMs );
+
+int RingQueuePopBatch ( RING_QUEUE *queue , void **items , int maxCount );
+
+void RingQueueClose ( RING_QUEUE *queue );
+
+int RingQueueClosed ( RING_QUEUE *queue );
+
+#endif
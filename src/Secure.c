@@ -0,0 +1,484 @@
+/* Nic Pucci
+ * SECURE IMPLEMENTATION
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/random.h>
+#include "List.h"
+#include "Secure.h"
+
+const char SECURE_HANDSHAKE_LABEL [] = "terminal-chat handshake v1";
+const int SECURE_KEY_FILE_MIN_SIZE = CRYPTO_KEY_SIZE; // a key file shorter than this is refused as too guessable
+const int SECURE_KEY_FILE_MAX_SIZE = 1 << 20;
+
+/* getrandom may return short for large requests or be interrupted */
+static int FillRandom ( unsigned char *buffer , size_t length )
+{
+	size_t numFilled = 0;
+	while ( numFilled < length )
+	{
+		ssize_t n = getrandom ( buffer + numFilled , length - numFilled , 0 );
+		if ( n < 0 )
+		{
+			return FAILURE_OP_CODE;
+		}
+		numFilled += n;
+	}
+
+	return SUCCESS_OP_CODE;
+}
+
+int SecureInit ( SECURE_SESSION *session , const unsigned char *presharedKey )
+{
+	memset ( session , 0 , sizeof ( SECURE_SESSION ) );
+
+	if ( FillRandom ( session -> secretKey , CRYPTO_KEY_SIZE ) == FAILURE_OP_CODE )
+	{
+		perror ( "getrandom failed" );
+		return FAILURE_OP_CODE;
+	}
+	X25519PublicKey ( session -> publicKey , session -> secretKey );
+
+	session -> hasPresharedKey = presharedKey != NULL;
+	if ( presharedKey )
+	{
+		memcpy ( session -> presharedKey , presharedKey , CRYPTO_KEY_SIZE );
+	}
+
+	atomic_init ( &session -> nextSendCounter , 0 );
+	atomic_init ( &session -> current , -1 );
+	atomic_init ( &session -> numSealing [ 0 ] , 0 );
+	atomic_init ( &session -> numSealing [ 1 ] , 0 );
+	return SUCCESS_OP_CODE;
+}
+
+/* The pre-shared key is the BLAKE2s hash of the whole file, so any file of
+ * enough random bytes will do (e.g. head -c 32 /dev/urandom). Reports why it
+ * could not be read on stderr. */
+int SecureLoadKey ( const char *path , unsigned char *presharedKey )
+{
+	int fd = open ( path , O_RDONLY );
+	if ( fd < 0 )
+	{
+		perror ( path );
+		return FAILURE_OP_CODE;
+	}
+
+	BLAKE2S_STATE state;
+	Blake2sInit ( &state , CRYPTO_KEY_SIZE , NULL , 0 );
+
+	unsigned char buffer [ 4096 ];
+	long size = 0;
+	ssize_t numRead;
+	while ( ( numRead = read ( fd , buffer , sizeof ( buffer ) ) ) > 0 && size <= SECURE_KEY_FILE_MAX_SIZE )
+	{
+		Blake2sUpdate ( &state , buffer , numRead );
+		size += numRead;
+	}
+	close ( fd );
+	CryptoWipe ( buffer , sizeof ( buffer ) );
+
+	if ( numRead < 0 || size < SECURE_KEY_FILE_MIN_SIZE || size > SECURE_KEY_FILE_MAX_SIZE )
+	{
+		fprintf ( stderr , "%s: a key file must hold %d bytes to 1 MB, best random\n" , path , SECURE_KEY_FILE_MIN_SIZE );
+		CryptoWipe ( &state , sizeof ( state ) );
+		return FAILURE_OP_CODE;
+	}
+
+	Blake2sFinal ( &state , presharedKey );
+	return SUCCESS_OP_CODE;
+}
+
+/* the MAC over a handshake's header and fields, under the pre-shared key */
+static void HandshakeMac ( const SECURE_SESSION *session , const char *frame , unsigned char *mac )
+{
+	Blake2s ( mac , SECURE_MAC_SIZE , session -> presharedKey , CRYPTO_KEY_SIZE , frame , FRAME_HEADER_SIZE + FRAME_HANDSHAKE_PAYLOAD_SIZE );
+}
+
+/* Writes this end's handshake frame into frame (SECURE_MAX_HANDSHAKE_SIZE
+ * bytes); returns its length. */
+int SecureEncodeHandshake ( const SECURE_SESSION *session , char *frame , int replyWanted )
+{
+	FRAME_HEADER header = {
+		.version = FRAME_PROTOCOL_VERSION ,
+		.type = FRAME_TYPE_HANDSHAKE ,
+		.flags = 0 ,
+		.sequence = 0 ,
+		.payloadLength = FRAME_HANDSHAKE_PAYLOAD_SIZE + ( session -> hasPresharedKey ? SECURE_MAC_SIZE : 0 )
+	};
+	FrameEncodeHeader ( frame , &header );
+
+	frame [ FRAME_HEADER_SIZE ] = replyWanted ? 1 : 0;
+	memcpy ( frame + FRAME_HEADER_SIZE + 1 , session -> publicKey , CRYPTO_KEY_SIZE );
+
+	if ( session -> hasPresharedKey )
+	{
+		HandshakeMac ( session , frame , ( unsigned char *) frame + FRAME_HEADER_SIZE + FRAME_HANDSHAKE_PAYLOAD_SIZE );
+	}
+
+	return FRAME_HEADER_SIZE + header.payloadLength;
+}
+
+/* Both directions' keys and the fingerprint, from the shared secret and both
+ * public keys, taken in one order both ends agree on. */
+static int DeriveKeys ( SECURE_SESSION *session , SECURE_KEYS *keys , const unsigned char *peerPublicKey )
+{
+	unsigned char shared [ CRYPTO_KEY_SIZE ];
+	X25519 ( shared , session -> secretKey , peerPublicKey );
+
+	// a low-order peer key makes the secret all zeros, whatever our key: nothing secret about it
+	static const unsigned char zeros [ CRYPTO_KEY_SIZE ] = { 0 };
+	if ( CryptoEqual ( shared , zeros , CRYPTO_KEY_SIZE ) )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	int peerFirst = memcmp ( peerPublicKey , session -> publicKey , CRYPTO_KEY_SIZE ) < 0;
+	const unsigned char *lowKey = peerFirst ? peerPublicKey : session -> publicKey;
+	const unsigned char *highKey = peerFirst ? session -> publicKey : peerPublicKey;
+
+	unsigned char chainKey [ CRYPTO_KEY_SIZE ];
+	BLAKE2S_STATE state;
+	Blake2sInit ( &state , CRYPTO_KEY_SIZE , session -> hasPresharedKey ? session -> presharedKey : NULL , session -> hasPresharedKey ? CRYPTO_KEY_SIZE : 0 );
+	Blake2sUpdate ( &state , SECURE_HANDSHAKE_LABEL , sizeof ( SECURE_HANDSHAKE_LABEL ) - 1 );
+	Blake2sUpdate ( &state , shared , CRYPTO_KEY_SIZE );
+	Blake2sUpdate ( &state , lowKey , CRYPTO_KEY_SIZE );
+	Blake2sUpdate ( &state , highKey , CRYPTO_KEY_SIZE );
+	Blake2sFinal ( &state , chainKey );
+
+	// each direction is keyed by its sender's public key, so the two never share a key
+	Blake2s ( keys -> sendKey , CRYPTO_KEY_SIZE , chainKey , CRYPTO_KEY_SIZE , session -> publicKey , CRYPTO_KEY_SIZE );
+	Blake2s ( keys -> receiveKey , CRYPTO_KEY_SIZE , chainKey , CRYPTO_KEY_SIZE , peerPublicKey , CRYPTO_KEY_SIZE );
+
+	unsigned char digest [ 8 ];
+	Blake2sInit ( &state , sizeof ( digest ) , NULL , 0 );
+	Blake2sUpdate ( &state , lowKey , CRYPTO_KEY_SIZE );
+	Blake2sUpdate ( &state , highKey , CRYPTO_KEY_SIZE );
+	Blake2sFinal ( &state , digest );
+	snprintf (
+		keys -> fingerprint , SECURE_FINGERPRINT_SIZE , "%02x%02x %02x%02x %02x%02x %02x%02x" ,
+		digest [ 0 ] , digest [ 1 ] , digest [ 2 ] , digest [ 3 ] , digest [ 4 ] , digest [ 5 ] , digest [ 6 ] , digest [ 7 ]
+	);
+
+	memcpy ( keys -> peerPublicKey , peerPublicKey , CRYPTO_KEY_SIZE );
+	keys -> receiveTop = 0;
+	keys -> hasReceived = 0;
+	memset ( keys -> replayBitmap , 0 , sizeof ( keys -> replayBitmap ) );
+	keys -> ready = 1;
+
+	CryptoWipe ( shared , sizeof ( shared ) );
+	CryptoWipe ( chainKey , sizeof ( chainKey ) );
+	return SUCCESS_OP_CODE;
+}
+
+/* 64 bits of the peer key's BLAKE2s hash: enough to know it again */
+static unsigned long long PeerKeyId ( const unsigned char *peerPublicKey )
+{
+	unsigned char digest [ 8 ];
+	Blake2s ( digest , sizeof ( digest ) , NULL , 0 , peerPublicKey , CRYPTO_KEY_SIZE );
+
+	unsigned long long id;
+	memcpy ( &id , digest , sizeof ( id ) );
+	return id;
+}
+
+static int PeerKeySeen ( const SECURE_SESSION *session , unsigned long long id )
+{
+	unsigned long numRemembered = session -> numPeerKeys < SECURE_MAX_PEER_KEYS ? session -> numPeerKeys : SECURE_MAX_PEER_KEYS;
+	for ( unsigned long i = 0 ; i < numRemembered ; i++ )
+	{
+		if ( session -> peerKeyIds [ i ] == id )
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Sealers only ever enter the current slot, so once one that is not current
+ * has none left it can be rewritten. Sealing takes about a microsecond. */
+static void WaitForSealers ( SECURE_SESSION *session , int slot )
+{
+	while ( atomic_load ( &session -> numSealing [ slot ] ) > 0 )
+	{
+		sched_yield ();
+	}
+}
+
+/* Takes the peer's handshake. *keysChanged is set if it gave the first keys,
+ * which are used at once. A key other than the one in use after that (a
+ * restart, or someone else) gets keys in the spare slot, which SecureOpen
+ * switches to once a datagram opens under them. Fails on a malformed
+ * handshake, a missing or wrong MAC, a key that gives no secret, or a key
+ * keys were derived for before that is neither in use nor waiting: an old
+ * handshake replayed. */
+int SecureAcceptHandshake ( SECURE_SESSION *session , const FRAME_HEADER *header , const char *payload , int *replyWanted , int *keysChanged )
+{
+	*keysChanged = 0;
+	*replyWanted = 0;
+
+	int expectedLength = FRAME_HANDSHAKE_PAYLOAD_SIZE + ( session -> hasPresharedKey ? SECURE_MAC_SIZE : 0 );
+	if ( header -> payloadLength != expectedLength )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	if ( session -> hasPresharedKey )
+	{
+		unsigned char mac [ SECURE_MAC_SIZE ];
+		HandshakeMac ( session , payload - FRAME_HEADER_SIZE , mac );
+		if ( !CryptoEqual ( mac , ( const unsigned char *) payload + FRAME_HANDSHAKE_PAYLOAD_SIZE , SECURE_MAC_SIZE ) )
+		{
+			return FAILURE_OP_CODE;
+		}
+	}
+
+	const unsigned char *peerPublicKey = ( const unsigned char *) payload + 1;
+	if ( memcmp ( peerPublicKey , session -> publicKey , CRYPTO_KEY_SIZE ) == 0 )
+	{
+		return FAILURE_OP_CODE; // our own handshake, looped back
+	}
+
+	*replyWanted = payload [ 0 ] != 0;
+
+	int current = atomic_load_explicit ( &session -> current , memory_order_relaxed );
+	if ( current >= 0 && memcmp ( session -> keys [ current ].peerPublicKey , peerPublicKey , CRYPTO_KEY_SIZE ) == 0 )
+	{
+		return SUCCESS_OP_CODE;
+	}
+
+	int spare = current == 0 ? 1 : 0;
+	SECURE_KEYS *keys = &session -> keys [ spare ];
+	if ( session -> spareUnconfirmed && memcmp ( keys -> peerPublicKey , peerPublicKey , CRYPTO_KEY_SIZE ) == 0 )
+	{
+		return SUCCESS_OP_CODE; // the new key's handshake again
+	}
+
+	// deriving again would reset the replay window of keys whose datagrams may be recorded
+	unsigned long long peerKeyId = PeerKeyId ( peerPublicKey );
+	if ( PeerKeySeen ( session , peerKeyId ) )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	WaitForSealers ( session , spare );
+	keys -> ready = 0;
+	if ( DeriveKeys ( session , keys , peerPublicKey ) == FAILURE_OP_CODE )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	session -> peerKeyIds [ session -> numPeerKeys % SECURE_MAX_PEER_KEYS ] = peerKeyId;
+	session -> numPeerKeys += 1;
+
+	if ( current >= 0 )
+	{
+		session -> spareUnconfirmed = 1;
+		return SUCCESS_OP_CODE;
+	}
+
+	// sealing threads pick the slot up only once it is whole
+	atomic_store ( &session -> current , spare );
+	*keysChanged = 1;
+	return SUCCESS_OP_CODE;
+}
+
+int SecureReady ( SECURE_SESSION *session )
+{
+	return atomic_load_explicit ( &session -> current , memory_order_acquire ) >= 0;
+}
+
+/* 4 zero bytes, then the counter, little-endian */
+static void CounterNonce ( unsigned char *nonce , unsigned long long counter )
+{
+	memset ( nonce , 0 , 4 );
+	for ( int i = 0 ; i < 8 ; i++ )
+	{
+		nonce [ 4 + i ] = ( unsigned char ) ( counter >> ( 8 * i ) );
+	}
+}
+
+/* Seals the plainLength bytes at datagram + SECURE_PLAIN_OFFSET in place: the
+ * sealed frame's header goes in front and the tag after, so the buffer needs
+ * FRAME_SEALED_OVERHEAD bytes more than the plaintext. Returns the sealed
+ * length, or 0 before the handshake has given keys. */
+int SecureSeal ( SECURE_SESSION *session , char *datagram , int plainLength )
+{
+	// counted in before the slot is used; one that stopped being current meanwhile is left again
+	int current;
+	for ( ;; )
+	{
+		current = atomic_load_explicit ( &session -> current , memory_order_acquire );
+		if ( current < 0 )
+		{
+			return 0;
+		}
+
+		atomic_fetch_add ( &session -> numSealing [ current ] , 1 );
+		if ( atomic_load ( &session -> current ) == current )
+		{
+			break;
+		}
+		atomic_fetch_sub_explicit ( &session -> numSealing [ current ] , 1 , memory_order_release );
+	}
+
+	const SECURE_KEYS *keys = &session -> keys [ current ];
+	unsigned long long counter = atomic_fetch_add_explicit ( &session -> nextSendCounter , 1 , memory_order_relaxed );
+
+	FRAME_HEADER header = {
+		.version = FRAME_PROTOCOL_VERSION ,
+		.type = FRAME_TYPE_SEALED ,
+		.flags = 0 ,
+		.sequence = 0 ,
+		.payloadLength = FRAME_SEALED_HEADER_SIZE + plainLength + CRYPTO_TAG_SIZE
+	};
+	FrameEncodeHeader ( datagram , &header );
+
+	unsigned int networkCounter [ 2 ] = { htonl ( ( unsigned int ) ( counter >> 32 ) ) , htonl ( ( unsigned int ) counter ) };
+	memcpy ( datagram + FRAME_HEADER_SIZE , networkCounter , FRAME_SEALED_HEADER_SIZE );
+
+	unsigned char nonce [ CRYPTO_NONCE_SIZE ];
+	CounterNonce ( nonce , counter );
+
+	unsigned char *text = ( unsigned char *) datagram + SECURE_PLAIN_OFFSET;
+	CryptoAeadSeal ( keys -> sendKey , nonce , ( const unsigned char *) datagram , SECURE_PLAIN_OFFSET , text , plainLength , text + plainLength );
+	atomic_fetch_sub_explicit ( &session -> numSealing [ current ] , 1 , memory_order_release );
+
+	return SECURE_PLAIN_OFFSET + plainLength + CRYPTO_TAG_SIZE;
+}
+
+static unsigned long long *ReplayWord ( SECURE_KEYS *keys , unsigned long long counter )
+{
+	return &keys -> replayBitmap [ ( counter % SECURE_REPLAY_WINDOW_SIZE ) / 64 ];
+}
+
+/* true if counter is inside the window and not opened yet */
+static int ReplayFresh ( SECURE_KEYS *keys , unsigned long long counter )
+{
+	if ( !keys -> hasReceived || counter > keys -> receiveTop )
+	{
+		return 1;
+	}
+
+	if ( keys -> receiveTop - counter >= SECURE_REPLAY_WINDOW_SIZE )
+	{
+		return 0;
+	}
+
+	return !( *ReplayWord ( keys , counter ) & ( 1ULL << ( counter % 64 ) ) );
+}
+
+/* Marks counter opened, sliding the window forward past it if it is the new highest. */
+static void ReplayMark ( SECURE_KEYS *keys , unsigned long long counter )
+{
+	if ( !keys -> hasReceived || counter > keys -> receiveTop )
+	{
+		unsigned long long numAdvanced = keys -> hasReceived ? counter - keys -> receiveTop : SECURE_REPLAY_WINDOW_SIZE;
+		if ( numAdvanced >= SECURE_REPLAY_WINDOW_SIZE )
+		{
+			memset ( keys -> replayBitmap , 0 , sizeof ( keys -> replayBitmap ) );
+		}
+		else
+		{
+			// the slots the window slides over now stand for counters not seen yet
+			for ( unsigned long long c = keys -> receiveTop + 1 ; c < counter ; c++ )
+			{
+				*ReplayWord ( keys , c ) &= ~( 1ULL << ( c % 64 ) );
+			}
+		}
+
+		keys -> receiveTop = counter;
+		keys -> hasReceived = 1;
+		*ReplayWord ( keys , counter ) &= ~( 1ULL << ( counter % 64 ) );
+	}
+
+	*ReplayWord ( keys , counter ) |= 1ULL << ( counter % 64 );
+}
+
+static int OpenWith ( SECURE_KEYS *keys , char *datagram , unsigned long long counter , int cipherLength )
+{
+	if ( !keys -> ready || !ReplayFresh ( keys , counter ) )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	unsigned char nonce [ CRYPTO_NONCE_SIZE ];
+	CounterNonce ( nonce , counter );
+
+	unsigned char *text = ( unsigned char *) datagram + SECURE_PLAIN_OFFSET;
+	if ( CryptoAeadOpen ( keys -> receiveKey , nonce , ( const unsigned char *) datagram , SECURE_PLAIN_OFFSET , text , cipherLength , text + cipherLength ) == FAILURE_OP_CODE )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	ReplayMark ( keys , counter );
+	return SUCCESS_OP_CODE;
+}
+
+/* Checks and decrypts one received datagram, which must be a single sealed
+ * frame, in place: the plaintext datagram is moved to the start of the buffer.
+ * Returns its length, or -1 if the datagram is not sealed, not authentic
+ * under either set of keys, or a replay. *keysChanged is set if it was the
+ * first to open under keys for a new peer key, which are now the ones in use. */
+int SecureOpen ( SECURE_SESSION *session , char *datagram , int length , int *keysChanged )
+{
+	*keysChanged = 0;
+
+	FRAME_HEADER header;
+	if ( FrameDecodeHeader ( datagram , length , &header ) == FAILURE_OP_CODE
+		|| header.type != FRAME_TYPE_SEALED
+		|| FRAME_HEADER_SIZE + header.payloadLength != length
+		|| header.payloadLength < FRAME_SEALED_HEADER_SIZE + CRYPTO_TAG_SIZE )
+	{
+		return -1;
+	}
+
+	int current = atomic_load_explicit ( &session -> current , memory_order_relaxed );
+	if ( current < 0 )
+	{
+		return -1;
+	}
+
+	unsigned int networkCounter [ 2 ];
+	memcpy ( networkCounter , datagram + FRAME_HEADER_SIZE , FRAME_SEALED_HEADER_SIZE );
+	unsigned long long counter = ( unsigned long long ) ntohl ( networkCounter [ 0 ] ) << 32 | ntohl ( networkCounter [ 1 ] );
+
+	int cipherLength = header.payloadLength - FRAME_SEALED_HEADER_SIZE - CRYPTO_TAG_SIZE;
+	if ( OpenWith ( &session -> keys [ current ] , datagram , counter , cipherLength ) == FAILURE_OP_CODE )
+	{
+		if ( OpenWith ( &session -> keys [ 1 - current ] , datagram , counter , cipherLength ) == FAILURE_OP_CODE )
+		{
+			return -1;
+		}
+
+		// the peer holds the new keys: seal with them from now on, keeping the old ones for stragglers
+		if ( session -> spareUnconfirmed )
+		{
+			session -> spareUnconfirmed = 0;
+			atomic_store ( &session -> current , 1 - current );
+			*keysChanged = 1;
+		}
+	}
+
+	memmove ( datagram , datagram + SECURE_PLAIN_OFFSET , cipherLength );
+	return cipherLength;
+}
+
+/* What both ends print once keys are agreed; they match unless someone in the
+ * path made a handshake of their own with each. */
+const char *SecureFingerprint ( SECURE_SESSION *session )
+{
+	int current = atomic_load_explicit ( &session -> current , memory_order_acquire );
+	return current >= 0 ? session -> keys [ current ].fingerprint : "";
+}
+
+void SecureFree ( SECURE_SESSION *session )
+{
+	CryptoWipe ( session , sizeof ( SECURE_SESSION ) );
+}
@@ -0,0 +1,104 @@
+/* Nic Pucci
+ * SECURE HEADER
+ *
+ * --encrypt: every datagram between two peers is sealed whole with
+ * ChaCha20-Poly1305 (Crypto.h) into one sealed frame, so the frames inside it,
+ * their types and their lengths travel encrypted, and anything forged,
+ * altered or replayed is dropped before a frame of it is parsed.
+ *
+ * Keys come from a handshake at session start. Each end makes an X25519 key
+ * pair for the run and sends its public key in a handshake frame; both then
+ * hash the shared secret and the two public keys (and the pre-shared key,
+ * with --psk-file) into one key per direction. Without a pre-shared key this
+ * stops anyone who only listens, but not someone in the path who answers
+ * each end with a key of their own: the fingerprint both ends print must then
+ * be compared out of band. With one, a handshake carries a MAC under it, and
+ * only an end that holds the same key can take part.
+ *
+ * A datagram's nonce is the sender's counter of datagrams sealed, which never
+ * goes back for as long as the key pair lives, and it travels in the clear in
+ * front of the ciphertext. The receiver keeps the highest counter seen and a
+ * bitmap of the SECURE_REPLAY_WINDOW_SIZE before it, so datagrams may arrive
+ * out of order but none is taken twice.
+ *
+ * A peer that restarts comes back with a new key pair and handshakes again.
+ * Once keys are in use a handshake naming a new key only derives keys for it
+ * in the spare slot: sealing switches to them once a datagram sealed under
+ * them has opened, so the sender of the handshake has shown it holds them.
+ * That is what a restarted peer does anyway; without a pre-shared key it is
+ * also all an attacker needs to do, so every switch after the first is
+ * reported and its fingerprint must be checked again. The previous keys stay
+ * in the spare slot, so datagrams sealed under them just before the change
+ * still open. A slot is only rewritten once no thread is sealing with it.
+ *
+ * Keys are derived at most once per peer key in a run. A handshake naming a
+ * peer key seen before is refused, unless it is the one in use or the new one
+ * still waiting in the spare slot. A recorded handshake replayed later would
+ * otherwise bring its old keys back with an empty replay window, so the old
+ * datagrams would open again, and the first of them would switch sealing to
+ * keys the peer no longer holds.
+ *
+ * Sealing may happen on any thread; handshakes and opening belong to the
+ * thread that reads the socket.
+*/
+
+#ifndef SECURE_H
+#define SECURE_H
+
+#include <stdatomic.h>
+#include "Crypto.h"
+#include "Protocol.h"
+
+#define SECURE_REPLAY_WINDOW_SIZE 2048 // counters behind the highest one seen that may still arrive; a multiple of 64
+#define SECURE_MAC_SIZE 16 // a handshake's MAC under the pre-shared key
+#define SECURE_MAX_HANDSHAKE_SIZE ( FRAME_HEADER_SIZE + FRAME_HANDSHAKE_PAYLOAD_SIZE + SECURE_MAC_SIZE )
+#define SECURE_PLAIN_OFFSET ( FRAME_HEADER_SIZE + FRAME_SEALED_HEADER_SIZE ) // where a sealed datagram's plaintext goes
+#define SECURE_FINGERPRINT_SIZE 20 // four groups of four hex digits, spaced, and a terminator
+#define SECURE_MAX_PEER_KEYS 256 // peer keys remembered as seen; past that the oldest are forgotten
+
+typedef struct secureKeys
+{
+	int ready;
+	unsigned char peerPublicKey [ CRYPTO_KEY_SIZE ];
+	unsigned char sendKey [ CRYPTO_KEY_SIZE ];
+	unsigned char receiveKey [ CRYPTO_KEY_SIZE ];
+	unsigned long long receiveTop; // highest counter opened
+	int hasReceived;
+	unsigned long long replayBitmap [ SECURE_REPLAY_WINDOW_SIZE / 64 ]; // bit counter % SECURE_REPLAY_WINDOW_SIZE: opened
+	char fingerprint [ SECURE_FINGERPRINT_SIZE ];
+} SECURE_KEYS;
+
+typedef struct secureSession
+{
+	int hasPresharedKey;
+	unsigned char presharedKey [ CRYPTO_KEY_SIZE ];
+	unsigned char secretKey [ CRYPTO_KEY_SIZE ];
+	unsigned char publicKey [ CRYPTO_KEY_SIZE ];
+	atomic_ullong nextSendCounter;
+	SECURE_KEYS keys [ 2 ];
+	atomic_int current; // the keys in use, -1 before the first handshake
+	atomic_int numSealing [ 2 ]; // threads sealing with each slot
+	int spareUnconfirmed; // the spare slot holds keys for a new peer key that nothing has opened under yet
+	unsigned long long peerKeyIds [ SECURE_MAX_PEER_KEYS ]; // of every peer key keys were derived for
+	unsigned long numPeerKeys;
+} SECURE_SESSION;
+
+int SecureInit ( SECURE_SESSION *session , const unsigned char *presharedKey );
+
+int SecureLoadKey ( const char *path , unsigned char *presharedKey );
+
+int SecureEncodeHandshake ( const SECURE_SESSION *session , char *frame , int replyWanted );
+
+int SecureAcceptHandshake ( SECURE_SESSION *session , const FRAME_HEADER *header , const char *payload , int *replyWanted , int *keysChanged );
+
+int SecureReady ( SECURE_SESSION *session );
+
+int SecureSeal ( SECURE_SESSION *session , char *datagram , int plainLength );
+
+int SecureOpen ( SECURE_SESSION *session , char *datagram , int length , int *keysChanged );
+
+const char *SecureFingerprint ( SECURE_SESSION *session );
+
+void SecureFree ( SECURE_SESSION *session );
+
+#endif
@@ -0,0 +1,229 @@
+/* Nic Pucci
+ * SHIM IMPLEMENTATION
+*/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "List.h"
+#include "IntrusiveList.h"
+#include "Stats.h"
+#include "Shim.h"
+
+const unsigned long long SHIM_MAX_QUEUE_NS = 50000000ULL; // drop-tail: the bottleneck holds at most 50 ms of traffic
+const unsigned int SHIM_SEED = 1; // fixed, so runs are repeatable
+
+typedef struct shimDatagram
+{
+	INTRUSIVE_LINK ( struct shimDatagram ) link;
+	unsigned long long dueNs;
+	struct sockaddr_storage address;
+	socklen_t addressLength; // 0 = the socket's connected peer
+	int length;
+	char data [];
+} SHIM_DATAGRAM;
+
+static inline int ShimDatagramEqual ( SHIM_DATAGRAM *datagram , void *other )
+{
+	return datagram == other;
+}
+
+static inline void ShimDatagramFree ( SHIM_DATAGRAM *datagram )
+{
+	free ( datagram );
+}
+
+INTRUSIVE_LIST_DEFINE ( ShimQueue , SHIM_QUEUE , SHIM_DATAGRAM , link , ShimDatagramEqual , ShimDatagramFree )
+
+struct shim
+{
+	int fd;
+	double lossRate; // 0 to 1
+	unsigned long long delayNs;
+	double nsPerByte; // bottleneck serialisation time, 0 = no rate limit
+	unsigned int seed;
+
+	pthread_mutex_t lock;
+	pthread_cond_t arrived;
+	pthread_t thread;
+	int running;
+	SHIM_QUEUE queue; // in due order
+	unsigned long long bottleneckFreeNs; // when the bottleneck is done with what it already holds
+};
+
+static void SendShimDatagram ( SHIM *shim , SHIM_DATAGRAM *datagram )
+{
+	struct sockaddr *address = datagram -> addressLength > 0 ? ( struct sockaddr *) &datagram -> address : NULL;
+	sendto ( shim -> fd , datagram -> data , datagram -> length , 0 , address , datagram -> addressLength );
+}
+
+/* Sends each queued datagram once it is due. Whatever is still queued when the
+ * shim is freed still goes out, on time, before the thread ends. */
+static void *RunShim ( void *arg )
+{
+	SHIM *shim = ( SHIM *) arg;
+	pthread_mutex_lock ( &shim -> lock );
+
+	for ( ;; )
+	{
+		SHIM_DATAGRAM *datagram = ShimQueueFirst ( &shim -> queue );
+		if ( !datagram && !shim -> running )
+		{
+			break;
+		}
+
+		if ( !datagram )
+		{
+			pthread_cond_wait ( &shim -> arrived , &shim -> lock );
+			continue;
+		}
+
+		if ( datagram -> dueNs > StatsNow () )
+		{
+			struct timespec due = { .tv_sec = datagram -> dueNs / 1000000000ULL , .tv_nsec = datagram -> dueNs % 1000000000ULL };
+			pthread_cond_timedwait ( &shim -> arrived , &shim -> lock , &due );
+			continue;
+		}
+
+		ShimQueueRemove ( &shim -> queue , datagram );
+		pthread_mutex_unlock ( &shim -> lock );
+
+		SendShimDatagram ( shim , datagram );
+		free ( datagram );
+
+		pthread_mutex_lock ( &shim -> lock );
+	}
+
+	pthread_mutex_unlock ( &shim -> lock );
+	return NULL;
+}
+
+SHIM *ShimCreate ( int fd , double lossPercent , int delayMs , double rateMbps )
+{
+	SHIM *shim = calloc ( 1 , sizeof ( SHIM ) );
+	if ( !shim )
+	{
+		return NULL;
+	}
+
+	shim -> fd = fd;
+	shim -> lossRate = lossPercent / 100.0;
+	shim -> delayNs = ( unsigned long long ) delayMs * 1000000ULL;
+	shim -> nsPerByte = rateMbps > 0 ? 8000.0 / rateMbps : 0;
+	shim -> seed = SHIM_SEED;
+	ShimQueueInit ( &shim -> queue );
+
+	// due times come from StatsNow, which is CLOCK_MONOTONIC
+	pthread_condattr_t conditionAttribute;
+	pthread_condattr_init ( &conditionAttribute );
+	pthread_condattr_setclock ( &conditionAttribute , CLOCK_MONOTONIC );
+	pthread_cond_init ( &shim -> arrived , &conditionAttribute );
+	pthread_condattr_destroy ( &conditionAttribute );
+	pthread_mutex_init ( &shim -> lock , NULL );
+
+	shim -> running = 1;
+	if ( pthread_create ( &shim -> thread , NULL , RunShim , shim ) != 0 )
+	{
+		pthread_cond_destroy ( &shim -> arrived );
+		pthread_mutex_destroy ( &shim -> lock );
+		free ( shim );
+		return NULL;
+	}
+
+	return shim;
+}
+
+void ShimFree ( SHIM *shim )
+{
+	if ( !shim )
+	{
+		return;
+	}
+
+	pthread_mutex_lock ( &shim -> lock );
+	shim -> running = 0;
+	pthread_cond_signal ( &shim -> arrived );
+	pthread_mutex_unlock ( &shim -> lock );
+	pthread_join ( shim -> thread , NULL );
+
+	ShimQueueFree ( &shim -> queue );
+	pthread_cond_destroy ( &shim -> arrived );
+	pthread_mutex_destroy ( &shim -> lock );
+	free ( shim );
+}
+
+/* Copies one datagram's iovecs into a queue entry. */
+static SHIM_DATAGRAM *CopyShimDatagram ( const struct msghdr *message )
+{
+	int length = 0;
+	for ( size_t i = 0 ; i < message -> msg_iovlen ; i++ )
+	{
+		length += message -> msg_iov [ i ].iov_len;
+	}
+
+	SHIM_DATAGRAM *datagram = malloc ( sizeof ( SHIM_DATAGRAM ) + length );
+	if ( !datagram )
+	{
+		return NULL;
+	}
+
+	datagram -> length = 0;
+	for ( size_t i = 0 ; i < message -> msg_iovlen ; i++ )
+	{
+		memcpy ( datagram -> data + datagram -> length , message -> msg_iov [ i ].iov_base , message -> msg_iov [ i ].iov_len );
+		datagram -> length += message -> msg_iov [ i ].iov_len;
+	}
+
+	datagram -> addressLength = 0;
+	if ( message -> msg_name && message -> msg_namelen <= sizeof ( datagram -> address ) )
+	{
+		memcpy ( &datagram -> address , message -> msg_name , message -> msg_namelen );
+		datagram -> addressLength = message -> msg_namelen;
+	}
+
+	return datagram;
+}
+
+/* Stands in for sendmmsg on the shim's socket. Every datagram counts as sent
+ * (msg_len is filled in) whether the link drops it or not, as it would for a
+ * real link; returns numHeaders. */
+int ShimSend ( SHIM *shim , struct mmsghdr *headers , int numHeaders )
+{
+	for ( int i = 0 ; i < numHeaders ; i++ )
+	{
+		SHIM_DATAGRAM *datagram = CopyShimDatagram ( &headers [ i ].msg_hdr );
+		if ( !datagram )
+		{
+			headers [ i ].msg_len = 0;
+			continue;
+		}
+		headers [ i ].msg_len = datagram -> length;
+
+		pthread_mutex_lock ( &shim -> lock );
+
+		unsigned long long nowNs = StatsNow ();
+		unsigned long long serviceStartNs = shim -> bottleneckFreeNs > nowNs ? shim -> bottleneckFreeNs : nowNs;
+
+		int lost = shim -> lossRate > 0 && rand_r ( &shim -> seed ) < shim -> lossRate * ( RAND_MAX + 1.0 );
+		int overflow = shim -> nsPerByte > 0 && serviceStartNs - nowNs > SHIM_MAX_QUEUE_NS;
+		if ( lost || overflow )
+		{
+			pthread_mutex_unlock ( &shim -> lock );
+			free ( datagram );
+			continue;
+		}
+
+		shim -> bottleneckFreeNs = serviceStartNs + ( unsigned long long ) ( datagram -> length * shim -> nsPerByte );
+		datagram -> dueNs = shim -> bottleneckFreeNs + shim -> delayNs;
+		ShimQueueAppend ( &shim -> queue , datagram );
+
+		pthread_cond_signal ( &shim -> arrived );
+		pthread_mutex_unlock ( &shim -> lock );
+	}
+
+	return numHeaders;
+}
@@ -0,0 +1,28 @@
+/* Nic Pucci
+ * SHIM HEADER
+ *
+ * A lossy, slow link in front of a socket, for testing on one machine. Every
+ * datagram handed to ShimSend is dropped with a fixed probability. The others
+ * go through a bottleneck of a fixed rate with a drop-tail queue, then a fixed
+ * one-way delay. A thread of the shim's own puts them on the socket when they
+ * are due.
+ *
+ * The delay is the same for every datagram and the bottleneck serves them in
+ * order, so they come out in the order they went in and one FIFO holds
+ * everything waiting.
+*/
+
+#ifndef SHIM_H
+#define SHIM_H
+
+#include <sys/socket.h>
+
+typedef struct shim SHIM;
+
+SHIM *ShimCreate ( int fd , double lossPercent , int delayMs , double rateMbps );
+
+void ShimFree ( SHIM *shim );
+
+int ShimSend ( SHIM *shim , struct mmsghdr *headers , int numHeaders );
+
+#endif
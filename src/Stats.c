@@ -0,0 +1,214 @@
+/* Nic Pucci
+ * STATS IMPLEMENTATION
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include "Stats.h"
+
+const int STATS_SUB_BUCKETS = 1 << STATS_SUB_BUCKET_BITS;
+
+const char *STATS_HISTOGRAM_NAMES [ STATS_NUM_HISTOGRAMS ] = {
+	"send queue wait" ,
+	"send" ,
+	"receive to print" ,
+	"render" ,
+	"bench end to end"
+};
+
+STATS_HISTOGRAM statsHistograms [ STATS_NUM_HISTOGRAMS ];
+atomic_ulong statsCounters [ STATS_NUM_COUNTERS ];
+
+unsigned long long StatsNow ()
+{
+	struct timespec now;
+	clock_gettime ( CLOCK_MONOTONIC , &now );
+	return ( unsigned long long ) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/* Low 32 bits of StatsNow, small enough to ride along in a message header.
+ * Differences stay exact for anything under ~4.29 s. */
+unsigned int StatsStamp ()
+{
+	return ( unsigned int ) StatsNow ();
+}
+
+static int BucketIndex ( unsigned long long value )
+{
+	if ( value < ( unsigned long long ) STATS_SUB_BUCKETS )
+	{
+		return ( int ) value;
+	}
+
+	int highestBit = 63 - __builtin_clzll ( value );
+	int shift = highestBit - STATS_SUB_BUCKET_BITS;
+	int subBucket = ( int ) ( value >> shift ) - STATS_SUB_BUCKETS;
+	return ( ( shift + 1 ) << STATS_SUB_BUCKET_BITS ) + subBucket;
+}
+
+/* Midpoint of the range of values a bucket stands for. */
+static unsigned long long BucketValue ( int index )
+{
+	if ( index < STATS_SUB_BUCKETS )
+	{
+		return index;
+	}
+
+	int shift = ( index >> STATS_SUB_BUCKET_BITS ) - 1;
+	unsigned long long subBucket = ( index & ( STATS_SUB_BUCKETS - 1 ) ) + STATS_SUB_BUCKETS;
+	unsigned long long lowest = subBucket << shift;
+	return lowest + ( ( 1ULL << shift ) >> 1 );
+}
+
+void StatsRecord ( int histogram , unsigned long long nanoseconds )
+{
+	STATS_HISTOGRAM *target = &statsHistograms [ histogram ];
+
+	atomic_fetch_add_explicit ( &target -> buckets [ BucketIndex ( nanoseconds ) ] , 1 , memory_order_relaxed );
+	atomic_fetch_add_explicit ( &target -> count , 1 , memory_order_relaxed );
+
+	unsigned long currentMax = atomic_load_explicit ( &target -> maxValue , memory_order_relaxed );
+	while ( nanoseconds > currentMax )
+	{
+		if ( atomic_compare_exchange_weak_explicit ( &target -> maxValue , &currentMax , nanoseconds , memory_order_relaxed , memory_order_relaxed ) )
+		{
+			break;
+		}
+	}
+}
+
+void StatsRecordSince ( int histogram , unsigned int stamp )
+{
+	StatsRecord ( histogram , ( unsigned int ) ( StatsStamp () - stamp ) );
+}
+
+void StatsAdd ( int counter , unsigned long amount )
+{
+	atomic_fetch_add_explicit ( &statsCounters [ counter ] , amount , memory_order_relaxed );
+}
+
+void StatsObserveMax ( int counter , unsigned long value )
+{
+	unsigned long currentMax = atomic_load_explicit ( &statsCounters [ counter ] , memory_order_relaxed );
+	while ( value > currentMax )
+	{
+		if ( atomic_compare_exchange_weak_explicit ( &statsCounters [ counter ] , &currentMax , value , memory_order_relaxed , memory_order_relaxed ) )
+		{
+			break;
+		}
+	}
+}
+
+unsigned long StatsCounter ( int counter )
+{
+	return atomic_load_explicit ( &statsCounters [ counter ] , memory_order_relaxed );
+}
+
+/* Value at the given percentile (0-100) in nanoseconds, or 0 if nothing was recorded. */
+unsigned long long StatsPercentile ( int histogram , double percentile )
+{
+	STATS_HISTOGRAM *source = &statsHistograms [ histogram ];
+
+	unsigned long count = atomic_load_explicit ( &source -> count , memory_order_relaxed );
+	if ( count == 0 )
+	{
+		return 0;
+	}
+
+	unsigned long rank = ( unsigned long ) ( percentile / 100.0 * count );
+	if ( rank >= count )
+	{
+		rank = count - 1;
+	}
+
+	unsigned long long maxValue = atomic_load_explicit ( &source -> maxValue , memory_order_relaxed );
+	unsigned long seen = 0;
+
+	for ( int i = 0 ; i < STATS_NUM_BUCKETS ; i++ )
+	{
+		seen += atomic_load_explicit ( &source -> buckets [ i ] , memory_order_relaxed );
+		if ( seen > rank )
+		{
+			unsigned long long value = BucketValue ( i );
+			return value < maxValue ? value : maxValue;
+		}
+	}
+
+	return maxValue;
+}
+
+/* Remembers a start stamp; if the batch is already full the oldest ones are
+ * recorded against now rather than dropped. */
+void StatsPendingAdd ( STATS_PENDING *pending , int histogram , unsigned int stamp )
+{
+	if ( pending -> count == STATS_MAX_PENDING )
+	{
+		StatsPendingRecord ( pending , histogram );
+	}
+
+	pending -> stamps [ pending -> count ] = stamp;
+	pending -> count += 1;
+}
+
+void StatsPendingRecord ( STATS_PENDING *pending , int histogram )
+{
+	unsigned int now = StatsStamp ();
+
+	for ( int i = 0 ; i < pending -> count ; i++ )
+	{
+		StatsRecord ( histogram , ( unsigned int ) ( now - pending -> stamps [ i ] ) );
+	}
+
+	pending -> count = 0;
+}
+
+/* Human readable snapshot; returns the number of bytes written (truncated to size). */
+int StatsFormat ( char *buffer , int size )
+{
+	int length = snprintf (
+		buffer , size ,
+		"stats: sent %lu messages / %lu datagrams / %lu bytes, received %lu messages / %lu datagrams / %lu bytes, drops %lu\n"
+		"  max queue depth: send %lu, print %lu\n"
+		"  retransmissions %lu, retransmission timeouts %lu\n"
+		"  fragments sent %lu, messages reassembled %lu, reassembly drops %lu\n"
+		"  frames compressed %lu, bytes saved %lu\n"
+		"  datagrams sealed %lu, datagrams rejected %lu\n"
+		"  latency (us)           count       p50       p99      p999       max\n" ,
+		StatsCounter ( STATS_MESSAGES_SENT ) ,
+		StatsCounter ( STATS_DATAGRAMS_SENT ) ,
+		StatsCounter ( STATS_BYTES_SENT ) ,
+		StatsCounter ( STATS_MESSAGES_RECEIVED ) ,
+		StatsCounter ( STATS_DATAGRAMS_RECEIVED ) ,
+		StatsCounter ( STATS_BYTES_RECEIVED ) ,
+		StatsCounter ( STATS_DROPS ) ,
+		StatsCounter ( STATS_SEND_QUEUE_DEPTH_MAX ) ,
+		StatsCounter ( STATS_PRINT_QUEUE_DEPTH_MAX ) ,
+		StatsCounter ( STATS_RETRANSMISSIONS ) ,
+		StatsCounter ( STATS_RETRANSMISSION_TIMEOUTS ) ,
+		StatsCounter ( STATS_FRAGMENTS_SENT ) ,
+		StatsCounter ( STATS_MESSAGES_REASSEMBLED ) ,
+		StatsCounter ( STATS_REASSEMBLY_DROPS ) ,
+		StatsCounter ( STATS_FRAMES_COMPRESSED ) ,
+		StatsCounter ( STATS_COMPRESSION_BYTES_SAVED ) ,
+		StatsCounter ( STATS_DATAGRAMS_SEALED ) ,
+		StatsCounter ( STATS_DATAGRAMS_REJECTED )
+	);
+
+	for ( int i = 0 ; i < STATS_NUM_HISTOGRAMS && length < size ; i++ )
+	{
+		STATS_HISTOGRAM *histogram = &statsHistograms [ i ];
+
+		length += snprintf (
+			buffer + length , size - length ,
+			"  %-18s %9lu %9.1f %9.1f %9.1f %9.1f\n" ,
+			STATS_HISTOGRAM_NAMES [ i ] ,
+			atomic_load_explicit ( &histogram -> count , memory_order_relaxed ) ,
+			StatsPercentile ( i , 50.0 ) / 1000.0 ,
+			StatsPercentile ( i , 99.0 ) / 1000.0 ,
+			StatsPercentile ( i , 99.9 ) / 1000.0 ,
+			atomic_load_explicit ( &histogram -> maxValue , memory_order_relaxed ) / 1000.0
+		);
+	}
+
+	return length < size ? length : size - 1;
+}
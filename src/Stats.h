@@ -0,0 +1,87 @@
+/* Nic Pucci
+ * STATS HEADER
+ *
+ * Process-wide counters and latency histograms for the chat pipeline. Every
+ * update is a relaxed atomic add on a fixed slot, so any thread can record
+ * without locks. Histograms are log-linear (HDR style): 32 sub-buckets per
+ * power of two of nanoseconds, so a percentile is within ~3% of the true value.
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+
+#define STATS_SUB_BUCKET_BITS 5
+#define STATS_NUM_BUCKETS ( ( 64 - STATS_SUB_BUCKET_BITS + 1 ) << STATS_SUB_BUCKET_BITS )
+#define STATS_MAX_PENDING 256
+
+enum STATS_HISTOGRAM {
+	STATS_SEND_QUEUE_WAIT, // read from stdin -> taken by the sender
+	STATS_SEND, // one sendmmsg batch
+	STATS_RECEIVE_TO_PRINT, // datagram received -> written to stdout
+	STATS_RENDER, // first message of a wakeup rendered -> screen write returned
+	STATS_BENCH_LATENCY, // bench mode: scheduled send -> taken off the receive queue
+	STATS_NUM_HISTOGRAMS
+};
+
+enum STATS_COUNTER {
+	STATS_MESSAGES_SENT,
+	STATS_BYTES_SENT,
+	STATS_DATAGRAMS_SENT,
+	STATS_MESSAGES_RECEIVED,
+	STATS_BYTES_RECEIVED,
+	STATS_DATAGRAMS_RECEIVED,
+	STATS_DROPS, // messages lost to a full/closed queue, a failed allocation or a failed send
+	STATS_SEND_QUEUE_DEPTH_MAX,
+	STATS_PRINT_QUEUE_DEPTH_MAX,
+	STATS_RETRANSMISSIONS, // reliable mode: frames sent again
+	STATS_RETRANSMISSION_TIMEOUTS, // reliable mode: times the retransmission timer fired
+	STATS_FRAGMENTS_SENT,
+	STATS_MESSAGES_REASSEMBLED,
+	STATS_REASSEMBLY_DROPS, // fragmented messages given up: timed out, malformed or over a reassembly limit
+	STATS_FRAMES_COMPRESSED,
+	STATS_COMPRESSION_BYTES_SAVED, // payload bytes compression kept off the wire
+	STATS_DATAGRAMS_SEALED,
+	STATS_DATAGRAMS_REJECTED, // --encrypt: received datagrams that were forged, replayed, plaintext or came before the keys
+	STATS_NUM_COUNTERS
+};
+
+typedef struct statsHistogram
+{
+	atomic_ulong buckets [ STATS_NUM_BUCKETS ];
+	atomic_ulong count;
+	atomic_ulong maxValue;
+} STATS_HISTOGRAM;
+
+/* Start stamps waiting for a shared end point (e.g. one screen write for many
+ * messages); only touched by the thread that owns it. */
+typedef struct statsPending
+{
+	unsigned int stamps [ STATS_MAX_PENDING ];
+	int count;
+} STATS_PENDING;
+
+unsigned long long StatsNow ();
+
+unsigned int StatsStamp ();
+
+void StatsRecord ( int histogram , unsigned long long nanoseconds );
+
+void StatsRecordSince ( int histogram , unsigned int stamp );
+
+void StatsAdd ( int counter , unsigned long amount );
+
+void StatsObserveMax ( int counter , unsigned long value );
+
+unsigned long StatsCounter ( int counter );
+
+unsigned long long StatsPercentile ( int histogram , double percentile );
+
+void StatsPendingAdd ( STATS_PENDING *pending , int histogram , unsigned int stamp );
+
+void StatsPendingRecord ( STATS_PENDING *pending , int histogram );
+
+int StatsFormat ( char *buffer , int size );
+
+#endif
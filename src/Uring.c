@@ -0,0 +1,292 @@
+/* Nic Pucci
+ * URING IMPLEMENTATION
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "List.h"
+#include "Uring.h"
+
+static int SysUringSetup ( unsigned int numEntries , struct io_uring_params *params )
+{
+	return ( int ) syscall ( __NR_io_uring_setup , numEntries , params );
+}
+
+static int SysUringEnter ( int ringFD , unsigned int toSubmit , unsigned int minComplete , unsigned int flags )
+{
+	return ( int ) syscall ( __NR_io_uring_enter , ringFD , toSubmit , minComplete , flags , NULL , 0 );
+}
+
+static int SysUringRegister ( int ringFD , unsigned int opcode , void *arg , unsigned int numArgs )
+{
+	return ( int ) syscall ( __NR_io_uring_register , ringFD , opcode , arg , numArgs );
+}
+
+int UringInit ( URING *uring , unsigned int numEntries )
+{
+	if ( !uring )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	memset ( uring , 0 , sizeof ( URING ) );
+	uring -> ringFD = -1;
+
+	struct io_uring_params params;
+	memset ( &params , 0 , sizeof ( params ) );
+
+	uring -> ringFD = SysUringSetup ( numEntries , &params );
+	if ( uring -> ringFD < 0 )
+	{
+		return FAILURE_OP_CODE;
+	}
+
+	// one mapping for both rings is all we support; every kernel with pbuf rings has it
+	if ( !( params.features & IORING_FEAT_SINGLE_MMAP ) )
+	{
+		close ( uring -> ringFD );
+		uring -> ringFD = -1;
+		return FAILURE_OP_CODE;
+	}
+
+	size_t sqRingSize = params.sq_off.array + params.sq_entries * sizeof ( unsigned int );
+	size_t cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof ( struct io_uring_cqe );
+	uring -> ringMemorySize = sqRingSize > cqRingSize ? sqRingSize : cqRingSize;
+
+	uring -> ringMemory = mmap (
+		NULL , uring -> ringMemorySize , PROT_READ | PROT_WRITE , MAP_SHARED | MAP_POPULATE ,
+		uring -> ringFD , IORING_OFF_SQ_RING
+	);
+	if ( uring -> ringMemory == MAP_FAILED )
+	{
+		close ( uring -> ringFD );
+		uring -> ringFD = -1;
+		return FAILURE_OP_CODE;
+	}
+
+	uring -> sqesSize = params.sq_entries * sizeof ( struct io_uring_sqe );
+	uring -> sqes = mmap (
+		NULL , uring -> sqesSize , PROT_READ | PROT_WRITE , MAP_SHARED | MAP_POPULATE ,
+		uring -> ringFD , IORING_OFF_SQES
+	);
+	if ( uring -> sqes == MAP_FAILED )
+	{
+		munmap ( uring -> ringMemory , uring -> ringMemorySize );
+		close ( uring -> ringFD );
+		uring -> ringFD = -1;
+		return FAILURE_OP_CODE;
+	}
+
+	char *ring = ( char *) uring -> ringMemory;
+	uring -> sqHead = ( unsigned int *) ( ring + params.sq_off.head );
+	uring -> sqTail = ( unsigned int *) ( ring + params.sq_off.tail );
+	uring -> sqMask = *( unsigned int *) ( ring + params.sq_off.ring_mask );
+	uring -> sqArray = ( unsigned int *) ( ring + params.sq_off.array );
+	uring -> sqLocalTail = *uring -> sqTail;
+
+	uring -> cqHead = ( unsigned int *) ( ring + params.cq_off.head );
+	uring -> cqTail = ( unsigned int *) ( ring + params.cq_off.tail );
+	uring -> cqMask = *( unsigned int *) ( ring + params.cq_off.ring_mask );
+	uring -> cqes = ( struct io_uring_cqe *) ( ring + params.cq_off.cqes );
+
+	return SUCCESS_OP_CODE;
+}
+
+void UringFree ( URING *uring )
+{
+	if ( !uring || uring -> ringFD < 0 )
+	{
+		return;
+	}
+
+	munmap ( uring -> sqes , uring -> sqesSize );
+	munmap ( uring -> ringMemory , uring -> ringMemorySize );
+	close ( uring -> ringFD );
+	uring -> ringFD = -1;
+}
+
+/* Returns a zeroed SQE, or NULL when the submission queue is full. */
+struct io_uring_sqe *UringGetSqe ( URING *uring )
+{
+	unsigned int head = atomic_load_explicit ( ( _Atomic unsigned int *) uring -> sqHead , memory_order_acquire );
+	if ( uring -> sqLocalTail - head > uring -> sqMask )
+	{
+		return NULL;
+	}
+
+	unsigned int index = uring -> sqLocalTail & uring -> sqMask;
+	struct io_uring_sqe *sqe = &uring -> sqes [ index ];
+	memset ( sqe , 0 , sizeof ( struct io_uring_sqe ) );
+
+	uring -> sqArray [ index ] = index;
+	uring -> sqLocalTail += 1;
+	return sqe;
+}
+
+/* Publishes every prepared SQE and, if asked, waits for minCompletions CQEs. */
+int UringSubmitAndWait ( URING *uring , unsigned int minCompletions )
+{
+	unsigned int oldTail = *uring -> sqTail;
+	unsigned int toSubmit = uring -> sqLocalTail - oldTail;
+	atomic_store_explicit ( ( _Atomic unsigned int *) uring -> sqTail , uring -> sqLocalTail , memory_order_release );
+
+	unsigned int flags = minCompletions > 0 ? IORING_ENTER_GETEVENTS : 0;
+	if ( toSubmit == 0 && flags == 0 )
+	{
+		return 0;
+	}
+
+	return SysUringEnter ( uring -> ringFD , toSubmit , minCompletions , flags );
+}
+
+struct io_uring_cqe *UringPeekCqe ( URING *uring )
+{
+	unsigned int head = *uring -> cqHead;
+	unsigned int tail = atomic_load_explicit ( ( _Atomic unsigned int *) uring -> cqTail , memory_order_acquire );
+	if ( head == tail )
+	{
+		return NULL;
+	}
+
+	return &uring -> cqes [ head & uring -> cqMask ];
+}
+
+void UringCqeSeen ( URING *uring )
+{
+	atomic_store_explicit ( ( _Atomic unsigned int *) uring -> cqHead , *uring -> cqHead + 1 , memory_order_release );
+}
+
+int UringInitBufferRing ( URING *uring , URING_BUFFER_RING *bufferRing , int numBuffers , int bufferSize , unsigned short groupID )
+{
+	memset ( bufferRing , 0 , sizeof ( URING_BUFFER_RING ) );
+
+	bufferRing -> ringSize = numBuffers * sizeof ( struct io_uring_buf );
+	bufferRing -> ring = mmap (
+		NULL , bufferRing -> ringSize , PROT_READ | PROT_WRITE , MAP_ANONYMOUS | MAP_PRIVATE , -1 , 0
+	);
+	if ( bufferRing -> ring == MAP_FAILED )
+	{
+		bufferRing -> ring = NULL;
+		return FAILURE_OP_CODE;
+	}
+
+	// one spare byte per buffer so callers can terminate a full datagram in place
+	bufferRing -> buffers = ( unsigned char *) malloc ( ( size_t ) numBuffers * ( bufferSize + 1 ) );
+	if ( !bufferRing -> buffers )
+	{
+		munmap ( bufferRing -> ring , bufferRing -> ringSize );
+		bufferRing -> ring = NULL;
+		return FAILURE_OP_CODE;
+	}
+
+	bufferRing -> numBuffers = numBuffers;
+	bufferRing -> bufferSize = bufferSize;
+	bufferRing -> groupID = groupID;
+
+	struct io_uring_buf_reg registration;
+	memset ( &registration , 0 , sizeof ( registration ) );
+	registration.ring_addr = ( unsigned long ) bufferRing -> ring;
+	registration.ring_entries = numBuffers;
+	registration.bgid = groupID;
+
+	if ( SysUringRegister ( uring -> ringFD , IORING_REGISTER_PBUF_RING , &registration , 1 ) < 0 )
+	{
+		UringFreeBufferRing ( NULL , bufferRing );
+		return FAILURE_OP_CODE;
+	}
+
+	for ( int i = 0 ; i < numBuffers ; i++ )
+	{
+		UringRecycleBuffer ( bufferRing , i );
+	}
+
+	return SUCCESS_OP_CODE;
+}
+
+void UringFreeBufferRing ( URING *uring , URING_BUFFER_RING *bufferRing )
+{
+	if ( !bufferRing -> ring )
+	{
+		return;
+	}
+
+	if ( uring )
+	{
+		struct io_uring_buf_reg registration;
+		memset ( &registration , 0 , sizeof ( registration ) );
+		registration.bgid = bufferRing -> groupID;
+		SysUringRegister ( uring -> ringFD , IORING_UNREGISTER_PBUF_RING , &registration , 1 );
+	}
+
+	munmap ( bufferRing -> ring , bufferRing -> ringSize );
+	free ( bufferRing -> buffers );
+	bufferRing -> ring = NULL;
+	bufferRing -> buffers = NULL;
+}
+
+unsigned char *UringBuffer ( URING_BUFFER_RING *bufferRing , unsigned short bufferID )
+{
+	return bufferRing -> buffers + ( size_t ) bufferID * ( bufferRing -> bufferSize + 1 );
+}
+
+/* Hands a buffer back to the kernel for the next multishot completion. */
+void UringRecycleBuffer ( URING_BUFFER_RING *bufferRing , unsigned short bufferID )
+{
+	unsigned short mask = bufferRing -> numBuffers - 1;
+	struct io_uring_buf *buffer = &bufferRing -> ring -> bufs [ bufferRing -> localTail & mask ];
+
+	buffer -> addr = ( unsigned long ) UringBuffer ( bufferRing , bufferID );
+	buffer -> len = bufferRing -> bufferSize;
+	buffer -> bid = bufferID;
+
+	bufferRing -> localTail += 1;
+	atomic_store_explicit ( ( _Atomic unsigned short *) &bufferRing -> ring -> tail , bufferRing -> localTail , memory_order_release );
+}
+
+/* Each buffer the kernel picks starts with a struct io_uring_recvmsg_out, then
+ * header -> msg_namelen bytes for the sender's address, then the datagram.
+ * header only gives those sizes, and must outlive the receive. */
+void UringPrepRecvMsgMultishot ( struct io_uring_sqe *sqe , int fd , struct msghdr *header , unsigned short groupID , unsigned long long userData )
+{
+	sqe -> opcode = IORING_OP_RECVMSG;
+	sqe -> fd = fd;
+	sqe -> addr = ( unsigned long ) header;
+	sqe -> len = 1;
+	sqe -> ioprio = IORING_RECV_MULTISHOT;
+	sqe -> flags = IOSQE_BUFFER_SELECT;
+	sqe -> buf_group = groupID;
+	sqe -> user_data = userData;
+}
+
+void UringPrepRead ( struct io_uring_sqe *sqe , int fd , void *buffer , unsigned int length , unsigned long long userData )
+{
+	sqe -> opcode = IORING_OP_READ;
+	sqe -> fd = fd;
+	sqe -> addr = ( unsigned long ) buffer;
+	sqe -> len = length;
+	sqe -> off = -1; // current file position, like read(2)
+	sqe -> user_data = userData;
+}
+
+void UringPrepWrite ( struct io_uring_sqe *sqe , int fd , const void *buffer , unsigned int length , unsigned long long userData )
+{
+	sqe -> opcode = IORING_OP_WRITE;
+	sqe -> fd = fd;
+	sqe -> addr = ( unsigned long ) buffer;
+	sqe -> len = length;
+	sqe -> off = -1;
+	sqe -> user_data = userData;
+}
+
+void UringPrepSend ( struct io_uring_sqe *sqe , int fd , const void *buffer , unsigned int length , unsigned long long userData )
+{
+	sqe -> opcode = IORING_OP_SEND;
+	sqe -> fd = fd;
+	sqe -> addr = ( unsigned long ) buffer;
+	sqe -> len = length;
+	sqe -> user_data = userData;
+}
@@ -0,0 +1,77 @@
+/* Nic Pucci
+ * URING HEADER
+ *
+ * Minimal io_uring wrapper on the raw syscalls (no liburing dependency): ring
+ * setup, SQE/CQE access, and provided buffer rings for multishot receives.
+*/
+
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+typedef struct uring
+{
+	int ringFD;
+
+	/* submission queue */
+	unsigned int *sqHead;
+	unsigned int *sqTail;
+	unsigned int sqMask;
+	unsigned int *sqArray;
+	struct io_uring_sqe *sqes;
+	unsigned int sqLocalTail;
+
+	/* completion queue */
+	unsigned int *cqHead;
+	unsigned int *cqTail;
+	unsigned int cqMask;
+	struct io_uring_cqe *cqes;
+
+	void *ringMemory;
+	size_t ringMemorySize;
+	size_t sqesSize;
+} URING;
+
+typedef struct uringBufferRing
+{
+	struct io_uring_buf_ring *ring;
+	size_t ringSize;
+	unsigned char *buffers;
+	int numBuffers; // power of 2
+	int bufferSize; // bytes the kernel may fill; each buffer has one spare byte after it
+	unsigned short groupID;
+	unsigned short localTail;
+} URING_BUFFER_RING;
+
+int UringInit ( URING *uring , unsigned int numEntries );
+
+void UringFree ( URING *uring );
+
+struct io_uring_sqe *UringGetSqe ( URING *uring );
+
+int UringSubmitAndWait ( URING *uring , unsigned int minCompletions );
+
+struct io_uring_cqe *UringPeekCqe ( URING *uring );
+
+void UringCqeSeen ( URING *uring );
+
+int UringInitBufferRing ( URING *uring , URING_BUFFER_RING *bufferRing , int numBuffers , int bufferSize , unsigned short groupID );
+
+void UringFreeBufferRing ( URING *uring , URING_BUFFER_RING *bufferRing );
+
+unsigned char *UringBuffer ( URING_BUFFER_RING *bufferRing , unsigned short bufferID );
+
+void UringRecycleBuffer ( URING_BUFFER_RING *bufferRing , unsigned short bufferID );
+
+void UringPrepRecvMsgMultishot ( struct io_uring_sqe *sqe , int fd , struct msghdr *header , unsigned short groupID , unsigned long long userData );
+
+void UringPrepRead ( struct io_uring_sqe *sqe , int fd , void *buffer , unsigned int length , unsigned long long userData );
+
+void UringPrepWrite ( struct io_uring_sqe *sqe , int fd , const void *buffer , unsigned int length , unsigned long long userData );
+
+void UringPrepSend ( struct io_uring_sqe *sqe , int fd , const void *buffer , unsigned int length , unsigned long long userData );
+
+#endif
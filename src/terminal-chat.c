@@ -2,18 +2,110 @@
  * TERMINAL-CHAT IMPLEMENTATION
 */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <netdb.h>
+#include <arpa/inet.h>
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
 #include "List.h"
+#include "RingQueue.h"
+#include "MessageSlab.h"
+#include "Uring.h"
+#include "Protocol.h"
+#include "Fragment.h"
+#include "FileTransfer.h"
+#include "Compress.h"
+#include "Stats.h"
+#include "PeerTable.h"
+#include "Relay.h"
+#include "Reliable.h"
+#include "Shim.h"
+#include "Crypto.h"
+#include "Secure.h"
 
 const char *PROGRAM_NAME_FIRST_ARG = "terminal-chat";
-const int MESSAGE_MAX_SIZE = 2048;
+const char *BENCH_FIRST_ARG = "bench";
+const char *RELAY_FIRST_ARG = "relay";
+const int MESSAGE_MAX_SIZE = 2048; // largest datagram, frame headers included
+const unsigned int MESSAGE_QUEUE_CAPACITY = 1024;
+
+/* NUM OF DATAGRAMS PER recvmmsg (Only for defining size of arrays at compile-time) */
+#define MAX_RECEIVE_BATCH_SIZE_ALLOC 256
+
+const int MAX_RECEIVE_BATCH_SIZE = MAX_RECEIVE_BATCH_SIZE_ALLOC;
+const int DEFAULT_RECEIVE_BATCH_SIZE = 32;
+const int DEFAULT_RECEIVE_BATCH_TIMEOUT_MS = 0; // 0 = take only what is already queued
+
+/* NUM OF MESSAGES PER sendmmsg (Only for defining size of arrays at compile-time) */
+#define MAX_SEND_BATCH_SIZE_ALLOC 256
+
+const int MAX_SEND_BATCH_SIZE = MAX_SEND_BATCH_SIZE_ALLOC;
+
+/* NUM OF DATAGRAMS SEALED PER sendmmsg WITH --encrypt, AND THEIR SIZE (Only for defining size of arrays at compile-time) */
+#define SEAL_BATCH_SIZE_ALLOC 32
+#define SEALED_DATAGRAM_SIZE_ALLOC 2048 // MESSAGE_MAX_SIZE
+
+const int SEAL_BATCH_SIZE = SEAL_BATCH_SIZE_ALLOC;
+const int DEFAULT_COALESCE_DELAY_MS = 1;
+
+const int STATS_TEXT_CAPACITY = 4096;
+const int DEFAULT_STATS_INTERVAL_MS = 1000;
+
+#define MAX_BENCH_SIZES_ALLOC 16
+
+const int MAX_BENCH_SIZES = MAX_BENCH_SIZES_ALLOC;
+const int DEFAULT_BENCH_NUM_MESSAGES = 100000;
+const int DEFAULT_BENCH_PORT = 7300; // the receiver takes this port, the sender the next one
+const int BENCH_IDLE_TIMEOUT_MS = 2000; // receiver gives up this long after the last datagram
+const int BENCH_RELAY_PORT_OFFSET = 2; // a bench relay takes benchPort + 2
+const int BENCH_RELAY_JOINS_PER_MS = 128; // idle clients joining, paced so the relay's socket buffers keep up
+const int BENCH_RELAY_SETTLE_MS = 50; // joins are not acknowledged; give the relay this long before sending
+const char BENCH_RELAY_ROOM [] = "bench";
+const int BENCH_RELAY_IDLE_ROOMS = 64; // idle clients are spread over this many other rooms
+
+const int RELIABLE_LINGER_MS = 2000; // a closing reliable sender gives up once acks stop for this long
+const int REASSEMBLY_TIMEOUT_MS = 5000; // a fragmented message that stops growing for this long is dropped
+const int INPUT_STREAM_GAP_MS = 20; // a long message read so far ends only after input has paused this long
+const int FILE_ANSWER_TIMEOUT_MS = 90000; // an offered file no one answers is given up after this long
+const int FILE_OFFER_TIMEOUT_MS = 60000; // a receiver not answering an offer refuses it, before the sender gives up
+const int FILE_PROGRESS_INTERVAL_MS = 1000; // a transfer's progress is shown at most this often
+const int FILE_MAX_UNSENT_CHUNKS = 256; // queued ahead of the window; a chat line waits behind no more than this
+const int NOTICE_CAPACITY = 512;
+const int HELLO_RETRY_MS = 1000; // an unanswered hello is sent again, at most this often, while the peer is heard from
+const int HANDSHAKE_RETRY_MS = 1000; // a handshake is sent again, at most this often, while there are no keys that work
+const int KEYS_WAIT_POLL_MS = 10; // a sending thread waiting for the handshake checks this often
+const int RELAY_JOIN_RENEW_MS = RELAY_MEMBER_TIMEOUT_MS / 4; // a client that only listens stays a relay member
+const int MAX_HELD_MESSAGES = 256; // typed before the handshake completed; past this they are dropped
+
+const int INITIAL_SCREEN_BUFFER_CAPACITY = 4096;
+const int DEFAULT_MAX_FRAMES_PER_SECOND = 0; // no cap: a blocked write already batches whatever queues up behind it
+const int SCREEN_BUFFER_HIGH_WATER_MARK = 1 << 20; // event loop stops reading the socket above this
+
+/* io_uring backend sizing */
+const unsigned int URING_NUM_ENTRIES = 256;
+const int URING_NUM_RECEIVE_BUFFERS = 256; // power of 2
+const unsigned short URING_RECEIVE_BUFFER_GROUP = 1;
+
+/* io_uring completions carry what they were for in the low bits of user_data;
+ * sends also carry their (16-byte aligned) message pointer */
+const unsigned long long URING_TAG_MASK = 0xf;
+const unsigned long long URING_TAG_RECEIVE = 1;
+const unsigned long long URING_TAG_INPUT = 2;
+const unsigned long long URING_TAG_SCREEN = 3;
+const unsigned long long URING_TAG_SEND = 4;
 
 const int FAILED_SOCKET_FD = -1; // must be -1 because that is the error code returned by socket ()
 const int FAILED_SENDING_MESSAGE = -1;
@@ -21,7 +113,19 @@ const int SUCCESS_SENDING_MESSAGE = 1;
 
 const char REMOTE_TERMINAL_LABEL [] = "\nRemote: ";
 const char USER_LEFT_CHAT_MESSAGE [] = "!";
+const char STATS_COMMAND [] = "/stats";
+const char SEND_FILE_COMMAND [] = "/send-file ";
+const char FILE_NEEDS_RELIABLE_MESSAGE [] = "/send-file needs --reliable on both ends";
+const char FILE_BUSY_MESSAGE [] = "A file is already being sent";
+const char FILE_ACCEPT_COMMAND [] = "/accept";
+const char FILE_REJECT_COMMAND [] = "/reject";
+const char NO_FILE_OFFER_MESSAGE [] = "No file offer is waiting for an answer";
+const char FILE_NAME_REFUSED_MESSAGE [] = "Refused a file whose name is hidden or unprintable";
 const char REMOTE_LEFT_CHAT_RESPONSE [] = "[User left the chat]";
+const char PLAINTEXT_REFUSED_MESSAGE [] = "Dropped a datagram that was not encrypted: the peer needs --encrypt too";
+const char HANDSHAKE_REFUSED_MESSAGE [] = "Refused a handshake: both ends need the same --psk-file";
+const char AWAITING_KEYS_MESSAGE [] = "Waiting for the peer's handshake: messages go out once it answers";
+const char ENCRYPTED_PEER_MESSAGE [] = "The peer is encrypted: start with --encrypt to read it";
 const char SESSION_STARTED_MESSAGE [] = "SESSION STARTED: Press RETURN KEY to send message. Enter '!' to exit the session.";
 const char SESSION_ENDED_MESSAGE [] = "SESSION ENDED: [Disconnected]";
 
@@ -30,29 +134,168 @@ const char REMOTE_LABEL_TEXT_COLOR [] = "\033[1;34m"; // bold blue
 const char REMOTE_MESSAGE_TEXT_COLOR [] = "\033[0;34m"; // blue
 const char SESSION_STARTED_TEXT_COLOR [] = "\033[1;32m"; // bold green
 const char SESSION_ENDED_TEXT_COLOR [] = "\033[1;31m"; // bold red
+const char NOTICE_TEXT_COLOR [] = "\033[0;33m"; // yellow
+const char WARNING_TEXT_COLOR [] = "\033[1;31m"; // bold red
 
 char *receivePort = "-1";
 char *sendHostName = "-1"; // e.g. localhost = "127.0.0.1"
 char *sendPort = "-1";
 
+int receiveBatchSize = DEFAULT_RECEIVE_BATCH_SIZE;
+int receiveBatchTimeoutMs = DEFAULT_RECEIVE_BATCH_TIMEOUT_MS;
+
+int coalesceMaxBytes = 0; // 0 = one datagram per message
+int coalesceDelayMs = DEFAULT_COALESCE_DELAY_MS;
+
+int maxFramesPerSecond = DEFAULT_MAX_FRAMES_PER_SECOND; // 0 = flush on every wakeup
+
+unsigned int nextSendSequence = 0; // only touched by whichever thread sends
+
+char *statsFilePath = NULL; // periodic dump target, NULL = none
+int statsIntervalMs = DEFAULT_STATS_INTERVAL_MS;
+
+int benchNumMessages = DEFAULT_BENCH_NUM_MESSAGES;
+int benchRate = 0; // messages per second, 0 = as fast as the sender takes them
+int benchWindow = 0; // messages in flight, 0 = open loop
+int benchPort = DEFAULT_BENCH_PORT;
+int benchSizes [ MAX_BENCH_SIZES_ALLOC ] = { 64 }; // payload bytes
+int benchWeights [ MAX_BENCH_SIZES_ALLOC ] = { 1 };
+int benchNumSizes = 1;
+
+int eventLoopMode = 0;
+int uringMode = 0;
+
+int groupMode = 0; // set by --peers / --peers-file
+PEER_TABLE peerTable; // the group; filled before any thread starts
+
+const char *relayRoom = NULL; // room joined at startup, set by --relay / --room
+int relayNumWorkers = 0; // relay mode, 0 = one per CPU
+
+int benchRelayWorkers = 0; // 0 = the bench sends straight to its receiver
+int benchRelayClients = 0; // idle clients registered with the bench relay
+int benchRelayRoomClients = 0; // idle clients in the bench's own room, which every message fans out to
+int benchIdleSinkFD = -1; // takes in what the relay forwards to the idle clients
+
+int reliableMode = 0; // --reliable: acknowledged, retransmitted, in-order delivery
+
+const int PEER_COMPRESSION_UNKNOWN = 0; // no hello from the peer yet: everything goes out as it is
+const int PEER_COMPRESSION_PLAIN = 1; // the peer decompresses, but has not loaded our dictionary
+const int PEER_COMPRESSION_DICTIONARY = 2; // the peer loaded the same dictionary
+
+int compressMode = 0; // --compress: chat frames go out compressed once the peer's hello says it can take them
+COMPRESS_DICTIONARY compressDictionary; // --compress-dict; data is NULL without one
+COMPRESSOR compressor; // only touched by whichever thread reads the input
+atomic_int peerCompression; // learnt by whichever thread renders, read by whichever reads the input
+long long lastHelloMs = 0; // when this end last asked for the peer's hello
+RELIABLE_SESSION reliableSession;
+
+int encryptMode = 0; // --encrypt / --psk-file: every datagram goes out sealed (Secure.h)
+int hasPresharedKey = 0;
+unsigned char presharedKey [ CRYPTO_KEY_SIZE ]; // --psk-file
+SECURE_SESSION secureSession;
+struct sockaddr_storage handshakeAddr; // the peer, where handshakes go
+socklen_t handshakeAddrLength = 0;
+atomic_llong lastHandshakeMs; // when this end last asked for the peer's handshake; any thread
+int plaintextNoticeShown = 0; // only touched by whichever thread reads the socket
+int handshakeNoticeShown = 0;
+int keysNoticeShown = 0; // the fingerprint has been shown once; later changes are warnings
+int awaitingKeysNoticeShown = 0; // only touched by the thread that sends
+LIST *heldMessages = NULL; // event loop and io_uring: typed before the handshake completed, in order
+int encryptedNoticeShown = 0;
+int maxPlainDatagramSize = 2048; // MESSAGE_MAX_SIZE, less FRAME_SEALED_OVERHEAD with --encrypt
+
+double shimLossPercent = 0; // the test shim's link: loss, one-way delay and rate
+int shimDelayMs = 0;
+double shimRateMbps = 0;
+SHIM *sendShim = NULL; // NULL = datagrams go straight to the send socket
+
+unsigned int nextFragmentedMessageId = 0; // only touched by whichever thread reads the input
+REASSEMBLER reassembler; // only touched by whichever thread renders
+
+/* the file being sent: started by the input thread, streamed by a thread of its
+ * own, answered and completed through the printing thread */
+typedef struct fileSending {
+	pthread_mutex_t lock;
+	pthread_cond_t answered;
+	pthread_t thread;
+	int started; // thread not joined yet
+	int running;
+	atomic_int stopping; // the session is over
+	int answer; // FILE_ANSWER_PENDING until the receiver replies
+	FILE_TRANSFER transfer; // id 0 = none yet
+} FILE_SENDING;
+
+const int FILE_ANSWER_PENDING = -1;
+
+FILE_SENDING fileSending = { .lock = PTHREAD_MUTEX_INITIALIZER , .answered = PTHREAD_COND_INITIALIZER };
+unsigned int nextFileTransferId = 1; // only touched by whichever thread reads the input
+
+/* a file offered by the peer, waiting for the user to /accept or /reject it:
+ * set by the printing thread, answered by the input thread, and refused by
+ * the printing thread once FILE_OFFER_TIMEOUT_MS passes unanswered */
+typedef struct fileOffer {
+	pthread_mutex_t lock;
+	int pending;
+	unsigned int id;
+	unsigned long long size;
+	char name [ FILE_MAX_NAME_SIZE + 1 ];
+	long long deadlineMs;
+} FILE_OFFER;
+
+FILE_OFFER fileOffer = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+FILE_TRANSFER fileReceiving; // set up by the input thread on /accept, then only touched by whichever thread renders
+atomic_int fileReceivingActive = 0; // published once fileReceiving is set up
+
 int receiveSocketFD = -1;
 int sendSocketFD = -1;
 
-LIST *sendMessagesList;
-LIST *printMessagesList;
+RING_QUEUE *sendMessagesQueue; // input thread -> sending thread
+RING_QUEUE *printMessagesQueue; // receiving thread -> printing thread
+
+typedef struct screenBuffer {
+	char *data;
+	int length;
+	int capacity;
+} SCREEN_BUFFER;
+
+typedef struct receiveBatch {
+	char *buffers [ MAX_RECEIVE_BATCH_SIZE_ALLOC ]; // MESSAGE_MAX_SIZE slab buffers
+	struct mmsghdr headers [ MAX_RECEIVE_BATCH_SIZE_ALLOC ];
+	struct iovec vectors [ MAX_RECEIVE_BATCH_SIZE_ALLOC ];
+	struct sockaddr_in addresses [ MAX_RECEIVE_BATCH_SIZE_ALLOC ]; // senders; the receive socket is IPv4
+	int batchSize;
+} RECEIVE_BATCH;
+
+/* what the screen frame handlers get: where to render and which peer sent it */
+typedef struct renderContext {
+	SCREEN_BUFFER *screen;
+	int source; // peer number in a group, 0 otherwise
+	int originLabelLength; // nonzero once an origin frame said who a relay forwarded this for
+	char originLabel [ PEER_LABEL_SIZE ];
+	unsigned long long origin; // the same client as a number, for telling fragments apart
+} RENDER_CONTEXT;
+
+/* a message being read from stdin, a fragment's worth of buffer at a time */
+typedef struct inputAssembly {
+	char *frame; // text goes in at FRAGMENT_TEXT_OFFSET; NULL until the next read needs it
+	int length; // text in frame
+	int numScanned; // of length, whole lines already found not to be the quit command
+	int midLine; // the text opens partway through a line, so its first line is no quit
+	int quitPending; // a quit line ended the last message, and goes out next
+	unsigned int messageId;
+	unsigned int numFragments; // of this message already handed out, 0 = none yet
+} INPUT_ASSEMBLY;
 
 pthread_t sendThread;
 pthread_t recvThread;
 pthread_t inputThread;
 pthread_t printingThread;
+pthread_t statsThread;
+pthread_t relayJoinThread;
+int relayJoining = 0; // relayJoinThread is running
 
-pthread_mutex_t sendMessagesListLock;
-pthread_cond_t messageReadyToSendCondition;
-pthread_cond_t messageSentCondition;
-
-pthread_mutex_t printMessagesListLock;
-pthread_cond_t messageReadyToPrintCondition;
-pthread_cond_t messagePrintedCondition;
+STATS_PENDING printStamps; // receive stamps of what the next flush shows; screen-writing thread only
 
 int StrEqual ( const char* str1 , const char* str2 ) {
 	if ( !str1 || !str2 ) {
@@ -64,17 +307,15 @@ int StrEqual ( const char* str1 , const char* str2 ) {
 }
 
 void FreeMessages ( void *message ) {
-	free ( ( char *) message );
+	MessageFree ( message );
 }
 
-void InitMutexConditionVars () {
-	pthread_mutex_init ( &sendMessagesListLock , NULL );
-	pthread_cond_init ( &messageReadyToSendCondition , NULL );
-	pthread_cond_init ( &messageSentCondition , NULL );
-
-	pthread_mutex_init ( &printMessagesListLock , NULL );
-	pthread_cond_init ( &messageReadyToPrintCondition , NULL );
-	pthread_cond_init ( &messagePrintedCondition , NULL );
+void EnqueueMessage ( RING_QUEUE *queue , char *message ) {
+	int enqueued = RingQueuePushWait ( queue , ( void *) message );
+	if ( enqueued == FAILURE_OP_CODE ) {
+		StatsAdd ( STATS_DROPS , 1 );
+		FreeMessages ( message );
+	}
 }
 
 void InitReceiveSocketFD () {
@@ -154,20 +395,57 @@ void InitSendSocketFD () {
 	freeaddrinfo ( servinfo );
 }
 
+/* A group sends from the bound receive socket rather than a connected one, so
+ * every datagram's source address is the sender's listening address: the one
+ * the other peers have in their tables. */
+void InitGroupSendSocketFD () {
+	sendSocketFD = dup ( receiveSocketFD );
+	if ( sendSocketFD < 0 ) {
+		perror ( "cannot create group socket" );
+		sendSocketFD = FAILED_SOCKET_FD;
+	}
+}
+
+/* sendmmsg on the send socket, or through the test shim when there is one */
+int SendPlainDatagrams ( struct mmsghdr *headers , int numHeaders ) {
+	if ( sendShim ) {
+		return ShimSend ( sendShim , headers , numHeaders );
+	}
+
+	return sendmmsg ( sendSocketFD , headers , numHeaders , 0 );
+}
+
 void CleanUp () {
-	pthread_cond_destroy ( &messageReadyToSendCondition );
-	pthread_cond_destroy ( &messageSentCondition );
-	pthread_cond_destroy ( &messageReadyToPrintCondition );
-	pthread_cond_destroy ( &messagePrintedCondition );
+	if ( relayJoining ) {
+		pthread_cancel ( relayJoinThread );
+		pthread_join ( relayJoinThread , NULL );
+	}
 
-	pthread_mutex_destroy ( &sendMessagesListLock );
-	pthread_mutex_destroy ( &printMessagesListLock );
+	RingQueueFree ( sendMessagesQueue , &FreeMessages );
+	RingQueueFree ( printMessagesQueue , &FreeMessages );
+
+	ShimFree ( sendShim ); // lets what it still holds go out first
+	if ( reliableMode ) {
+		ReliableFree ( &reliableSession );
+	}
+
+	ReassemblerFree ( &reassembler );
+	CompressDictionaryFree ( &compressDictionary );
+	if ( encryptMode ) {
+		SecureFree ( &secureSession );
+	}
 
-	ListFree ( sendMessagesList , &FreeMessages );
-	ListFree ( sendMessagesList , &FreeMessages );
+	// a file the session ended in the middle of is not left behind looking whole
+	if ( fileReceivingActive ) {
+		FileTransferAbandon ( &fileReceiving );
+	}
 
 	close ( sendSocketFD );
 	close ( receiveSocketFD );
+
+	if ( groupMode ) {
+		PeerTableFree ( &peerTable );
+	}
 }
 
 void WriteToScreen ( const char *str ) {
@@ -178,256 +456,3763 @@ void WriteToScreen ( const char *str ) {
 	write ( STDOUT_FILENO , str , strlen ( str ) );
 }
 
-void *RunScreenPrinting () {
-	if ( !printMessagesList ) {
-		return NULL;
+/* Every send path goes through the shim once one of the --shim options is given. */
+void StartSendShim () {
+	if ( shimLossPercent <= 0 && shimDelayMs <= 0 && shimRateMbps <= 0 ) {
+		return;
+	}
+
+	sendShim = ShimCreate ( sendSocketFD , shimLossPercent , shimDelayMs , shimRateMbps );
+	if ( !sendShim ) {
+		WriteToScreen ( "Shim wasn't created\n" );
+		exit ( -1 );
 	}
+}
 
-	WriteToScreen ( SESSION_STARTED_TEXT_COLOR );
-	WriteToScreen ( SESSION_STARTED_MESSAGE );
-	WriteToScreen ( DEFAULT_TERMINAL_TEXT_COLOR );
+long long MonotonicTimeMs () {
+	struct timespec now;
+	clock_gettime ( CLOCK_MONOTONIC , &now );
+	return ( long long ) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
 
-	for ( ;; ) {
-		pthread_mutex_lock ( &printMessagesListLock );
-		pthread_cond_wait( &messageReadyToPrintCondition , &printMessagesListLock );
+/* --encrypt: this end's public key, in the clear. Like the opening hello it
+ * goes out from the unconnected receive socket, and it skips the shim. */
+/* --encrypt: an empty sealed datagram. A peer that handshook with a new key
+ * only switches to it once something opens under it, so one follows every
+ * handshake sent with keys in place, and the first keys agreed. */
+void SendKeyConfirmation () {
+	char datagram [ FRAME_SEALED_OVERHEAD ];
+	int length = SecureSeal ( &secureSession , datagram , 0 );
 
-		char *printMessage = ( char *) ListTrim ( printMessagesList );
-		if ( !printMessage ) {
-			continue;
-		}
+	if ( length > 0 && sendto ( receiveSocketFD , datagram , length , 0 , ( struct sockaddr *) &handshakeAddr , handshakeAddrLength ) == length ) {
+		StatsAdd ( STATS_DATAGRAMS_SENT , 1 );
+		StatsAdd ( STATS_BYTES_SENT , length );
+	}
+}
+
+void SendHandshake ( int replyWanted ) {
+	char frame [ SECURE_MAX_HANDSHAKE_SIZE ];
+	int length = SecureEncodeHandshake ( &secureSession , frame , replyWanted );
+
+	if ( sendto ( receiveSocketFD , frame , length , 0 , ( struct sockaddr *) &handshakeAddr , handshakeAddrLength ) == length ) {
+		StatsAdd ( STATS_DATAGRAMS_SENT , 1 );
+		StatsAdd ( STATS_BYTES_SENT , length );
+	}
+
+	if ( SecureReady ( &secureSession ) ) {
+		SendKeyConfirmation ();
+	}
+}
+
+/* Asks for the peer's handshake again, at most every HANDSHAKE_RETRY_MS, from
+ * any thread that finds it has no keys or that the peer's datagrams do not
+ * open (it restarted with a new key pair, say). */
+void RetryHandshake () {
+	long long nowMs = MonotonicTimeMs ();
+	long long lastMs = atomic_load ( &lastHandshakeMs );
+	if ( nowMs - lastMs < HANDSHAKE_RETRY_MS || !atomic_compare_exchange_strong ( &lastHandshakeMs , &lastMs , nowMs ) ) {
+		return;
+	}
+
+	SendHandshake ( 1 );
+}
+
+/* Seals each datagram into a buffer of its own, its frames gathered from the
+ * iovecs behind the sealed frame's header, and sends them SEAL_BATCH_SIZE at a
+ * time. Returns what SendPlainDatagrams would; each header's msg_len is the
+ * sealed length that went on the wire. Before the handshake has given keys
+ * nothing can go: errno is ENOTCONN, as for a socket not connected yet. */
+int SendSealedDatagrams ( struct mmsghdr *headers , int numHeaders ) {
+	char sealedDatagrams [ SEAL_BATCH_SIZE_ALLOC ][ SEALED_DATAGRAM_SIZE_ALLOC ];
+	struct iovec sealedVectors [ SEAL_BATCH_SIZE_ALLOC ];
+	struct mmsghdr sealedHeaders [ SEAL_BATCH_SIZE_ALLOC ];
+
+	if ( !SecureReady ( &secureSession ) ) {
+		RetryHandshake ();
+		errno = ENOTCONN;
+		return -1;
+	}
+
+	int numSent = 0;
+	while ( numSent < numHeaders ) {
+		int numSealed = 0;
+		while ( numSealed < SEAL_BATCH_SIZE && numSent + numSealed < numHeaders ) {
+			struct msghdr *plain = &headers [ numSent + numSealed ].msg_hdr;
 
-		int userQuitSessionMessage = StrEqual ( printMessage , USER_LEFT_CHAT_MESSAGE );
-		int remoteLeftSessionMessage = StrEqual ( printMessage , REMOTE_LEFT_CHAT_RESPONSE );
+			size_t plainLength = 0;
+			for ( size_t v = 0 ; v < plain -> msg_iovlen ; v++ ) {
+				plainLength += plain -> msg_iov [ v ].iov_len;
+			}
+			if ( plainLength > SEALED_DATAGRAM_SIZE_ALLOC - FRAME_SEALED_OVERHEAD ) {
+				break; // the coalescing limit keeps datagrams below this; sendmmsg would refuse one past MESSAGE_MAX_SIZE alike
+			}
+
+			char *datagram = sealedDatagrams [ numSealed ];
+			char *text = datagram + SECURE_PLAIN_OFFSET;
+			for ( size_t v = 0 ; v < plain -> msg_iovlen ; v++ ) {
+				memcpy ( text , plain -> msg_iov [ v ].iov_base , plain -> msg_iov [ v ].iov_len );
+				text += plain -> msg_iov [ v ].iov_len;
+			}
 
-		if ( !userQuitSessionMessage ) {
-			WriteToScreen ( REMOTE_LABEL_TEXT_COLOR );
-			WriteToScreen ( REMOTE_TERMINAL_LABEL );
-			WriteToScreen ( REMOTE_MESSAGE_TEXT_COLOR );
-			WriteToScreen ( printMessage );
-			WriteToScreen ( DEFAULT_TERMINAL_TEXT_COLOR );
+			sealedVectors [ numSealed ].iov_base = datagram;
+			sealedVectors [ numSealed ].iov_len = SecureSeal ( &secureSession , datagram , plainLength );
+			sealedHeaders [ numSealed ] = headers [ numSent + numSealed ]; // msg_name stays
+			sealedHeaders [ numSealed ].msg_hdr.msg_iov = &sealedVectors [ numSealed ];
+			sealedHeaders [ numSealed ].msg_hdr.msg_iovlen = 1;
+			numSealed += 1;
 		}
 
-		FreeMessages ( printMessage );
+		if ( numSealed == 0 ) {
+			errno = EMSGSIZE;
+			return numSent > 0 ? numSent : -1;
+		}
+		StatsAdd ( STATS_DATAGRAMS_SEALED , numSealed );
+
+		int sent = SendPlainDatagrams ( sealedHeaders , numSealed );
+		if ( sent < 0 ) {
+			return numSent > 0 ? numSent : -1;
+		}
 
-		pthread_cond_signal ( &messagePrintedCondition ); 
-		pthread_mutex_unlock ( &printMessagesListLock );
+		for ( int i = 0 ; i < sent ; i++ ) {
+			headers [ numSent + i ].msg_len = sealedHeaders [ i ].msg_len;
+		}
+		numSent += sent;
 
-		if ( userQuitSessionMessage || remoteLeftSessionMessage ) {
+		if ( sent < numSealed ) {
 			break;
 		}
 	}
 
-	WriteToScreen ( SESSION_ENDED_TEXT_COLOR );
-	WriteToScreen ( SESSION_ENDED_MESSAGE );
-	WriteToScreen ( DEFAULT_TERMINAL_TEXT_COLOR );
+	return numSent;
+}
 
-	return NULL;
+/* Every send path's way out: sealed with --encrypt, as they are otherwise. */
+int SendDatagrams ( struct mmsghdr *headers , int numHeaders ) {
+	if ( encryptMode ) {
+		return SendSealedDatagrams ( headers , numHeaders );
+	}
+
+	return SendPlainDatagrams ( headers , numHeaders );
 }
 
-void *RunReceiving () {
-	if ( receiveSocketFD == FAILED_SOCKET_FD ) {
-		return NULL;
+int ScreenBufferReserve ( SCREEN_BUFFER *screen , int length ) {
+	if ( screen -> length + length <= screen -> capacity ) {
+		return SUCCESS_OP_CODE;
 	}
 
-	if ( receiveSocketFD == FAILED_SOCKET_FD ) {
-		return NULL;
+	int newCapacity = screen -> capacity > 0 ? screen -> capacity : INITIAL_SCREEN_BUFFER_CAPACITY;
+	while ( newCapacity < screen -> length + length ) {
+		newCapacity *= 2;
 	}
 
-	if ( !printMessagesList ) {
-		return NULL;
+	char *newData = ( char *) realloc ( screen -> data , newCapacity );
+	if ( !newData ) {
+		return FAILURE_OP_CODE;
 	}
 
-	struct sockaddr_in remaddr; // remote address
-	socklen_t addrlen = sizeof ( remaddr ); // length of address
-	int recvlen; // # bytes received
-	unsigned char receiveBuffer [ MESSAGE_MAX_SIZE]; // receive buffer
+	screen -> data = newData;
+	screen -> capacity = newCapacity;
+	return SUCCESS_OP_CODE;
+}
+
+int ScreenBufferAppend ( SCREEN_BUFFER *screen , const char *str , int length ) {
+	if ( ScreenBufferReserve ( screen , length ) == FAILURE_OP_CODE ) {
+		return FAILURE_OP_CODE;
+	}
 
-	for ( ;; ) {
-		recvlen = recvfrom (
-			receiveSocketFD , 
-			receiveBuffer ,
-			MESSAGE_MAX_SIZE , 
-			0 , 
-			( struct sockaddr *) &remaddr , 
-			&addrlen 
-		);
+	memcpy ( screen -> data + screen -> length , str , length );
+	screen -> length += length;
+	return SUCCESS_OP_CODE;
+}
 
-		if ( recvlen > 0 ) {
-			receiveBuffer [ recvlen ] = 0; // remove whitespace chars
+void FreeScreenBuffer ( SCREEN_BUFFER *screen ) {
+	free ( screen -> data );
+	screen -> data = NULL;
+	screen -> length = 0;
+	screen -> capacity = 0;
+}
 
-			char *receivedMessage = ( char *) malloc ( sizeof ( char ) * MESSAGE_MAX_SIZE );
-			strncpy ( receivedMessage , ( char *) receiveBuffer , MESSAGE_MAX_SIZE );
+/* Writes as much of the buffer as stdout takes. On a blocking stdout that is all
+ * of it; on a non-blocking one the rest stays buffered for the next call. */
+int FlushScreenBuffer ( SCREEN_BUFFER *screen ) {
+	int numWritten = 0;
 
-			pthread_mutex_lock ( &printMessagesListLock );
-			ListPrepend ( printMessagesList , ( void *) receivedMessage );
+	while ( numWritten < screen -> length ) {
+		int w = write ( STDOUT_FILENO , screen -> data + numWritten , screen -> length - numWritten );
+		if ( w < 0 ) {
+			if ( errno == EINTR ) {
+				continue;
+			}
 
-			pthread_cond_signal ( &messageReadyToPrintCondition );
+			if ( errno != EAGAIN && errno != EWOULDBLOCK ) {
+				screen -> length = 0; // stdout is gone; drop the output
+				return FAILURE_OP_CODE;
+			}
 
-			pthread_cond_wait( &messagePrintedCondition, &printMessagesListLock ); 
-			pthread_mutex_unlock ( &printMessagesListLock );
+			break;
 		}
+
+		numWritten += w;
 	}
 
-	return NULL;
+	memmove ( screen -> data , screen -> data + numWritten , screen -> length - numWritten );
+	screen -> length -= numWritten;
+	return SUCCESS_OP_CODE;
 }
 
-int SendMessage ( const char *message ) {
-	if ( sendSocketFD == FAILED_SOCKET_FD ) {
-		perror ( "Send Socket is not initialized: message failed to send" );
-		return FAILED_SENDING_MESSAGE;
+void RenderSessionStarted ( SCREEN_BUFFER *screen ) {
+	ScreenBufferAppend ( screen , SESSION_STARTED_TEXT_COLOR , sizeof ( SESSION_STARTED_TEXT_COLOR ) - 1 );
+	ScreenBufferAppend ( screen , SESSION_STARTED_MESSAGE , sizeof ( SESSION_STARTED_MESSAGE ) - 1 );
+	ScreenBufferAppend ( screen , DEFAULT_TERMINAL_TEXT_COLOR , sizeof ( DEFAULT_TERMINAL_TEXT_COLOR ) - 1 );
+}
+
+void RenderSessionEnded ( SCREEN_BUFFER *screen ) {
+	ScreenBufferAppend ( screen , SESSION_ENDED_TEXT_COLOR , sizeof ( SESSION_ENDED_TEXT_COLOR ) - 1 );
+	ScreenBufferAppend ( screen , SESSION_ENDED_MESSAGE , sizeof ( SESSION_ENDED_MESSAGE ) - 1 );
+	ScreenBufferAppend ( screen , DEFAULT_TERMINAL_TEXT_COLOR , sizeof ( DEFAULT_TERMINAL_TEXT_COLOR ) - 1 );
+}
+
+/* a line of the session's own (a file transfer, the encryption): not something the remote wrote */
+void RenderNotice ( SCREEN_BUFFER *screen , const char *text , int length ) {
+	ScreenBufferAppend ( screen , NOTICE_TEXT_COLOR , sizeof ( NOTICE_TEXT_COLOR ) - 1 );
+	ScreenBufferAppend ( screen , "\n" , 1 );
+	ScreenBufferAppend ( screen , text , length );
+	ScreenBufferAppend ( screen , DEFAULT_TERMINAL_TEXT_COLOR , sizeof ( DEFAULT_TERMINAL_TEXT_COLOR ) - 1 );
+}
+
+/* The same line straight to stdout, for threads that have no screen buffer. */
+void WriteNotice ( const char *text ) {
+	char notice [ NOTICE_CAPACITY ];
+	snprintf ( notice , NOTICE_CAPACITY , "%s\n%s%s" , NOTICE_TEXT_COLOR , text , DEFAULT_TERMINAL_TEXT_COLOR );
+	WriteToScreen ( notice );
+}
+
+/* text from the remote, from one peer of a group or from whoever a relay
+ * forwarded it for, under that sender's own label */
+void RenderRemoteText ( RENDER_CONTEXT *render , const char *text , int length ) {
+	SCREEN_BUFFER *screen = render -> screen;
+	const char *label = REMOTE_TERMINAL_LABEL;
+	int labelLength = sizeof ( REMOTE_TERMINAL_LABEL ) - 1;
+	if ( render -> originLabelLength > 0 ) {
+		label = render -> originLabel;
+		labelLength = render -> originLabelLength;
+	}
+	else if ( groupMode ) {
+		label = peerTable.peers [ render -> source ].label;
+		labelLength = peerTable.peers [ render -> source ].labelLength;
 	}
 
-	int numSentBytes = sendto ( 
-		sendSocketFD , 
-		message , 
-		strlen ( message ) , 
-		0 , 
-		0 , // p -> ai_addr , 
-		0 // p -> ai_addrlen
-	);
-	if ( numSentBytes == -1 ) {
-		perror ( "message failed to send" );
-		return FAILED_SENDING_MESSAGE;
+	// one reservation and straight copies; the escape sequences' lengths are compile-time
+	int prefixLength = sizeof ( REMOTE_LABEL_TEXT_COLOR ) - 1 + labelLength + sizeof ( REMOTE_MESSAGE_TEXT_COLOR ) - 1;
+	int suffixLength = sizeof ( DEFAULT_TERMINAL_TEXT_COLOR ) - 1;
+
+	if ( ScreenBufferReserve ( screen , prefixLength + length + suffixLength ) == SUCCESS_OP_CODE ) {
+		ScreenBufferAppend ( screen , REMOTE_LABEL_TEXT_COLOR , sizeof ( REMOTE_LABEL_TEXT_COLOR ) - 1 );
+		ScreenBufferAppend ( screen , label , labelLength );
+		ScreenBufferAppend ( screen , REMOTE_MESSAGE_TEXT_COLOR , sizeof ( REMOTE_MESSAGE_TEXT_COLOR ) - 1 );
+		ScreenBufferAppend ( screen , text , length );
+		ScreenBufferAppend ( screen , DEFAULT_TERMINAL_TEXT_COLOR , suffixLength );
 	}
+}
 
-	return SUCCESS_SENDING_MESSAGE;
+/* Points *header and *payload at a compressed frame's restored header and
+ * payload, kept in plainHeader and plain (COMPRESS_MAX_PAYLOAD_SIZE bytes).
+ * Returns 0 if it cannot be restored: the frame is dropped. */
+int ExpandFrame ( const FRAME_HEADER **header , const char **payload , FRAME_HEADER *plainHeader , char *plain ) {
+	if ( !( ( *header ) -> flags & FRAME_FLAG_COMPRESSED ) ) {
+		return 1;
+	}
+
+	if ( DecompressFrame ( &compressDictionary , *header , *payload , plainHeader , plain ) == FAILURE_OP_CODE ) {
+		StatsAdd ( STATS_DROPS , 1 );
+		return 0;
+	}
+
+	*header = plainHeader;
+	*payload = plain;
+	return 1;
 }
 
-void *RunSending () {
-	if ( !sendMessagesList ) {
-		return NULL;
+int RenderDataFrame ( const FRAME_HEADER *header , const char *payload , void *context ) {
+	RENDER_CONTEXT *render = ( RENDER_CONTEXT *) context;
+	FRAME_HEADER plainHeader;
+	char plain [ COMPRESS_MAX_PAYLOAD_SIZE ];
+	if ( !ExpandFrame ( &header , &payload , &plainHeader , plain ) ) {
+		return 0;
 	}
 
-	for ( ;; ) {
-		pthread_mutex_lock ( &sendMessagesListLock );
+	StatsAdd ( STATS_MESSAGES_RECEIVED , 1 );
 
-		pthread_cond_wait( &messageReadyToSendCondition, &sendMessagesListLock );
+	if ( groupMode ) {
+		PeerSetPresent ( &peerTable , render -> source , 1 ); // back after leaving
+	}
 
-		char *sendMessage = ( char *) ListTrim ( sendMessagesList );
-		if ( sendMessage ) {
-			int quitSessionMessage = StrEqual ( sendMessage , USER_LEFT_CHAT_MESSAGE );
-			if ( quitSessionMessage ) {
-				strncpy ( sendMessage , REMOTE_LEFT_CHAT_RESPONSE , MESSAGE_MAX_SIZE );
-			}
-		}
+	RenderRemoteText ( render , payload , header -> payloadLength );
+	return 0;
+}
 
-		SendMessage ( sendMessage );
-		FreeMessages ( sendMessage );
-			
-		pthread_cond_signal ( &messageSentCondition ); 
-		pthread_mutex_unlock ( &sendMessagesListLock );
+/* In a group one peer leaving ends the session only if it was the last one; a
+ * relayed leave is another member of the room going, never the relay itself. */
+int RenderLeaveFrame ( const FRAME_HEADER *header , const char *payload , void *context ) {
+	RENDER_CONTEXT *render = ( RENDER_CONTEXT *) context;
+	RenderRemoteText ( render , REMOTE_LEFT_CHAT_RESPONSE , sizeof ( REMOTE_LEFT_CHAT_RESPONSE ) - 1 );
+
+	if ( render -> originLabelLength > 0 ) {
+		return 0;
 	}
 
-	return NULL;
+	if ( groupMode ) {
+		return PeerSetPresent ( &peerTable , render -> source , 0 ) == 0;
+	}
+
+	return 1;
 }
 
-void *RunUserInput () {
-	char inputBuffer [ MESSAGE_MAX_SIZE ];
-	int inputLength = 0;
+/* labels the frames after it with the client a relay forwarded them for */
+int RenderOriginFrame ( const FRAME_HEADER *header , const char *payload , void *context ) {
+	RENDER_CONTEXT *render = ( RENDER_CONTEXT *) context;
+	if ( header -> payloadLength < FRAME_ORIGIN_PAYLOAD_SIZE ) {
+		return 0;
+	}
 
-	while ( ( inputLength = read ( STDIN_FILENO , inputBuffer , MESSAGE_MAX_SIZE ) ) > 0 )
-	{
-		char lastChar = inputBuffer [ inputLength - 1 ];
-		if ( lastChar == 10 ) {
-			inputBuffer [ inputLength - 1 ] = 0; // remove newline char
-		}
+	struct in_addr originAddr;
+	unsigned short originPort;
+	memcpy ( &originAddr.s_addr , payload , 4 );
+	memcpy ( &originPort , payload + 4 , 2 );
 
-		char *sendMessage = ( char *) malloc ( sizeof ( char ) * MESSAGE_MAX_SIZE );
-		strncpy ( sendMessage , inputBuffer , MESSAGE_MAX_SIZE );
-	
-		pthread_mutex_lock ( &sendMessagesListLock );
+	char host [ INET_ADDRSTRLEN ];
+	inet_ntop ( AF_INET , &originAddr , host , sizeof ( host ) );
+
+	int length = snprintf ( render -> originLabel , PEER_LABEL_SIZE , "\n%s:%u: " , host , ntohs ( originPort ) );
+	render -> originLabelLength = length < PEER_LABEL_SIZE ? length : PEER_LABEL_SIZE - 1;
+	render -> origin = ( unsigned long long ) originAddr.s_addr << 16 | originPort;
+	return 0;
+}
 
-		ListPrepend ( sendMessagesList , ( void * ) sendMessage );
+/* Fragments are put back together per sender: the group peer, and behind a
+ * relay the client it forwarded them for. A message is rendered once whole. */
+int RenderFragmentFrame ( const FRAME_HEADER *header , const char *payload , void *context ) {
+	RENDER_CONTEXT *render = ( RENDER_CONTEXT *) context;
+	unsigned long long sender = ( unsigned long long ) render -> source << 48 ^ render -> origin;
 
-		pthread_cond_signal ( &messageReadyToSendCondition );
-		
-		pthread_cond_wait( &messageSentCondition, &sendMessagesListLock ); 
-		pthread_mutex_unlock ( &sendMessagesListLock );
+	FRAME_HEADER plainHeader;
+	char plain [ COMPRESS_MAX_PAYLOAD_SIZE ];
+	if ( !ExpandFrame ( &header , &payload , &plainHeader , plain ) ) {
+		return 0;
+	}
 
-		int quitSessionInput = StrEqual ( inputBuffer , USER_LEFT_CHAT_MESSAGE );
-		if ( quitSessionInput ) {
-			char *endSessionMessage = ( char *) malloc ( sizeof ( char ) * MESSAGE_MAX_SIZE );
-			strncpy ( endSessionMessage , ( char *) &USER_LEFT_CHAT_MESSAGE , MESSAGE_MAX_SIZE );
+	int messageLength;
+	char *message = ReassemblerAdd ( &reassembler , sender , header , payload , &messageLength );
+	if ( !message ) {
+		return 0;
+	}
 
-			pthread_mutex_lock ( &printMessagesListLock );
-			ListPrepend ( printMessagesList , ( void *) endSessionMessage );
+	StatsAdd ( STATS_MESSAGES_RECEIVED , 1 );
+	if ( groupMode ) {
+		PeerSetPresent ( &peerTable , render -> source , 1 );
+	}
 
-			pthread_cond_signal ( &messageReadyToPrintCondition );
+	RenderRemoteText ( render , message , messageLength );
+	free ( message );
+	return 0;
+}
 
-			pthread_cond_wait( &messagePrintedCondition, &printMessagesListLock ); 
-			pthread_mutex_unlock ( &printMessagesListLock );
-		}
+/* Answers a file offer, or reports one complete, through the reliable session.
+ * The printer never waits for buffer space: the acks that would free it are
+ * read by the receiving thread, which may itself be waiting on the printer. A
+ * frame that does not fit is dropped. */
+void SendFileControlFrame ( int type , unsigned int id , int accepted ) {
+	if ( !reliableMode ) {
+		return;
 	}
 
-	return NULL;
+	char *frame = MessageAlloc ( FILE_CONTROL_FRAME_SIZE );
+	if ( !frame ) {
+		return;
+	}
+
+	MessageSetLength ( frame , FileTransferEncodeControl ( frame , type , id , accepted ) );
+	if ( ReliableTrySend ( &reliableSession , frame ) == FAILURE_OP_CODE ) {
+		StatsAdd ( STATS_DROPS , 1 );
+		MessageFree ( frame );
+	}
 }
 
-int main ( int argc , char *argv [] ) 
-{
-	if ( argc < 5 ) {
-		WriteToScreen ( "Incorrect amount of inputs. Please include the following arguments:\n");
-		WriteToScreen ( "terminal-chat [your port number] [remote machine name] [remote port number]\n");
-		exit ( -1 );
+void RenderFileProgress ( SCREEN_BUFFER *screen , FILE_TRANSFER *transfer , const char *verb , int done ) {
+	char text [ NOTICE_CAPACITY ];
+	int length = done
+		? FileTransferFormatDone ( transfer , verb , text , NOTICE_CAPACITY )
+		: FileTransferFormatProgress ( transfer , verb , text , NOTICE_CAPACITY );
+	RenderNotice ( screen , text , length );
+}
+
+void FinishFileReceiving ( SCREEN_BUFFER *screen ) {
+	FileTransferClose ( &fileReceiving );
+
+	SendFileControlFrame ( FRAME_TYPE_FILE_COMPLETE , fileReceiving.id , 1 );
+	RenderFileProgress ( screen , &fileReceiving , "Received" , 1 );
+	atomic_store ( &fileReceivingActive , 0 ); // the next offer may be accepted from here on
+}
+
+/* One incoming file at a time, and only in reliable mode: chunks are written
+ * as they come and nothing but the reliable session makes sure they all do.
+ * An offer waits for the user to answer it; one that could not be taken, or
+ * whose name could land somewhere unexpected, is refused at once. */
+int RenderFileOfferFrame ( const FRAME_HEADER *header , const char *payload , void *context ) {
+	RENDER_CONTEXT *render = ( RENDER_CONTEXT *) context;
+
+	unsigned int id;
+	unsigned long long size;
+	char name [ FILE_MAX_NAME_SIZE + 1 ];
+	if ( FileTransferDecodeOffer ( header , payload , &id , &size , name ) == FAILURE_OP_CODE ) {
+		return 0;
 	}
 
-	int correctFirstParameter = StrEqual ( PROGRAM_NAME_FIRST_ARG , argv [ 1 ] );
-	if ( !correctFirstParameter ) {
-		WriteToScreen ( "Incorrect first argument. The first input must be \"terminal-chat\"\n" );
-		exit ( -1 );
+	char text [ NOTICE_CAPACITY ];
+	int length;
+	if ( !FileTransferNameAllowed ( name ) ) {
+		SendFileControlFrame ( FRAME_TYPE_FILE_ANSWER , id , 0 );
+		RenderNotice ( render -> screen , FILE_NAME_REFUSED_MESSAGE , sizeof ( FILE_NAME_REFUSED_MESSAGE ) - 1 );
+		return 0;
 	}
 
-	receivePort = argv [ 2 ];
-	sendHostName = argv [ 3 ];
-	sendPort = argv [ 4 ];
+	pthread_mutex_lock ( &fileOffer.lock );
+	int busy = fileOffer.pending || atomic_load ( &fileReceivingActive );
+	int offered = reliableMode && !busy;
+	if ( offered ) {
+		fileOffer.pending = 1;
+		fileOffer.id = id;
+		fileOffer.size = size;
+		memcpy ( fileOffer.name , name , sizeof ( name ) );
+		fileOffer.deadlineMs = MonotonicTimeMs () + FILE_OFFER_TIMEOUT_MS;
+	}
+	pthread_mutex_unlock ( &fileOffer.lock );
 
-	InitReceiveSocketFD ();
-	if ( receiveSocketFD == FAILED_SOCKET_FD ) {
-		WriteToScreen ( "ERROR: Receive Socket failed to be created" );
-		exit ( -1 );
+	if ( !offered ) {
+		SendFileControlFrame ( FRAME_TYPE_FILE_ANSWER , id , 0 );
+		length = snprintf (
+			text , NOTICE_CAPACITY , "Refused the file %s%s" ,
+			name , reliableMode ? ": another one is already coming" : ": it needs --reliable"
+		);
+		RenderNotice ( render -> screen , text , length < NOTICE_CAPACITY ? length : NOTICE_CAPACITY - 1 );
+		return 0;
 	}
-	
-	InitSendSocketFD ();
-	if ( sendSocketFD == FAILED_SOCKET_FD ) {
-		WriteToScreen ( "ERROR: Send Socket failed to be created" );
-		exit ( -1 );
+
+	length = snprintf (
+		text , NOTICE_CAPACITY , "The peer offers %s (%.1f MB): %s or %s within %d s" ,
+		name , size / 1e6 , FILE_ACCEPT_COMMAND , FILE_REJECT_COMMAND , FILE_OFFER_TIMEOUT_MS / 1000
+	);
+	RenderNotice ( render -> screen , text , length < NOTICE_CAPACITY ? length : NOTICE_CAPACITY - 1 );
+	return 0;
+}
+
+/* How long the printing thread may wait before an offer runs out of time. */
+int FileOfferWaitMs () {
+	int waitMs = RING_QUEUE_WAIT_FOREVER;
+
+	pthread_mutex_lock ( &fileOffer.lock );
+	if ( fileOffer.pending ) {
+		long long remainingMs = fileOffer.deadlineMs - MonotonicTimeMs ();
+		waitMs = remainingMs > 0 ? ( int ) remainingMs : 0;
 	}
+	pthread_mutex_unlock ( &fileOffer.lock );
 
-	sendMessagesList = ListCreate ();
-	if ( !sendMessagesList ) {
-		WriteToScreen ( "Send Messages List wasn't created" );
-		exit ( -1 );
+	return waitMs;
+}
+
+/* Refuses the offer no one answered in time. */
+void ExpireFileOffer ( SCREEN_BUFFER *screen ) {
+	char text [ NOTICE_CAPACITY ];
+	int length = 0;
+	unsigned int id = 0;
+
+	pthread_mutex_lock ( &fileOffer.lock );
+	int expired = fileOffer.pending && MonotonicTimeMs () >= fileOffer.deadlineMs;
+	if ( expired ) {
+		fileOffer.pending = 0;
+		id = fileOffer.id;
+		length = snprintf ( text , NOTICE_CAPACITY , "Refused the file %s: no answer" , fileOffer.name );
 	}
+	pthread_mutex_unlock ( &fileOffer.lock );
 
-	printMessagesList = ListCreate ();
-	if ( !printMessagesList ) {
-		WriteToScreen ( "Print Messages List wasn't created" );
-		exit ( -1 );
+	if ( !expired ) {
+		return;
 	}
 
-	InitMutexConditionVars ();
-	
-	pthread_attr_t threadAttribute;
-	pthread_attr_init ( &threadAttribute );
-    pthread_attr_setdetachstate ( &threadAttribute , PTHREAD_CREATE_JOINABLE );
+	SendFileControlFrame ( FRAME_TYPE_FILE_ANSWER , id , 0 );
+	RenderNotice ( screen , text , length < NOTICE_CAPACITY ? length : NOTICE_CAPACITY - 1 );
+}
 
-	pthread_create ( &printingThread , &threadAttribute , RunScreenPrinting , NULL );
+/* Each chunk is copied into place whatever order it comes in. */
+int RenderFileChunkFrame ( const FRAME_HEADER *header , const char *payload , void *context ) {
+	RENDER_CONTEXT *render = ( RENDER_CONTEXT *) context;
+	if ( !atomic_load_explicit ( &fileReceivingActive , memory_order_acquire ) || FileTransferWriteChunk ( &fileReceiving , header , payload ) == FAILURE_OP_CODE ) {
+		return 0;
+	}
 
-	sleep ( 0.5f ); // allow time for the printing thread to print session start message before user input
+	if ( fileReceiving.numBytesDone == fileReceiving.size ) {
+		FinishFileReceiving ( render -> screen );
+		return 0;
+	}
 
-	pthread_create ( &sendThread , &threadAttribute , RunSending , NULL );     
-	pthread_create ( &recvThread , &threadAttribute , RunReceiving , NULL );
-	pthread_create ( &inputThread , &threadAttribute , RunUserInput , NULL );
+	unsigned long long nowNs = StatsNow ();
+	if ( nowNs - fileReceiving.lastProgressNs >= ( unsigned long long ) FILE_PROGRESS_INTERVAL_MS * 1000000ULL ) {
+		fileReceiving.lastProgressNs = nowNs;
+		RenderFileProgress ( render -> screen , &fileReceiving , "Receiving" , 0 );
+	}
 
-	pthread_join ( printingThread , NULL );
+	return 0;
+}
 
-	pthread_cancel ( recvThread );
-	pthread_cancel ( sendThread );
-	pthread_cancel ( inputThread );
+/* Wakes the file sending thread waiting on this answer. */
+int RenderFileAnswerFrame ( const FRAME_HEADER *header , const char *payload , void *context ) {
+	unsigned int id;
+	int accepted;
+	if ( FileTransferDecodeControl ( header , payload , &id , &accepted ) == FAILURE_OP_CODE ) {
+		return 0;
+	}
 
-	pthread_join ( sendThread , NULL );
-	pthread_join ( recvThread , NULL );
-	pthread_join ( inputThread , NULL );
-	
+	pthread_mutex_lock ( &fileSending.lock );
+	if ( fileSending.running && id == fileSending.transfer.id && fileSending.answer == FILE_ANSWER_PENDING ) {
+		fileSending.answer = accepted;
+		pthread_cond_broadcast ( &fileSending.answered );
+	}
+	pthread_mutex_unlock ( &fileSending.lock );
+
+	return 0;
+}
+
+/* The receiver has the whole file: the transfer's throughput end to end. */
+int RenderFileCompleteFrame ( const FRAME_HEADER *header , const char *payload , void *context ) {
+	RENDER_CONTEXT *render = ( RENDER_CONTEXT *) context;
+
+	unsigned int id;
+	int accepted;
+	if ( FileTransferDecodeControl ( header , payload , &id , &accepted ) == FAILURE_OP_CODE ) {
+		return 0;
+	}
+
+	pthread_mutex_lock ( &fileSending.lock );
+	if ( id != 0 && id == fileSending.transfer.id ) {
+		RenderFileProgress ( render -> screen , &fileSending.transfer , "Delivered" , 1 );
+	}
+	pthread_mutex_unlock ( &fileSending.lock );
+
+	return 0;
+}
+
+/* Tells the peer which dictionary this end has loaded, through the reliable
+ * session in reliable mode (never waiting for room, as for file control
+ * frames). Otherwise it is one datagram of its own, with nothing resent. */
+void SendHello ( int replyWanted ) {
+	char *frame = MessageAlloc ( COMPRESS_HELLO_FRAME_SIZE );
+	if ( !frame ) {
+		return;
+	}
+
+	int length = CompressEncodeHello ( frame , &compressDictionary , replyWanted );
+	MessageSetLength ( frame , length );
+
+	if ( reliableMode ) {
+		if ( ReliableTrySend ( &reliableSession , frame ) == FAILURE_OP_CODE ) {
+			StatsAdd ( STATS_DROPS , 1 );
+			MessageFree ( frame );
+		}
+		return;
+	}
+
+	struct iovec vector = { .iov_base = frame , .iov_len = length };
+	struct mmsghdr header;
+	memset ( &header , 0 , sizeof ( header ) );
+	header.msg_hdr.msg_iov = &vector;
+	header.msg_hdr.msg_iovlen = 1;
+
+	if ( SendDatagrams ( &header , 1 ) == 1 ) {
+		StatsAdd ( STATS_DATAGRAMS_SENT , 1 );
+		StatsAdd ( STATS_BYTES_SENT , length );
+	}
+	MessageFree ( frame );
+}
+
+/* The peer's hello says how it can take compressed frames; it is answered with
+ * ours if it asks. Groups and relays do not negotiate. */
+int RenderHelloFrame ( const FRAME_HEADER *header , const char *payload , void *context ) {
+	unsigned int dictionaryId;
+	int replyWanted;
+	if ( groupMode || CompressDecodeHello ( header , payload , &dictionaryId , &replyWanted ) == FAILURE_OP_CODE ) {
+		return 0;
+	}
+
+	int sameDictionary = compressDictionary.data && dictionaryId == compressDictionary.id;
+	atomic_store ( &peerCompression , sameDictionary ? PEER_COMPRESSION_DICTIONARY : PEER_COMPRESSION_PLAIN );
+
+	if ( replyWanted ) {
+		SendHello ( 0 );
+	}
+	return 0;
+}
+
+/* A notice into screen, or straight to stdout for a thread without one. */
+void ShowNotice ( SCREEN_BUFFER *screen , const char *text ) {
+	if ( screen ) {
+		RenderNotice ( screen , text , strlen ( text ) );
+	}
+	else {
+		WriteNotice ( text );
+	}
+}
+
+/* A notice the user has to act on (the peer's key changed), in the warning color. */
+void ShowWarning ( SCREEN_BUFFER *screen , const char *text ) {
+	char warning [ NOTICE_CAPACITY ];
+	int length = snprintf ( warning , NOTICE_CAPACITY , "%s\n%s%s" , WARNING_TEXT_COLOR , text , DEFAULT_TERMINAL_TEXT_COLOR );
+	if ( screen ) {
+		ScreenBufferAppend ( screen , warning , length < NOTICE_CAPACITY ? length : NOTICE_CAPACITY - 1 );
+	}
+	else {
+		WriteToScreen ( warning );
+	}
+}
+
+/* Without --encrypt, a handshake or sealed frame means the peer has it and
+ * nothing it sends can be read; with --encrypt these never reach a handler. */
+int RenderEncryptedFrame ( const FRAME_HEADER *header , const char *payload , void *context ) {
+	RENDER_CONTEXT *render = ( RENDER_CONTEXT *) context;
+	if ( !encryptedNoticeShown ) {
+		ShowNotice ( render -> screen , ENCRYPTED_PEER_MESSAGE );
+		encryptedNoticeShown = 1;
+	}
+	return 0;
+}
+
+/* what each received frame type does to the screen; a nonzero return ends the session */
+const FRAME_HANDLER SCREEN_FRAME_HANDLERS [ FRAME_NUM_TYPES ] = {
+	[ FRAME_TYPE_DATA ] = RenderDataFrame ,
+	[ FRAME_TYPE_LEAVE ] = RenderLeaveFrame ,
+	[ FRAME_TYPE_ORIGIN ] = RenderOriginFrame ,
+	[ FRAME_TYPE_FRAGMENT ] = RenderFragmentFrame ,
+	[ FRAME_TYPE_FILE_OFFER ] = RenderFileOfferFrame ,
+	[ FRAME_TYPE_FILE_ANSWER ] = RenderFileAnswerFrame ,
+	[ FRAME_TYPE_FILE_CHUNK ] = RenderFileChunkFrame ,
+	[ FRAME_TYPE_FILE_COMPLETE ] = RenderFileCompleteFrame ,
+	[ FRAME_TYPE_HELLO ] = RenderHelloFrame ,
+	[ FRAME_TYPE_HANDSHAKE ] = RenderEncryptedFrame ,
+	[ FRAME_TYPE_SEALED ] = RenderEncryptedFrame
+};
+
+/* --compress: the peer is up, since it was just heard from, so an opening
+ * hello that it never answered (it may have started after us) is sent again. */
+void RetryHello () {
+	long long nowMs = MonotonicTimeMs ();
+	if ( compressMode && !groupMode && atomic_load ( &peerCompression ) == PEER_COMPRESSION_UNKNOWN && nowMs - lastHelloMs >= HELLO_RETRY_MS ) {
+		lastHelloMs = nowMs;
+		SendHello ( 1 );
+	}
+}
+
+/* Once the keys change the fingerprint is shown: the first time as a notice,
+ * after that as a warning, since it may be someone else answering in the
+ * peer's place. With --compress our hello goes out again (the first could
+ * not be read before). */
+void ShowKeysChanged ( SCREEN_BUFFER *screen ) {
+	char text [ NOTICE_CAPACITY ];
+	if ( keysNoticeShown ) {
+		snprintf (
+			text , NOTICE_CAPACITY , "The peer's key changed, key fingerprint now %s%s" ,
+			SecureFingerprint ( &secureSession ) ,
+			hasPresharedKey ? " (it restarted)" : ": it restarted, or someone else is answering; check it matches the peer's"
+		);
+		ShowWarning ( screen , text );
+	}
+	else {
+		snprintf (
+			text , NOTICE_CAPACITY , "Encrypted (%s, %s), key fingerprint %s%s" ,
+			hasPresharedKey ? "pre-shared key" : "X25519" ,
+			CryptoKernelName ( CryptoKernel () ) ,
+			SecureFingerprint ( &secureSession ) ,
+			hasPresharedKey ? "" : ": check it matches the peer's"
+		);
+		ShowNotice ( screen , text );
+		keysNoticeShown = 1;
+	}
+
+	if ( compressMode && atomic_load ( &peerCompression ) == PEER_COMPRESSION_UNKNOWN ) {
+		lastHelloMs = MonotonicTimeMs ();
+		SendHello ( 1 );
+	}
+}
+
+/* Whether source is the peer's receiving address, where handshakes come from. */
+int FromHandshakeAddress ( const struct sockaddr_in *source ) {
+	const struct sockaddr_in *peer = ( const struct sockaddr_in *) &handshakeAddr;
+	return source && peer -> sin_family == AF_INET && source -> sin_port == peer -> sin_port && source -> sin_addr.s_addr == peer -> sin_addr.s_addr;
+}
+
+/* The peer's handshake: answered if it asks. The first keys are used at once,
+ * and confirmed to the peer in case it is the end that changed its key. */
+void TakeHandshake ( SCREEN_BUFFER *screen , const FRAME_HEADER *header , const char *payload ) {
+	int replyWanted;
+	int keysChanged;
+	if ( SecureAcceptHandshake ( &secureSession , header , payload , &replyWanted , &keysChanged ) == FAILURE_OP_CODE ) {
+		StatsAdd ( STATS_DATAGRAMS_REJECTED , 1 );
+		if ( !handshakeNoticeShown ) {
+			ShowNotice ( screen , HANDSHAKE_REFUSED_MESSAGE );
+			handshakeNoticeShown = 1;
+		}
+		return;
+	}
+
+	if ( replyWanted ) {
+		SendHandshake ( 0 );
+	}
+	else if ( keysChanged ) {
+		SendKeyConfirmation ();
+	}
+
+	if ( keysChanged ) {
+		ShowKeysChanged ( screen );
+	}
+}
+
+/* --encrypt: opens a received datagram from source in place and returns its
+ * plaintext length. A handshake from the peer's receiving address is taken
+ * here and returns -1, as does a key confirmation and anything that is not
+ * sealed, not authentic or a replay: none of it reaches the frame handlers.
+ * Called by whichever thread reads the socket. */
+int OpenReceivedDatagram ( SCREEN_BUFFER *screen , const struct sockaddr_in *source , char *datagram , int length ) {
+	FRAME_HEADER header;
+	int decoded = FrameDecodeHeader ( datagram , length , &header ) == SUCCESS_OP_CODE;
+	if ( decoded && header.type == FRAME_TYPE_HANDSHAKE ) {
+		if ( FromHandshakeAddress ( source ) ) {
+			TakeHandshake ( screen , &header , datagram + FRAME_HEADER_SIZE );
+		}
+		else {
+			StatsAdd ( STATS_DATAGRAMS_REJECTED , 1 );
+		}
+		return -1;
+	}
+
+	int keysChanged;
+	int plainLength = SecureOpen ( &secureSession , datagram , length , &keysChanged );
+	if ( keysChanged ) {
+		ShowKeysChanged ( screen );
+	}
+	if ( plainLength > 0 ) {
+		return plainLength;
+	}
+	if ( plainLength == 0 ) {
+		return -1; // a key confirmation
+	}
+
+	StatsAdd ( STATS_DATAGRAMS_REJECTED , 1 );
+	if ( decoded && header.type != FRAME_TYPE_SEALED ) {
+		if ( !plaintextNoticeShown ) {
+			ShowNotice ( screen , PLAINTEXT_REFUSED_MESSAGE );
+			plaintextNoticeShown = 1;
+		}
+	}
+	else {
+		RetryHandshake (); // no keys yet, or not the peer's current ones
+	}
+	return -1;
+}
+
+/* Renders every frame of one datagram from source; returns 1 if it ended the session. */
+int RenderDatagram ( SCREEN_BUFFER *screen , int source , const char *datagram , int datagramLength ) {
+	RENDER_CONTEXT render = { .screen = screen , .source = source , .originLabelLength = 0 , .origin = 0 };
+	int sessionEnded = FrameDispatch ( datagram , datagramLength , SCREEN_FRAME_HANDLERS , &render );
+
+	RetryHello ();
+	return sessionEnded;
+}
+
+/* Renders one queued datagram, straight from the buffer it was received into;
+ * returns 1 if it ends the session. */
+int RenderMessage ( SCREEN_BUFFER *screen , const char *printMessage ) {
+	StatsPendingAdd ( &printStamps , STATS_RECEIVE_TO_PRINT , MessageStamp ( printMessage ) );
+	return RenderDatagram ( screen , MessageSource ( printMessage ) , printMessage , MessageLength ( printMessage ) );
+}
+
+/* Renders every message already waiting in the print queue; returns 1 if one of
+ * them ended the session (anything queued after it is dropped). */
+int RenderQueuedMessages ( SCREEN_BUFFER *screen ) {
+	char *printMessages [ MAX_RECEIVE_BATCH_SIZE_ALLOC ];
+	int numMessages;
+
+	while ( ( numMessages = RingQueuePopBatch ( printMessagesQueue , ( void **) printMessages , MAX_RECEIVE_BATCH_SIZE ) ) > 0 ) {
+		int sessionEnded = 0;
+		for ( int i = 0 ; i < numMessages ; i++ ) {
+			if ( !sessionEnded ) {
+				sessionEnded = RenderMessage ( screen , printMessages [ i ] );
+			}
+
+			FreeMessages ( printMessages [ i ] );
+		}
+
+		if ( sessionEnded ) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Each wakeup renders everything queued into one reusable buffer and flushes it
+ * with a single write. Flushes are paced to maxFramesPerSecond: a message that
+ * arrives within a frame of the last flush waits for the next frame, gathering
+ * whatever else arrives meanwhile. */
+void *RunScreenPrinting () {
+	if ( !printMessagesQueue ) {
+		return NULL;
+	}
+
+	SCREEN_BUFFER screen = { 0 };
+
+	RenderSessionStarted ( &screen );
+	FlushScreenBuffer ( &screen );
+
+	int frameIntervalMs = maxFramesPerSecond > 0 ? 1000 / maxFramesPerSecond : 0;
+	long long lastFlushMs = 0;
+
+	for ( ;; ) {
+		// a file offer waiting for an answer bounds the wait
+		char *printMessage = ( char *) RingQueuePopWait ( printMessagesQueue , FileOfferWaitMs () );
+		if ( !printMessage && !RingQueueClosed ( printMessagesQueue ) ) {
+			ExpireFileOffer ( &screen );
+			FlushScreenBuffer ( &screen );
+			continue;
+		}
+
+		if ( !printMessage ) {
+			break; // drained after the local user quit (or shutdown)
+		}
+
+		unsigned long long renderStartNs = StatsNow ();
+
+		int sessionEnded = RenderMessage ( &screen , printMessage );
+		FreeMessages ( printMessage );
+
+		if ( !sessionEnded ) {
+			sessionEnded = RenderQueuedMessages ( &screen );
+		}
+
+		long long nextFrameMs = lastFlushMs + frameIntervalMs;
+		long long nowMs = MonotonicTimeMs ();
+
+		while ( !sessionEnded && nowMs < nextFrameMs ) {
+			printMessage = ( char *) RingQueuePopWait ( printMessagesQueue , ( int ) ( nextFrameMs - nowMs ) );
+			if ( printMessage ) {
+				sessionEnded = RenderMessage ( &screen , printMessage );
+				FreeMessages ( printMessage );
+			}
+			else if ( RingQueueClosed ( printMessagesQueue ) ) {
+				sessionEnded = 1; // drained after the local user quit
+			}
+
+			if ( !sessionEnded ) {
+				sessionEnded = RenderQueuedMessages ( &screen );
+			}
+
+			nowMs = MonotonicTimeMs ();
+		}
+
+		FlushScreenBuffer ( &screen );
+		lastFlushMs = nowMs;
+
+		// render time includes any --max-fps pacing wait
+		StatsPendingRecord ( &printStamps , STATS_RECEIVE_TO_PRINT );
+		StatsRecord ( STATS_RENDER , StatsNow () - renderStartNs );
+
+		if ( sessionEnded ) {
+			break;
+		}
+	}
+
+	RenderSessionEnded ( &screen );
+	FlushScreenBuffer ( &screen );
+	FreeScreenBuffer ( &screen );
+
+	return NULL;
+}
+
+void FreeUnqueuedMessages ( char **messages , int numEnqueued , int numMessages ) {
+	for ( int i = numEnqueued ; i < numMessages ; i++ ) {
+		FreeMessages ( messages [ i ] );
+	}
+}
+
+/* Blocks for the first datagram, then takes whatever else is already queued. With
+ * a batch timeout it lingers up to that long for the batch to fill. */
+int ReceiveBatch ( struct mmsghdr *headers , int batchSize ) {
+	int numReceived = recvmmsg ( receiveSocketFD , headers , batchSize , MSG_WAITFORONE , NULL );
+	if ( numReceived <= 0 || receiveBatchTimeoutMs <= 0 ) {
+		return numReceived;
+	}
+
+	long long deadlineMs = MonotonicTimeMs () + receiveBatchTimeoutMs;
+	while ( numReceived < batchSize ) {
+		long long remainingMs = deadlineMs - MonotonicTimeMs ();
+		if ( remainingMs <= 0 ) {
+			break;
+		}
+
+		struct pollfd receivePoll = { .fd = receiveSocketFD , .events = POLLIN };
+		if ( poll ( &receivePoll , 1 , ( int ) remainingMs ) <= 0 ) {
+			break;
+		}
+
+		int numMore = recvmmsg (
+			receiveSocketFD ,
+			headers + numReceived ,
+			batchSize - numReceived ,
+			MSG_DONTWAIT ,
+			NULL
+		);
+		if ( numMore <= 0 ) {
+			break;
+		}
+
+		numReceived += numMore;
+	}
+
+	return numReceived;
+}
+
+void FreeReceiveBatch ( RECEIVE_BATCH *batch ) {
+	for ( int i = 0 ; i < batch -> batchSize ; i++ ) {
+		MessageFree ( batch -> buffers [ i ] );
+		batch -> buffers [ i ] = NULL;
+	}
+}
+
+int InitReceiveBatch ( RECEIVE_BATCH *batch , int batchSize ) {
+	memset ( batch , 0 , sizeof ( RECEIVE_BATCH ) );
+	batch -> batchSize = batchSize;
+
+	for ( int i = 0 ; i < batchSize ; i++ ) {
+		batch -> buffers [ i ] = MessageAlloc ( MESSAGE_MAX_SIZE );
+		if ( !batch -> buffers [ i ] ) {
+			FreeReceiveBatch ( batch );
+			return FAILURE_OP_CODE;
+		}
+
+		batch -> vectors [ i ].iov_base = batch -> buffers [ i ];
+		batch -> vectors [ i ].iov_len = MESSAGE_MAX_SIZE;
+		batch -> headers [ i ].msg_hdr.msg_iov = &batch -> vectors [ i ];
+		batch -> headers [ i ].msg_hdr.msg_iovlen = 1;
+		batch -> headers [ i ].msg_hdr.msg_name = &batch -> addresses [ i ];
+		batch -> headers [ i ].msg_hdr.msg_namelen = sizeof ( struct sockaddr_in );
+	}
+
+	return SUCCESS_OP_CODE;
+}
+
+/* Hands out the buffer datagram i was received into, as is, and puts a fresh one
+ * in its place. Returns NULL (dropping the datagram, keeping its buffer) if no
+ * replacement can be had. */
+char *TakeReceivedDatagram ( RECEIVE_BATCH *batch , int i ) {
+	char *freshBuffer = MessageAlloc ( MESSAGE_MAX_SIZE );
+	if ( !freshBuffer ) {
+		return NULL;
+	}
+
+	char *datagram = batch -> buffers [ i ];
+	MessageSetLength ( datagram , batch -> headers [ i ].msg_len );
+
+	batch -> buffers [ i ] = freshBuffer;
+	batch -> vectors [ i ].iov_base = freshBuffer;
+	return datagram;
+}
+
+/* The peer datagram i came from: its number in a group (-1 if the sender is not
+ * in the group), always 0 outside one. */
+int ReceivedSource ( RECEIVE_BATCH *batch , int i ) {
+	if ( !groupMode ) {
+		return 0;
+	}
+
+	return PeerTableFind ( &peerTable , &batch -> addresses [ i ] );
+}
+
+void QueueReceivedMessages ( char **messages , int numMessages ) {
+	int numEnqueued = RingQueuePushBatchWait ( printMessagesQueue , ( void **) messages , numMessages );
+	FreeUnqueuedMessages ( messages , numEnqueued , numMessages );
+
+	StatsAdd ( STATS_DROPS , numMessages - numEnqueued );
+	StatsObserveMax ( STATS_PRINT_QUEUE_DEPTH_MAX , RingQueueCount ( printMessagesQueue ) );
+}
+
+/* Reliable mode: the session takes the datagram (acks, or a frame to put in
+ * order) and whatever is now in sequence joins messages, a full batch being
+ * queued as it goes. Returns the new number of messages. */
+int TakeReliableDatagram ( char *datagram , char **messages , int numMessages ) {
+	char *delivered = ReliableReceive ( &reliableSession , datagram ) ? datagram : NULL; // not reliable, or unordered
+	char *inOrder = ReliableNextInOrder ( &reliableSession );
+
+	while ( delivered || inOrder ) {
+		if ( numMessages == MAX_RECEIVE_BATCH_SIZE ) {
+			QueueReceivedMessages ( messages , numMessages );
+			numMessages = 0;
+		}
+
+		if ( delivered ) {
+			messages [ numMessages ] = delivered;
+			delivered = NULL;
+		}
+		else {
+			messages [ numMessages ] = inOrder;
+			inOrder = ReliableNextInOrder ( &reliableSession );
+		}
+		numMessages += 1;
+	}
+
+	return numMessages;
+}
+
+/* One ack per receive batch, covering everything that batch brought. */
+void SendReliableAck () {
+	char ackFrame [ RELIABLE_MAX_ACK_SIZE ];
+	int length = ReliableEncodeAck ( &reliableSession , ackFrame );
+	if ( length == 0 ) {
+		return;
+	}
+
+	struct iovec vector = { .iov_base = ackFrame , .iov_len = length };
+	struct mmsghdr header;
+	memset ( &header , 0 , sizeof ( header ) );
+	header.msg_hdr.msg_iov = &vector;
+	header.msg_hdr.msg_iovlen = 1;
+
+	if ( SendDatagrams ( &header , 1 ) == 1 ) {
+		StatsAdd ( STATS_DATAGRAMS_SENT , 1 );
+		StatsAdd ( STATS_BYTES_SENT , length );
+	}
+}
+
+void CountReceivedBatch ( RECEIVE_BATCH *batch , int numReceived ) {
+	unsigned long numBytes = 0;
+	for ( int i = 0 ; i < numReceived ; i++ ) {
+		numBytes += batch -> headers [ i ].msg_len;
+	}
+
+	StatsAdd ( STATS_DATAGRAMS_RECEIVED , numReceived );
+	StatsAdd ( STATS_BYTES_RECEIVED , numBytes );
+}
+
+void *RunReceiving () {
+	if ( receiveSocketFD == FAILED_SOCKET_FD ) {
+		return NULL;
+	}
+
+	if ( !printMessagesQueue ) {
+		return NULL;
+	}
+
+	RECEIVE_BATCH batch;
+	if ( InitReceiveBatch ( &batch , receiveBatchSize ) == FAILURE_OP_CODE ) {
+		return NULL;
+	}
+
+	char *receivedMessages [ MAX_RECEIVE_BATCH_SIZE_ALLOC ];
+
+	for ( ;; ) {
+		pthread_setcancelstate ( PTHREAD_CANCEL_ENABLE , NULL );
+		int numReceived = ReceiveBatch ( batch.headers , batch.batchSize );
+		if ( numReceived <= 0 ) {
+			continue;
+		}
+
+		// a batch is handled whole: in reliable mode that means taking the session lock and sending
+		pthread_setcancelstate ( PTHREAD_CANCEL_DISABLE , NULL );
+
+		unsigned int receiveStamp = StatsStamp ();
+		CountReceivedBatch ( &batch , numReceived );
+
+		// datagrams are queued in the buffers they arrived in; the printer parses the frames
+		int numMessages = 0;
+		for ( int i = 0 ; i < numReceived ; i++ ) {
+			if ( batch.headers [ i ].msg_len == 0 ) {
+				continue;
+			}
+
+			int source = ReceivedSource ( &batch , i );
+			if ( source < 0 ) {
+				StatsAdd ( STATS_DROPS , 1 ); // not one of the group
+				continue;
+			}
+
+			if ( encryptMode ) {
+				int plainLength = OpenReceivedDatagram ( NULL , &batch.addresses [ i ] , batch.buffers [ i ] , batch.headers [ i ].msg_len );
+				if ( plainLength < 0 ) {
+					continue;
+				}
+				batch.headers [ i ].msg_len = plainLength;
+			}
+
+			char *receivedMessage = TakeReceivedDatagram ( &batch , i );
+			if ( !receivedMessage ) {
+				StatsAdd ( STATS_DROPS , 1 );
+				continue;
+			}
+
+			MessageSetStamp ( receivedMessage , receiveStamp );
+			MessageSetSource ( receivedMessage , source );
+
+			if ( reliableMode ) {
+				numMessages = TakeReliableDatagram ( receivedMessage , receivedMessages , numMessages );
+				continue;
+			}
+
+			receivedMessages [ numMessages ] = receivedMessage;
+			numMessages += 1;
+		}
+
+		if ( reliableMode ) {
+			SendReliableAck ();
+		}
+
+		QueueReceivedMessages ( receivedMessages , numMessages );
+	}
+
+	FreeReceiveBatch ( &batch );
+	return NULL;
+}
+
+int SendMessage ( char *message ) {
+	if ( sendSocketFD == FAILED_SOCKET_FD ) {
+		perror ( "Send Socket is not initialized: message failed to send" );
+		return FAILED_SENDING_MESSAGE;
+	}
+
+	FrameSetSequence ( message , nextSendSequence++ );
+
+	struct iovec vector = { .iov_base = message , .iov_len = FrameLength ( message ) };
+	struct mmsghdr header;
+	memset ( &header , 0 , sizeof ( header ) );
+	header.msg_hdr.msg_iov = &vector;
+	header.msg_hdr.msg_iovlen = 1;
+
+	int numSentBytes = SendDatagrams ( &header , 1 ) == 1 ? ( int ) header.msg_len : -1;
+	if ( numSentBytes == -1 ) {
+		perror ( "message failed to send" );
+		StatsAdd ( STATS_DROPS , 1 );
+		return FAILED_SENDING_MESSAGE;
+	}
+
+	StatsAdd ( STATS_MESSAGES_SENT , 1 );
+	StatsAdd ( STATS_DATAGRAMS_SENT , 1 );
+	StatsAdd ( STATS_BYTES_SENT , numSentBytes );
+	return SUCCESS_SENDING_MESSAGE;
+}
+
+/* Groups frames into datagrams without copying: each datagram is an iovec list
+ * of frames laid back to back, stamped with consecutive sequence numbers. A
+ * maxBytes of 0 puts every frame in its own datagram. Returns the number of
+ * datagrams. */
+int PackDatagrams (
+	char **messages ,
+	int numMessages ,
+	int maxBytes ,
+	struct mmsghdr *headers ,
+	struct iovec *vectors
+) {
+	int numDatagrams = 0;
+	int numVectors = 0;
+	int datagramBytes = 0;
+
+	for ( int i = 0 ; i < numMessages ; i++ ) {
+		FrameSetSequence ( messages [ i ] , nextSendSequence++ );
+		int length = FrameLength ( messages [ i ] );
+
+		int fitsCurrent = numDatagrams > 0 && datagramBytes + length <= maxBytes;
+		if ( fitsCurrent ) {
+			headers [ numDatagrams - 1 ].msg_hdr.msg_iovlen += 1;
+			datagramBytes += length;
+		}
+		else {
+			memset ( &headers [ numDatagrams ] , 0 , sizeof ( struct mmsghdr ) );
+			headers [ numDatagrams ].msg_hdr.msg_iov = &vectors [ numVectors ];
+			headers [ numDatagrams ].msg_hdr.msg_iovlen = 1;
+			numDatagrams += 1;
+			datagramBytes = length;
+		}
+
+		vectors [ numVectors ].iov_base = messages [ i ];
+		vectors [ numVectors ].iov_len = length;
+		numVectors += 1;
+	}
+
+	return numDatagrams;
+}
+
+/* sendmmsg until every copy is out. A copy the kernel refuses is skipped, so one
+ * bad peer cannot hold up the rest, and a full socket buffer is waited out.
+ * Returns the number of copies sent. */
+int SendDatagramCopies ( struct mmsghdr *copies , int numCopies , unsigned long *numBytes , int *numUnsentFrames ) {
+	int numSent = 0;
+	int next = 0;
+
+	while ( next < numCopies ) {
+		int sent = SendDatagrams ( copies + next , numCopies - next );
+		if ( sent < 0 && ( errno == EAGAIN || errno == EINTR ) ) {
+			struct pollfd sendPoll = { .fd = sendSocketFD , .events = POLLOUT };
+			poll ( &sendPoll , 1 , -1 ); // the event loop shares the socket's O_NONBLOCK
+			continue;
+		}
+
+		if ( sent < 0 ) {
+			perror ( "message failed to send" );
+			*numUnsentFrames += copies [ next ].msg_hdr.msg_iovlen;
+			next += 1;
+			continue;
+		}
+
+		for ( int i = next ; i < next + sent ; i++ ) {
+			*numBytes += copies [ i ].msg_len;
+		}
+		next += sent;
+		numSent += sent;
+	}
+
+	return numSent;
+}
+
+/* Sends every packed datagram to every peer still in the group. The copies share
+ * the datagrams' iovecs, so frames are encoded once however many peers there
+ * are and only msg_name differs; up to MAX_SEND_BATCH_SIZE copies go out per
+ * sendmmsg. Messages count once; datagrams and bytes count every copy. */
+int SendToGroup ( struct mmsghdr *datagrams , int numDatagrams , int numMessages ) {
+	struct mmsghdr copies [ MAX_SEND_BATCH_SIZE_ALLOC ];
+	int numCopies = 0;
+	int numSent = 0;
+	int numUnsentFrames = 0;
+	unsigned long numBytes = 0;
+
+	for ( int i = 0 ; i < numDatagrams ; i++ ) {
+		for ( int peerNumber = 0 ; peerNumber < peerTable.numPeers ; peerNumber++ ) {
+			PEER *peer = &peerTable.peers [ peerNumber ];
+			if ( !atomic_load_explicit ( &peer -> present , memory_order_relaxed ) ) {
+				continue;
+			}
+
+			copies [ numCopies ] = datagrams [ i ];
+			copies [ numCopies ].msg_hdr.msg_name = &peer -> address;
+			copies [ numCopies ].msg_hdr.msg_namelen = sizeof ( peer -> address );
+			numCopies += 1;
+
+			if ( numCopies == MAX_SEND_BATCH_SIZE ) {
+				numSent += SendDatagramCopies ( copies , numCopies , &numBytes , &numUnsentFrames );
+				numCopies = 0;
+			}
+		}
+	}
+
+	numSent += SendDatagramCopies ( copies , numCopies , &numBytes , &numUnsentFrames );
+
+	StatsAdd ( STATS_MESSAGES_SENT , numMessages );
+	StatsAdd ( STATS_DATAGRAMS_SENT , numSent );
+	StatsAdd ( STATS_BYTES_SENT , numBytes );
+	StatsAdd ( STATS_DROPS , numUnsentFrames );
+
+	return numUnsentFrames == 0 ? SUCCESS_SENDING_MESSAGE : FAILED_SENDING_MESSAGE;
+}
+
+int SendMessageBatch ( char **messages , int numMessages ) {
+	if ( sendSocketFD == FAILED_SOCKET_FD ) {
+		perror ( "Send Socket is not initialized: message failed to send" );
+		return FAILED_SENDING_MESSAGE;
+	}
+
+	struct mmsghdr sendHeaders [ MAX_SEND_BATCH_SIZE_ALLOC ];
+	struct iovec sendVectors [ MAX_SEND_BATCH_SIZE_ALLOC ];
+
+	int numDatagrams = PackDatagrams ( messages , numMessages , coalesceMaxBytes , sendHeaders , sendVectors );
+	if ( groupMode ) {
+		return SendToGroup ( sendHeaders , numDatagrams , numMessages );
+	}
+
+	int numSent = 0;
+	unsigned long numBytes = 0;
+	while ( numSent < numDatagrams ) {
+		int sent = SendDatagrams ( sendHeaders + numSent , numDatagrams - numSent );
+		if ( sent < 0 ) {
+			perror ( "message failed to send" );
+			break;
+		}
+
+		for ( int i = numSent ; i < numSent + sent ; i++ ) {
+			numBytes += sendHeaders [ i ].msg_len;
+		}
+		numSent += sent;
+	}
+
+	// each datagram's iovecs are its frames, so the unsent ones count the lost messages
+	int numUnsentMessages = 0;
+	for ( int i = numSent ; i < numDatagrams ; i++ ) {
+		numUnsentMessages += sendHeaders [ i ].msg_hdr.msg_iovlen;
+	}
+
+	StatsAdd ( STATS_MESSAGES_SENT , numMessages - numUnsentMessages );
+	StatsAdd ( STATS_DATAGRAMS_SENT , numSent );
+	StatsAdd ( STATS_BYTES_SENT , numBytes );
+	StatsAdd ( STATS_DROPS , numUnsentMessages );
+
+	return numSent == numDatagrams ? SUCCESS_SENDING_MESSAGE : FAILED_SENDING_MESSAGE;
+}
+
+/* The reliable session's way out: every frame is a datagram of its own. A frame
+ * the kernel refuses (say, the peer is not up yet) is retransmitted like a lost
+ * one, so it is not counted as a drop. */
+int TransmitReliableFrames ( char **frames , int numFrames , void *context ) {
+	struct mmsghdr headers [ RELIABLE_TRANSMIT_BATCH_SIZE ];
+	struct iovec vectors [ RELIABLE_TRANSMIT_BATCH_SIZE ];
+
+	for ( int i = 0 ; i < numFrames ; i++ ) {
+		vectors [ i ].iov_base = frames [ i ];
+		vectors [ i ].iov_len = FrameLength ( frames [ i ] );
+		memset ( &headers [ i ] , 0 , sizeof ( struct mmsghdr ) );
+		headers [ i ].msg_hdr.msg_iov = &vectors [ i ];
+		headers [ i ].msg_hdr.msg_iovlen = 1;
+	}
+
+	unsigned long numBytes = 0;
+	int numUnsentFrames = 0;
+	int numSent = SendDatagramCopies ( headers , numFrames , &numBytes , &numUnsentFrames );
+
+	StatsAdd ( STATS_DATAGRAMS_SENT , numSent );
+	StatsAdd ( STATS_BYTES_SENT , numBytes );
+	return numSent;
+}
+
+/* Takes every message that is ready. In coalescing mode it keeps collecting until
+ * a datagram's worth of bytes is pending or coalesceDelayMs has passed. */
+int CollectSendBatch ( char **messages ) {
+	char *firstMessage = ( char *) RingQueuePopWait ( sendMessagesQueue , RING_QUEUE_WAIT_FOREVER );
+	if ( !firstMessage ) {
+		return 0;
+	}
+
+	messages [ 0 ] = firstMessage;
+	int numMessages = 1;
+	numMessages += RingQueuePopBatch ( sendMessagesQueue , ( void **) messages + 1 , MAX_SEND_BATCH_SIZE - 1 );
+
+	if ( coalesceMaxBytes <= 0 ) {
+		return numMessages;
+	}
+
+	long long deadlineMs = MonotonicTimeMs () + coalesceDelayMs;
+	int pendingBytes = 0;
+	for ( int i = 0 ; i < numMessages ; i++ ) {
+		pendingBytes += FrameLength ( messages [ i ] );
+	}
+
+	while ( numMessages < MAX_SEND_BATCH_SIZE && pendingBytes < coalesceMaxBytes ) {
+		int leaving = FrameType ( messages [ numMessages - 1 ] ) == FRAME_TYPE_LEAVE;
+		long long remainingMs = deadlineMs - MonotonicTimeMs ();
+		if ( leaving || remainingMs <= 0 ) {
+			break;
+		}
+
+		char *message = ( char *) RingQueuePopWait ( sendMessagesQueue , ( int ) remainingMs );
+		if ( !message ) {
+			break;
+		}
+
+		messages [ numMessages ] = message;
+		numMessages += 1;
+		pendingBytes += FrameLength ( message );
+	}
+
+	return numMessages;
+}
+
+/* --encrypt, sending thread: nothing can be sealed before the handshake, so
+ * messages wait in the send queue until it completes. Returns 0 if the session
+ * ended first, with nothing sent. */
+int WaitForKeys () {
+	while ( !SecureReady ( &secureSession ) ) {
+		if ( RingQueueClosed ( sendMessagesQueue ) ) {
+			return 0;
+		}
+
+		if ( !awaitingKeysNoticeShown ) {
+			WriteNotice ( AWAITING_KEYS_MESSAGE );
+			awaitingKeysNoticeShown = 1;
+		}
+		RetryHandshake ();
+		usleep ( KEYS_WAIT_POLL_MS * 1000 );
+	}
+
+	return 1;
+}
+
+/* Reliable mode: the session numbers, sends and retransmits every frame and
+ * frees it once acknowledged. Between messages the thread sleeps no longer than
+ * the retransmission timer. After the queue is closed and drained it lingers
+ * until the peer has everything, or has stopped answering. */
+void RunReliableSending () {
+	char *sendMessages [ MAX_SEND_BATCH_SIZE_ALLOC ];
+
+	for ( ;; ) {
+		char *firstMessage = ( char *) RingQueuePopWait ( sendMessagesQueue , ReliableTimeoutMs ( &reliableSession ) );
+		if ( !firstMessage ) {
+			if ( RingQueueClosed ( sendMessagesQueue ) && RingQueueCount ( sendMessagesQueue ) == 0 ) {
+				break;
+			}
+
+			ReliableOnTimer ( &reliableSession );
+			continue;
+		}
+
+		sendMessages [ 0 ] = firstMessage;
+		int numMessages = 1 + RingQueuePopBatch ( sendMessagesQueue , ( void **) sendMessages + 1 , MAX_SEND_BATCH_SIZE - 1 );
+
+		for ( int i = 0 ; i < numMessages ; i++ ) {
+			StatsRecordSince ( STATS_SEND_QUEUE_WAIT , MessageStamp ( sendMessages [ i ] ) );
+		}
+
+		if ( encryptMode && !WaitForKeys () ) {
+			StatsAdd ( STATS_DROPS , numMessages );
+			for ( int i = 0 ; i < numMessages ; i++ ) {
+				FreeMessages ( sendMessages [ i ] );
+			}
+			continue;
+		}
+
+		unsigned long long sendStartNs = StatsNow ();
+		ReliableSend ( &reliableSession , sendMessages , numMessages );
+		StatsRecord ( STATS_SEND , StatsNow () - sendStartNs );
+		StatsAdd ( STATS_MESSAGES_SENT , numMessages );
+	}
+
+	ReliableFlush ( &reliableSession , RELIABLE_LINGER_MS );
+}
+
+void *RunSending () {
+	if ( !sendMessagesQueue ) {
+		return NULL;
+	}
+
+	if ( reliableMode ) {
+		RunReliableSending ();
+		return NULL;
+	}
+
+	char *sendMessages [ MAX_SEND_BATCH_SIZE_ALLOC ];
+
+	for ( ;; ) {
+		// keeps draining after the queue is closed so a final leave message still goes out
+		int numMessages = CollectSendBatch ( sendMessages );
+		if ( numMessages == 0 ) {
+			break;
+		}
+
+		for ( int i = 0 ; i < numMessages ; i++ ) {
+			StatsRecordSince ( STATS_SEND_QUEUE_WAIT , MessageStamp ( sendMessages [ i ] ) );
+		}
+
+		if ( encryptMode && !WaitForKeys () ) {
+			StatsAdd ( STATS_DROPS , numMessages );
+		}
+		else {
+			unsigned long long sendStartNs = StatsNow ();
+			SendMessageBatch ( sendMessages , numMessages );
+			StatsRecord ( STATS_SEND , StatsNow () - sendStartNs );
+		}
+
+		for ( int i = 0 ; i < numMessages ; i++ ) {
+			FreeMessages ( sendMessages [ i ] );
+		}
+	}
+
+	return NULL;
+}
+
+/* --reliable: frames leave through TransmitReliableFrames and arrive in order. */
+void StartReliableSession () {
+	if ( !reliableMode ) {
+		return;
+	}
+
+	if ( ReliableInit ( &reliableSession , TransmitReliableFrames , NULL ) == FAILURE_OP_CODE ) {
+		WriteToScreen ( "Reliable session wasn't created\n" );
+		exit ( -1 );
+	}
+}
+
+/* --encrypt: a key pair for the run, then a handshake asking for the peer's.
+ * Nothing else can go out until one comes back. */
+void StartEncryption () {
+	if ( !encryptMode ) {
+		return;
+	}
+
+	if ( SecureInit ( &secureSession , hasPresharedKey ? presharedKey : NULL ) == FAILURE_OP_CODE ) {
+		WriteToScreen ( "Encryption wasn't started\n" );
+		exit ( -1 );
+	}
+
+	handshakeAddrLength = sizeof ( handshakeAddr );
+	if ( getpeername ( sendSocketFD , ( struct sockaddr *) &handshakeAddr , &handshakeAddrLength ) < 0 ) {
+		perror ( "cannot find the peer's address" );
+		exit ( -1 );
+	}
+
+	heldMessages = ListCreate ();
+	atomic_store ( &lastHandshakeMs , MonotonicTimeMs () );
+	SendHandshake ( 1 );
+}
+
+/* --compress: asks for the peer's hello at startup. The peer may not be up
+ * yet, so outside reliable mode this one goes out from the unconnected receive
+ * socket: the connected send socket would report the refusal on its next send,
+ * failing the user's first line instead. With --encrypt it goes sealed once
+ * there are keys, which outside the bench is when the handshake completes
+ * (TakeHandshake). */
+void StartCompression () {
+	if ( !compressMode ) {
+		return;
+	}
+
+	CompressorInit ( &compressor );
+	lastHelloMs = MonotonicTimeMs ();
+
+	if ( encryptMode ) {
+		if ( SecureReady ( &secureSession ) ) {
+			SendHello ( 1 );
+		}
+		return;
+	}
+
+	if ( reliableMode ) {
+		SendHello ( 1 );
+		return;
+	}
+
+	char frame [ COMPRESS_HELLO_FRAME_SIZE ];
+	int length = CompressEncodeHello ( frame , &compressDictionary , 1 );
+
+	struct sockaddr_storage peerAddr;
+	socklen_t peerAddrLength = sizeof ( peerAddr );
+	if ( getpeername ( sendSocketFD , ( struct sockaddr *) &peerAddr , &peerAddrLength ) == 0
+		&& sendto ( receiveSocketFD , frame , length , 0 , ( struct sockaddr *) &peerAddr , peerAddrLength ) == length ) {
+		StatsAdd ( STATS_DATAGRAMS_SENT , 1 );
+		StatsAdd ( STATS_BYTES_SENT , length );
+	}
+}
+
+/* Chat frames go out compressed, when that pays, once the peer has said how it
+ * can take them. Called by whichever thread reads the input. */
+void CompressOutgoingFrame ( char *frame ) {
+	int peer = atomic_load ( &peerCompression );
+	int type = FrameType ( frame );
+	if ( !compressMode || peer == PEER_COMPRESSION_UNKNOWN || ( type != FRAME_TYPE_DATA && type != FRAME_TYPE_FRAGMENT ) ) {
+		return;
+	}
+
+	const COMPRESS_DICTIONARY *dictionary = peer == PEER_COMPRESSION_DICTIONARY ? &compressDictionary : NULL;
+	MessageSetLength ( frame , CompressFrame ( &compressor , dictionary , frame ) );
+}
+
+/* Frames one read from stdin in place: the text was read to frame +
+ * FRAME_HEADER_SIZE and the header is written in front of it, dropping the
+ * trailing newline. The quit command becomes a leave frame; anything else,
+ * whatever it says, is data. Returns the frame's length. */
+int FrameInput ( char *frame , int inputLength ) {
+	char *text = frame + FRAME_HEADER_SIZE;
+
+	char lastChar = text [ inputLength - 1 ];
+	if ( lastChar == 10 ) {
+		inputLength -= 1; // remove newline char
+	}
+
+	int quitCommand = inputLength == sizeof ( USER_LEFT_CHAT_MESSAGE ) - 1
+		&& memcmp ( text , USER_LEFT_CHAT_MESSAGE , inputLength ) == 0;
+
+	FRAME_HEADER header = {
+		.version = FRAME_PROTOCOL_VERSION ,
+		.type = quitCommand ? FRAME_TYPE_LEAVE : FRAME_TYPE_DATA ,
+		.flags = 0 ,
+		.sequence = 0 , // stamped on sending
+		.payloadLength = quitCommand ? 0 : inputLength
+	};
+	FrameEncodeHeader ( frame , &header );
+
+	return FRAME_HEADER_SIZE + header.payloadLength;
+}
+
+/* True if more input comes within gapMs: what was read so far is part of a
+ * paste or a piped stream, not a line typed on its own. */
+int InputPending ( int gapMs ) {
+	struct pollfd inputPoll = { .fd = STDIN_FILENO , .events = POLLIN };
+	return poll ( &inputPoll , 1 , gapMs ) > 0;
+}
+
+/* Where the next read of stdin goes and how much it may take; NULL if no
+ * buffer can be had. */
+char *InputAssemblyBuffer ( INPUT_ASSEMBLY *input , int *capacity ) {
+	if ( !input -> frame ) {
+		input -> frame = MessageAlloc ( FRAGMENT_MAX_DATAGRAM_SIZE );
+		input -> length = 0;
+		input -> numScanned = 0;
+		if ( !input -> frame ) {
+			return NULL;
+		}
+	}
+
+	*capacity = FRAGMENT_DATA_SIZE - input -> length;
+	return input -> frame + FRAGMENT_TEXT_OFFSET + input -> length;
+}
+
+/* Offset in the buffer of the first whole line that is the quit command, or
+ * -1. A last line still missing its newline counts only at EOF. */
+int FindQuitLine ( INPUT_ASSEMBLY *input , int endOfInput ) {
+	char *text = input -> frame + FRAGMENT_TEXT_OFFSET;
+	int quitLength = sizeof ( USER_LEFT_CHAT_MESSAGE ) - 1;
+
+	while ( input -> numScanned < input -> length ) {
+		char *line = text + input -> numScanned;
+		char *newline = memchr ( line , '\n' , input -> length - input -> numScanned );
+		if ( !newline && !endOfInput ) {
+			return -1;
+		}
+
+		int lineLength = newline ? newline - line : input -> length - input -> numScanned;
+		if ( !input -> midLine && lineLength == quitLength && memcmp ( line , USER_LEFT_CHAT_MESSAGE , quitLength ) == 0 ) {
+			return input -> numScanned;
+		}
+
+		input -> midLine = 0;
+		input -> numScanned += newline ? lineLength + 1 : lineLength;
+	}
+
+	return -1;
+}
+
+/* Takes numRead bytes just read into the buffer (none, with endOfInput, at EOF).
+ * A message ends at a newline with no more input coming, or at EOF, so the
+ * lines of one paste or burst go out together. One that ends within the first
+ * buffer is framed in place as one frame; a longer one goes out as fragments,
+ * each handed out as soon as its buffer is full, so a long paste streams out
+ * as it is read. A line holding only the quit command ends the message before
+ * it, and the leave follows on the next call; whatever was read after it is
+ * not sent. Returns the next frame to send, owned by the caller, or NULL while
+ * more must be read first: call again with numRead 0 until NULL before reading
+ * more. A message of more than FRAGMENT_MAX_FRAGMENTS is cut there and the
+ * rest read as the next one. */
+char *InputAssemblyAdd ( INPUT_ASSEMBLY *input , int numRead , int endOfInput ) {
+	if ( input -> quitPending ) {
+		input -> quitPending = 0;
+		char *leaveFrame = MessageAlloc ( FRAGMENT_MAX_DATAGRAM_SIZE );
+		if ( !leaveFrame ) {
+			StatsAdd ( STATS_DROPS , 1 );
+			return NULL;
+		}
+
+		memcpy ( leaveFrame + FRAME_HEADER_SIZE , USER_LEFT_CHAT_MESSAGE , sizeof ( USER_LEFT_CHAT_MESSAGE ) - 1 );
+		MessageSetLength ( leaveFrame , FrameInput ( leaveFrame , sizeof ( USER_LEFT_CHAT_MESSAGE ) - 1 ) );
+		MessageSetStamp ( leaveFrame , StatsStamp () );
+		return leaveFrame;
+	}
+
+	if ( !input -> frame ) {
+		return NULL;
+	}
+
+	char *text = input -> frame + FRAGMENT_TEXT_OFFSET;
+	input -> length += numRead;
+
+	int length = input -> length;
+	int messageEnded;
+	int quitOffset = FindQuitLine ( input , endOfInput );
+	if ( quitOffset == 0 && input -> numFragments == 0 ) {
+		length = sizeof ( USER_LEFT_CHAT_MESSAGE ) - 1; // framed as the leave itself
+		messageEnded = 1;
+	}
+	else if ( quitOffset >= 0 ) {
+		length = quitOffset;
+		messageEnded = 1;
+		input -> quitPending = 1;
+	}
+	else {
+		// a typed line is sent the moment it is read, but a pipe writer can fall behind for a moment mid-message
+		int gapMs = input -> numFragments > 0 ? INPUT_STREAM_GAP_MS : 0;
+		messageEnded = endOfInput || ( length > 0 && text [ length - 1 ] == '\n' && !InputPending ( gapMs ) );
+	}
+
+	if ( !messageEnded && length < FRAGMENT_DATA_SIZE ) {
+		return NULL;
+	}
+
+	if ( length == 0 && input -> numFragments == 0 ) {
+		return NULL; // EOF with nothing read
+	}
+
+	char *frame = input -> frame;
+	input -> frame = NULL;
+	input -> length = 0;
+	input -> midLine = !messageEnded && text [ length - 1 ] != '\n';
+	MessageSetStamp ( frame , StatsStamp () );
+
+	if ( messageEnded && input -> numFragments == 0 ) {
+		memmove ( frame + FRAME_HEADER_SIZE , text , length );
+		MessageSetLength ( frame , FrameInput ( frame , length ) );
+		return frame;
+	}
+
+	if ( input -> numFragments == 0 ) {
+		input -> messageId = nextFragmentedMessageId++;
+	}
+
+	int last = messageEnded || input -> numFragments == FRAGMENT_MAX_FRAGMENTS - 1;
+	if ( last && length > 0 && text [ length - 1 ] == '\n' ) {
+		length -= 1; // remove newline char
+	}
+
+	MessageSetLength ( frame , FragmentEncode ( frame , input -> messageId , input -> numFragments , length , last ) );
+	input -> numFragments = last ? 0 : input -> numFragments + 1;
+	StatsAdd ( STATS_FRAGMENTS_SENT , 1 );
+	return frame;
+}
+
+void InputAssemblyFree ( INPUT_ASSEMBLY *input ) {
+	MessageFree ( input -> frame );
+	input -> frame = NULL;
+}
+
+/* Reads stdin straight into slab buffers until a frame is ready to be queued
+ * and sent as is. Returns NULL on EOF or error. */
+char *ReadInputFrame ( INPUT_ASSEMBLY *input ) {
+	char *frame = InputAssemblyAdd ( input , 0 , 0 ); // a quit read along with the last message
+	while ( !frame ) {
+		int capacity;
+		char *text = InputAssemblyBuffer ( input , &capacity );
+		if ( !text ) {
+			return NULL;
+		}
+
+		int inputLength = read ( STDIN_FILENO , text , capacity );
+		if ( inputLength < 0 && errno == EINTR ) {
+			continue;
+		}
+
+		int endOfInput = inputLength <= 0;
+		frame = InputAssemblyAdd ( input , endOfInput ? 0 : inputLength , endOfInput );
+		if ( endOfInput ) {
+			break;
+		}
+	}
+
+	return frame;
+}
+
+/* Writes a join frame asking a relay for room; returns its length. */
+int EncodeJoinFrame ( char *frame , const char *room ) {
+	int nameLength = strlen ( room );
+	if ( nameLength > FRAME_MAX_ROOM_NAME_SIZE ) {
+		nameLength = FRAME_MAX_ROOM_NAME_SIZE;
+	}
+
+	FRAME_HEADER header = {
+		.version = FRAME_PROTOCOL_VERSION ,
+		.type = FRAME_TYPE_JOIN ,
+		.flags = 0 ,
+		.sequence = 0 ,
+		.payloadLength = nameLength
+	};
+	FrameEncodeHeader ( frame , &header );
+	memcpy ( frame + FRAME_HEADER_SIZE , room , nameLength );
+
+	return FRAME_HEADER_SIZE + nameLength;
+}
+
+/* The relay answers nothing, it just starts forwarding. It forgets a client
+ * it has not heard from in RELAY_MEMBER_TIMEOUT_MS, so the join is sent again
+ * every RELAY_JOIN_RENEW_MS for as long as the session lasts; that also keeps
+ * a NAT's mapping for the client open. */
+void *RunRelayJoining () {
+	char joinFrame [ FRAME_HEADER_SIZE + FRAME_MAX_ROOM_NAME_SIZE ];
+	EncodeJoinFrame ( joinFrame , relayRoom );
+
+	for ( ;; ) {
+		char *joinMessage = joinFrame;
+		SendMessageBatch ( &joinMessage , 1 );
+		sleep ( RELAY_JOIN_RENEW_MS / 1000 );
+	}
+
+	return NULL;
+}
+
+void JoinRelayRoom () {
+	relayJoining = pthread_create ( &relayJoinThread , NULL , RunRelayJoining , NULL ) == 0;
+}
+
+/* True if the input frame is exactly the command, not sent but run. */
+int IsCommand ( const char *frame , const char *command ) {
+	int payloadLength = FrameLength ( frame ) - FRAME_HEADER_SIZE;
+
+	return FrameType ( frame ) == FRAME_TYPE_DATA
+		&& payloadLength == ( int ) strlen ( command )
+		&& memcmp ( frame + FRAME_HEADER_SIZE , command , payloadLength ) == 0;
+}
+
+/* "/stats" is answered locally instead of being sent. */
+int IsStatsCommand ( const char *frame ) {
+	return IsCommand ( frame , STATS_COMMAND );
+}
+
+/* Pipeline counters and latencies, then the slab's view of message buffers. */
+int FormatStats ( char *buffer , int size ) {
+	int length = StatsFormat ( buffer , size );
+	length += MessageSlabFormatStats ( buffer + length , size - length );
+	return length;
+}
+
+void PrintStats ( int fd ) {
+	char text [ STATS_TEXT_CAPACITY ];
+	int length = FormatStats ( text , STATS_TEXT_CAPACITY );
+	write ( fd , text , length );
+}
+
+void RenderStats ( SCREEN_BUFFER *screen ) {
+	char text [ STATS_TEXT_CAPACITY ];
+	int length = FormatStats ( text , STATS_TEXT_CAPACITY );
+	ScreenBufferAppend ( screen , "\n" , 1 );
+	ScreenBufferAppend ( screen , text , length );
+}
+
+/* Rewrites the dump file with a fresh snapshot. */
+void DumpStatsFile () {
+	int fd = open ( statsFilePath , O_WRONLY | O_CREAT | O_TRUNC , 0644 );
+	if ( fd < 0 ) {
+		return;
+	}
+
+	PrintStats ( fd );
+	close ( fd );
+}
+
+/* Sleeps in sigwait so a SIGUSR1 prints the stats to stderr from a normal thread
+ * context; with --stats-file it also rewrites the file every statsIntervalMs. */
+void *RunStatsReporting () {
+	sigset_t reportSignals;
+	sigemptyset ( &reportSignals );
+	sigaddset ( &reportSignals , SIGUSR1 );
+
+	struct timespec interval = {
+		.tv_sec = statsIntervalMs / 1000 ,
+		.tv_nsec = ( long ) ( statsIntervalMs % 1000 ) * 1000000
+	};
+
+	for ( ;; ) {
+		int signalNumber = statsFilePath
+			? sigtimedwait ( &reportSignals , NULL , &interval )
+			: sigwaitinfo ( &reportSignals , NULL );
+
+		if ( signalNumber == SIGUSR1 ) {
+			PrintStats ( STDERR_FILENO );
+		}
+
+		if ( statsFilePath ) {
+			DumpStatsFile ();
+		}
+	}
+
+	return NULL;
+}
+
+/* Must run before any other thread starts so that every thread inherits the
+ * blocked SIGUSR1 and only the reporting thread ever takes it. */
+void StartStatsReporting () {
+	sigset_t reportSignals;
+	sigemptyset ( &reportSignals );
+	sigaddset ( &reportSignals , SIGUSR1 );
+	pthread_sigmask ( SIG_BLOCK , &reportSignals , NULL );
+
+	pthread_create ( &statsThread , NULL , RunStatsReporting , NULL );
+}
+
+void StopStatsReporting () {
+	pthread_cancel ( statsThread );
+	pthread_join ( statsThread , NULL );
+
+	if ( statsFilePath ) {
+		DumpStatsFile ();
+	}
+}
+
+/* "/send-file PATH" starts a file transfer instead of being sent. */
+int IsSendFileCommand ( const char *frame ) {
+	int payloadLength = FrameLength ( frame ) - FRAME_HEADER_SIZE;
+
+	return FrameType ( frame ) == FRAME_TYPE_DATA
+		&& payloadLength > ( int ) sizeof ( SEND_FILE_COMMAND ) - 1
+		&& memcmp ( frame + FRAME_HEADER_SIZE , SEND_FILE_COMMAND , sizeof ( SEND_FILE_COMMAND ) - 1 ) == 0;
+}
+
+/* "/accept" or "/reject": the answer to the file offer waiting for one. */
+int IsFileAnswerCommand ( const char *frame ) {
+	return IsCommand ( frame , FILE_ACCEPT_COMMAND ) || IsCommand ( frame , FILE_REJECT_COMMAND );
+}
+
+/* Answers the pending offer. Accepting creates the destination here, before the
+ * answer goes out, and publishes it to the printing thread that writes the
+ * chunks; an empty file is done at once. */
+void AnswerFileOffer ( const char *frame ) {
+	char text [ NOTICE_CAPACITY ];
+
+	pthread_mutex_lock ( &fileOffer.lock );
+	int pending = fileOffer.pending;
+	fileOffer.pending = 0;
+	pthread_mutex_unlock ( &fileOffer.lock );
+
+	if ( !pending ) {
+		WriteNotice ( NO_FILE_OFFER_MESSAGE );
+		return;
+	}
+
+	int accepted = IsCommand ( frame , FILE_ACCEPT_COMMAND )
+		&& FileTransferCreateDestination ( &fileReceiving , fileOffer.id , fileOffer.name , fileOffer.size ) == SUCCESS_OP_CODE;
+	if ( accepted && fileOffer.size > 0 ) {
+		atomic_store_explicit ( &fileReceivingActive , 1 , memory_order_release );
+	}
+	SendFileControlFrame ( FRAME_TYPE_FILE_ANSWER , fileOffer.id , accepted );
+
+	if ( !accepted ) {
+		snprintf ( text , NOTICE_CAPACITY , "Refused the file %s" , fileOffer.name );
+		WriteNotice ( text );
+		return;
+	}
+
+	snprintf ( text , NOTICE_CAPACITY , "Receiving %.200s (%.1f MB) into %.200s" , fileOffer.name , fileOffer.size / 1e6 , fileReceiving.name );
+	WriteNotice ( text );
+
+	if ( fileOffer.size == 0 ) {
+		FileTransferClose ( &fileReceiving );
+		SendFileControlFrame ( FRAME_TYPE_FILE_COMPLETE , fileReceiving.id , 1 );
+		FileTransferFormatDone ( &fileReceiving , "Received" , text , NOTICE_CAPACITY );
+		WriteNotice ( text );
+	}
+}
+
+/* Waits for the receiver to answer the offer; true if it accepted. */
+int WaitForFileAnswer () {
+	struct timespec deadline;
+	clock_gettime ( CLOCK_REALTIME , &deadline );
+	deadline.tv_sec += FILE_ANSWER_TIMEOUT_MS / 1000;
+
+	pthread_mutex_lock ( &fileSending.lock );
+	while ( fileSending.answer == FILE_ANSWER_PENDING && !fileSending.stopping ) {
+		if ( pthread_cond_timedwait ( &fileSending.answered , &fileSending.lock , &deadline ) == ETIMEDOUT ) {
+			break;
+		}
+	}
+
+	int answer = fileSending.answer;
+	pthread_mutex_unlock ( &fileSending.lock );
+	return answer;
+}
+
+/* Streams the mapped file as chunk frames, a transmit batch at a time, straight
+ * into the reliable session: its window is the transfer's sliding window, and
+ * the thread keeps only FILE_MAX_UNSENT_CHUNKS queued ahead of it. Progress is
+ * shown as the session takes the chunks in; the receiver's completion shows
+ * the rate end to end. */
+void StreamFileChunks ( FILE_TRANSFER *transfer ) {
+	char *chunks [ RELIABLE_TRANSMIT_BATCH_SIZE ];
+	char text [ NOTICE_CAPACITY ];
+
+	transfer -> startNs = StatsNow ();
+	transfer -> lastProgressNs = transfer -> startNs;
+
+	while ( transfer -> numBytesDone < transfer -> size && !atomic_load_explicit ( &fileSending.stopping , memory_order_relaxed ) ) {
+		int numChunks = 0;
+		while ( numChunks < RELIABLE_TRANSMIT_BATCH_SIZE && transfer -> numBytesDone < transfer -> size ) {
+			char *chunk = MessageAlloc ( FRAGMENT_MAX_DATAGRAM_SIZE );
+			if ( !chunk ) {
+				break;
+			}
+
+			MessageSetLength ( chunk , FileTransferEncodeChunk ( transfer , chunk ) );
+			chunks [ numChunks ] = chunk;
+			numChunks += 1;
+		}
+
+		if ( numChunks == 0 || ReliableSendBulk ( &reliableSession , chunks , numChunks , FILE_MAX_UNSENT_CHUNKS ) < numChunks ) {
+			break; // out of buffers, or the session is closing
+		}
+
+		unsigned long long nowNs = StatsNow ();
+		if ( nowNs - transfer -> lastProgressNs >= ( unsigned long long ) FILE_PROGRESS_INTERVAL_MS * 1000000ULL ) {
+			transfer -> lastProgressNs = nowNs;
+			FileTransferFormatProgress ( transfer , "Sending" , text , NOTICE_CAPACITY );
+			WriteNotice ( text );
+		}
+	}
+}
+
+/* Offers the file opened by StartFileSending, then streams it once accepted. */
+void *RunFileSending () {
+	FILE_TRANSFER *transfer = &fileSending.transfer;
+	char text [ NOTICE_CAPACITY ];
+
+	char *offer = MessageAlloc ( FILE_MAX_OFFER_SIZE );
+	if ( offer ) {
+		MessageSetLength ( offer , FileTransferEncodeOffer ( transfer , offer ) );
+		ReliableSend ( &reliableSession , &offer , 1 );
+	}
+
+	int answer = offer ? WaitForFileAnswer () : FILE_ANSWER_PENDING;
+	if ( answer == 1 ) {
+		StreamFileChunks ( transfer );
+	}
+
+	if ( answer == FILE_ANSWER_PENDING ) {
+		snprintf ( text , NOTICE_CAPACITY , "No answer to the offer of %s" , transfer -> name );
+	}
+	else if ( answer == 0 ) {
+		snprintf ( text , NOTICE_CAPACITY , "%s was refused" , transfer -> name );
+	}
+	else if ( transfer -> numBytesDone < transfer -> size ) {
+		FileTransferFormatProgress ( transfer , "Stopped sending" , text , NOTICE_CAPACITY );
+	}
+	else {
+		snprintf ( text , NOTICE_CAPACITY , "Sent %s, waiting for the receiver to confirm" , transfer -> name );
+	}
+	WriteNotice ( text );
+
+	pthread_mutex_lock ( &fileSending.lock );
+	FileTransferClose ( transfer ); // every chunk was copied into its frame
+	fileSending.running = 0;
+	pthread_mutex_unlock ( &fileSending.lock );
+
+	return NULL;
+}
+
+/* Maps the file the command names and hands it to a sending thread; one file
+ * is sent at a time. */
+void StartFileSending ( const char *frame ) {
+	if ( !reliableMode ) {
+		WriteNotice ( FILE_NEEDS_RELIABLE_MESSAGE );
+		return;
+	}
+
+	pthread_mutex_lock ( &fileSending.lock );
+	int running = fileSending.running;
+	pthread_mutex_unlock ( &fileSending.lock );
+
+	if ( running ) {
+		WriteNotice ( FILE_BUSY_MESSAGE );
+		return;
+	}
+
+	if ( fileSending.started ) {
+		pthread_join ( fileSending.thread , NULL );
+		fileSending.started = 0;
+	}
+
+	char path [ FRAGMENT_DATA_SIZE + 1 ];
+	int pathLength = FrameLength ( frame ) - FRAME_HEADER_SIZE - ( sizeof ( SEND_FILE_COMMAND ) - 1 );
+	memcpy ( path , frame + FRAME_HEADER_SIZE + sizeof ( SEND_FILE_COMMAND ) - 1 , pathLength );
+	path [ pathLength ] = 0;
+
+	char text [ NOTICE_CAPACITY ];
+	pthread_mutex_lock ( &fileSending.lock );
+	int opened = FileTransferOpenSource ( &fileSending.transfer , path , nextFileTransferId++ ) == SUCCESS_OP_CODE;
+	int openError = errno;
+	fileSending.answer = FILE_ANSWER_PENDING;
+	fileSending.running = opened;
+	pthread_mutex_unlock ( &fileSending.lock );
+
+	if ( !opened ) {
+		snprintf ( text , NOTICE_CAPACITY , "Cannot send %.256s: %s" , path , strerror ( openError ) );
+		WriteNotice ( text );
+		return;
+	}
+
+	snprintf ( text , NOTICE_CAPACITY , "Offering %s (%.1f MB)" , fileSending.transfer.name , fileSending.transfer.size / 1e6 );
+	WriteNotice ( text );
+
+	if ( pthread_create ( &fileSending.thread , NULL , RunFileSending , NULL ) != 0 ) {
+		pthread_mutex_lock ( &fileSending.lock );
+		FileTransferClose ( &fileSending.transfer );
+		fileSending.running = 0;
+		pthread_mutex_unlock ( &fileSending.lock );
+		return;
+	}
+
+	fileSending.started = 1;
+}
+
+/* Ends the transfer still being sent, if any, and joins its thread. Sends
+ * blocked on the peer are let go first: it may be gone. */
+void StopFileSending () {
+	pthread_mutex_lock ( &fileSending.lock );
+	fileSending.stopping = 1;
+	pthread_cond_broadcast ( &fileSending.answered );
+	pthread_mutex_unlock ( &fileSending.lock );
+
+	if ( !fileSending.started ) {
+		return;
+	}
+
+	ReliableStopSending ( &reliableSession );
+	pthread_join ( fileSending.thread , NULL );
+	fileSending.started = 0;
+}
+
+void *RunUserInput () {
+	INPUT_ASSEMBLY input = { 0 };
+	char *sendMessage;
+
+	while ( ( sendMessage = ReadInputFrame ( &input ) ) )
+	{
+		if ( IsStatsCommand ( sendMessage ) ) {
+			PrintStats ( STDOUT_FILENO );
+			MessageFree ( sendMessage );
+			continue;
+		}
+
+		if ( IsSendFileCommand ( sendMessage ) ) {
+			StartFileSending ( sendMessage );
+			MessageFree ( sendMessage );
+			continue;
+		}
+
+		if ( IsFileAnswerCommand ( sendMessage ) ) {
+			AnswerFileOffer ( sendMessage );
+			MessageFree ( sendMessage );
+			continue;
+		}
+
+		int quitSessionInput = FrameType ( sendMessage ) == FRAME_TYPE_LEAVE;
+
+		CompressOutgoingFrame ( sendMessage );
+		EnqueueMessage ( sendMessagesQueue , sendMessage );
+		StatsObserveMax ( STATS_SEND_QUEUE_DEPTH_MAX , RingQueueCount ( sendMessagesQueue ) );
+
+		// the printer ends the session once it has drained what was already received
+		if ( quitSessionInput ) {
+			RingQueueClose ( printMessagesQueue );
+			break; // lines after the quit are not sent
+		}
+	}
+
+	InputAssemblyFree ( &input );
+	return NULL;
+}
+
+int SetNonBlocking ( int fd , int *savedFlags ) {
+	*savedFlags = fcntl ( fd , F_GETFL );
+	if ( *savedFlags < 0 ) {
+		return FAILURE_OP_CODE;
+	}
+
+	return fcntl ( fd , F_SETFL , *savedFlags | O_NONBLOCK ) < 0 ? FAILURE_OP_CODE : SUCCESS_OP_CODE;
+}
+
+/* Regular files and /dev/null cannot be registered with epoll (EPERM); they are
+ * always ready, so the loop simply treats them that way. */
+int AddToEpoll ( int epollFD , int fd , unsigned int events ) {
+	struct epoll_event event = { .events = events , .data.fd = fd };
+	return epoll_ctl ( epollFD , EPOLL_CTL_ADD , fd , &event ) < 0 ? FAILURE_OP_CODE : SUCCESS_OP_CODE;
+}
+
+void ModifyEpoll ( int epollFD , int fd , unsigned int events ) {
+	struct epoll_event event = { .events = events , .data.fd = fd };
+	epoll_ctl ( epollFD , EPOLL_CTL_MOD , fd , &event );
+}
+
+/* Sends one frame of input, or runs it if it is a command; returns 1 if the
+ * user quit. */
+/* --encrypt, event loop and io_uring: a message typed before the handshake
+ * completed, or behind one that was, is held so that it goes out in order
+ * once it does. Returns whether it was held (or dropped, past
+ * MAX_HELD_MESSAGES). */
+int HoldUntilKeys ( SCREEN_BUFFER *screen , char *message ) {
+	if ( !encryptMode || ( SecureReady ( &secureSession ) && ListCount ( heldMessages ) == 0 ) ) {
+		return 0;
+	}
+
+	if ( !awaitingKeysNoticeShown ) {
+		RenderNotice ( screen , AWAITING_KEYS_MESSAGE , sizeof ( AWAITING_KEYS_MESSAGE ) - 1 );
+		awaitingKeysNoticeShown = 1;
+	}
+	RetryHandshake ();
+
+	if ( ListCount ( heldMessages ) >= MAX_HELD_MESSAGES || ListAppend ( heldMessages , message ) == FAILURE_OP_CODE ) {
+		StatsAdd ( STATS_DROPS , 1 );
+		FreeMessages ( message );
+	}
+	return 1;
+}
+
+/* The oldest held message once there are keys to seal it, else NULL. */
+char *NextHeldMessage () {
+	if ( ListCount ( heldMessages ) == 0 || !SecureReady ( &secureSession ) ) {
+		return NULL;
+	}
+
+	ListFirst ( heldMessages );
+	return ( char *) ListRemove ( heldMessages );
+}
+
+/* Whatever is still held when the session ends never went out. */
+void DropHeldMessages () {
+	StatsAdd ( STATS_DROPS , ListCount ( heldMessages ) );
+	ListFree ( heldMessages , FreeMessages );
+	heldMessages = NULL;
+}
+
+/* Sends one frame the user typed; returns 1 if it was a quit. */
+int SendEventLoopMessage ( char *sendMessage ) {
+	int quitSessionInput = FrameType ( sendMessage ) == FRAME_TYPE_LEAVE;
+
+	CompressOutgoingFrame ( sendMessage );
+	unsigned long long sendStartNs = StatsNow ();
+	SendMessageBatch ( &sendMessage , 1 );
+	StatsRecord ( STATS_SEND , StatsNow () - sendStartNs );
+	MessageFree ( sendMessage );
+
+	return quitSessionInput;
+}
+
+int SendEventLoopInput ( SCREEN_BUFFER *screen , char *sendMessage ) {
+	if ( IsStatsCommand ( sendMessage ) ) {
+		RenderStats ( screen );
+		MessageFree ( sendMessage );
+		return 0;
+	}
+
+	if ( IsSendFileCommand ( sendMessage ) ) {
+		RenderNotice ( screen , FILE_NEEDS_RELIABLE_MESSAGE , sizeof ( FILE_NEEDS_RELIABLE_MESSAGE ) - 1 );
+		MessageFree ( sendMessage );
+		return 0;
+	}
+
+	int quitSessionInput = FrameType ( sendMessage ) == FRAME_TYPE_LEAVE;
+	if ( HoldUntilKeys ( screen , sendMessage ) ) {
+		return quitSessionInput; // a quit before the handshake: the peer never heard from us
+	}
+
+	return SendEventLoopMessage ( sendMessage );
+}
+
+/* Reads one chunk of input and sends every frame it completes; returns 1 if
+ * the user quit. Clears *inputOpen on EOF. */
+int HandleEventLoopInput ( SCREEN_BUFFER *screen , INPUT_ASSEMBLY *input , int *inputOpen ) {
+	int capacity;
+	char *text = InputAssemblyBuffer ( input , &capacity );
+	if ( !text ) {
+		return 0;
+	}
+
+	int inputLength = read ( STDIN_FILENO , text , capacity );
+	if ( inputLength < 0 && ( errno == EAGAIN || errno == EINTR ) ) {
+		return 0;
+	}
+
+	int endOfInput = inputLength <= 0;
+	if ( endOfInput ) {
+		*inputOpen = 0;
+	}
+
+	int numRead = endOfInput ? 0 : inputLength;
+	char *sendMessage;
+	while ( ( sendMessage = InputAssemblyAdd ( input , numRead , endOfInput ) ) ) {
+		numRead = 0;
+		if ( SendEventLoopInput ( screen , sendMessage ) ) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Drains one receive batch straight into the screen buffer; returns 1 if the remote left. */
+int HandleEventLoopReceive ( SCREEN_BUFFER *screen , RECEIVE_BATCH *batch ) {
+	int numReceived = recvmmsg ( receiveSocketFD , batch -> headers , batch -> batchSize , MSG_DONTWAIT , NULL );
+	if ( numReceived <= 0 ) {
+		return 0;
+	}
+
+	unsigned int receiveStamp = StatsStamp ();
+	CountReceivedBatch ( batch , numReceived );
+
+	for ( int i = 0 ; i < numReceived ; i++ ) {
+		int source = ReceivedSource ( batch , i );
+		if ( source < 0 ) {
+			StatsAdd ( STATS_DROPS , 1 ); // not one of the group
+			continue;
+		}
+
+		char *datagram = ( char *) batch -> vectors [ i ].iov_base;
+		int length = batch -> headers [ i ].msg_len;
+		if ( encryptMode && ( length = OpenReceivedDatagram ( screen , &batch -> addresses [ i ] , datagram , length ) ) < 0 ) {
+			continue;
+		}
+
+		StatsPendingAdd ( &printStamps , STATS_RECEIVE_TO_PRINT , receiveStamp );
+
+		if ( RenderDatagram ( screen , source , datagram , length ) ) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Single-threaded alternative to the four pthreads: stdin, the receive socket and
+ * stdout are multiplexed with epoll and non-blocking I/O. */
+int RunEventLoop () {
+	int epollFD = epoll_create1 ( 0 );
+	if ( epollFD < 0 ) {
+		perror ( "epoll_create1 failed" );
+		return FAILURE_OP_CODE;
+	}
+
+	RECEIVE_BATCH batch;
+	if ( InitReceiveBatch ( &batch , receiveBatchSize ) == FAILURE_OP_CODE ) {
+		close ( epollFD );
+		return FAILURE_OP_CODE;
+	}
+
+	int savedStdinFlags , savedStdoutFlags , savedSocketFlags;
+	SetNonBlocking ( STDIN_FILENO , &savedStdinFlags );
+	SetNonBlocking ( STDOUT_FILENO , &savedStdoutFlags );
+	SetNonBlocking ( receiveSocketFD , &savedSocketFlags );
+
+	INPUT_ASSEMBLY input = { 0 };
+	int inputOpen = 1;
+	int stdinPollable = AddToEpoll ( epollFD , STDIN_FILENO , EPOLLIN ) == SUCCESS_OP_CODE;
+	int stdoutPollable = AddToEpoll ( epollFD , STDOUT_FILENO , 0 ) == SUCCESS_OP_CODE;
+	AddToEpoll ( epollFD , receiveSocketFD , EPOLLIN );
+
+	SCREEN_BUFFER screen = { 0 };
+	RenderSessionStarted ( &screen );
+
+	int sessionEnded = 0;
+	int receivePaused = 0;
+	int waitingForStdout = 0;
+	unsigned long long renderStartNs = 0; // when the first message still waiting to be shown came in
+
+	while ( !sessionEnded ) {
+		FlushScreenBuffer ( &screen );
+
+		if ( screen.length == 0 && renderStartNs ) {
+			StatsPendingRecord ( &printStamps , STATS_RECEIVE_TO_PRINT );
+			StatsRecord ( STATS_RENDER , StatsNow () - renderStartNs );
+			renderStartNs = 0;
+		}
+
+		int backlogged = screen.length > 0;
+		if ( stdoutPollable && backlogged != waitingForStdout ) {
+			ModifyEpoll ( epollFD , STDOUT_FILENO , backlogged ? EPOLLOUT : 0 );
+			waitingForStdout = backlogged;
+		}
+
+		// a terminal that cannot keep up pushes back on the socket instead of growing the buffer
+		int overHighWaterMark = screen.length > SCREEN_BUFFER_HIGH_WATER_MARK;
+		if ( overHighWaterMark != receivePaused ) {
+			ModifyEpoll ( epollFD , receiveSocketFD , overHighWaterMark ? 0 : EPOLLIN );
+			receivePaused = overHighWaterMark;
+		}
+
+		int inputAlwaysReady = inputOpen && !stdinPollable;
+
+		struct epoll_event events [ 4 ];
+		int numEvents = epoll_wait ( epollFD , events , 4 , inputAlwaysReady ? 0 : -1 );
+		if ( numEvents < 0 && errno != EINTR ) {
+			perror ( "epoll_wait failed" );
+			break;
+		}
+
+		for ( int i = 0 ; i < numEvents && !sessionEnded ; i++ ) {
+			int fd = events [ i ].data.fd;
+
+			if ( fd == STDIN_FILENO ) {
+				sessionEnded = HandleEventLoopInput ( &screen , &input , &inputOpen );
+				if ( !inputOpen ) {
+					epoll_ctl ( epollFD , EPOLL_CTL_DEL , STDIN_FILENO , NULL );
+				}
+			}
+			else if ( fd == receiveSocketFD ) {
+				unsigned long long receiveStartNs = StatsNow ();
+				sessionEnded = HandleEventLoopReceive ( &screen , &batch );
+
+				// the handshake may just have completed
+				char *heldMessage;
+				while ( !sessionEnded && ( heldMessage = NextHeldMessage () ) ) {
+					sessionEnded = SendEventLoopMessage ( heldMessage );
+				}
+
+				if ( printStamps.count > 0 && !renderStartNs ) {
+					renderStartNs = receiveStartNs;
+				}
+			}
+		}
+
+		if ( inputAlwaysReady && !sessionEnded ) {
+			sessionEnded = HandleEventLoopInput ( &screen , &input , &inputOpen );
+		}
+	}
+
+	RenderSessionEnded ( &screen );
+
+	fcntl ( STDIN_FILENO , F_SETFL , savedStdinFlags );
+	fcntl ( STDOUT_FILENO , F_SETFL , savedStdoutFlags );
+	fcntl ( receiveSocketFD , F_SETFL , savedSocketFlags );
+
+	FlushScreenBuffer ( &screen );
+	FreeScreenBuffer ( &screen );
+	FreeReceiveBatch ( &batch );
+	DropHeldMessages ();
+	InputAssemblyFree ( &input );
+	close ( epollFD );
+
+	return SUCCESS_OP_CODE;
+}
+
+struct io_uring_sqe *GetUringSqe ( URING *uring ) {
+	struct io_uring_sqe *sqe = UringGetSqe ( uring );
+	if ( !sqe ) {
+		UringSubmitAndWait ( uring , 0 ); // make room
+		sqe = UringGetSqe ( uring );
+	}
+
+	return sqe;
+}
+
+/* --encrypt on the io_uring path, where a send goes out of the message's own
+ * buffer: the frame is moved up behind the sealed frame's header and sealed in
+ * place. Returns the sealed length, or 0 if it cannot go (no keys yet). */
+int SealMessage ( char *message , int length ) {
+	if ( MessageCapacity ( message ) < length + FRAME_SEALED_OVERHEAD ) {
+		return 0;
+	}
+
+	if ( !SecureReady ( &secureSession ) ) {
+		RetryHandshake ();
+		return 0;
+	}
+
+	memmove ( message + SECURE_PLAIN_OFFSET , message , length );
+	StatsAdd ( STATS_DATAGRAMS_SEALED , 1 );
+	return SecureSeal ( &secureSession , message , length );
+}
+
+/* Prepares the send of one frame the user typed, which is owned by the send
+ * until it completes. Sends prepared in the same round are linked behind
+ * *lastSendSqe so they leave in order. Returns 1, or 0 if the frame could not
+ * go and was freed. */
+int PrepUringSend ( URING *uring , char *sendMessage , struct io_uring_sqe **lastSendSqe ) {
+	CompressOutgoingFrame ( sendMessage );
+	FrameSetSequence ( sendMessage , nextSendSequence++ );
+
+	int sendLength = FrameLength ( sendMessage );
+	if ( encryptMode && ( sendLength = SealMessage ( sendMessage , sendLength ) ) == 0 ) {
+		StatsAdd ( STATS_DROPS , 1 );
+		FreeMessages ( sendMessage );
+		return 0;
+	}
+
+	// linked before the next sqe is taken, as taking it may submit the last one to make room
+	if ( *lastSendSqe ) {
+		( *lastSendSqe ) -> flags |= IOSQE_IO_LINK;
+	}
+	struct io_uring_sqe *sqe = GetUringSqe ( uring );
+	UringPrepSend ( sqe , sendSocketFD , sendMessage , sendLength , ( unsigned long long ) sendMessage | URING_TAG_SEND );
+	*lastSendSqe = sqe;
+	return 1;
+}
+
+/* io_uring alternative to the event loop: a multishot recvmsg stays armed on the
+ * receive socket with a provided buffer ring, and sends, stdin reads and stdout
+ * writes are all submitted without blocking. Returns FAILURE_OP_CODE without
+ * touching the terminal if io_uring is unavailable, so the caller can fall back. */
+int RunUringLoop () {
+	URING uring;
+	if ( UringInit ( &uring , URING_NUM_ENTRIES ) == FAILURE_OP_CODE ) {
+		return FAILURE_OP_CODE;
+	}
+
+	// each receive buffer holds the kernel's recvmsg header and the sender's address ahead of the datagram
+	struct msghdr receiveHeader = { .msg_namelen = sizeof ( struct sockaddr_in ) };
+	int receivePrefixSize = sizeof ( struct io_uring_recvmsg_out ) + sizeof ( struct sockaddr_in );
+
+	URING_BUFFER_RING bufferRing;
+	int bufferRingReady = UringInitBufferRing (
+		&uring , &bufferRing , URING_NUM_RECEIVE_BUFFERS , receivePrefixSize + MESSAGE_MAX_SIZE , URING_RECEIVE_BUFFER_GROUP
+	);
+	if ( bufferRingReady == FAILURE_OP_CODE ) {
+		UringFree ( &uring );
+		return FAILURE_OP_CODE;
+	}
+
+	// output is double buffered: one buffer is being written while the other fills
+	SCREEN_BUFFER screens [ 2 ] = { { 0 } , { 0 } };
+	SCREEN_BUFFER *pendingScreen = &screens [ 0 ];
+	SCREEN_BUFFER *flushingScreen = &screens [ 1 ];
+	int flushOffset = 0;
+	int screenWriteInFlight = 0;
+
+	// receive stamps follow their screen buffer: printStamps fill with pendingScreen
+	STATS_PENDING flushingStamps = { .count = 0 };
+	unsigned long long renderStartNs = 0;
+	unsigned long long flushingRenderStartNs = 0;
+
+	INPUT_ASSEMBLY input = { 0 }; // stdin is read straight into the slab buffers that get sent
+	int inputOpen = 1;
+	int inputInFlight = 0;
+	int receiveArmed = 0;
+	int sendsInFlight = 0;
+	int sessionEnded = 0;
+	int sessionEndRendered = 0;
+
+	RenderSessionStarted ( pendingScreen );
+
+	for ( ;; ) {
+		if ( sessionEnded && !sessionEndRendered ) {
+			RenderSessionEnded ( pendingScreen );
+			sessionEndRendered = 1;
+		}
+
+		int outputPending = pendingScreen -> length > 0 || screenWriteInFlight;
+		if ( sessionEnded && !outputPending && sendsInFlight == 0 ) {
+			break;
+		}
+
+		if ( !sessionEnded && !receiveArmed ) {
+			UringPrepRecvMsgMultishot ( GetUringSqe ( &uring ) , receiveSocketFD , &receiveHeader , URING_RECEIVE_BUFFER_GROUP , URING_TAG_RECEIVE );
+			receiveArmed = 1;
+		}
+
+		if ( !sessionEnded && inputOpen && !inputInFlight ) {
+			int capacity;
+			char *text = InputAssemblyBuffer ( &input , &capacity );
+			if ( text ) {
+				UringPrepRead ( GetUringSqe ( &uring ) , STDIN_FILENO , text , capacity , URING_TAG_INPUT );
+				inputInFlight = 1;
+			}
+		}
+
+		if ( !screenWriteInFlight && pendingScreen -> length > 0 ) {
+			SCREEN_BUFFER *swap = flushingScreen;
+			flushingScreen = pendingScreen;
+			pendingScreen = swap;
+			pendingScreen -> length = 0;
+			flushOffset = 0;
+
+			flushingStamps = printStamps;
+			printStamps.count = 0;
+			flushingRenderStartNs = renderStartNs;
+			renderStartNs = 0;
+
+			UringPrepWrite ( GetUringSqe ( &uring ) , STDOUT_FILENO , flushingScreen -> data , flushingScreen -> length , URING_TAG_SCREEN );
+			screenWriteInFlight = 1;
+		}
+
+		int submitted = UringSubmitAndWait ( &uring , 1 );
+		if ( submitted < 0 && errno != EINTR ) {
+			perror ( "io_uring_enter failed" );
+			break;
+		}
+
+		struct io_uring_sqe *lastSendSqe = NULL;
+		struct io_uring_cqe *cqe;
+
+		while ( ( cqe = UringPeekCqe ( &uring ) ) ) {
+			unsigned long long userData = cqe -> user_data;
+			unsigned long long tag = userData & URING_TAG_MASK;
+			int result = cqe -> res;
+			unsigned int flags = cqe -> flags;
+			UringCqeSeen ( &uring );
+
+			if ( tag == URING_TAG_RECEIVE ) {
+				if ( !( flags & IORING_CQE_F_MORE ) ) {
+					receiveArmed = 0; // out of buffers or cancelled; re-armed next round
+				}
+
+				if ( result > receivePrefixSize && ( flags & IORING_CQE_F_BUFFER ) ) {
+					unsigned short bufferID = flags >> IORING_CQE_BUFFER_SHIFT;
+					struct io_uring_recvmsg_out *received = ( struct io_uring_recvmsg_out *) UringBuffer ( &bufferRing , bufferID );
+					const struct sockaddr_in *source = ( const struct sockaddr_in *) ( received + 1 );
+					char *datagram = ( char *) received + receivePrefixSize;
+					result -= receivePrefixSize; // what was copied; payloadlen would count a truncated tail too
+
+					StatsAdd ( STATS_DATAGRAMS_RECEIVED , 1 );
+					StatsAdd ( STATS_BYTES_RECEIVED , result );
+					StatsPendingAdd ( &printStamps , STATS_RECEIVE_TO_PRINT , StatsStamp () );
+					if ( !renderStartNs ) {
+						renderStartNs = StatsNow ();
+					}
+
+					if ( encryptMode ) {
+						result = OpenReceivedDatagram ( pendingScreen , source , datagram , result );
+					}
+
+					if ( !sessionEnded && result >= 0 ) {
+						sessionEnded = RenderDatagram ( pendingScreen , 0 , datagram , result );
+					}
+
+					UringRecycleBuffer ( &bufferRing , bufferID );
+				}
+			}
+			else if ( tag == URING_TAG_INPUT ) {
+				inputInFlight = 0;
+
+				if ( result < 0 && ( result == -EINTR || result == -EAGAIN ) ) {
+					continue;
+				}
+
+				int endOfInput = result <= 0;
+				if ( endOfInput ) {
+					inputOpen = 0;
+				}
+
+				if ( sessionEnded ) {
+					continue;
+				}
+
+				// every frame the read completed goes out, up to a quit
+				int numRead = endOfInput ? 0 : result;
+				char *sendMessage;
+				for ( ; !sessionEnded && ( sendMessage = InputAssemblyAdd ( &input , numRead , endOfInput ) ) ; numRead = 0 ) {
+					if ( IsStatsCommand ( sendMessage ) ) {
+						RenderStats ( pendingScreen );
+						MessageFree ( sendMessage );
+						continue;
+					}
+
+					if ( IsSendFileCommand ( sendMessage ) ) {
+						RenderNotice ( pendingScreen , FILE_NEEDS_RELIABLE_MESSAGE , sizeof ( FILE_NEEDS_RELIABLE_MESSAGE ) - 1 );
+						MessageFree ( sendMessage );
+						continue;
+					}
+
+					int quitSessionInput = FrameType ( sendMessage ) == FRAME_TYPE_LEAVE;
+					if ( !HoldUntilKeys ( pendingScreen , sendMessage ) ) {
+						sendsInFlight += PrepUringSend ( &uring , sendMessage , &lastSendSqe );
+					}
+					sessionEnded = quitSessionInput;
+				}
+			}
+			else if ( tag == URING_TAG_SEND ) {
+				char *sentMessage = ( char *) ( userData & ~URING_TAG_MASK );
+				StatsRecordSince ( STATS_SEND , MessageStamp ( sentMessage ) );
+
+				if ( result < 0 ) {
+					errno = -result;
+					perror ( "message failed to send" );
+					StatsAdd ( STATS_DROPS , 1 );
+				}
+				else {
+					StatsAdd ( STATS_MESSAGES_SENT , 1 );
+					StatsAdd ( STATS_DATAGRAMS_SENT , 1 );
+					StatsAdd ( STATS_BYTES_SENT , result );
+				}
+
+				FreeMessages ( sentMessage );
+				sendsInFlight -= 1;
+			}
+			else if ( tag == URING_TAG_SCREEN ) {
+				if ( result > 0 && flushOffset + result < flushingScreen -> length ) {
+					// short write: resubmit the remainder
+					flushOffset += result;
+					UringPrepWrite (
+						GetUringSqe ( &uring ) , STDOUT_FILENO ,
+						flushingScreen -> data + flushOffset , flushingScreen -> length - flushOffset ,
+						URING_TAG_SCREEN
+					);
+					continue;
+				}
+
+				flushingScreen -> length = 0;
+				screenWriteInFlight = 0;
+
+				StatsPendingRecord ( &flushingStamps , STATS_RECEIVE_TO_PRINT );
+				if ( flushingRenderStartNs ) {
+					StatsRecord ( STATS_RENDER , StatsNow () - flushingRenderStartNs );
+				}
+			}
+		}
+
+		// the handshake may just have completed; a quit held behind the rest still goes out last
+		char *heldMessage;
+		while ( ( heldMessage = NextHeldMessage () ) ) {
+			sendsInFlight += PrepUringSend ( &uring , heldMessage , &lastSendSqe );
+		}
+	}
+
+	DropHeldMessages ();
+
+	// closing the ring cancels the still-armed receive and any pending stdin read
+	UringFreeBufferRing ( &uring , &bufferRing );
+	UringFree ( &uring );
+	InputAssemblyFree ( &input );
+	FreeScreenBuffer ( &screens [ 0 ] );
+	FreeScreenBuffer ( &screens [ 1 ] );
+
+	return SUCCESS_OP_CODE;
+}
+
+typedef struct benchResult {
+	unsigned long numReceived;
+	unsigned long numBytes; // payload bytes
+	unsigned long long firstReceiveNs;
+	unsigned long long lastReceiveNs;
+	unsigned long long latencyNs [ 4 ]; // p50 , p99 , p999 , max
+} BENCH_RESULT;
+
+/* Bench messages start with the CLOCK_MONOTONIC time they were due to be sent,
+ * which both processes share on one host. */
+void BenchDelivered ( BENCH_RESULT *benchResult , const char *text , int length ) {
+	unsigned long long sentNs;
+	if ( length < ( int ) sizeof ( sentNs ) ) {
+		return;
+	}
+	memcpy ( &sentNs , text , sizeof ( sentNs ) );
+
+	unsigned long long nowNs = StatsNow ();
+	StatsRecord ( STATS_BENCH_LATENCY , nowNs > sentNs ? nowNs - sentNs : 0 );
+
+	if ( benchResult -> numReceived == 0 ) {
+		benchResult -> firstReceiveNs = nowNs;
+	}
+	benchResult -> lastReceiveNs = nowNs;
+	benchResult -> numReceived += 1;
+	benchResult -> numBytes += length;
+
+	// closed loop: every delivery is acknowledged by echoing its timestamp back
+	if ( benchWindow > 0 ) {
+		char echo [ FRAME_HEADER_SIZE + sizeof ( sentNs ) ];
+		FRAME_HEADER echoHeader = {
+			.version = FRAME_PROTOCOL_VERSION ,
+			.type = FRAME_TYPE_DATA ,
+			.flags = 0 ,
+			.sequence = 0 ,
+			.payloadLength = sizeof ( sentNs )
+		};
+		FrameEncodeHeader ( echo , &echoHeader );
+		memcpy ( echo + FRAME_HEADER_SIZE , &sentNs , sizeof ( sentNs ) );
+		SendMessage ( echo );
+	}
+}
+
+int BenchDataFrame ( const FRAME_HEADER *header , const char *payload , void *result ) {
+	BenchDelivered ( ( BENCH_RESULT *) result , payload , header -> payloadLength );
+	return 0;
+}
+
+/* a message larger than one frame counts once it is whole */
+int BenchFragmentFrame ( const FRAME_HEADER *header , const char *payload , void *result ) {
+	int messageLength;
+	char *message = ReassemblerAdd ( &reassembler , 0 , header , payload , &messageLength );
+	if ( message ) {
+		BenchDelivered ( ( BENCH_RESULT *) result , message , messageLength );
+		free ( message );
+	}
+
+	return 0;
+}
+
+int BenchLeaveFrame ( const FRAME_HEADER *header , const char *payload , void *result ) {
+	return 1;
+}
+
+const FRAME_HANDLER BENCH_SINK_HANDLERS [ FRAME_NUM_TYPES ] = {
+	[ FRAME_TYPE_DATA ] = BenchDataFrame ,
+	[ FRAME_TYPE_LEAVE ] = BenchLeaveFrame ,
+	[ FRAME_TYPE_FRAGMENT ] = BenchFragmentFrame
+};
+
+int CountDataFrame ( const FRAME_HEADER *header , const char *payload , void *count ) {
+	*( int *) count += 1;
+	return 0;
+}
+
+const FRAME_HANDLER BENCH_ECHO_HANDLERS [ FRAME_NUM_TYPES ] = {
+	[ FRAME_TYPE_DATA ] = CountDataFrame
+};
+
+/* Asks the bench relay to put fd's address in room. */
+void SendBenchJoin ( int fd , const char *room ) {
+	struct sockaddr_in relayAddr;
+	memset ( &relayAddr , 0 , sizeof ( relayAddr ) );
+	relayAddr.sin_family = AF_INET;
+	relayAddr.sin_addr.s_addr = htonl ( INADDR_LOOPBACK );
+	relayAddr.sin_port = htons ( benchPort + BENCH_RELAY_PORT_OFFSET );
+
+	char joinFrame [ FRAME_HEADER_SIZE + FRAME_MAX_ROOM_NAME_SIZE ];
+	int length = EncodeJoinFrame ( joinFrame , room );
+	sendto ( fd , joinFrame , length , 0 , ( struct sockaddr *) &relayAddr , sizeof ( relayAddr ) );
+}
+
+/* Forks the bench relay on benchPort + 2. Its output comes back through *output,
+ * starting with the line it prints once every worker is listening. */
+pid_t StartBenchRelay ( FILE **output ) {
+	char relayPortText [ 16 ];
+	snprintf ( relayPortText , sizeof ( relayPortText ) , "%d" , benchPort + BENCH_RELAY_PORT_OFFSET );
+
+	int outputPipe [ 2 ];
+	if ( pipe ( outputPipe ) < 0 ) {
+		perror ( "pipe failed" );
+		return -1;
+	}
+
+	pid_t relayPID = fork ();
+	if ( relayPID < 0 ) {
+		perror ( "fork failed" );
+		return -1;
+	}
+
+	if ( relayPID == 0 ) {
+		dup2 ( outputPipe [ 1 ] , STDOUT_FILENO );
+		close ( outputPipe [ 0 ] );
+		close ( outputPipe [ 1 ] );
+		exit ( RunRelay ( relayPortText , benchRelayWorkers ) == SUCCESS_OP_CODE ? 0 : -1 );
+	}
+
+	close ( outputPipe [ 1 ] );
+	*output = fdopen ( outputPipe [ 0 ] , "r" );
+
+	char line [ 256 ];
+	if ( !*output || !fgets ( line , sizeof ( line ) , *output ) ) {
+		fprintf ( stderr , "bench relay failed to start\n" );
+		waitpid ( relayPID , NULL , 0 );
+		return -1;
+	}
+
+	return relayPID;
+}
+
+/* Stops the bench relay and totals its per-worker report: the clients still
+ * joined and the datagrams it dropped. */
+void StopBenchRelay ( pid_t relayPID , FILE *output , unsigned long *numClients , unsigned long *numDrops ) {
+	kill ( relayPID , SIGTERM );
+	if ( benchIdleSinkFD >= 0 ) {
+		close ( benchIdleSinkFD );
+		benchIdleSinkFD = -1;
+	}
+
+	char line [ 256 ];
+	while ( fgets ( line , sizeof ( line ) , output ) ) {
+		unsigned long workerClients , workerDrops;
+		int parsed = sscanf (
+			line , "relay worker %*d: %lu clients, %*u datagrams in, %*u delivered, %lu dropped" ,
+			&workerClients , &workerDrops
+		);
+		if ( parsed == 2 ) {
+			*numClients += workerClients;
+			*numDrops += workerDrops;
+		}
+	}
+
+	fclose ( output );
+	waitpid ( relayPID , NULL , 0 );
+}
+
+/* Joins benchRelayClients idle clients to the bench relay, each from its own
+ * loopback address (127.1.x.y) so every one is a distinct member, spread over
+ * BENCH_RELAY_IDLE_ROOMS rooms that carry no traffic; then benchRelayRoomClients
+ * more to the bench's room, so every message is also forwarded to each of them.
+ * Their sockets are closed once joined; one socket on the wildcard address then
+ * takes in what is forwarded to them, so that costs the relay no more than a
+ * live client would, instead of an ICMP error per datagram. */
+void JoinBenchIdleClients () {
+	char room [ 32 ];
+
+	for ( int i = 0 ; i < benchRelayClients + benchRelayRoomClients ; i++ ) {
+		int clientFD = socket ( AF_INET , SOCK_DGRAM , 0 );
+		if ( clientFD < 0 ) {
+			perror ( "cannot create bench client socket" );
+			return;
+		}
+
+		struct sockaddr_in clientAddr;
+		memset ( &clientAddr , 0 , sizeof ( clientAddr ) );
+		clientAddr.sin_family = AF_INET;
+		clientAddr.sin_addr.s_addr = htonl ( ( 127U << 24 ) | ( 1U << 16 ) | ( i & 0xffff ) );
+		clientAddr.sin_port = htons ( benchPort + BENCH_RELAY_PORT_OFFSET + 1 );
+
+		if ( bind ( clientFD , ( struct sockaddr *) &clientAddr , sizeof ( clientAddr ) ) == 0 ) {
+			if ( i < benchRelayClients ) {
+				snprintf ( room , sizeof ( room ) , "idle-%d" , i % BENCH_RELAY_IDLE_ROOMS );
+			}
+			else {
+				snprintf ( room , sizeof ( room ) , "%s" , BENCH_RELAY_ROOM );
+			}
+			SendBenchJoin ( clientFD , room );
+		}
+		close ( clientFD );
+
+		if ( ( i + 1 ) % BENCH_RELAY_JOINS_PER_MS == 0 ) {
+			usleep ( 1000 );
+		}
+	}
+
+	if ( benchRelayRoomClients == 0 ) {
+		return;
+	}
+
+	struct sockaddr_in sinkAddr;
+	memset ( &sinkAddr , 0 , sizeof ( sinkAddr ) );
+	sinkAddr.sin_family = AF_INET;
+	sinkAddr.sin_addr.s_addr = htonl ( INADDR_ANY );
+	sinkAddr.sin_port = htons ( benchPort + BENCH_RELAY_PORT_OFFSET + 1 );
+
+	benchIdleSinkFD = socket ( AF_INET , SOCK_DGRAM , 0 );
+	if ( benchIdleSinkFD >= 0 && bind ( benchIdleSinkFD , ( struct sockaddr *) &sinkAddr , sizeof ( sinkAddr ) ) < 0 ) {
+		perror ( "cannot bind the bench idle clients' sink" );
+		close ( benchIdleSinkFD );
+		benchIdleSinkFD = -1;
+	}
+}
+
+/* The receiving instance: the real RunReceiving thread feeds the print queue and
+ * this sink stands in for the screen. Ends on the sender's leave frame, or after
+ * BENCH_IDLE_TIMEOUT_MS of silence if that was lost, and reports over resultFD. */
+void RunBenchReceiver ( int readyFD , int resultFD ) {
+	InitReceiveSocketFD ();
+	InitSendSocketFD ();
+	StartSendShim ();
+	StartReliableSession ();
+	StartCompression ();
+	printMessagesQueue = RingQueueCreate ( MESSAGE_QUEUE_CAPACITY );
+
+	int receiverReady = receiveSocketFD != FAILED_SOCKET_FD && sendSocketFD != FAILED_SOCKET_FD && printMessagesQueue;
+	if ( receiverReady && benchRelayWorkers > 0 ) {
+		SendBenchJoin ( receiveSocketFD , BENCH_RELAY_ROOM );
+	}
+
+	write ( readyFD , &receiverReady , sizeof ( receiverReady ) );
+	if ( !receiverReady ) {
+		exit ( -1 );
+	}
+
+	pthread_create ( &recvThread , NULL , RunReceiving , NULL );
+
+	BENCH_RESULT result = { 0 };
+	unsigned long long joinedNs = StatsNow ();
+	for ( ;; ) {
+		char *datagram = ( char *) RingQueuePopWait ( printMessagesQueue , BENCH_IDLE_TIMEOUT_MS );
+		if ( !datagram ) {
+			break;
+		}
+
+		// it only listens, so it renews its join as a chat client would
+		if ( benchRelayWorkers > 0 && StatsNow () - joinedNs >= ( unsigned long long ) RELAY_JOIN_RENEW_MS * 1000000ULL ) {
+			SendBenchJoin ( receiveSocketFD , BENCH_RELAY_ROOM );
+			joinedNs = StatsNow ();
+		}
+
+		int senderLeft = FrameDispatch ( datagram , MessageLength ( datagram ) , BENCH_SINK_HANDLERS , &result );
+		MessageFree ( datagram );
+
+		if ( senderLeft ) {
+			break;
+		}
+	}
+
+	result.latencyNs [ 0 ] = StatsPercentile ( STATS_BENCH_LATENCY , 50.0 );
+	result.latencyNs [ 1 ] = StatsPercentile ( STATS_BENCH_LATENCY , 99.0 );
+	result.latencyNs [ 2 ] = StatsPercentile ( STATS_BENCH_LATENCY , 99.9 );
+	result.latencyNs [ 3 ] = StatsPercentile ( STATS_BENCH_LATENCY , 100.0 );
+
+	write ( resultFD , &result , sizeof ( result ) );
+
+	if ( sendShim ) {
+		// the last acks may still be waiting out the shim's delay
+		pthread_cancel ( recvThread );
+		pthread_join ( recvThread , NULL );
+		ShimFree ( sendShim );
+	}
+
+	exit ( 0 ); // the receiving thread is still blocked in recvmmsg
+}
+
+/* --encrypt: the bench's two ends agree keys in process, each taking the
+ * other's handshake frame as it would off the wire, before the receiver is
+ * forked with its own. An open loop sender reads nothing off its socket, so a
+ * handshake there could never complete. */
+int PairBenchSessions ( SECURE_SESSION *receiverSession ) {
+	SECURE_SESSION *ends [ 2 ] = { &secureSession , receiverSession };
+	for ( int i = 0 ; i < 2 ; i++ ) {
+		if ( SecureInit ( ends [ i ] , hasPresharedKey ? presharedKey : NULL ) == FAILURE_OP_CODE ) {
+			return FAILURE_OP_CODE;
+		}
+	}
+
+	for ( int i = 0 ; i < 2 ; i++ ) {
+		char frame [ SECURE_MAX_HANDSHAKE_SIZE ];
+		int length = SecureEncodeHandshake ( ends [ i ] , frame , 0 );
+
+		FRAME_HEADER header;
+		int replyWanted;
+		int keysChanged;
+		if ( FrameDecodeHeader ( frame , length , &header ) == FAILURE_OP_CODE
+			|| SecureAcceptHandshake ( ends [ 1 - i ] , &header , frame + FRAME_HEADER_SIZE , &replyWanted , &keysChanged ) == FAILURE_OP_CODE ) {
+			return FAILURE_OP_CODE;
+		}
+	}
+
+	return SUCCESS_OP_CODE;
+}
+
+/* Picks the next payload size from the --sizes mix (weighted, fixed seed so runs
+ * are repeatable). */
+int NextBenchSize ( unsigned int *seed ) {
+	int totalWeight = 0;
+	for ( int i = 0 ; i < benchNumSizes ; i++ ) {
+		totalWeight += benchWeights [ i ];
+	}
+
+	int pick = rand_r ( seed ) % totalWeight;
+	for ( int i = 0 ; i < benchNumSizes ; i++ ) {
+		pick -= benchWeights [ i ];
+		if ( pick < 0 ) {
+			return benchSizes [ i ];
+		}
+	}
+
+	return benchSizes [ benchNumSizes - 1 ];
+}
+
+char *NewBenchFrame ( int payloadLength , unsigned long long sentNs ) {
+	char *frame = MessageAlloc ( FRAME_HEADER_SIZE + payloadLength );
+	if ( !frame ) {
+		return NULL;
+	}
+
+	FRAME_HEADER header = {
+		.version = FRAME_PROTOCOL_VERSION ,
+		.type = FRAME_TYPE_DATA ,
+		.flags = 0 ,
+		.sequence = 0 ,
+		.payloadLength = payloadLength
+	};
+	FrameEncodeHeader ( frame , &header );
+
+	memcpy ( frame + FRAME_HEADER_SIZE , &sentNs , sizeof ( sentNs ) );
+	memset ( frame + FRAME_HEADER_SIZE + sizeof ( sentNs ) , 'x' , payloadLength - sizeof ( sentNs ) );
+	MessageSetStamp ( frame , StatsStamp () );
+	return frame;
+}
+
+/* A bench message too long for one frame goes out as fragments, as a long paste
+ * would; the time it was due to be sent starts the first one. */
+void QueueBenchFragments ( int length , unsigned long long sentNs ) {
+	unsigned int messageId = nextFragmentedMessageId++;
+	int numFragments = ( length + FRAGMENT_DATA_SIZE - 1 ) / FRAGMENT_DATA_SIZE;
+
+	for ( int index = 0 ; index < numFragments ; index++ ) {
+		int last = index == numFragments - 1;
+		int textLength = last ? length - index * FRAGMENT_DATA_SIZE : FRAGMENT_DATA_SIZE;
+
+		char *frame = MessageAlloc ( FRAGMENT_TEXT_OFFSET + textLength );
+		if ( !frame ) {
+			StatsAdd ( STATS_DROPS , 1 );
+			return;
+		}
+
+		memset ( frame + FRAGMENT_TEXT_OFFSET , 'x' , textLength );
+		if ( index == 0 ) {
+			memcpy ( frame + FRAGMENT_TEXT_OFFSET , &sentNs , sizeof ( sentNs ) );
+		}
+
+		FragmentEncode ( frame , messageId , index , textLength , last );
+		MessageSetStamp ( frame , StatsStamp () );
+		EnqueueMessage ( sendMessagesQueue , frame );
+		StatsAdd ( STATS_FRAGMENTS_SENT , 1 );
+	}
+}
+
+/* Closed loop: blocks until fewer than benchWindow messages are unacknowledged.
+ * An echo that never comes (loss) frees the whole window after the idle timeout. */
+void WaitForBenchWindow ( int *numOutstanding , unsigned long *numWindowTimeouts ) {
+	while ( *numOutstanding >= benchWindow ) {
+		char *echo = ( char *) RingQueuePopWait ( printMessagesQueue , BENCH_IDLE_TIMEOUT_MS );
+		if ( !echo ) {
+			*numOutstanding = 0;
+			*numWindowTimeouts += 1;
+			return;
+		}
+
+		int numEchoed = 0;
+		FrameDispatch ( echo , MessageLength ( echo ) , BENCH_ECHO_HANDLERS , &numEchoed );
+		MessageFree ( echo );
+
+		*numOutstanding -= numEchoed;
+	}
+}
+
+/* Headless load generator: forks a receiving instance on benchPort, then pushes
+ * benchNumMessages through the real sending thread (batching and coalescing
+ * options apply) either open loop at benchRate messages/s (0 = flat out) or
+ * closed loop with benchWindow messages in flight. With --relay-workers the
+ * messages go through a forked relay instead, which also holds
+ * benchRelayClients idle members elsewhere and benchRelayRoomClients in the
+ * bench's room. Prints one JSON line. */
+int RunBench () {
+	static char benchPortText [ 16 ];
+	static char echoPortText [ 16 ];
+	static char relayPortText [ 16 ];
+	snprintf ( benchPortText , sizeof ( benchPortText ) , "%d" , benchPort );
+	snprintf ( echoPortText , sizeof ( echoPortText ) , "%d" , benchPort + 1 );
+	snprintf ( relayPortText , sizeof ( relayPortText ) , "%d" , benchPort + BENCH_RELAY_PORT_OFFSET );
+	sendHostName = "127.0.0.1";
+
+	int readyPipe [ 2 ];
+	int resultPipe [ 2 ];
+	if ( pipe ( readyPipe ) < 0 || pipe ( resultPipe ) < 0 ) {
+		perror ( "pipe failed" );
+		return FAILURE_OP_CODE;
+	}
+
+	// through a relay: the receiver and the sender join one room, the idle clients others
+	pid_t relayPID = -1;
+	FILE *relayOutput = NULL;
+	unsigned long relayNumClients = 0;
+	unsigned long relayNumDrops = 0;
+	if ( benchRelayWorkers > 0 ) {
+		relayPID = StartBenchRelay ( &relayOutput );
+		if ( relayPID < 0 ) {
+			return FAILURE_OP_CODE;
+		}
+
+		JoinBenchIdleClients ();
+	}
+
+	SECURE_SESSION receiverSession;
+	if ( encryptMode && PairBenchSessions ( &receiverSession ) == FAILURE_OP_CODE ) {
+		fprintf ( stderr , "bench keys could not be agreed\n" );
+		return FAILURE_OP_CODE;
+	}
+
+	pid_t receiverPID = fork ();
+	if ( receiverPID < 0 ) {
+		perror ( "fork failed" );
+		if ( relayPID > 0 ) {
+			StopBenchRelay ( relayPID , relayOutput , &relayNumClients , &relayNumDrops );
+		}
+		return FAILURE_OP_CODE;
+	}
+
+	if ( receiverPID == 0 ) {
+		receivePort = benchPortText;
+		sendPort = echoPortText;
+		memcpy ( &secureSession , &receiverSession , sizeof ( SECURE_SESSION ) );
+		RunBenchReceiver ( readyPipe [ 1 ] , resultPipe [ 1 ] );
+	}
+
+	int receiverReady = 0;
+	read ( readyPipe [ 0 ] , &receiverReady , sizeof ( receiverReady ) );
+	if ( !receiverReady ) {
+		fprintf ( stderr , "bench receiver failed to start\n" );
+		waitpid ( receiverPID , NULL , 0 );
+		if ( relayPID > 0 ) {
+			StopBenchRelay ( relayPID , relayOutput , &relayNumClients , &relayNumDrops );
+		}
+		return FAILURE_OP_CODE;
+	}
+
+	receivePort = echoPortText;
+	sendPort = relayPID > 0 ? relayPortText : benchPortText;
+	InitReceiveSocketFD ();
+	InitSendSocketFD ();
+	StartSendShim ();
+	StartReliableSession ();
+	StartCompression ();
+
+	sendMessagesQueue = RingQueueCreate ( MESSAGE_QUEUE_CAPACITY );
+	printMessagesQueue = RingQueueCreate ( MESSAGE_QUEUE_CAPACITY ); // echoes, closed loop only
+	if ( receiveSocketFD == FAILED_SOCKET_FD || sendSocketFD == FAILED_SOCKET_FD || !sendMessagesQueue || !printMessagesQueue ) {
+		kill ( receiverPID , SIGTERM );
+		waitpid ( receiverPID , NULL , 0 );
+		if ( relayPID > 0 ) {
+			StopBenchRelay ( relayPID , relayOutput , &relayNumClients , &relayNumDrops );
+		}
+		return FAILURE_OP_CODE;
+	}
+
+	if ( relayPID > 0 ) {
+		SendBenchJoin ( sendSocketFD , BENCH_RELAY_ROOM );
+		usleep ( BENCH_RELAY_SETTLE_MS * 1000 );
+	}
+
+	// the receiving thread brings back echoes (closed loop) and acks (reliable mode)
+	int receivesReplies = benchWindow > 0 || reliableMode;
+	pthread_create ( &sendThread , NULL , RunSending , NULL );
+	if ( receivesReplies ) {
+		pthread_create ( &recvThread , NULL , RunReceiving , NULL );
+	}
+
+	unsigned int seed = 1;
+	int numOutstanding = 0;
+	unsigned long numWindowTimeouts = 0;
+	unsigned long long startNs = StatsNow ();
+
+	for ( int i = 0 ; i < benchNumMessages ; i++ ) {
+		unsigned long long sentNs;
+
+		if ( benchWindow > 0 ) {
+			WaitForBenchWindow ( &numOutstanding , &numWindowTimeouts );
+			sentNs = StatsNow ();
+		}
+		else if ( benchRate > 0 ) {
+			// stamped with the scheduled time, so a stalled sender shows up as latency
+			sentNs = startNs + ( unsigned long long ) i * 1000000000ULL / benchRate;
+			struct timespec due = { .tv_sec = sentNs / 1000000000ULL , .tv_nsec = sentNs % 1000000000ULL };
+			while ( clock_nanosleep ( CLOCK_MONOTONIC , TIMER_ABSTIME , &due , NULL ) == EINTR );
+		}
+		else {
+			sentNs = StatsNow ();
+		}
+
+		int payloadLength = NextBenchSize ( &seed );
+		if ( FRAME_HEADER_SIZE + payloadLength > maxPlainDatagramSize ) {
+			QueueBenchFragments ( payloadLength , sentNs );
+			numOutstanding += 1;
+			continue;
+		}
+
+		char *frame = NewBenchFrame ( payloadLength , sentNs );
+		if ( !frame ) {
+			StatsAdd ( STATS_DROPS , 1 );
+			continue;
+		}
+
+		EnqueueMessage ( sendMessagesQueue , frame );
+		numOutstanding += 1;
+	}
+
+	// the leave frame queues behind the data, so the receiver stops once everything sent has arrived
+	char *leaveFrame = MessageAlloc ( FRAME_HEADER_SIZE + sizeof ( USER_LEFT_CHAT_MESSAGE ) );
+	if ( leaveFrame ) {
+		memcpy ( leaveFrame + FRAME_HEADER_SIZE , USER_LEFT_CHAT_MESSAGE , sizeof ( USER_LEFT_CHAT_MESSAGE ) - 1 );
+		FrameInput ( leaveFrame , sizeof ( USER_LEFT_CHAT_MESSAGE ) - 1 );
+		MessageSetStamp ( leaveFrame , StatsStamp () );
+		EnqueueMessage ( sendMessagesQueue , leaveFrame );
+	}
+
+	RingQueueClose ( sendMessagesQueue );
+	pthread_join ( sendThread , NULL );
+
+	BENCH_RESULT result = { 0 };
+	read ( resultPipe [ 0 ] , &result , sizeof ( result ) );
+	waitpid ( receiverPID , NULL , 0 );
+
+	if ( relayPID > 0 ) {
+		StopBenchRelay ( relayPID , relayOutput , &relayNumClients , &relayNumDrops );
+	}
+
+	if ( receivesReplies ) {
+		pthread_cancel ( recvThread );
+		pthread_join ( recvThread , NULL );
+	}
+
+	unsigned long numDrops = StatsCounter ( STATS_DROPS );
+	unsigned long numSent = numDrops < ( unsigned long ) benchNumMessages ? benchNumMessages - numDrops : 0;
+	unsigned long numLost = numSent > result.numReceived ? numSent - result.numReceived : 0;
+	unsigned long long endNs = result.lastReceiveNs > startNs ? result.lastReceiveNs : StatsNow ();
+	double seconds = ( endNs - startNs ) / 1e9;
+
+	printf (
+		"{\"loop\":\"%s\",\"rate\":%d,\"window\":%d,\"recv_batch\":%d,\"coalesce_bytes\":%d,"
+		"\"relay_workers\":%d,\"relay_clients\":%lu,\"relay_room_clients\":%d,\"relay_drops\":%lu,"
+		"\"reliable\":%d,\"encrypted\":%d,\"crypto_kernel\":\"%s\",\"shim_loss_pct\":%.2f,\"shim_delay_ms\":%d,\"shim_rate_mbps\":%.1f,"
+		"\"messages\":%d,\"sent\":%lu,\"received\":%lu,\"lost\":%lu,\"loss_pct\":%.3f,\"send_drops\":%lu,\"window_timeouts\":%lu,"
+		"\"retransmissions\":%lu,\"retransmission_timeouts\":%lu,"
+		"\"seconds\":%.6f,\"msgs_per_sec\":%.1f,\"bytes_per_sec\":%.1f,"
+		"\"latency_us\":{\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}}\n" ,
+		benchWindow > 0 ? "closed" : "open" ,
+		benchRate ,
+		benchWindow ,
+		receiveBatchSize ,
+		coalesceMaxBytes ,
+		benchRelayWorkers ,
+		relayNumClients ,
+		benchRelayRoomClients ,
+		relayNumDrops ,
+		reliableMode ,
+		encryptMode ,
+		encryptMode ? CryptoKernelName ( CryptoKernel () ) : "none" ,
+		shimLossPercent ,
+		shimDelayMs ,
+		shimRateMbps ,
+		benchNumMessages ,
+		numSent ,
+		result.numReceived ,
+		numLost ,
+		numSent > 0 ? 100.0 * numLost / numSent : 0.0 ,
+		numDrops ,
+		numWindowTimeouts ,
+		StatsCounter ( STATS_RETRANSMISSIONS ) ,
+		StatsCounter ( STATS_RETRANSMISSION_TIMEOUTS ) ,
+		seconds ,
+		seconds > 0 ? result.numReceived / seconds : 0.0 ,
+		seconds > 0 ? result.numBytes / seconds : 0.0 ,
+		result.latencyNs [ 0 ] / 1000.0 ,
+		result.latencyNs [ 1 ] / 1000.0 ,
+		result.latencyNs [ 2 ] / 1000.0 ,
+		result.latencyNs [ 3 ] / 1000.0
+	);
+
+	CleanUp ();
+	return SUCCESS_OP_CODE;
+}
+
+void PrintUsage () {
+	WriteToScreen ( "terminal-chat [your port number] [remote machine name] [remote port number] [options]\n" );
+	WriteToScreen ( "terminal-chat [your port number] --peers HOST:PORT,... [options]\n" );
+	WriteToScreen ( "terminal-chat [your port number] --relay HOST:PORT [--room NAME] [options]\n" );
+	WriteToScreen ( "options:\n" );
+	WriteToScreen ( "  --peers HOST:PORT,...  group chat: every message goes to each peer (the remote, if given, is one)\n" );
+	WriteToScreen ( "  --peers-file PATH      add the peers listed in PATH, one HOST:PORT per line\n" );
+	WriteToScreen ( "  --relay HOST:PORT      chat through a relay instead of with each peer directly\n" );
+	WriteToScreen ( "  --room NAME            room to join on the relay (default lobby)\n" );
+	WriteToScreen ( "  --reliable             acknowledge, retransmit and order every message (two peers, threaded path;\n" );
+	WriteToScreen ( "                         both ends need it; one message per datagram, so no coalescing)\n" );
+	WriteToScreen ( "                         /send-file PATH then offers a file, saved in the receiver's directory\n" );
+	WriteToScreen ( "                         once it answers /accept (or /reject)\n" );
+	WriteToScreen ( "  --compress             send messages LZ compressed when that pays, once the peer has said it can\n" );
+	WriteToScreen ( "                         decode them (two peers; the other end needs no option)\n" );
+	WriteToScreen ( "  --compress-dict PATH   --compress, primed with PATH (say, a sample of past logs); used for the\n" );
+	WriteToScreen ( "                         frames sent to a peer that loaded the same file\n" );
+	WriteToScreen ( "  --encrypt              seal every datagram with ChaCha20-Poly1305 under keys agreed by X25519 (two\n" );
+	WriteToScreen ( "                         peers; both ends need it); compare the fingerprint both ends print\n" );
+	WriteToScreen ( "  --psk-file PATH        --encrypt, with the keys also bound to the pre-shared key hashed from PATH\n" );
+	WriteToScreen ( "                         (32 bytes or more, say from /dev/urandom); only ends holding it can talk\n" );
+	WriteToScreen ( "  --shim-loss PCT        test shim: drop PCT% of the datagrams sent\n" );
+	WriteToScreen ( "  --shim-delay-ms T      test shim: delay every datagram sent by T ms\n" );
+	WriteToScreen ( "  --shim-rate-mbps R     test shim: send through an R Mbit/s bottleneck with a 50 ms queue\n" );
+	WriteToScreen ( "  --recv-batch N         datagrams taken per recvmmsg call (1-256, default 32)\n" );
+	WriteToScreen ( "  --recv-timeout-ms T    how long to wait for a receive batch to fill (default 0)\n" );
+	WriteToScreen ( "  --coalesce-bytes N     pack several messages into datagrams of up to N bytes\n" );
+	WriteToScreen ( "  --coalesce-delay-ms T  longest a message waits to be packed (default 1)\n" );
+	WriteToScreen ( "  --max-fps N            most screen flushes per second while messages burst (default 0 = no limit)\n" );
+	WriteToScreen ( "  --event-loop           run on one thread with epoll instead of four threads\n" );
+	WriteToScreen ( "  --io-uring             run on one thread with io_uring (falls back to threads)\n" );
+	WriteToScreen ( "  --stats-file PATH      keep PATH updated with a stats snapshot (also: /stats, SIGUSR1)\n" );
+	WriteToScreen ( "  --stats-interval-ms T  how often --stats-file is rewritten (default 1000)\n" );
+	WriteToScreen ( "\nterminal-chat bench [options]\n" );
+	WriteToScreen ( "  loopback load test through the threaded send/receive path; prints one JSON line\n" );
+	WriteToScreen ( "  --messages N           messages to send (default 100000)\n" );
+	WriteToScreen ( "  --sizes S:W,...        payload size mix, size S with weight W (default 64:1); sizes\n" );
+	WriteToScreen ( "                         past one frame are sent as fragments\n" );
+	WriteToScreen ( "  --rate N               open loop at N messages per second (default 0 = unpaced)\n" );
+	WriteToScreen ( "  --closed-loop W        keep W messages in flight, each acknowledged by the receiver\n" );
+	WriteToScreen ( "  --port P               use ports P and P+1 (default 7300)\n" );
+	WriteToScreen ( "  --relay-workers W      send through a relay with W workers on port P+2\n" );
+	WriteToScreen ( "  --relay-clients N      idle clients joined to that relay, in 64 other rooms\n" );
+	WriteToScreen ( "  --relay-room-clients N idle clients joined to the sender's room, so each message fans out to N more\n" );
+	WriteToScreen ( "  the batching, coalescing, reliable, compression, encryption, shim and stats options above also apply\n" );
+	WriteToScreen ( "\nterminal-chat relay [port number] [options]\n" );
+	WriteToScreen ( "  forwards every client's messages to the rest of its room until SIGINT/SIGTERM\n" );
+	WriteToScreen ( "  --workers N            worker threads, each with an SO_REUSEPORT socket (default: one per CPU)\n" );
+}
+
+/* Reads a "size:weight,size:weight" mix; a missing weight counts as 1. Sizes are
+ * clamped so the send timestamp and the frame header always fit one datagram. */
+void ParseBenchSizes ( char *mix ) {
+	benchNumSizes = 0;
+
+	for ( char *entry = strtok ( mix , "," ) ; entry && benchNumSizes < MAX_BENCH_SIZES ; entry = strtok ( NULL , "," ) ) {
+		int size = atoi ( entry );
+		char *weight = strchr ( entry , ':' );
+
+		if ( size < ( int ) sizeof ( unsigned long long ) ) {
+			size = sizeof ( unsigned long long );
+		}
+		if ( size > FRAGMENT_MAX_FRAGMENTS * FRAGMENT_DATA_SIZE ) {
+			size = FRAGMENT_MAX_FRAGMENTS * FRAGMENT_DATA_SIZE;
+		}
+
+		benchSizes [ benchNumSizes ] = size;
+		benchWeights [ benchNumSizes ] = weight ? atoi ( weight + 1 ) : 1;
+		if ( benchWeights [ benchNumSizes ] > 0 ) {
+			benchNumSizes += 1;
+		}
+	}
+
+	if ( benchNumSizes == 0 ) {
+		WriteToScreen ( "--sizes needs at least one size with a positive weight\n" );
+		exit ( -1 );
+	}
+}
+
+/* --peers and --peers-file; the first one turns the session into a group chat. */
+void AddGroupPeers ( char *peers , int isFile ) {
+	if ( !groupMode ) {
+		if ( PeerTableInit ( &peerTable ) == FAILURE_OP_CODE ) {
+			WriteToScreen ( "Peer table wasn't created\n" );
+			exit ( -1 );
+		}
+
+		groupMode = 1;
+	}
+
+	int added = isFile ? PeerTableLoadFile ( &peerTable , peers ) : PeerTableAddList ( &peerTable , peers );
+	if ( added == FAILURE_OP_CODE ) {
+		exit ( -1 );
+	}
+}
+
+void ParseOptionalArguments ( int argc , char *argv [] , int firstOption ) {
+	for ( int i = firstOption ; i < argc ; i++ ) {
+		int hasValue = i + 1 < argc;
+
+		if ( StrEqual ( argv [ i ] , "--recv-batch" ) && hasValue ) {
+			receiveBatchSize = atoi ( argv [ ++i ] );
+		}
+		else if ( StrEqual ( argv [ i ] , "--recv-timeout-ms" ) && hasValue ) {
+			receiveBatchTimeoutMs = atoi ( argv [ ++i ] );
+		}
+		else if ( StrEqual ( argv [ i ] , "--max-fps" ) && hasValue ) {
+			maxFramesPerSecond = atoi ( argv [ ++i ] );
+		}
+		else if ( StrEqual ( argv [ i ] , "--event-loop" ) ) {
+			eventLoopMode = 1;
+		}
+		else if ( StrEqual ( argv [ i ] , "--io-uring" ) ) {
+			uringMode = 1;
+		}
+		else if ( StrEqual ( argv [ i ] , "--peers" ) && hasValue ) {
+			AddGroupPeers ( argv [ ++i ] , 0 );
+		}
+		else if ( StrEqual ( argv [ i ] , "--peers-file" ) && hasValue ) {
+			AddGroupPeers ( argv [ ++i ] , 1 );
+		}
+		else if ( StrEqual ( argv [ i ] , "--relay" ) && hasValue ) {
+			AddGroupPeers ( argv [ ++i ] , 0 );
+			if ( !relayRoom ) {
+				relayRoom = RELAY_LOBBY_ROOM;
+			}
+		}
+		else if ( StrEqual ( argv [ i ] , "--room" ) && hasValue ) {
+			relayRoom = argv [ ++i ];
+		}
+		else if ( StrEqual ( argv [ i ] , "--workers" ) && hasValue ) {
+			relayNumWorkers = atoi ( argv [ ++i ] );
+		}
+		else if ( StrEqual ( argv [ i ] , "--relay-workers" ) && hasValue ) {
+			benchRelayWorkers = atoi ( argv [ ++i ] );
+		}
+		else if ( StrEqual ( argv [ i ] , "--relay-clients" ) && hasValue ) {
+			benchRelayClients = atoi ( argv [ ++i ] );
+		}
+		else if ( StrEqual ( argv [ i ] , "--relay-room-clients" ) && hasValue ) {
+			benchRelayRoomClients = atoi ( argv [ ++i ] );
+		}
+		else if ( StrEqual ( argv [ i ] , "--reliable" ) ) {
+			reliableMode = 1;
+		}
+		else if ( StrEqual ( argv [ i ] , "--compress" ) ) {
+			compressMode = 1;
+		}
+		else if ( StrEqual ( argv [ i ] , "--compress-dict" ) && hasValue ) {
+			if ( CompressDictionaryLoad ( &compressDictionary , argv [ ++i ] ) == FAILURE_OP_CODE ) {
+				exit ( -1 );
+			}
+			compressMode = 1;
+		}
+		else if ( StrEqual ( argv [ i ] , "--encrypt" ) ) {
+			encryptMode = 1;
+		}
+		else if ( StrEqual ( argv [ i ] , "--psk-file" ) && hasValue ) {
+			if ( SecureLoadKey ( argv [ ++i ] , presharedKey ) == FAILURE_OP_CODE ) {
+				exit ( -1 );
+			}
+			hasPresharedKey = 1;
+			encryptMode = 1;
+		}
+		else if ( StrEqual ( argv [ i ] , "--shim-loss" ) && hasValue ) {
+			shimLossPercent = atof ( argv [ ++i ] );
+		}
+		else if ( StrEqual ( argv [ i ] , "--shim-delay-ms" ) && hasValue ) {
+			shimDelayMs = atoi ( argv [ ++i ] );
+		}
+		else if ( StrEqual ( argv [ i ] , "--shim-rate-mbps" ) && hasValue ) {
+			shimRateMbps = atof ( argv [ ++i ] );
+		}
+		else if ( StrEqual ( argv [ i ] , "--coalesce-bytes" ) && hasValue ) {
+			coalesceMaxBytes = atoi ( argv [ ++i ] );
+		}
+		else if ( StrEqual ( argv [ i ] , "--coalesce-delay-ms" ) && hasValue ) {
+			coalesceDelayMs = atoi ( argv [ ++i ] );
+		}
+		else if ( StrEqual ( argv [ i ] , "--stats-file" ) && hasValue ) {
+			statsFilePath = argv [ ++i ];
+		}
+		else if ( StrEqual ( argv [ i ] , "--stats-interval-ms" ) && hasValue ) {
+			statsIntervalMs = atoi ( argv [ ++i ] );
+		}
+		else if ( StrEqual ( argv [ i ] , "--messages" ) && hasValue ) {
+			benchNumMessages = atoi ( argv [ ++i ] );
+		}
+		else if ( StrEqual ( argv [ i ] , "--sizes" ) && hasValue ) {
+			ParseBenchSizes ( argv [ ++i ] );
+		}
+		else if ( StrEqual ( argv [ i ] , "--rate" ) && hasValue ) {
+			benchRate = atoi ( argv [ ++i ] );
+		}
+		else if ( StrEqual ( argv [ i ] , "--closed-loop" ) && hasValue ) {
+			benchWindow = atoi ( argv [ ++i ] );
+		}
+		else if ( StrEqual ( argv [ i ] , "--port" ) && hasValue ) {
+			benchPort = atoi ( argv [ ++i ] );
+		}
+		else {
+			WriteToScreen ( "Unknown option: " );
+			WriteToScreen ( argv [ i ] );
+			WriteToScreen ( "\n" );
+			PrintUsage ();
+			exit ( -1 );
+		}
+	}
+
+	if ( receiveBatchSize < 1 || receiveBatchSize > MAX_RECEIVE_BATCH_SIZE ) {
+		WriteToScreen ( "--recv-batch must be between 1 and 256\n" );
+		exit ( -1 );
+	}
+
+	if ( receiveBatchTimeoutMs < 0 ) {
+		receiveBatchTimeoutMs = 0;
+	}
+
+	// the receiver's buffers are MESSAGE_MAX_SIZE long, so datagrams must fit in one, sealed if need be
+	maxPlainDatagramSize = encryptMode ? MESSAGE_MAX_SIZE - FRAME_SEALED_OVERHEAD : MESSAGE_MAX_SIZE;
+	if ( coalesceMaxBytes > maxPlainDatagramSize ) {
+		coalesceMaxBytes = maxPlainDatagramSize;
+	}
+
+	if ( coalesceDelayMs < 0 ) {
+		coalesceDelayMs = 0;
+	}
+
+	if ( statsIntervalMs < 1 ) {
+		statsIntervalMs = DEFAULT_STATS_INTERVAL_MS;
+	}
+
+	if ( benchNumMessages < 0 ) {
+		benchNumMessages = 0;
+	}
+
+	if ( benchRate < 0 ) {
+		benchRate = 0;
+	}
+
+	if ( benchWindow < 0 ) {
+		benchWindow = 0;
+	}
+
+	// a relay forwards to the address a client sends from, which only a group's socket also receives on
+	if ( relayRoom && !groupMode ) {
+		WriteToScreen ( "--room needs --relay\n" );
+		exit ( -1 );
+	}
+
+	if ( relayNumWorkers < 0 || relayNumWorkers > RELAY_MAX_WORKERS || benchRelayWorkers < 0 || benchRelayWorkers > RELAY_MAX_WORKERS ) {
+		WriteToScreen ( "a relay runs 1 to 64 workers\n" );
+		exit ( -1 );
+	}
+
+	if ( benchRelayClients < 0 || benchRelayRoomClients < 0 || benchRelayClients + benchRelayRoomClients > 0xffff ) {
+		WriteToScreen ( "--relay-clients and --relay-room-clients must add up to at most 65535\n" );
+		exit ( -1 );
+	}
+
+	// sequence numbers and acks are kept for one peer
+	if ( reliableMode && groupMode ) {
+		WriteToScreen ( "--reliable works between two peers, not in a group or through a relay\n" );
+		exit ( -1 );
+	}
+
+	// the hello that negotiates it is exchanged with one peer
+	if ( compressMode && groupMode ) {
+		WriteToScreen ( "--compress works between two peers, not in a group or through a relay\n" );
+		exit ( -1 );
+	}
+
+	// keys are agreed with one peer, and a relay has to read the frames it forwards
+	if ( encryptMode && ( groupMode || benchRelayWorkers > 0 ) ) {
+		WriteToScreen ( "--encrypt works between two peers, not in a group or through a relay\n" );
+		exit ( -1 );
+	}
+
+	if ( shimLossPercent < 0 || shimLossPercent > 100 ) {
+		WriteToScreen ( "--shim-loss must be between 0 and 100\n" );
+		exit ( -1 );
+	}
+
+	if ( shimDelayMs < 0 ) {
+		shimDelayMs = 0;
+	}
+
+	if ( shimRateMbps < 0 ) {
+		shimRateMbps = 0;
+	}
+}
+
+/* one worker per CPU, within the relay's limit */
+int DefaultRelayWorkers () {
+	long numCPUs = sysconf ( _SC_NPROCESSORS_ONLN );
+	if ( numCPUs < 1 ) {
+		return 1;
+	}
+
+	return numCPUs < RELAY_MAX_WORKERS ? ( int ) numCPUs : RELAY_MAX_WORKERS;
+}
+
+int main ( int argc , char *argv [] ) 
+{
+	ReassemblerInit ( &reassembler , REASSEMBLY_TIMEOUT_MS );
+	CryptoInit ();
+
+	int benchMode = argc >= 2 && StrEqual ( BENCH_FIRST_ARG , argv [ 1 ] );
+	if ( benchMode ) {
+		ParseOptionalArguments ( argc , argv , 2 );
+		exit ( RunBench () == SUCCESS_OP_CODE ? 0 : -1 );
+	}
+
+	int relayMode = argc >= 3 && StrEqual ( RELAY_FIRST_ARG , argv [ 1 ] );
+	if ( relayMode ) {
+		ParseOptionalArguments ( argc , argv , 3 );
+		exit ( RunRelay ( argv [ 2 ] , relayNumWorkers > 0 ? relayNumWorkers : DefaultRelayWorkers () ) == SUCCESS_OP_CODE ? 0 : -1 );
+	}
+
+	if ( argc < 3 ) {
+		WriteToScreen ( "Incorrect amount of inputs. Please include the following arguments:\n");
+		PrintUsage ();
+		exit ( -1 );
+	}
+
+	int correctFirstParameter = StrEqual ( PROGRAM_NAME_FIRST_ARG , argv [ 1 ] );
+	if ( !correctFirstParameter ) {
+		WriteToScreen ( "Incorrect first argument. The first input must be \"terminal-chat\", \"bench\" or \"relay\"\n" );
+		exit ( -1 );
+	}
+
+	receivePort = argv [ 2 ];
+
+	// a group may name all of its peers with --peers / --peers-file instead
+	int hasRemote = argc >= 5 && strncmp ( argv [ 3 ] , "--" , 2 ) != 0;
+	if ( hasRemote ) {
+		sendHostName = argv [ 3 ];
+		sendPort = argv [ 4 ];
+	}
+
+	ParseOptionalArguments ( argc , argv , hasRemote ? 5 : 3 );
+
+	if ( !hasRemote && !groupMode ) {
+		WriteToScreen ( "Incorrect amount of inputs. Please include the following arguments:\n");
+		PrintUsage ();
+		exit ( -1 );
+	}
+
+	if ( groupMode && hasRemote && PeerTableAdd ( &peerTable , sendHostName , sendPort ) == FAILURE_OP_CODE ) {
+		exit ( -1 );
+	}
+
+	InitReceiveSocketFD ();
+	if ( receiveSocketFD == FAILED_SOCKET_FD ) {
+		WriteToScreen ( "ERROR: Receive Socket failed to be created" );
+		exit ( -1 );
+	}
+	
+	if ( groupMode ) {
+		InitGroupSendSocketFD ();
+	}
+	else {
+		InitSendSocketFD ();
+	}
+
+	if ( sendSocketFD == FAILED_SOCKET_FD ) {
+		WriteToScreen ( "ERROR: Send Socket failed to be created" );
+		exit ( -1 );
+	}
+
+	StartSendShim ();
+	StartReliableSession ();
+	StartEncryption ();
+	StartCompression ();
+
+	if ( relayRoom ) {
+		JoinRelayRoom ();
+	}
+
+	StartStatsReporting ();
+
+	// the io_uring loop keeps no peer table, so a group cannot tell its peers apart there
+	if ( uringMode && groupMode ) {
+		fprintf ( stderr , "io_uring mode does not support groups, using the threaded path\n" );
+	}
+	else if ( uringMode && ( reliableMode || sendShim ) ) {
+		fprintf ( stderr , "io_uring mode has no reliable layer or shim, using the threaded path\n" );
+	}
+	else if ( uringMode ) {
+		if ( RunUringLoop () == SUCCESS_OP_CODE ) {
+			StopStatsReporting ();
+			CleanUp ();
+			exit ( 0 );
+		}
+
+		fprintf ( stderr , "io_uring is unavailable, using the threaded path\n" );
+	}
+
+	// retransmission needs a timer and a sender that can wait on acks, which the threaded path has
+	if ( eventLoopMode && reliableMode ) {
+		fprintf ( stderr , "the event loop has no reliable layer, using the threaded path\n" );
+	}
+	else if ( eventLoopMode ) {
+		RunEventLoop ();
+		StopStatsReporting ();
+		CleanUp ();
+		exit ( 0 );
+	}
+
+	sendMessagesQueue = RingQueueCreate ( MESSAGE_QUEUE_CAPACITY );
+	if ( !sendMessagesQueue ) {
+		WriteToScreen ( "Send Messages Queue wasn't created" );
+		exit ( -1 );
+	}
+
+	printMessagesQueue = RingQueueCreate ( MESSAGE_QUEUE_CAPACITY );
+	if ( !printMessagesQueue ) {
+		WriteToScreen ( "Print Messages Queue wasn't created" );
+		exit ( -1 );
+	}
+	
+	pthread_attr_t threadAttribute;
+	pthread_attr_init ( &threadAttribute );
+    pthread_attr_setdetachstate ( &threadAttribute , PTHREAD_CREATE_JOINABLE );
+
+	pthread_create ( &printingThread , &threadAttribute , RunScreenPrinting , NULL );
+
+	sleep ( 0.5f ); // allow time for the printing thread to print session start message before user input
+
+	pthread_create ( &sendThread , &threadAttribute , RunSending , NULL );     
+	pthread_create ( &recvThread , &threadAttribute , RunReceiving , NULL );
+	pthread_create ( &inputThread , &threadAttribute , RunUserInput , NULL );
+
+	pthread_join ( printingThread , NULL );
+
+	// the sender is not cancelled: closing its queue lets it flush what is left and exit
+	RingQueueClose ( sendMessagesQueue );
+	RingQueueClose ( printMessagesQueue );
+
+	StopFileSending ();
+
+	// joined before the receiver goes: a reliable sender still needs it to hear the last acks
+	pthread_join ( sendThread , NULL );
+
+	pthread_cancel ( recvThread );
+	pthread_cancel ( inputThread );
+
+	pthread_join ( recvThread , NULL );
+	pthread_join ( inputThread , NULL );
+
+	StopStatsReporting ();
 	CleanUp ();
 
 	exit ( 0 );